@@ -0,0 +1,356 @@
+#include "alsa_tuner.hpp"
+
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+int alsa_open_capture(const std::string& device,
+                      snd_pcm_format_t format,
+                      int channels,
+                      unsigned int& rate,
+                      alsaPeriodParams& params,
+                      snd_pcm_t** handle,
+                      const std::string& name,
+                      bool* htstamp_monotonic)
+{
+    int err;
+    if ((err = snd_pcm_open(handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+        fprintf(stderr, "%s: ERROR: cannot open audio device %s (%s)\n",
+                name.c_str(), device.c_str(), snd_strerror(err));
+        return -1;
+    }
+
+    snd_pcm_hw_params_t* hw_params;
+    snd_pcm_uframes_t period = params.period_frames;
+    snd_pcm_uframes_t buffer = params.buffer_frames;
+    int dir = 0;
+    snd_pcm_hw_params_malloc(&hw_params);
+    if ((err = snd_pcm_hw_params_any(*handle, hw_params)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(*handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(*handle, hw_params, format)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(*handle, hw_params, &rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(*handle, hw_params, channels)) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot set hw_params of %s (%s)\n",
+                name.c_str(), device.c_str(), snd_strerror(err));
+        snd_pcm_hw_params_free(hw_params);
+        snd_pcm_close(*handle);
+        return -2;
+    }
+    // Optional period / buffer sizes (the driver rounds them to the nearest legal values, refusals keep its defaults)
+    if (period > 0 && (err = snd_pcm_hw_params_set_period_size_near(*handle, hw_params, &period, &dir)) < 0) {
+        fprintf(stderr, "%s: WARNING: Cannot set period size %lu (%s)\n",
+                name.c_str(), params.period_frames, snd_strerror(err));
+    }
+    if (buffer > 0 && (err = snd_pcm_hw_params_set_buffer_size_near(*handle, hw_params, &buffer)) < 0) {
+        fprintf(stderr, "%s: WARNING: Cannot set buffer size %lu (%s)\n",
+                name.c_str(), params.buffer_frames, snd_strerror(err));
+    }
+    if ((err = snd_pcm_hw_params(*handle, hw_params)) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot set hw_params of %s (%s)\n",
+                name.c_str(), device.c_str(), snd_strerror(err));
+        snd_pcm_hw_params_free(hw_params);
+        snd_pcm_close(*handle);
+        return -2;
+    }
+    snd_pcm_hw_params_get_period_size(hw_params, &period, &dir);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &buffer);
+    snd_pcm_hw_params_free(hw_params);
+    params.period_frames = period;
+    params.buffer_frames = buffer;
+
+    snd_pcm_sw_params_t* sw_params;
+    snd_pcm_sw_params_malloc(&sw_params);
+    if ((err = snd_pcm_sw_params_current(*handle, sw_params)) < 0 ||
+        (err = snd_pcm_sw_params_set_tstamp_mode(*handle, sw_params, SND_PCM_TSTAMP_ENABLE)) < 0 ||
+        (params.avail_min > 0 && (err = snd_pcm_sw_params_set_avail_min(*handle, sw_params, params.avail_min)) < 0) ||
+        (params.start_threshold > 0 &&
+         (err = snd_pcm_sw_params_set_start_threshold(*handle, sw_params, params.start_threshold)) < 0)) {
+        fprintf(stderr, "%s: ERROR: Cannot configure sw_params of %s (%s)\n",
+                name.c_str(), device.c_str(), snd_strerror(err));
+        snd_pcm_sw_params_free(sw_params);
+        snd_pcm_close(*handle);
+        return -3;
+    }
+    bool monotonic = (err = snd_pcm_sw_params_set_tstamp_type(*handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC)) == 0;
+    if (!monotonic) {
+        fprintf(stderr, "%s: WARNING: Cannot set monotonic time stamps, falling back to read times (%s)\n",
+                name.c_str(), snd_strerror(err));
+    }
+    if (htstamp_monotonic != nullptr) *htstamp_monotonic = monotonic;
+    err = snd_pcm_sw_params(*handle, sw_params);
+    snd_pcm_sw_params_free(sw_params);
+    if (err < 0 || (err = snd_pcm_prepare(*handle)) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot prepare %s (%s)\n",
+                name.c_str(), device.c_str(), snd_strerror(err));
+        snd_pcm_close(*handle);
+        return -3;
+    }
+    return 0;
+}
+
+const char* profile_name(MicReadLatencyProfile profile)
+{
+    switch(profile) {
+    case MICREAD_PROFILE_LOW_LATENCY: return "low-latency";
+    case MICREAD_PROFILE_LOW_WAKEUP: return "low-wakeup";
+    default: return "default";
+    }
+}
+
+static double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+AlsaTuner::AlsaTuner(const std::string& device,
+                     unsigned int rate,
+                     int channels,
+                     snd_pcm_format_t format,
+                     int read_frames):
+    device_(device),
+    rate_(rate),
+    channels_(channels),
+    format_(format),
+    read_frames_(read_frames),
+    name_("AlsaTuner")
+{
+}
+
+int AlsaTuner::sweep(std::vector<alsaTuneResult>& results, double seconds_per_config)
+{
+    int err;
+    snd_pcm_t* handle;
+    snd_pcm_hw_params_t* hw_params;
+
+    // Legal ranges for this format / rate / channels
+    if ((err = snd_pcm_open(&handle, device_.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+        fprintf(stderr, "%s: ERROR: cannot open audio device %s (%s)\n",
+                name_.c_str(), device_.c_str(), snd_strerror(err));
+        return -1;
+    }
+    snd_pcm_hw_params_malloc(&hw_params);
+    unsigned int rate = rate_;
+    snd_pcm_uframes_t period_min = 0, period_max = 0, buffer_min = 0, buffer_max = 0;
+    int dir = 0;
+    if ((err = snd_pcm_hw_params_any(handle, hw_params)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(handle, hw_params, format_)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(handle, hw_params, &rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(handle, hw_params, channels_)) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot restrict parameters of %s (%s)\n",
+                name_.c_str(), device_.c_str(), snd_strerror(err));
+        snd_pcm_hw_params_free(hw_params);
+        snd_pcm_close(handle);
+        return -2;
+    }
+    snd_pcm_hw_params_get_period_size_min(hw_params, &period_min, &dir);
+    snd_pcm_hw_params_get_period_size_max(hw_params, &period_max, &dir);
+    snd_pcm_hw_params_get_buffer_size_min(hw_params, &buffer_min);
+    snd_pcm_hw_params_get_buffer_size_max(hw_params, &buffer_max);
+    snd_pcm_hw_params_free(hw_params);
+    snd_pcm_close(handle);
+
+    fprintf(stdout, "%s: %s period %lu..%lu buffer %lu..%lu frames. Sweeping ...\n",
+            name_.c_str(), device_.c_str(), period_min, period_max, buffer_min, buffer_max);
+
+    // Powers of 2 periods, 2 / 4 / 8 periods per buffer
+    results.clear();
+    for(snd_pcm_uframes_t period = ALSA_TUNE_MIN_PERIOD; period <= ALSA_TUNE_MAX_PERIOD; period *= 2)
+    {
+        if(period < period_min || period > period_max) continue;
+        for(int periods = 2; periods <= 8; periods *= 2)
+        {
+            alsaPeriodParams params;
+            params.period_frames = period;
+            params.buffer_frames = period * periods;
+            if(params.buffer_frames < buffer_min || params.buffer_frames > buffer_max) continue;
+            params.avail_min = period;
+            params.start_threshold = 1;
+
+            alsaTuneResult result;
+            if(measure(params, seconds_per_config, result) == 0) {
+                print(result);
+                results.push_back(result);
+            }
+        }
+    }
+    return results.empty() ? -3 : 0;
+}
+
+int AlsaTuner::measure(const alsaPeriodParams& params, double seconds, alsaTuneResult& result)
+{
+    snd_pcm_t* handle;
+    unsigned int rate = rate_;
+    result.params = params;
+    if (alsa_open_capture(device_, format_, channels_, rate, result.params, &handle, name_) < 0) {
+        fprintf(stderr, "%s: WARNING: period %lu buffer %lu rejected\n",
+                name_.c_str(), params.period_frames, params.buffer_frames);
+        return -2;
+    }
+    snd_pcm_uframes_t period = result.params.period_frames;
+    snd_pcm_uframes_t read_frames = read_frames_ > 0 ? (snd_pcm_uframes_t)read_frames_ : period;
+    result.reads = 0;
+    result.xruns = 0;
+
+    std::vector<int8_t> buf(read_frames * channels_ * snd_pcm_format_physical_width(format_) / 8);
+    double sum = 0., sum_sq = 0., max_interval = 0.;
+    long intervals = 0;
+    double cpu_start = thread_cpu_seconds();
+    auto t_start = std::chrono::steady_clock::now();
+    auto t_prev = t_start;
+    auto t_end = t_start + std::chrono::microseconds((long)(seconds * 1e6));
+    bool first = true;
+
+    while(std::chrono::steady_clock::now() < t_end)
+    {
+        snd_pcm_sframes_t n = snd_pcm_readi(handle, buf.data(), read_frames);
+        auto t_now = std::chrono::steady_clock::now();
+        if(n == -EPIPE) {
+            result.xruns++;
+            snd_pcm_prepare(handle);
+            first = true;
+            continue;
+        }
+        if(n < 0) {
+            if(snd_pcm_recover(handle, (int)n, 1) < 0) break;
+            continue;
+        }
+        result.reads++;
+        // The first read includes the start up, it is not a steady state interval
+        if(!first) {
+            double interval = std::chrono::duration<double, std::micro>(t_now - t_prev).count();
+            sum += interval;
+            sum_sq += interval * interval;
+            if(interval > max_interval) max_interval = interval;
+            intervals++;
+        }
+        first = false;
+        t_prev = t_now;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    double cpu = thread_cpu_seconds() - cpu_start;
+
+    snd_pcm_drop(handle);
+    snd_pcm_close(handle);
+
+    result.seconds = wall;
+    result.interval_mean_us = intervals > 0 ? sum / intervals : 0.;
+    result.interval_std_us = intervals > 0 ? sqrt(std::max(0., sum_sq / intervals - result.interval_mean_us * result.interval_mean_us)) : 0.;
+    result.interval_max_us = max_interval;
+    result.cpu_load = wall > 0. ? cpu / wall : 0.;
+    // A wakeup happens per period, or per read if reads are larger than periods
+    result.wakeups_per_s = (double)rate_ / std::max<unsigned long>(period, read_frames);
+    return 0;
+}
+
+int AlsaTuner::choose(const std::vector<alsaTuneResult>& results, MicReadLatencyProfile profile, alsaPeriodParams& params) const
+{
+    int best = -1;
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const alsaTuneResult& r = results[i];
+        if(r.xruns > 0 || r.reads == 0) continue;
+        // A wakeup arriving later than a whole buffer would be an xrun on a busier system
+        double buffer_us = r.params.buffer_frames * 1e6 / rate_;
+        if(r.interval_max_us > 0.5 * buffer_us) continue;
+        if(best < 0) {
+            best = i;
+            continue;
+        }
+        const alsaTuneResult& b = results[best];
+        if(profile == MICREAD_PROFILE_LOW_LATENCY) {
+            // Smallest period, then lowest jitter
+            if(r.params.period_frames < b.params.period_frames ||
+               (r.params.period_frames == b.params.period_frames && r.interval_std_us < b.interval_std_us)) {
+                best = i;
+            }
+        } else {
+            // Fewest wakeups, then lowest CPU, then the largest buffer (most slack)
+            if(r.wakeups_per_s < b.wakeups_per_s ||
+               (r.wakeups_per_s == b.wakeups_per_s && r.cpu_load < b.cpu_load) ||
+               (r.wakeups_per_s == b.wakeups_per_s && r.cpu_load == b.cpu_load && r.params.buffer_frames > b.params.buffer_frames)) {
+                best = i;
+            }
+        }
+    }
+    if(best < 0) {
+        fprintf(stderr, "%s: ERROR: No xrun free configuration for the %s profile\n",
+                name_.c_str(), profile_name(profile));
+        return -1;
+    }
+    params = results[best].params;
+    fprintf(stdout, "%s: %s profile: period %lu buffer %lu avail_min %lu start_threshold %lu\n",
+            name_.c_str(), profile_name(profile),
+            params.period_frames, params.buffer_frames, params.avail_min, params.start_threshold);
+    return 0;
+}
+
+std::string AlsaTuner::key(MicReadLatencyProfile profile) const
+{
+    std::ostringstream os;
+    os << device_ << " " << rate_ << " " << channels_ << " " << snd_pcm_format_width(format_) << " " << profile_name(profile);
+    return os.str();
+}
+
+int AlsaTuner::load(const std::string& filename, MicReadLatencyProfile profile, alsaPeriodParams& params) const
+{
+    std::ifstream f(filename);
+    std::string line;
+    std::string entry_key = key(profile);
+    while(std::getline(f, line))
+    {
+        // <device> <rate> <channels> <bits> <profile> <period> <buffer> <avail_min> <start_threshold>
+        std::istringstream is(line);
+        std::string device, rate, channels, bits, profile_str;
+        alsaPeriodParams entry;
+        if(!(is >> device >> rate >> channels >> bits >> profile_str
+                >> entry.period_frames >> entry.buffer_frames >> entry.avail_min >> entry.start_threshold)) {
+            continue;
+        }
+        if(device + " " + rate + " " + channels + " " + bits + " " + profile_str == entry_key) {
+            params = entry;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int AlsaTuner::save(const std::string& filename, MicReadLatencyProfile profile, const alsaPeriodParams& params) const
+{
+    // Keeping entries of other devices / profiles
+    std::vector<std::string> lines;
+    std::string entry_key = key(profile) + " ";
+    {
+        std::ifstream f(filename);
+        std::string line;
+        while(std::getline(f, line)) {
+            if(line.compare(0, entry_key.size(), entry_key) != 0) lines.push_back(line);
+        }
+    }
+    std::ostringstream entry;
+    entry << entry_key << params.period_frames << " " << params.buffer_frames << " "
+          << params.avail_min << " " << params.start_threshold;
+    lines.push_back(entry.str());
+
+    std::ofstream f(filename);
+    for(size_t i = 0; i < lines.size(); i++) f << lines[i] << std::endl;
+    if(!f) {
+        fprintf(stderr, "%s: ERROR: Cannot write %s\n", name_.c_str(), filename.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+void AlsaTuner::print(const alsaTuneResult& r)
+{
+    fprintf(stdout, "AlsaTuner: period %5lu buffer %6lu: reads %5ld xruns %ld interval %8.1f +- %7.1f (max %8.1f) us cpu %5.2f%% wakeups %.1f/s\n",
+            r.params.period_frames, r.params.buffer_frames, r.reads, r.xruns,
+            r.interval_mean_us, r.interval_std_us, r.interval_max_us, r.cpu_load * 100., r.wakeups_per_s);
+}
@@ -0,0 +1,113 @@
+/*
+ALSA period / buffer autotuning.
+AlsaTuner sweeps the legal period / buffer size combinations of a capture device, reads from it
+for a short while with every combination and measures the read interval jitter, the CPU use of
+the reading thread and the number of xruns. A latency profile then picks the configuration:
+ - MICREAD_PROFILE_LOW_LATENCY: smallest xrun free period (the data arrives as soon as possible)
+ - MICREAD_PROFILE_LOW_WAKEUP: largest xrun free period and buffer (fewest wakeups, archival recording)
+The choice is persisted into a small text file (one line per device / rate / channels / format / profile),
+thus later startups skip the sweep.
+
+MicReadAlsa does all of this when it is constructed with a profile other than MICREAD_PROFILE_DEFAULT.
+Manual use:
+    AlsaTuner tuner("hw:2,0", 44100, 1, SND_PCM_FORMAT_S16_LE);
+    alsaPeriodParams params;
+    if(tuner.load(MICREAD_DEF_TUNE_FILENAME, MICREAD_PROFILE_LOW_LATENCY, params) < 0) {
+        std::vector<alsaTuneResult> results;
+        tuner.sweep(results);
+        tuner.choose(results, MICREAD_PROFILE_LOW_LATENCY, params);
+        tuner.save(MICREAD_DEF_TUNE_FILENAME, MICREAD_PROFILE_LOW_LATENCY, params);
+    }
+ */
+
+#ifndef MIC_READ_THREAD_ALSA_TUNER_HPP
+#define MIC_READ_THREAD_ALSA_TUNER_HPP
+
+#include <string>
+#include <vector>
+
+#include <alsa/asoundlib.h>
+
+#define MICREAD_DEF_TUNE_FILENAME "micread_tune.txt"
+#define ALSA_TUNE_DEF_SECONDS 0.5 //measuring time per configuration
+#define ALSA_TUNE_MIN_PERIOD 32
+#define ALSA_TUNE_MAX_PERIOD 8192
+
+enum MicReadLatencyProfile
+{
+    MICREAD_PROFILE_DEFAULT = 0, //driver defaults, no tuning (previous behaviour)
+    MICREAD_PROFILE_LOW_LATENCY,
+    MICREAD_PROFILE_LOW_WAKEUP
+};
+
+// Period / buffer configuration applied by MicReadAlsa::openDevice(). Zeros mean driver defaults
+struct alsaPeriodParams
+{
+    alsaPeriodParams(): period_frames(0), buffer_frames(0), avail_min(0), start_threshold(0) {}
+    unsigned long period_frames;
+    unsigned long buffer_frames;
+    unsigned long avail_min;       //sw_params: wake up the reader once this many frames are available
+    unsigned long start_threshold; //sw_params: capture starts once a read of this many frames is requested
+};
+
+struct alsaTuneResult
+{
+    alsaPeriodParams params; //actual (possibly rounded by the driver) sizes
+    double seconds;
+    long reads;
+    long xruns;
+    double interval_mean_us; //time between returned reads
+    double interval_std_us;  //read jitter
+    double interval_max_us;
+    double cpu_load;         //CPU time of the reading thread / wall time
+    double wakeups_per_s;
+};
+
+const char* profile_name(MicReadLatencyProfile profile);
+
+// Opens a capture device: interleaved access, period / buffer sizes and sw_params thresholds when nonzero,
+// monotonic status time stamps (htstamp_monotonic: whether the driver accepted them).
+// rate and params are updated to the actual values. Returns 0 or a negative error
+int alsa_open_capture(const std::string& device,
+                      snd_pcm_format_t format,
+                      int channels,
+                      unsigned int& rate,
+                      alsaPeriodParams& params,
+                      snd_pcm_t** handle,
+                      const std::string& name,
+                      bool* htstamp_monotonic=nullptr);
+
+class AlsaTuner
+{
+public:
+    AlsaTuner(const std::string& device,
+              unsigned int rate,
+              int channels,
+              snd_pcm_format_t format,
+              int read_frames=512); //frames per read while measuring, 0: one period per read
+
+    // Measures all legal combinations (the device must not be opened by anybody else)
+    int sweep(std::vector<alsaTuneResult>& results, double seconds_per_config=ALSA_TUNE_DEF_SECONDS);
+    // Measures a single combination
+    int measure(const alsaPeriodParams& params, double seconds, alsaTuneResult& result);
+    // Picks the configuration for the profile. Returns -1 if no configuration qualifies
+    int choose(const std::vector<alsaTuneResult>& results, MicReadLatencyProfile profile, alsaPeriodParams& params) const;
+
+    // Persistence. load() returns -1 if there is no entry for this device / profile
+    int load(const std::string& filename, MicReadLatencyProfile profile, alsaPeriodParams& params) const;
+    int save(const std::string& filename, MicReadLatencyProfile profile, const alsaPeriodParams& params) const;
+
+    static void print(const alsaTuneResult& result);
+
+protected:
+    std::string device_;
+    unsigned int rate_;
+    int channels_;
+    snd_pcm_format_t format_;
+    int read_frames_;
+    std::string name_;
+
+    std::string key(MicReadLatencyProfile profile) const; //identifies the entry in the tune file
+};
+
+#endif //MIC_READ_THREAD_ALSA_TUNER_HPP
@@ -0,0 +1,376 @@
+#include "dataset_builder.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+static std::string trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if(begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static void split(const std::string& line, char delimiter, std::vector<std::string>& out)
+{
+    out.clear();
+    size_t start = 0;
+    while(true) {
+        size_t pos = line.find(delimiter, start);
+        out.push_back(trim(line.substr(start, pos == std::string::npos ? std::string::npos : pos - start)));
+        if(pos == std::string::npos) break;
+        start = pos + 1;
+    }
+}
+
+static int column(const std::vector<std::string>& header, const char* name)
+{
+    for(size_t i = 0; i < header.size(); i++) {
+        if(header[i] == name) return (int)i;
+    }
+    return -1;
+}
+
+DatasetBuilder::DatasetBuilder(std::string out_dir,
+                               int frames,
+                               int bands,
+                               int shift_chunks,
+                               FeatureStoreDType dtype,
+                               int threads):
+    out_dir_(out_dir),
+    name_("DatasetBuilder"),
+    frames_(frames),
+    bands_(bands),
+    shift_chunks_(shift_chunks > 0 ? shift_chunks : 1),
+    dtype_(dtype),
+    threads_(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    channels_(1),
+    rate_(44100),
+    fixed_point_(false),
+    default_label_(-1),
+    cache_(nullptr),
+    next_drive_(0)
+{
+}
+
+void DatasetBuilder::addDrive(const std::string& dir)
+{
+    drives_.push_back(dir);
+}
+
+int64_t DatasetBuilder::parseTime(const std::string& value)
+{
+    // Same conventions as convert_datetimestamp(): "H:M:S.f" or (fractional) seconds
+    if(value.find(':') != std::string::npos) {
+        int hours = 0, minutes = 0;
+        double seconds = 0.;
+        if(sscanf(value.c_str(), "%d:%d:%lf", &hours, &minutes, &seconds) != 3) return -1;
+        return (int64_t)(hours * 3600LL + minutes * 60LL) * 1000000LL + (int64_t)llround(seconds * 1e6);
+    }
+    return (int64_t)llround(atof(value.c_str()) * 1e6);
+}
+
+int DatasetBuilder::parseLabels(const std::string& filename, std::vector<datasetLabelInterval>& intervals) const
+{
+    intervals.clear();
+    FILE* file = fopen(filename.c_str(), "r");
+    if(file == nullptr) {
+        fprintf(stderr, "%s: ERROR: cannot open %s (%s)\n", name_.c_str(), filename.c_str(), strerror(errno));
+        return -1;
+    }
+    char* line = nullptr;
+    size_t capacity = 0;
+    std::vector<std::string> header, row;
+    int start_col = -1, end_col = -1, label_col = -1;
+    while(getline(&line, &capacity, file) > 0) {
+        if(trim(line).empty()) continue;
+        if(header.empty()) {
+            split(line, ',', header);
+            start_col = column(header, "start_time");
+            end_col = column(header, "end_time");
+            label_col = column(header, "label");
+            if(start_col < 0) break;
+            continue;
+        }
+        split(line, ',', row);
+        if((int)row.size() <= start_col) continue;
+        datasetLabelInterval interval;
+        interval.t0 = parseTime(row[start_col]);
+        interval.t1 = end_col >= 0 && (int)row.size() > end_col ? parseTime(row[end_col]) : INT64_MAX;
+        interval.label = default_label_;
+        if(label_col >= 0 && (int)row.size() > label_col && !row[label_col].empty()) {
+            const std::string& value = row[label_col];
+            auto name = std::find(label_names_.begin(), label_names_.end(), value);
+            if(name != label_names_.end()) interval.label = (int)(name - label_names_.begin());
+            else if(isdigit((unsigned char)value[0])) interval.label = atoi(value.c_str());
+            else interval.label = -1;
+        }
+        intervals.push_back(interval);
+    }
+    free(line);
+    fclose(file);
+    if(start_col < 0) {
+        fprintf(stderr, "%s: ERROR: %s has no start_time column\n", name_.c_str(), filename.c_str());
+        return -2;
+    }
+
+    // Without end times an interval runs up to the next start
+    std::sort(intervals.begin(), intervals.end(),
+              [](const datasetLabelInterval& a, const datasetLabelInterval& b){ return a.t0 < b.t0; });
+    for(size_t i = 0; i + 1 < intervals.size(); i++) {
+        intervals[i].t1 = std::min(intervals[i].t1, intervals[i + 1].t0);
+    }
+    return (int)intervals.size();
+}
+
+int DatasetBuilder::run()
+{
+    if(mkdir(out_dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: ERROR: cannot create %s (%s)\n", name_.c_str(), out_dir_.c_str(), strerror(errno));
+        return (int)drives_.size();
+    }
+    results_.assign(drives_.size(), datasetDriveResult());
+    next_drive_ = 0;
+    std::vector<std::thread> workers;
+    int threads = std::min<int>(threads_, (int)drives_.size());
+    for(int i = 0; i < threads; i++) {
+        workers.emplace_back(&DatasetBuilder::worker, this);
+    }
+    for(auto& worker : workers) worker.join();
+
+    int failed = 0;
+    for(const datasetDriveResult& res : results_) {
+        if(res.error < 0) failed++;
+    }
+    return failed;
+}
+
+void DatasetBuilder::worker()
+{
+    MfccExtractor mfcc(rate_, bands_);
+    FixedMfccExtractor mfcc_fixed(rate_, bands_);
+    size_t drive;
+    while((drive = next_drive_++) < drives_.size()) {
+        processDrive(drive, mfcc, mfcc_fixed);
+    }
+}
+
+std::string DatasetBuilder::params() const
+{
+    std::string labels;
+    for(size_t i = 0; i < label_names_.size(); i++) labels += (i ? "," : "") + label_names_[i];
+    char params[512];
+    snprintf(params, sizeof(params), "dataset v1 %s rate=%u n_fft=%d hop=%d mels=%d top_db=%g bands=%d frames=%d "
+             "shift=%d channels=%d dtype=%s labels=%s default_label=%d",
+             fixed_point_ ? "mfcc_fixed" : "mfcc", rate_, MFCC_DEF_FFT_SIZE, MFCC_DEF_HOP, MFCC_DEF_MELS,
+             (double)MFCC_DEF_TOP_DB, bands_, frames_, shift_chunks_, channels_,
+             dtype_ == FEATSTORE_FLOAT16 ? "float16" : "float32", labels.c_str(), default_label_);
+    return params;
+}
+
+int DatasetBuilder::linkShard(const std::string& shard, const std::string& target)
+{
+    char resolved[PATH_MAX];
+    std::string abs_target = realpath((target + ".feat").c_str(), resolved) != nullptr ? resolved : target + ".feat";
+    abs_target = abs_target.substr(0, abs_target.size() - 5);
+    for(const char* ext : {".feat", ".lbl"}) {
+        unlink((shard + ext).c_str());
+        if(symlink((abs_target + ext).c_str(), (shard + ext).c_str()) < 0) {
+            fprintf(stderr, "%s: ERROR: cannot link %s%s (%s)\n", name_.c_str(), shard.c_str(), ext, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void DatasetBuilder::processDrive(size_t drive, MfccExtractor& mfcc, FixedMfccExtractor& mfcc_fixed)
+{
+    auto t_start = std::chrono::steady_clock::now();
+    datasetDriveResult& res = results_[drive];
+    std::string dir = drives_[drive];
+    while(dir.size() > 1 && dir.back() == '/') dir.pop_back();
+    res.dir = dir;
+    res.shard = out_dir_ + "/" + dir.substr(dir.find_last_of('/') + 1);
+
+    if(cache_ == nullptr) {
+        // Shards are rebuilt from scratch
+        unlink((res.shard + ".feat").c_str());
+        unlink((res.shard + ".lbl").c_str());
+        res.error = extract(dir, res.shard, (int32_t)drive, mfcc, mfcc_fixed, res);
+    } else {
+        std::string key = cache_->key({dir + "/" + DATASET_CSV_NAME, dir + "/" + DATASET_LABELS_NAME}, params());
+        if(key.empty()) {
+            res.error = -5;
+        } else if(cache_->contains(key)) {
+            FeatureStore store;
+            res.cached = true;
+            if((res.error = store.open(cache_->entry(key))) == 0) res.windows = (long)store.size();
+        } else {
+            std::string pending = cache_->pending(key);
+            res.error = extract(dir, pending, (int32_t)drive, mfcc, mfcc_fixed, res);
+            if(res.error == 0) res.error = cache_->commit(key, pending);
+            else cache_->discard(pending);
+        }
+        if(res.error == 0) res.error = linkShard(res.shard, cache_->entry(key));
+    }
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+int DatasetBuilder::extract(const std::string& dir, const std::string& store_base, int32_t source, MfccExtractor& mfcc,
+                            FixedMfccExtractor& mfcc_fixed, datasetDriveResult& res)
+{
+    std::vector<datasetLabelInterval> intervals;
+    if(parseLabels(dir + "/" + DATASET_LABELS_NAME, intervals) < 0) {
+        return -1;
+    }
+    FILE* csv = fopen((dir + "/" + DATASET_CSV_NAME).c_str(), "r");
+    if(csv == nullptr) {
+        fprintf(stderr, "%s: ERROR: cannot open %s/%s (%s)\n", name_.c_str(), dir.c_str(), DATASET_CSV_NAME, strerror(errno));
+        return -2;
+    }
+    char* line = nullptr;
+    size_t capacity = 0;
+    std::vector<std::string> header;
+    if(getline(&line, &capacity, csv) > 0) split(line, ',', header);
+    int timestamp_col = column(header, "timestamp");
+    int sample_index_col = column(header, "sample_index");
+    int rate_col = column(header, "rate");
+    int frames_col = column(header, "frames");
+    if(timestamp_col < 0 || frames_col != (int)header.size() - 1) {
+        fprintf(stderr, "%s: ERROR: %s/%s: unexpected csv header\n", name_.c_str(), dir.c_str(), DATASET_CSV_NAME);
+        free(line);
+        fclose(csv);
+        return -3;
+    }
+
+    FeatureStore store;
+    if(store.create(store_base, dtype_, frames_, bands_) < 0) {
+        free(line);
+        fclose(csv);
+        return -4;
+    }
+
+    const size_t window = (size_t)mfcc.hop() * (frames_ - 1);
+    const size_t shift = (size_t)mfcc.hop() * shift_chunks_;
+    const size_t record = (size_t)frames_ * bands_;
+    std::vector<float> batch_features(DATASET_BATCH_WINDOWS * record);
+    std::vector<int32_t> batch_labels(DATASET_BATCH_WINDOWS);
+    std::vector<int64_t> batch_timestamps(DATASET_BATCH_WINDOWS);
+    std::vector<int32_t> batch_sources(DATASET_BATCH_WINDOWS, source);
+    size_t batch = 0;
+    int append_error = 0; //a failed append (e.g. disk full) ends the extraction
+    auto flush = [&]() {
+        if(batch > 0 && append_error == 0 &&
+           store.append(batch_features.data(), batch_labels.data(), batch_timestamps.data(), batch,
+                        batch_sources.data()) < 0) {
+            append_error = -5;
+        }
+        batch = 0;
+    };
+
+    // Sliding buffer of the interleaved samples: buffer[0] is the sample base (samples counted since the last gap)
+    struct anchor
+    {
+        int64_t position;
+        int64_t timestamp;
+        double rate;
+    };
+    std::vector<int16_t> buffer;
+    std::deque<anchor> anchors; //chunk starts
+    int64_t base = 0, total = 0, next_window = 0, expected_index = -1;
+    auto time_at = [&](int64_t position) {
+        auto it = std::upper_bound(anchors.begin(), anchors.end(), position,
+                                   [](int64_t p, const anchor& a){ return p < a.position; });
+        const anchor& a = *(it - 1);
+        return a.timestamp + (int64_t)((position - a.position) * 1e6 / a.rate);
+    };
+
+    std::vector<char*> fields(header.size());
+    std::vector<int> samples;
+    while(append_error == 0 && getline(&line, &capacity, csv) > 0) {
+        // The frames are the last column: the first commas separate the scalar columns
+        char* p = line;
+        size_t f = 0;
+        for(; f + 1 < fields.size(); f++) {
+            fields[f] = p;
+            p = strchr(p, ',');
+            if(p == nullptr) break;
+            *p++ = '\0';
+        }
+        if(p == nullptr) continue; //truncated line
+        fields[f] = p;
+
+        int64_t timestamp = strtoll(fields[timestamp_col], nullptr, 10);
+        int64_t sample_index = sample_index_col >= 0 ? strtoll(fields[sample_index_col], nullptr, 10) : -1;
+        double rate = rate_col >= 0 ? atof(fields[rate_col]) : 0.;
+        if(rate <= 0.) rate = rate_;
+        samples.clear();
+        char* end;
+        for(p = fields[frames_col]; ; p = end) {
+            long value = strtol(p, &end, 10);
+            if(end == p) break;
+            samples.push_back((int)value);
+        }
+        size_t frames_num = samples.size() / channels_;
+        res.chunks++;
+
+        if(sample_index >= 0 && expected_index >= 0 && sample_index != expected_index) {
+            res.gaps++;
+            buffer.clear();
+            anchors.clear();
+            base = total = next_window = 0;
+        }
+        expected_index = sample_index >= 0 ? sample_index + (int64_t)frames_num : -1;
+
+        anchors.push_back({total, timestamp, rate});
+        for(size_t i = 0; i < frames_num * channels_; i++) {
+            buffer.push_back((int16_t)std::max(-32768, std::min(32767, samples[i])));
+        }
+        total += frames_num;
+
+        while(next_window + (int64_t)window <= total) {
+            int64_t t0 = time_at(next_window);
+            int64_t t1 = time_at(next_window + window);
+            auto it = std::upper_bound(intervals.begin(), intervals.end(), t0,
+                                       [](int64_t t, const datasetLabelInterval& in){ return t < in.t0; });
+            int label = -1;
+            if(it != intervals.begin() && t1 <= (it - 1)->t1) label = (it - 1)->label;
+            if(label >= 0) {
+                const int16_t* x = &buffer[(next_window - base) * channels_];
+                if(fixed_point_) mfcc_fixed.compute(x, window, &batch_features[batch * record], channels_);
+                else mfcc.compute(x, window, &batch_features[batch * record], channels_);
+                batch_labels[batch] = label;
+                batch_timestamps[batch] = t1;
+                if(++batch == DATASET_BATCH_WINDOWS) flush();
+                res.windows++;
+            } else {
+                res.windows_unlabeled++;
+            }
+            next_window += shift;
+        }
+
+        // Dropping the samples before the next window (in large steps to keep the copies rare)
+        if(next_window - base > (int64_t)(4 * window)) {
+            int64_t drop = std::min(next_window, total) - base;
+            buffer.erase(buffer.begin(), buffer.begin() + drop * channels_);
+            base += drop;
+            while(anchors.size() > 1 && anchors[1].position <= base) anchors.pop_front();
+        }
+    }
+    flush();
+    free(line);
+    fclose(csv);
+    store.close();
+    return append_error;
+}
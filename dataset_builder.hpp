@@ -0,0 +1,126 @@
+/*
+Parallel dataset builder: drive recordings -> labeled MFCC feature shards.
+A drive folder holds the recorder output mic_rec.csv and timelabels.txt. Every drive becomes one feature store shard
+<out_dir>/<drive folder name>.{feat,lbl} (see feature_store.hpp), drives are processed concurrently by a pool of
+worker threads (one MfccExtractor each, FixedMfccExtractor with setFixedPoint()). Per drive the csv is read in one
+streaming pass:
+ - label intervals: the rows of timelabels.txt (start_time as "H:M:S.f" or seconds, as convert_datetimestamp()
+   of test_simple_puddle_classifier.py) run up to the next start_time (or an end_time column). The label comes from
+   a "label" column (class name or number), otherwise every interval gets the default label
+ - chunks are appended to a sliding sample buffer, the chunk time stamps (and rates) are kept as anchors:
+   the time of any sample follows without per sample interpolation
+ - windows of (frames - 1) * hop samples are cut every shift samples (20480 / 4096 as extract_features() with
+   41 frames and shift 8); a window is kept if it lies within one label interval. A gap in the chunk sample
+   indices restarts the windowing, windows never span dropped chunks
+ - the record time stamp is the time of the first sample after the window (feat_timestamps of extract_features())
+With a FeatureCache (setCache()) the shards are cache entries keyed by the csv / timelabels.txt contents and params():
+only drives without an entry are extracted, <out_dir>/<drive>.{feat,lbl} become symbolic links to the entries.
+
+A minimal example:
+    DatasetBuilder builder("_data/features");
+    builder.setLabelNames({"dry", "wet"});
+    builder.addDrive("_data/thunderhill/2018_Aug_22_15:16:34__wet");
+    builder.addDrive("_data/thunderhill/2018_Aug_22_13:20:45__dry");
+    builder.run();
+ */
+
+#ifndef MIC_READ_THREAD_DATASET_BUILDER_HPP
+#define MIC_READ_THREAD_DATASET_BUILDER_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <inttypes.h>
+
+#include "feature_store.hpp"
+#include "feature_cache.hpp"
+#include "mfcc.hpp"
+#include "mfcc_fixed.hpp"
+
+#define DATASET_DEF_SHIFT_CHUNKS 8
+#define DATASET_CSV_NAME "mic_rec.csv"
+#define DATASET_LABELS_NAME "timelabels.txt"
+#define DATASET_BATCH_WINDOWS 256 //windows appended to the shard at once
+
+struct datasetLabelInterval
+{
+    int64_t t0; //microseconds, [t0, t1)
+    int64_t t1;
+    int label;  //-1: unknown class name (windows are skipped)
+};
+
+struct datasetDriveResult
+{
+    datasetDriveResult(): chunks(0), windows(0), windows_unlabeled(0), gaps(0), seconds(0.), cached(false), error(0) {}
+    std::string dir;
+    std::string shard;     //feature store base name
+    long chunks;
+    long windows;           //written windows
+    long windows_unlabeled; //windows outside of (or across) label intervals
+    long gaps;              //sample index discontinuities
+    double seconds;         //processing time
+    bool cached;            //shard taken from the feature cache (chunks / unlabeled / gaps are not known then)
+    int error;              //negative on failure
+};
+
+class DatasetBuilder
+{
+public:
+    DatasetBuilder(std::string out_dir,
+                   int frames=FEATSTORE_DEF_FRAMES,
+                   int bands=FEATSTORE_DEF_BANDS,
+                   int shift_chunks=DATASET_DEF_SHIFT_CHUNKS,
+                   FeatureStoreDType dtype=FEATSTORE_FLOAT32,
+                   int threads=0); //0: hardware concurrency
+
+    // Class names of the label column (index = class id). Numbers in the column are used as they are
+    void setLabelNames(const std::vector<std::string>& names) {label_names_ = names;}
+    // Label of intervals without a label column (e.g. drives sorted into dry / wet folders). -1: skip such drives
+    void setDefaultLabel(int label) {default_label_ = label;}
+    void setChannels(int channels) {channels_ = channels;}  //interleaved channels of the csv frames (averaged)
+    void setRate(unsigned int rate) {rate_ = rate;}
+    // Integer MFCC (FixedMfccExtractor) instead of the float / librosa path: the features of small targets
+    void setFixedPoint(bool fixed_point) {fixed_point_ = fixed_point;}
+    // Shards are taken from / added to the cache (nullptr: always extracted). The cache must be open()
+    void setCache(FeatureCache* cache) {cache_ = cache;}
+    // Canonical string of everything the features depend on besides the input files (the cache key part)
+    std::string params() const;
+
+    void addDrive(const std::string& dir);
+    // Processes all drives. Returns the number of failed drives
+    int run();
+    const std::vector<datasetDriveResult>& results() const {return results_;}
+
+    // timelabels.txt -> sorted intervals. Negative on error
+    int parseLabels(const std::string& filename, std::vector<datasetLabelInterval>& intervals) const;
+    // "H:M:S.f" or seconds -> microseconds
+    static int64_t parseTime(const std::string& value);
+
+protected:
+    std::string out_dir_;
+    std::string name_;
+    int frames_;
+    int bands_;
+    int shift_chunks_;
+    FeatureStoreDType dtype_;
+    int threads_;
+    int channels_;
+    unsigned int rate_;
+    bool fixed_point_;
+    std::vector<std::string> label_names_;
+    int default_label_;
+    FeatureCache* cache_;
+
+    std::vector<std::string> drives_;
+    std::vector<datasetDriveResult> results_;
+    std::atomic<size_t> next_drive_;
+
+    void worker();
+    void processDrive(size_t drive, MfccExtractor& mfcc, FixedMfccExtractor& mfcc_fixed);
+    // Streams the csv of the drive into a new feature store. Negative on error
+    int extract(const std::string& dir, const std::string& store_base, int32_t source, MfccExtractor& mfcc,
+                FixedMfccExtractor& mfcc_fixed, datasetDriveResult& res);
+    int linkShard(const std::string& shard, const std::string& target);
+};
+
+#endif //MIC_READ_THREAD_DATASET_BUILDER_HPP
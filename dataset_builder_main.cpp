@@ -0,0 +1,105 @@
+//
+// Builds labeled feature shards from drive folders (mic_rec.csv + timelabels.txt), see dataset_builder.hpp
+// Usage: build_dataset [-o out_dir] [-j threads] [-s shift_chunks] [-l dry,wet] [-d default_label] [-c channels]
+//                      [-r rate] [-h] [-Q] [-C cache_dir] drive_dir ...
+//   -h: float16 features (default float32)
+//   -Q: integer MFCC (mfcc_fixed.hpp) instead of the float / librosa path
+//   -C: take unchanged drives from the feature cache (feature_cache.hpp), the shards link to the entries
+//
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+
+#include "dataset_builder.hpp"
+
+int main(int argc, char** argv)
+{
+    std::string out_dir = "_data/features";
+    int threads = 0;
+    int shift_chunks = DATASET_DEF_SHIFT_CHUNKS;
+    std::vector<std::string> label_names = {"dry", "wet"};
+    int default_label = -1;
+    int channels = 1;
+    unsigned int rate = 44100;
+    FeatureStoreDType dtype = FEATSTORE_FLOAT32;
+    std::string cache_dir;
+    bool fixed_point = false;
+
+    int c;
+    while((c = getopt(argc, argv, "o:j:s:l:d:c:r:hQC:")) != -1) {
+        switch(c) {
+            case 'o': out_dir = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 's': shift_chunks = atoi(optarg); break;
+            case 'l': {
+                label_names.clear();
+                std::string names = optarg;
+                size_t start = 0, pos;
+                while((pos = names.find(',', start)) != std::string::npos) {
+                    label_names.push_back(names.substr(start, pos - start));
+                    start = pos + 1;
+                }
+                label_names.push_back(names.substr(start));
+                break;
+            }
+            case 'd': default_label = atoi(optarg); break;
+            case 'c': channels = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'h': dtype = FEATSTORE_FLOAT16; break;
+            case 'Q': fixed_point = true; break;
+            case 'C': cache_dir = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-o out_dir] [-j threads] [-s shift_chunks] [-l dry,wet] [-d default_label] "
+                                "[-c channels] [-r rate] [-h] [-Q] [-C cache_dir] drive_dir ...\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) {
+        fprintf(stderr, "%s: no drive folders given\n", argv[0]);
+        return 1;
+    }
+
+    DatasetBuilder builder(out_dir, FEATSTORE_DEF_FRAMES, FEATSTORE_DEF_BANDS, shift_chunks, dtype, threads);
+    builder.setLabelNames(label_names);
+    builder.setDefaultLabel(default_label);
+    builder.setChannels(channels);
+    builder.setRate(rate);
+    builder.setFixedPoint(fixed_point);
+    for(int i = optind; i < argc; i++) builder.addDrive(argv[i]);
+    FeatureCache cache(cache_dir);
+    if(!cache_dir.empty()) {
+        if(cache.open() < 0) return 1;
+        builder.setCache(&cache);
+    }
+
+    auto t_start = std::chrono::steady_clock::now();
+    int failed = builder.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+    long windows = 0, chunks = 0;
+    for(const datasetDriveResult& res : builder.results()) {
+        if(res.error < 0) {
+            printf("%s: FAILED (%d)\n", res.dir.c_str(), res.error);
+            continue;
+        }
+        if(res.cached) {
+            printf("%s -> %s: cached, %ld windows, %.2f s\n", res.dir.c_str(), res.shard.c_str(), res.windows,
+                   res.seconds);
+        } else {
+            printf("%s -> %s: %ld chunks, %ld windows (%ld unlabeled), %ld gaps, %.2f s\n", res.dir.c_str(),
+                   res.shard.c_str(), res.chunks, res.windows, res.windows_unlabeled, res.gaps, res.seconds);
+        }
+        windows += res.windows;
+        chunks += res.chunks;
+    }
+    printf("%zu drives (%d failed), %ld chunks, %ld windows in %.2f s (%.0f windows/s)\n",
+           builder.results().size(), failed, chunks, windows, seconds, seconds > 0 ? windows / seconds : 0.);
+    if(!cache_dir.empty()) {
+        printf("cache %s: %ld hits, %ld misses, %ld files hashed\n", cache.dir().c_str(), cache.getHits(),
+               cache.getMisses(), cache.getFilesHashed());
+    }
+    return failed > 0 ? 1 : 0;
+}
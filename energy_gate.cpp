@@ -0,0 +1,138 @@
+#include "energy_gate.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+EnergyGate::EnergyGate(unsigned int rate,
+                       double open_db,
+                       double close_db,
+                       int hold_chunks,
+                       int preroll_chunks):
+    rate_(rate),
+    open_db_(open_db),
+    close_db_(close_db),
+    hold_chunks_(hold_chunks),
+    open_(false),
+    quiet_chunks_(0),
+    last_rms_db_(-200.),
+    preroll_(preroll_chunks),
+    preroll_pos_(0),
+    preroll_filled_(0),
+    chunks_passed_(0),
+    chunks_skipped_(0),
+    openings_(0)
+{
+    if(close_db_ > open_db_) {
+        fprintf(stderr, "EnergyGate: WARNING: close threshold %.1f dB is above the open one %.1f dB\n",
+                close_db_, open_db_);
+        close_db_ = open_db_;
+    }
+    for(size_t i = 0; i < preroll_.size(); i++) {
+        preroll_[i].frames.reserve(MICREAD_DEF_BUF_SIZE);
+    }
+}
+
+int EnergyGate::addBand(double freq, double open_db, double close_db)
+{
+    if(band_freqs_.size() >= ENERGY_GATE_MAX_BANDS) {
+        fprintf(stderr, "EnergyGate: ERROR: Too many bands (max %d)\n", ENERGY_GATE_MAX_BANDS);
+        return -1;
+    }
+    band_freqs_.push_back(freq);
+    band_open_db_.push_back(open_db < 0. ? open_db : open_db_);
+    band_close_db_.push_back(close_db < 0. ? close_db : close_db_);
+    band_coeffs_.push_back((float)(2.0 * cos(2.0 * M_PI * freq / rate_)));
+    return 0;
+}
+
+double EnergyGate::measure(const int16_t* samples, size_t n, double* bands_db)
+{
+    const int bands = (int)band_coeffs_.size();
+    float s1[ENERGY_GATE_MAX_BANDS] = {0};
+    float s2[ENERGY_GATE_MAX_BANDS] = {0};
+    const float* coeffs = band_coeffs_.data();
+    double sum_sq = 0.;
+
+    // One pass over the samples: energy and all Goertzel filters (the band loop is independent per band)
+    for(size_t i = 0; i < n; i++)
+    {
+        float x = samples[i];
+        sum_sq += x * x;
+        for(int b = 0; b < bands; b++) {
+            float s0 = x + coeffs[b] * s1[b] - s2[b];
+            s2[b] = s1[b];
+            s1[b] = s0;
+        }
+    }
+
+    const double full_scale_sq = 32768.0 * 32768.0;
+    double rms_sq = (n > 0) ? sum_sq / n : 0.;
+    if(bands_db != nullptr) {
+        double norm = (n > 0) ? (n / 2.0) * (n / 2.0) : 1.;
+        for(int b = 0; b < bands; b++) {
+            double power = (double)s1[b] * s1[b] + (double)s2[b] * s2[b] - (double)coeffs[b] * s1[b] * s2[b];
+            // amplitude^2 of a sine at the band frequency -> dB relative to full scale
+            bands_db[b] = 10.0 * log10(power / norm / full_scale_sq + 1e-20);
+        }
+    }
+    return 10.0 * log10(rms_sq / full_scale_sq + 1e-20);
+}
+
+void EnergyGate::process(const micDataStamped& chunk)
+{
+    double rms_db = measure(chunk.frames.data(), chunk.frames.size(), bands_db_);
+    last_rms_db_ = rms_db;
+
+    bool above_open = rms_db >= open_db_;
+    bool above_close = rms_db >= close_db_;
+    for(int b = 0; b < getBandsNum(); b++) {
+        above_open = above_open || bands_db_[b] >= band_open_db_[b];
+        above_close = above_close || bands_db_[b] >= band_close_db_[b];
+    }
+
+    if(!open_ && above_open) {
+        open_ = true;
+        openings_++;
+        quiet_chunks_ = 0;
+        // Replaying the pre-roll (oldest first). These chunks are not skipped after all
+        chunks_skipped_ -= preroll_filled_;
+        size_t start = (preroll_pos_ + preroll_.size() - preroll_filled_) % std::max<size_t>(preroll_.size(), 1);
+        for(size_t i = 0; i < preroll_filled_; i++) {
+            forward(preroll_[(start + i) % preroll_.size()]);
+        }
+        preroll_filled_ = 0;
+    } else if(open_) {
+        quiet_chunks_ = above_close ? 0 : quiet_chunks_ + 1;
+        if(quiet_chunks_ >= hold_chunks_) {
+            open_ = false;
+        }
+    }
+
+    if(open_) {
+        forward(chunk);
+        return;
+    }
+
+    chunks_skipped_++;
+    if(!preroll_.empty()) {
+        // Copy into a preallocated slot (assign reuses the slot capacity)
+        micDataStamped& slot = preroll_[preroll_pos_];
+        slot.id = chunk.id;
+        slot.timestamp = chunk.timestamp;
+        slot.sample_index = chunk.sample_index;
+        slot.rate = chunk.rate;
+        slot.flags = chunk.flags;
+        slot.frames.assign(chunk.frames.begin(), chunk.frames.end());
+        preroll_pos_ = (preroll_pos_ + 1) % preroll_.size();
+        preroll_filled_ = std::min(preroll_filled_ + 1, preroll_.size());
+    }
+}
+
+void EnergyGate::forward(const micDataStamped& chunk)
+{
+    chunks_passed_++;
+    for(size_t s = 0; s < stages_.size(); s++) {
+        stages_[s]->process(chunk);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+Cheap activity gate in front of feature extraction / inference.
+For every chunk it computes the RMS level and the level of a few Goertzel bands (dBFS).
+The gate opens when the RMS or any band exceeds its open threshold and closes only after
+all levels stayed below the (lower) close thresholds for hold_chunks chunks (hysteresis).
+Downstream stages only receive chunks while the gate is open. When the gate opens the last
+preroll_chunks chunks are replayed first, so downstream windows start with full context.
+
+A minimal example:
+    MicReadAlsa mic_reader(std::chrono::steady_clock::now(), true);
+    EnergyGate gate(mic_reader.getRate());
+    gate.addBand(500.);  gate.addBand(2000.);
+    StftStream stft(mic_reader.getRate());
+    gate.addStage(&stft);
+    mic_reader.addStage(&gate);
+    ...
+    printf("passed %ld skipped %ld\n", gate.getChunksPassed(), gate.getChunksSkipped());
+ */
+
+#ifndef MIC_READ_THREAD_ENERGY_GATE_HPP
+#define MIC_READ_THREAD_ENERGY_GATE_HPP
+
+#include <vector>
+#include <atomic>
+
+#include "micread_thread.hpp"
+
+#define ENERGY_GATE_MAX_BANDS 8
+#define ENERGY_GATE_DEF_OPEN_DB -45.0
+#define ENERGY_GATE_DEF_CLOSE_DB -50.0
+#define ENERGY_GATE_DEF_HOLD_CHUNKS 43 //~0.5s of 512 frame chunks at 44100
+#define ENERGY_GATE_DEF_PREROLL_CHUNKS 8
+
+class EnergyGate : public MicReadStage
+{
+public:
+    EnergyGate(unsigned int rate=MICREAD_DEF_RATE,
+               double open_db=ENERGY_GATE_DEF_OPEN_DB,
+               double close_db=ENERGY_GATE_DEF_CLOSE_DB,
+               int hold_chunks=ENERGY_GATE_DEF_HOLD_CHUNKS,
+               int preroll_chunks=ENERGY_GATE_DEF_PREROLL_CHUNKS);
+
+    // Adds a Goertzel band. Thresholds of 0 mean the RMS ones are used. Returns -1 if there are too many bands
+    int addBand(double freq, double open_db=0., double close_db=0.);
+    void addStage(MicReadStage* stage) {stages_.push_back(stage);}
+
+    // MicReadStage
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "energy gate";}
+
+    // Levels of a chunk (dBFS). bands_db must hold getBandsNum() values (may be nullptr)
+    double measure(const int16_t* samples, size_t n, double* bands_db);
+
+    bool isOpen() const {return open_;}
+    int getBandsNum() const {return (int)band_freqs_.size();}
+    double getLastRmsDb() const {return last_rms_db_;}
+    long getChunksPassed() const {return chunks_passed_;}
+    long getChunksSkipped() const {return chunks_skipped_;}
+    long getOpenings() const {return openings_;}
+
+protected:
+    unsigned int rate_;
+    double open_db_;
+    double close_db_;
+    int hold_chunks_;
+
+    std::vector<double> band_freqs_;
+    std::vector<double> band_open_db_;
+    std::vector<double> band_close_db_;
+    std::vector<float> band_coeffs_; //2*cos(2*pi*f/rate)
+    double bands_db_[ENERGY_GATE_MAX_BANDS];
+
+    std::atomic<bool> open_;
+    int quiet_chunks_; //chunks below the close thresholds while open
+    std::atomic<double> last_rms_db_;
+
+    // Pre-roll ring (preallocated chunks, reused)
+    std::vector<micDataStamped> preroll_;
+    size_t preroll_pos_;
+    size_t preroll_filled_;
+
+    std::vector<MicReadStage*> stages_;
+
+    std::atomic<long> chunks_passed_;
+    std::atomic<long> chunks_skipped_;
+    std::atomic<long> openings_;
+
+    void forward(const micDataStamped& chunk);
+};
+
+#endif //MIC_READ_THREAD_ENERGY_GATE_HPP
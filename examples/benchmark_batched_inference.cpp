@@ -0,0 +1,107 @@
+/*
+Throughput and added latency of cross-stream batched inference (InferenceScheduler)
+for 1, 4 and 8 streams, against evaluating every window alone (max_batch = 1).
+Usage: benchmark_batched_inference [weights.lstm]   (random weights if not given)
+ */
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+
+#include "../inference_scheduler.hpp"
+
+// Closed loop: every stream submits its next window as soon as the previous result arrived
+double throughput(LstmClassifier& model, int streams, int max_batch, double seconds)
+{
+    InferenceScheduler scheduler(model, max_batch);
+    std::vector<std::atomic<bool> > done(streams);
+    for(int s = 0; s < streams; s++) done[s] = true;
+    scheduler.setCallback([&done](const inferenceResult& res){ done[res.stream] = true; });
+    std::vector<int> ids;
+    for(int s = 0; s < streams; s++) ids.push_back(scheduler.addStream());
+    scheduler.start();
+
+    std::vector<float> window(model.windowSize(), 0.1f);
+    auto t_start = std::chrono::steady_clock::now();
+    auto t_end = t_start + std::chrono::microseconds((long)(seconds * 1e6));
+    long id = 0;
+    while(std::chrono::steady_clock::now() < t_end) {
+        for(int s = 0; s < streams; s++) {
+            if(done[s].exchange(false)) scheduler.submit(ids[s], window.data(), id++, 0);
+        }
+        std::this_thread::yield();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    scheduler.finish();
+    return (scheduler.getWindowsProcessed() - scheduler.getWindowsFlushed()) / elapsed; //in the measured time
+}
+
+// Open loop: every stream produces a window per period (real time), reports the latency added by batching
+void latency(LstmClassifier& model, int streams, int max_batch, double period_ms, int windows_per_stream)
+{
+    InferenceScheduler scheduler(model, max_batch);
+    std::atomic<long> latency_total(0), latency_max(0);
+    scheduler.setCallback([&](const inferenceResult& res){
+        latency_total += res.latency_us;
+        if(res.latency_us > latency_max) latency_max = res.latency_us;
+    });
+    std::vector<int> ids;
+    for(int s = 0; s < streams; s++) ids.push_back(scheduler.addStream());
+    scheduler.start();
+
+    std::vector<std::thread> producers;
+    for(int s = 0; s < streams; s++) {
+        producers.push_back(std::thread([&, s]() {
+            std::vector<float> window(model.windowSize(), 0.1f * s);
+            std::mt19937 gen(s);
+            std::uniform_int_distribution<int> jitter(0, (int)(period_ms * 100)); //streams are not in phase
+            std::this_thread::sleep_for(std::chrono::microseconds(jitter(gen) * 10));
+            auto next = std::chrono::steady_clock::now();
+            for(int i = 0; i < windows_per_stream; i++) {
+                scheduler.submit(ids[s], window.data(), i, 0);
+                next += std::chrono::microseconds((long)(period_ms * 1000));
+                std::this_thread::sleep_until(next);
+            }
+        }));
+    }
+    for(size_t p = 0; p < producers.size(); p++) producers[p].join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    scheduler.finish();
+
+    long n = scheduler.getWindowsProcessed();
+    printf("  streams %d max_batch %2d: avg batch %5.2f  added wait avg %7.0f us max %7ld us  total latency avg %7.0f us max %7ld us\n",
+           streams, max_batch, scheduler.getAvgBatchSize(),
+           scheduler.getAvgWaitUs(), scheduler.getMaxWaitUs(),
+           n > 0 ? (double)latency_total / n : 0., (long)latency_max);
+}
+
+int main(int argc, char** argv)
+{
+    LstmClassifier model;
+    if(argc > 1) {
+        if(model.load(argv[1]) < 0) return 1;
+    } else {
+        model.initRandom();
+    }
+
+    int streams_list[] = {1, 4, 8};
+    printf("Throughput (closed loop, windows/s):\n");
+    for(int i = 0; i < 3; i++) {
+        int streams = streams_list[i];
+        double unbatched = throughput(model, streams, 1, 2.0);
+        double batched = throughput(model, streams, INFER_DEF_MAX_BATCH, 2.0);
+        printf("  streams %d: unbatched %8.1f  batched %8.1f  speedup %.2fx\n",
+               streams, unbatched, batched, batched / unbatched);
+    }
+
+    // Real time: a window every 8 chunks of 512 frames at 44100 (the shift used by the classifier)
+    double period_ms = 8 * 512 * 1000.0 / 44100;
+    printf("Latency (a window per %.1f ms per stream):\n", period_ms);
+    for(int i = 0; i < 3; i++) {
+        latency(model, streams_list[i], 1, period_ms, 40);
+        latency(model, streams_list[i], INFER_DEF_MAX_BATCH, period_ms, 40);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+Heap allocations per second of a consumer loop draining MicReadAlsa every 10 ms (like micread_main.cpp):
+ - getData()              : returns a new vector every call (previous API)
+ - getData(out)           : reused vector, frame buffers recycled to the reading thread
+ - getSamples(buf, n)     : contiguous int16 buffer
+Allocations are counted by replacing the global operator new, separately for the consumer thread
+and for the whole process (i.e. including the reading thread).
+Usage: benchmark_drain_allocations [device] [seconds per variant]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include "../micread_thread.hpp"
+
+#ifdef MICREAD_INSTRUMENT
+// Instrumented builds replace operator new already (instrument.hpp)
+static long thread_allocations() {return Instrument::thread()->allocations;}
+static long process_allocations() {return Instrument::allocations();}
+#else
+static std::atomic<long> g_allocs(0);
+static thread_local long t_allocs = 0;
+
+void* operator new(size_t size)
+{
+    g_allocs++;
+    t_allocs++;
+    void* p = malloc(size > 0 ? size : 1);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static long thread_allocations() {return t_allocs;}
+static long process_allocations() {return g_allocs;}
+#endif
+
+enum DrainVariant {DRAIN_VECTOR_NEW, DRAIN_VECTOR_REUSED, DRAIN_SAMPLES};
+
+void run_variant(MicReadAlsa& mic, DrainVariant variant, const char* name, double seconds)
+{
+    std::vector<micDataStamped> chunks;
+    std::vector<int16_t> samples(MICREAD_DEF_RATE); //1 s of audio
+    long chunks_total = 0, samples_total = 0;
+
+    // Warming up: the pool and the reused containers reach their steady state size
+    for(int i = 0; i < 50; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mic.getData(chunks);
+        mic.getSamples(samples.data(), samples.size());
+    }
+    chunks.clear(); //keeps the capacity
+
+    long allocs_thread_start = thread_allocations();
+    long allocs_start = process_allocations();
+    auto t_start = std::chrono::steady_clock::now();
+    auto t_end = t_start + std::chrono::microseconds((long)(seconds * 1e6));
+    while(std::chrono::steady_clock::now() < t_end)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        switch(variant) {
+        case DRAIN_VECTOR_NEW: {
+            std::vector<micDataStamped> data = mic.getData();
+            chunks_total += data.size();
+            break;
+        }
+        case DRAIN_VECTOR_REUSED:
+            chunks_total += mic.getData(chunks);
+            break;
+        case DRAIN_SAMPLES:
+            samples_total += mic.getSamples(samples.data(), samples.size());
+            break;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    long allocs_thread = thread_allocations() - allocs_thread_start;
+    long allocs = process_allocations() - allocs_start;
+    printf("%-22s chunks/s %7.1f samples/s %9.1f | allocations/s: consumer %8.1f process %8.1f\n",
+           name, chunks_total / elapsed, samples_total / elapsed, allocs_thread / elapsed, allocs / elapsed);
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = argc > 1 ? argv[1] : MICREAD_DEF_DEVICE;
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+
+    // No recording thread: the consumer loop is the only reader of the buffer
+    MicReadAlsa mic(std::chrono::steady_clock::now(), true, false, true, false,
+                    MICREAD_DEF_REC_FREQ, MICREAD_DEF_REC_FILENAME, device);
+    mic.start();
+
+    run_variant(mic, DRAIN_VECTOR_NEW, "getData()", seconds);
+    run_variant(mic, DRAIN_VECTOR_REUSED, "getData(out)", seconds);
+    run_variant(mic, DRAIN_SAMPLES, "getSamples(buf, n)", seconds);
+
+    mic.finish();
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+Float (MfccExtractor, matches librosa) vs integer (FixedMfccExtractor) MFCC of classifier windows (20480 samples):
+ - error budget per signal level: max / RMS absolute error of the coefficients, worst error relative to the spread
+   (standard deviation) of the coefficient over the windows
+ - speed: windows per second of both paths (int16 input, the integer path with Q8 output)
+ - classifier: agreement of the LSTM predictions on the two feature sets and the largest probability difference
+   (accuracy numbers on labeled drives: build_dataset -Q / evaluate_model -Q against the float shards)
+Signals: a tone mix with noise and slowly changing amplitude (road noise like), from -6 dBFS down to -78 dBFS.
+Usage: benchmark_mfcc_fixed [weights.lstm|random] [windows per level]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "../mfcc.hpp"
+#include "../mfcc_fixed.hpp"
+#include "../lstm_classifier.hpp"
+
+#define WINDOW_SAMPLES 20480
+
+static void make_window(std::vector<int16_t>& x, double level_db, std::mt19937& rng)
+{
+    std::normal_distribution<double> noise(0., 1.);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    double amplitude = 32767. * pow(10., level_db / 20.);
+    double f1 = 80. + 400. * uniform(rng), f2 = 1000. + 6000. * uniform(rng);
+    double noise_level = 0.05 + 0.5 * uniform(rng);
+    double phase = 2 * M_PI * uniform(rng);
+    for(size_t i = 0; i < x.size(); i++) {
+        double t = (double)i / 44100.;
+        double envelope = 0.6 + 0.4 * sin(2 * M_PI * 3. * t + phase);
+        double v = envelope * (0.5 * sin(2 * M_PI * f1 * t) + 0.2 * sin(2 * M_PI * f2 * t)) + noise_level * noise(rng);
+        v = amplitude * v / (0.7 + 3. * noise_level);
+        x[i] = (int16_t)std::max(-32768., std::min(32767., round(v)));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string weights = argc > 1 ? argv[1] : "random";
+    int windows = argc > 2 ? atoi(argv[2]) : 64;
+
+    LstmClassifier model;
+    if(weights == "random") model.initRandom();
+    else if(model.load(weights) < 0) return 1;
+
+    MfccExtractor mfcc(44100);
+    FixedMfccExtractor mfcc_fixed(44100);
+    const int coeffs = mfcc.coefficients();
+    const size_t frames = mfcc.frames(WINDOW_SAMPLES);
+    const size_t record = frames * coeffs;
+    if((int)frames != model.steps() || coeffs != model.input()) {
+        fprintf(stderr, "The model expects %d x %d windows, the features are %zu x %d\n", model.steps(), model.input(),
+                frames, coeffs);
+        return 1;
+    }
+
+    std::vector<int16_t> x(WINDOW_SAMPLES);
+    std::vector<float> ref((size_t)windows * record), fix((size_t)windows * record);
+    std::vector<int32_t> fix_q(record);
+    std::vector<float> probs_ref((size_t)windows * model.classes()), probs_fix((size_t)windows * model.classes());
+    double t_float = 0., t_fixed = 0.;
+    long agree = 0, total = 0;
+    double prob_diff_max = 0.;
+    std::mt19937 rng(1);
+
+    printf("%9s | %9s %9s %9s | %10s %10s | %9s %9s\n", "level dBFS", "max err", "rms err", "max/std", "float w/s",
+           "fixed w/s", "agreement", "max dprob");
+    for(double level_db = -6.; level_db >= -78.; level_db -= 12.) {
+        double level_float = 0., level_fixed = 0.;
+        for(int w = 0; w < windows; w++) {
+            make_window(x, level_db, rng);
+            auto t0 = std::chrono::steady_clock::now();
+            mfcc.compute(x.data(), x.size(), &ref[w * record]);
+            auto t1 = std::chrono::steady_clock::now();
+            mfcc_fixed.compute(x.data(), x.size(), fix_q.data());
+            auto t2 = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < record; i++) fix[w * record + i] = fix_q[i] * (1.f / (1 << MFCC_FIXED_FRAC_BITS));
+            level_float += std::chrono::duration<double>(t1 - t0).count();
+            level_fixed += std::chrono::duration<double>(t2 - t1).count();
+        }
+        t_float += level_float;
+        t_fixed += level_fixed;
+
+        // Error per coefficient, relative to its spread over the windows
+        double err_max = 0., err_sq = 0., rel_max = 0.;
+        for(int k = 0; k < coeffs; k++) {
+            double sum = 0., sum_sq = 0., coeff_err = 0.;
+            for(int w = 0; w < windows; w++) {
+                for(size_t t = 0; t < frames; t++) {
+                    size_t i = w * record + t * coeffs + k;
+                    double err = fabs(fix[i] - ref[i]);
+                    coeff_err = std::max(coeff_err, err);
+                    err_sq += err * err;
+                    sum += ref[i];
+                    sum_sq += (double)ref[i] * ref[i];
+                }
+            }
+            double n = (double)windows * frames;
+            double std_dev = sqrt(std::max(0., sum_sq / n - (sum / n) * (sum / n)));
+            err_max = std::max(err_max, coeff_err);
+            if(std_dev > 0.) rel_max = std::max(rel_max, coeff_err / std_dev);
+        }
+
+        model.predict(ref.data(), windows, probs_ref.data());
+        model.predict(fix.data(), windows, probs_fix.data());
+        long level_agree = 0;
+        for(int w = 0; w < windows; w++) {
+            const float* pr = &probs_ref[(size_t)w * model.classes()];
+            const float* pf = &probs_fix[(size_t)w * model.classes()];
+            if(std::max_element(pr, pr + model.classes()) - pr == std::max_element(pf, pf + model.classes()) - pf) {
+                level_agree++;
+            }
+            for(int c = 0; c < model.classes(); c++) prob_diff_max = std::max(prob_diff_max, (double)fabs(pr[c] - pf[c]));
+        }
+        agree += level_agree;
+        total += windows;
+        printf("%9.0f | %9.4f %9.4f %9.4f | %10.1f %10.1f | %8.1f%% %9.5f\n", level_db, err_max,
+               sqrt(err_sq / ((double)windows * record)), rel_max, windows / level_float, windows / level_fixed,
+               100. * level_agree / windows, prob_diff_max);
+    }
+    printf("all levels: float %.1f windows/s, fixed %.1f windows/s (x%.2f), prediction agreement %.2f%% of %ld windows\n",
+           total / t_float, total / t_fixed, t_float / t_fixed, 100. * agree / total, total);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+Loopback test of the network streaming: NetStreamSender -> 127.0.0.1 -> NetStreamReceiver in one process.
+Synthetic chunks (low pass filtered noise, 512 frames, 44.1 kHz) are fed at device pace (or as fast as
+possible with speedup 0) for TCP / UDP with and without delta compression. Reports bytes/s, messages,
+lost chunks, capture -> receive latency and checks that the received samples are bit exact.
+Usage: benchmark_net_stream [seconds] [speedup]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unistd.h>
+
+#include "../net_stream.hpp"
+
+// Checks the received chunks against the generator (same seed)
+class CheckStage : public MicReadStage
+{
+public:
+    CheckStage(): mismatches(0) {}
+    void process(const micDataStamped& chunk) {
+        for(size_t i = 0; i < chunk.frames.size(); i++) {
+            if(chunk.frames[i] != expected(chunk.sample_index + i)) {
+                mismatches++;
+                return;
+            }
+        }
+    }
+    static int16_t expected(int64_t sample) {
+        // Deterministic low pass noise: a sum of a few sines with incommensurate frequencies
+        double t = sample / 44100.;
+        return (int16_t)(1500. * sin(2 * M_PI * 97. * t) + 700. * sin(2 * M_PI * 431. * t + 1.) +
+                         300. * sin(2 * M_PI * 1733. * t + 2.) + 80. * sin(2 * M_PI * 5101. * t));
+    }
+    long mismatches;
+};
+
+static void run(NetStreamTransport transport, bool compress, double seconds, double speedup, int port)
+{
+    const int frames = 512;
+    CheckStage check;
+    NetStreamReceiver receiver(port, transport, "127.0.0.1");
+    receiver.addStage(&check);
+    if(receiver.start() < 0) return;
+    NetStreamSender sender("127.0.0.1", port, transport);
+    sender.setCompression(compress);
+    sender.start();
+    usleep(100000);
+
+    long chunks = (long)(seconds * 44100 / frames);
+    micDataStamped chunk;
+    chunk.frames.resize(frames);
+    chunk.rate = 44100.;
+    auto t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        if(speedup > 0.) {
+            std::this_thread::sleep_until(t0 + std::chrono::microseconds((long)(c * frames * 1e6 / 44100. / speedup)));
+        }
+        chunk.id = c;
+        chunk.sample_index = (int64_t)c * frames;
+        chunk.timestamp = (int64_t)(chunk.sample_index * 1e6 / 44100.);
+        for(int i = 0; i < frames; i++) chunk.frames[i] = CheckStage::expected(chunk.sample_index + i);
+        sender.process(chunk);
+    }
+    sender.finish();
+    usleep(200000);
+    receiver.finish();
+
+    double raw_bytes = (double)sender.getChunksSent() * frames * sizeof(int16_t);
+    printf("%s %-5s: sent %ld dropped %ld received %ld lost %ld mismatches %ld | %.1f KB/s, %ld messages, "
+           "%.0f%% of raw | latency avg %.0f us max %ld us (network %.0f us)\n",
+           transport == NETSTREAM_TCP ? "TCP" : "UDP", compress ? "delta" : "raw",
+           sender.getChunksSent(), sender.getChunksDropped(), receiver.getChunksReceived(), receiver.getChunksLost(),
+           check.mismatches, sender.getBytesPerSecond() / 1024., sender.getMessagesSent(),
+           raw_bytes > 0 ? 100. * sender.getBytesSent() / raw_bytes : 0.,
+           receiver.getAvgLatencyUs(), receiver.getMaxLatencyUs(), receiver.getAvgNetLatencyUs());
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 5.;
+    double speedup = argc > 2 ? atof(argv[2]) : 1.;
+    run(NETSTREAM_TCP, false, seconds, speedup, 5601);
+    run(NETSTREAM_TCP, true, seconds, speedup, 5602);
+    run(NETSTREAM_UDP, false, seconds, speedup, 5603);
+    run(NETSTREAM_UDP, true, seconds, speedup, 5604);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+Chunk delivery latency and consumer wakeups of MicReadAlsa:
+ - poll 10 ms     : sleep 10 ms, getData(out) (the loop of micread_main.cpp)
+ - waitData       : waitData(out, timeout) returns as soon as a chunk lands
+ - nextData future: std::future of the next data, then getData(out)
+ - callback       : addCallback(), chunks pushed from the dispatch thread
+Latency: consumer time - end of the chunk (time stamp of the first sample + chunk duration, i.e. it includes
+the driver / period latency common to all variants). Age: consumer time - time stamp of the first sample (the
+chunk duration included: what a latency profile shortens). Wakeups: consumer loop iterations per second.
+Usage: benchmark_push_delivery [device] [seconds per variant] [default|low-latency|low-wakeup]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+
+#include "../micread_thread.hpp"
+
+enum DeliveryVariant {DELIVERY_POLL, DELIVERY_WAIT, DELIVERY_FUTURE, DELIVERY_CALLBACK};
+
+struct latencyStats
+{
+    latencyStats(): chunks(0), total_us(0), max_us(0), age_us(0) {}
+    long chunks;
+    int64_t total_us;
+    int64_t max_us;
+    int64_t age_us;
+    void add(int64_t latency_us, int64_t duration_us) {
+        chunks++;
+        total_us += latency_us;
+        max_us = std::max(max_us, latency_us);
+        age_us += latency_us + duration_us;
+    }
+};
+
+static int64_t since(std::chrono::steady_clock::time_point t_start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+static int64_t duration_us(const micDataStamped& chunk)
+{
+    return (int64_t)chunk.frames.size() * 1000000 / MICREAD_DEF_RATE; //mono
+}
+
+void run_variant(const char* device, DeliveryVariant variant, const char* name, double seconds,
+                 MicReadLatencyProfile profile)
+{
+    auto t_start = std::chrono::steady_clock::now();
+    MicReadAlsa mic(t_start, true, false, true, false, MICREAD_DEF_REC_FREQ, "", device, MICREAD_DEF_BUF_SIZE,
+                    MICREAD_DEF_RATE, 1, SND_PCM_FORMAT_S16_LE, MICREAD_DEF_NAME, profile);
+    latencyStats stats;
+    long wakeups = 0;
+    std::atomic<long> callback_chunks(0), callback_total_us(0), callback_max_us(0), callback_age_us(0);
+    if(variant == DELIVERY_CALLBACK) {
+        mic.addCallback([&](const micDataStamped& chunk) {
+            long latency = (long)(since(t_start) - chunk.timestamp - duration_us(chunk));
+            callback_chunks++;
+            callback_total_us += latency;
+            callback_age_us += latency + duration_us(chunk);
+            if(latency > callback_max_us) callback_max_us = latency;
+        });
+    }
+    mic.start();
+
+    std::vector<micDataStamped> chunks;
+    // From the start of the capture (the constructor may have run a tuning sweep first)
+    auto t_begin = std::chrono::steady_clock::now();
+    auto t_end = t_begin + std::chrono::microseconds((long)(seconds * 1e6));
+    while(std::chrono::steady_clock::now() < t_end)
+    {
+        switch(variant) {
+        case DELIVERY_POLL:
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            mic.getData(chunks);
+            break;
+        case DELIVERY_WAIT:
+            mic.waitData(chunks, std::chrono::milliseconds(100));
+            break;
+        case DELIVERY_FUTURE: {
+            std::future<size_t> ready = mic.nextData();
+            if(ready.wait_for(std::chrono::milliseconds(100)) == std::future_status::ready && ready.get() > 0) {
+                mic.getData(chunks);
+            }
+            break;
+        }
+        case DELIVERY_CALLBACK:
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        wakeups++;
+        int64_t now_us = since(t_start);
+        for(const micDataStamped& chunk : chunks) stats.add(now_us - chunk.timestamp - duration_us(chunk), duration_us(chunk));
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_begin).count();
+    mic.finish();
+    if(variant == DELIVERY_CALLBACK) {
+        stats.chunks = callback_chunks;
+        stats.total_us = callback_total_us;
+        stats.max_us = callback_max_us;
+        stats.age_us = callback_age_us;
+        wakeups = mic.getDispatchWakeups();
+    }
+    printf("%-16s chunks %5ld | latency mean %6.2f ms max %6.2f ms | age mean %6.2f ms | wakeups/s %7.1f (%.2f chunks per wakeup)\n",
+           name, stats.chunks, stats.chunks > 0 ? stats.total_us / 1000. / stats.chunks : 0., stats.max_us / 1000.,
+           stats.chunks > 0 ? stats.age_us / 1000. / stats.chunks : 0.,
+           wakeups / elapsed, wakeups > 0 ? (double)stats.chunks / wakeups : 0.);
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = argc > 1 ? argv[1] : MICREAD_DEF_DEVICE;
+    double seconds = argc > 2 ? atof(argv[2]) : 5.;
+    std::string profile_name = argc > 3 ? argv[3] : "default";
+    MicReadLatencyProfile profile = MICREAD_PROFILE_DEFAULT;
+    if(profile_name == "low-latency") profile = MICREAD_PROFILE_LOW_LATENCY;
+    else if(profile_name == "low-wakeup") profile = MICREAD_PROFILE_LOW_WAKEUP;
+
+    run_variant(device, DELIVERY_POLL, "poll 10 ms", seconds, profile);
+    run_variant(device, DELIVERY_WAIT, "waitData", seconds, profile);
+    run_variant(device, DELIVERY_FUTURE, "nextData future", seconds, profile);
+    run_variant(device, DELIVERY_CALLBACK, "callback", seconds, profile);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+Queue policies of MicReadAlsa under a CPU spike of the consumer.
+The consumer drains the reader in batches of 4 chunks and "processes" every chunk (busy work, a quarter of the
+chunk period). For spike seconds the processing takes twice the chunk period, i.e. the consumer falls behind.
+Per policy: chunks shed / decimated, block waits, the largest capture -> processed latency and whether the reader
+is back to full rate processing (stride 1, not shedding) at the end. BLOCK / DROP_NEWEST keep the oldest audio
+(latency up to max_chunks times the processing time), DROP_OLDEST / DECIMATE bound it to max_chunks periods.
+Usage: benchmark_queue_policies [device] [max_chunks] [spike seconds]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../micread_thread.hpp"
+
+static void busy(std::chrono::microseconds work)
+{
+    auto t_end = std::chrono::steady_clock::now() + work;
+    while(std::chrono::steady_clock::now() < t_end) {}
+}
+
+void run_policy(const char* device, MicReadQueuePolicy policy, const char* name, int max_chunks, double spike_s)
+{
+    auto t_start = std::chrono::steady_clock::now();
+    MicReadAlsa mic(t_start, true, false, true, false, MICREAD_DEF_REC_FREQ, "", device);
+    mic.setQueuePolicy(policy, max_chunks);
+    const long period_us = (long)MICREAD_DEF_BUF_SIZE * 1000000L / MICREAD_DEF_RATE;
+    mic.start();
+
+    // 1 s normal, spike, 3 s normal again (recovery)
+    const double spike_begin = 1., spike_end = 1. + spike_s, end = spike_end + 3.;
+    std::vector<micDataStamped> chunks;
+    long processed = 0, skipped = 0;
+    int64_t latency_max = 0, latency_after_us = 0;
+    double now_s = 0.;
+    while((now_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count()) < end)
+    {
+        if(mic.getData(chunks, 4) == 0) { //small batches: the backlog stays in the reader's buffer
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        for(const micDataStamped& chunk : chunks) {
+            if(chunk.flags.skip) {
+                skipped++;
+                continue;
+            }
+            bool spike = now_s >= spike_begin && now_s < spike_end;
+            busy(std::chrono::microseconds(spike ? 2 * period_us : period_us / 4));
+            processed++;
+            int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - t_start).count();
+            int64_t latency = now_us - chunk.timestamp - period_us;
+            if(latency > latency_max) latency_max = latency;
+            if(now_s > spike_end + 2.) latency_after_us = std::max(latency_after_us, latency);
+        }
+        now_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    }
+    bool recovered = !mic.isShedding() && mic.getProcessingStride() == 1;
+    mic.finish();
+    printf("%-12s read %5ld processed %5ld skipped %5ld shed %5ld dropped %3ld waits %4ld timeouts %4ld xruns %2ld "
+           "episodes %2ld high water %4ld | latency max %6.1f ms, last second %6.1f ms | %s\n",
+           name, mic.getChunksRead(), processed, skipped, mic.getChunksShed(), mic.getChunksDropped(),
+           mic.getBlockWaits(), mic.getBlockTimeouts(), mic.getXruns(), mic.getSheddingEpisodes(),
+           mic.getQueueHighWater(), latency_max / 1000., latency_after_us / 1000., recovered ? "recovered" : "BEHIND");
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = argc > 1 ? argv[1] : MICREAD_DEF_DEVICE;
+    int max_chunks = argc > 2 ? atoi(argv[2]) : 64;
+    double spike_s = argc > 3 ? atof(argv[3]) : 2.;
+
+    run_policy(device, MICREAD_QUEUE_UNBOUNDED, "unbounded", max_chunks, spike_s);
+    run_policy(device, MICREAD_QUEUE_BLOCK, "block", max_chunks, spike_s);
+    run_policy(device, MICREAD_QUEUE_DROP_OLDEST, "drop_oldest", max_chunks, spike_s);
+    run_policy(device, MICREAD_QUEUE_DROP_NEWEST, "drop_newest", max_chunks, spike_s);
+    run_policy(device, MICREAD_QUEUE_DECIMATE, "decimate", max_chunks, spike_s);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+Handoff latency of the shared memory ring between two processes.
+The parent publishes synthetic chunks (time stamp = CLOCK_MONOTONIC at publish) at the pace of a 44.1 kHz
+device with 512 frame chunks (or as fast as possible with interval 0); a forked child reads them with
+ShmRingReader and measures now - time stamp.
+Usage: benchmark_shm_ring [chunks] [interval_us]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../shm_ring.hpp"
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int reader_process(long chunks)
+{
+    ShmRingReader reader("benchmark");
+    if(reader.open() < 0) return 1;
+    micDataStamped chunk;
+    std::vector<double> latencies;
+    latencies.reserve(chunks);
+    while((long)latencies.size() < chunks && reader.read(chunk, 2000) == 1) {
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count() - chunk.timestamp);
+    }
+    if(latencies.empty()) return 1;
+    std::sort(latencies.begin(), latencies.end());
+    printf("Reader: %zu chunks, lost %ld, handoff latency us: median %.1f  p99 %.1f  max %.1f\n",
+           latencies.size(), reader.getChunksLost(),
+           latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    long chunks = argc > 1 ? atol(argv[1]) : 2000;
+    long interval_us = argc > 2 ? atol(argv[2]) : 11610; //512 frames at 44.1 kHz
+
+    ShmRingPublisher publisher("benchmark", 44100);
+    if(publisher.create() < 0) return 1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        // _exit(): the child must not run the destructor of the inherited publisher (it would remove the ring)
+        int status = reader_process(chunks);
+        fflush(stdout);
+        _exit(status);
+    }
+    usleep(200000); //the reader starts with the next published chunk
+
+    micDataStamped chunk;
+    chunk.frames.assign(512, 0);
+    int64_t next = now_us();
+    for(long i = 0; i < chunks; i++) {
+        if(interval_us > 0) {
+            next += interval_us;
+            int64_t wait = next - now_us();
+            if(wait > 0) usleep(wait);
+        }
+        chunk.id = i;
+        chunk.sample_index = i * 512;
+        chunk.timestamp = now_us();
+        publisher.process(chunk);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    printf("Publisher: %ld chunks published\n", publisher.getChunksPublished());
+    return WEXITSTATUS(status);
+}
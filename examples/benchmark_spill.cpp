@@ -0,0 +1,68 @@
+/*
+Memory budget of MicReadAlsa: the consumer stalls for stall seconds (e.g. a blocked network sink), then drains the
+backlog in batches. Without a budget the backlog stays in memory, with setMemoryBudget() the chunks over the budget
+spill to a temporary file and come back through getData(out).
+Per run: peak buffered memory vs the budget, chunks / bytes spilled, peak spill file size, read back latency per
+chunk, dropped chunks / xruns (the reading thread must not notice the spilling) and the order of the delivered chunks
+(consecutive ids, contiguous sample indices).
+Usage: benchmark_spill [device] [budget KiB] [stall seconds] [spill dir]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "../micread_thread.hpp"
+
+void run_budget(const char* device, size_t budget, double stall_s, const char* spill_dir)
+{
+    auto t_start = std::chrono::steady_clock::now();
+    MicReadAlsa mic(t_start, true, false, true, false, MICREAD_DEF_REC_FREQ, "", device);
+    if(budget > 0 && mic.setMemoryBudget(budget, spill_dir) < 0) return;
+    mic.start();
+
+    // stall, then drain (2 s)
+    const double end = stall_s + 2.;
+    std::vector<micDataStamped> chunks;
+    long delivered = 0, out_of_order = 0, gaps = 0;
+    long last_id = -1;
+    int64_t next_sample = -1;
+    long peak_bytes = 0, peak_file = 0;
+    double now_s = 0.;
+    while((now_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count()) < end)
+    {
+        peak_bytes = std::max(peak_bytes, mic.getBufferedBytes());
+        peak_file = std::max(peak_file, mic.getSpillFileBytes());
+        if(now_s < stall_s || mic.getData(chunks, 16) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        for(const micDataStamped& chunk : chunks) {
+            if(last_id >= 0 && chunk.id != last_id + 1) out_of_order++;
+            if(next_sample >= 0 && chunk.sample_index != next_sample) gaps++;
+            last_id = chunk.id;
+            next_sample = chunk.sample_index + (int64_t)chunk.frames.size(); //mono
+            delivered++;
+        }
+    }
+    mic.finish();
+    printf("budget %7zu KiB | read %5ld delivered %5ld dropped %3ld xruns %2ld | peak memory %8.1f KiB, spill file "
+           "%8.1f KiB | spilled %5ld chunks (%.1f KiB), read back %5ld, %6.1f us mean %7.1f us max | order %s\n",
+           budget / 1024, mic.getChunksRead(), delivered, mic.getChunksDropped(), mic.getXruns(), peak_bytes / 1024.,
+           peak_file / 1024., mic.getChunksSpilled(), mic.getBytesSpilled() / 1024., mic.getChunksReadBack(),
+           mic.getReadBackLatencyUs(), mic.getReadBackMaxUs(), out_of_order == 0 && gaps == 0 ? "ok" : "BROKEN");
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = argc > 1 ? argv[1] : MICREAD_DEF_DEVICE;
+    size_t budget = (argc > 2 ? atol(argv[2]) : 64) * 1024;
+    double stall_s = argc > 3 ? atof(argv[3]) : 4.;
+    const char* spill_dir = argc > 4 ? argv[4] : MICREAD_DEF_SPILL_DIR;
+
+    run_budget(device, 0, stall_s, spill_dir);
+    run_budget(device, budget, stall_s, spill_dir);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+Per chunk cost of the conversion (device format -> int16 chunk) and of the WAV recording loop:
+ - runtime loop   : the previous MicReadAlsa::run() / record_thread() loops (push_back per sample,
+                    bits_per_sample_ arithmetic, sample by sample WAV writing)
+ - runtime wrapper: MicReadAlsa now (vector chunk, convert_samples_runtime(), whole chunk WAV writing)
+ - MicRead<>      : fixed size aligned std::array chunk, convert_samples<Format, Samples>()
+No device is needed: the chunks are synthetic. The WAV data goes to /dev/null.
+Usage: benchmark_static_capture [chunks]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <random>
+
+#include "../micread_static.hpp"
+
+template <typename Word>
+std::ostream& write_word_swap_endian(std::ostream& outs, Word value, unsigned size = sizeof(Word))
+{
+    for (; size; --size, value >>= 8)
+        outs.put(static_cast<int8_t>(value & 0xFF));
+    return outs;
+}
+
+struct benchResult
+{
+    double convert_ns;
+    double record_ns;
+    long checksum;
+};
+
+static double elapsed_ns(std::chrono::steady_clock::time_point t0, long chunks)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / chunks;
+}
+
+benchResult bench_runtime_loop(const std::vector<uint8_t>& raw, snd_pcm_format_t format, int channels, int frames, long chunks, std::ostream& f)
+{
+    benchResult res = {0., 0., 0};
+    int bits_per_sample = snd_pcm_format_width(format);
+    int8_t* buffer = (int8_t*)raw.data();
+    micDataStamped chunk_stamped;
+    auto t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        chunk_stamped = micDataStamped();
+        int i_incr = bits_per_sample / 8;
+        int buffer_bytes = frames * channels * bits_per_sample / 8;
+        for (int i = 0; i < buffer_bytes; i += i_incr) {
+            auto val_ptr = (int16_t *) (buffer + i);
+            chunk_stamped.frames.push_back(*val_ptr);
+        }
+        res.checksum += chunk_stamped.frames[c % chunk_stamped.frames.size()];
+    }
+    res.convert_ns = elapsed_ns(t0, chunks);
+
+    t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        for(size_t i = 0; i < chunk_stamped.frames.size(); i++) {
+            write_word_swap_endian(f, chunk_stamped.frames[i], (int)bits_per_sample / 8);
+        }
+    }
+    res.record_ns = elapsed_ns(t0, chunks);
+    return res;
+}
+
+benchResult bench_runtime_wrapper(const std::vector<uint8_t>& raw, snd_pcm_format_t format, int channels, int frames, long chunks, std::ostream& f)
+{
+    benchResult res = {0., 0., 0};
+    micDataStamped chunk_stamped;
+    auto t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        chunk_stamped.frames.resize(frames * channels);
+        convert_samples_runtime(format, raw.data(), chunk_stamped.frames.data(), chunk_stamped.frames.size());
+        res.checksum += chunk_stamped.frames[c % chunk_stamped.frames.size()];
+    }
+    res.convert_ns = elapsed_ns(t0, chunks);
+
+    t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        f.write((const char*)chunk_stamped.frames.data(), chunk_stamped.frames.size() * sizeof(int16_t));
+    }
+    res.record_ns = elapsed_ns(t0, chunks);
+    return res;
+}
+
+template <snd_pcm_format_t Format, int Channels, int Frames>
+benchResult bench_static(const std::vector<uint8_t>& raw, long chunks, std::ostream& f)
+{
+    typedef typename MicRead<Format, Channels, Frames>::Chunk Chunk;
+    benchResult res = {0., 0., 0};
+    Chunk chunk;
+    auto t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        convert_samples<Format, Channels * Frames>(raw.data(), chunk.frames.data());
+        res.checksum += chunk.frames[c % chunk.frames.size()];
+    }
+    res.convert_ns = elapsed_ns(t0, chunks);
+
+    t0 = std::chrono::steady_clock::now();
+    for(long c = 0; c < chunks; c++) {
+        f.write((const char*)chunk.frames.data(), sizeof(chunk.frames));
+    }
+    res.record_ns = elapsed_ns(t0, chunks);
+    return res;
+}
+
+static void print(const char* name, const benchResult& r)
+{
+    printf("  %-16s convert %8.1f ns/chunk   record %9.1f ns/chunk   (checksum %ld)\n",
+           name, r.convert_ns, r.record_ns, r.checksum);
+}
+
+template <snd_pcm_format_t Format, int Channels, int Frames>
+void bench_config(const char* config, long chunks)
+{
+    std::vector<uint8_t> raw(Channels * Frames * MicReadFormat<Format>::bytes);
+    std::mt19937 gen(1);
+    for(size_t i = 0; i < raw.size(); i++) raw[i] = (uint8_t)gen();
+    std::ofstream f("/dev/null", std::ios::binary);
+
+    printf("%s, %d channels, %d frames per chunk, %ld chunks:\n", config, Channels, Frames, chunks);
+    print("runtime loop", bench_runtime_loop(raw, Format, Channels, Frames, chunks, f));
+    print("runtime wrapper", bench_runtime_wrapper(raw, Format, Channels, Frames, chunks, f));
+    print("MicRead<>", bench_static<Format, Channels, Frames>(raw, chunks, f));
+}
+
+int main(int argc, char** argv)
+{
+    long chunks = argc > 1 ? atol(argv[1]) : 100000;
+    bench_config<SND_PCM_FORMAT_S16_LE, 1, 512>("S16_LE", chunks);
+    bench_config<SND_PCM_FORMAT_S32_LE, 2, 512>("S32_LE", chunks);
+    return 0;
+}
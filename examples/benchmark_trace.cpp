@@ -0,0 +1,54 @@
+/*
+Cost of the trace spans (trace.hpp): ns per span with tracing disabled and enabled, in a tight loop of empty
+spans on 1 and 4 threads (every thread has its own ring, there is no shared state to contend on), and the time to
+dump the rings as Chrome trace JSON.
+Usage: benchmark_trace [spans per thread] [trace.json]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../trace.hpp"
+
+static double run_threads(int threads, long spans)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([spans, t]{
+            std::string name = "worker " + std::to_string(t);
+            Trace::nameThread(name.c_str());
+            for(long i = 0; i < spans; i++) {
+                TraceSpan span("span");
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char** argv)
+{
+    long spans = argc > 1 ? atol(argv[1]) : 10000000;
+    std::string path = argc > 2 ? argv[2] : "benchmark_trace.json";
+
+    int thread_counts[] = {1, 4};
+    for(int threads : thread_counts) {
+        Trace::disable();
+        double disabled = run_threads(threads, spans);
+        Trace::enable();
+        double enabled = run_threads(threads, spans);
+        // CPU time per span (the threads may share cores)
+        printf("%d thread(s): %6.2f ns per span disabled, %6.2f ns per span enabled\n", threads,
+               disabled * 1e9 / ((double)spans * threads), enabled * 1e9 / ((double)spans * threads));
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    if(Trace::write(path) < 0) return 1;
+    printf("dump of %ld spans (%d events per thread kept): %.1f ms\n", Trace::spans(), TRACE_DEF_EVENTS,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+Steady state check of the capture loop (instrumented builds only: cmake -DMICREAD_INSTRUMENT=ON):
+after a warm-up the reading thread must not allocate at all, for every chunk read, converted and queued, while a
+consumer drains the buffer with getData(out) every 10 ms. Reported: allocations of the reading thread (total and
+per chunk) and of the consumer, lock waits / try_lock failures of data_mtx_. With "record" the recording thread
+runs too as the only consumer (record only mode; reported, not checked).
+Without "record" the buffer is bounded (MICREAD_QUEUE_DROP_OLDEST): devices without a clock, like the ALSA "null" PCM used by
+ctest, deliver chunks as fast as they are read and the queue must not grow.
+Exit status: 0 no allocations, 1 the capture loop allocated (regression), 2 setup failure.
+Usage: check_steady_state_allocations [device] [seconds] [record]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../micread_thread.hpp"
+
+#ifndef MICREAD_INSTRUMENT
+#error "check_steady_state_allocations needs an instrumented build (MICREAD_INSTRUMENT)"
+#endif
+
+#define CHECK_MAX_CHUNKS 64 //bound of the buffer (well below MICREAD_FRAMES_POOL_SIZE)
+
+int main(int argc, char** argv)
+{
+    std::string device = argc > 1 ? argv[1] : MICREAD_DEF_DEVICE;
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    bool record = argc > 3 && std::string(argv[3]) == "record";
+    Instrument::nameThread("consumer");
+
+    MicReadAlsa mic(std::chrono::steady_clock::now(), true, record, true, false,
+                    MICREAD_DEF_REC_FREQ, MICREAD_DEF_REC_FILENAME, device);
+    if(!record) mic.setQueuePolicy(MICREAD_QUEUE_DROP_OLDEST, CHECK_MAX_CHUNKS);
+    mic.start();
+
+    // Warming up: the frame pool, the staging slots and the reused containers reach their steady state size
+    std::vector<micDataStamped> chunks;
+    for(int i = 0; i < 100; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if(!record) mic.getData(chunks);
+    }
+    const instrumentThreadStats* reader = mic.getThreadStats(MicReadAlsa::THREAD_READ);
+    const instrumentThreadStats* recorder = mic.getThreadStats(MicReadAlsa::THREAD_RECORD);
+    if(reader == nullptr || mic.getChunksRead() == 0) {
+        fprintf(stderr, "check_steady_state_allocations: ERROR: No chunks read from %s\n", device.c_str());
+        mic.finish();
+        return 2;
+    }
+
+    long chunks_start = mic.getChunksRead();
+    long reader_start = reader->allocations;
+    long reader_bytes_start = reader->allocated_bytes;
+    long recorder_start = recorder != nullptr ? (long)recorder->allocations : 0;
+    long consumer_start = Instrument::thread()->allocations;
+    long waits_start = mic.getDataMutex().waits();
+    long failures_start = mic.getDataMutex().tryLockFailures();
+    auto t_start = std::chrono::steady_clock::now();
+    auto t_end = t_start + std::chrono::microseconds((long)(seconds * 1e6));
+    while(std::chrono::steady_clock::now() < t_end)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if(!record) mic.getData(chunks);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    long chunks_read = mic.getChunksRead() - chunks_start;
+    long reader_allocs = reader->allocations - reader_start;
+    long reader_bytes = reader->allocated_bytes - reader_bytes_start;
+    long consumer_allocs = Instrument::thread()->allocations - consumer_start;
+
+    printf("%.1f s, %ld chunks read\n", elapsed, chunks_read);
+    printf("reading thread : %ld allocations (%.3f per chunk), %ld bytes\n", reader_allocs,
+           chunks_read > 0 ? (double)reader_allocs / chunks_read : 0., reader_bytes);
+    printf("consumer       : %ld allocations\n", consumer_allocs);
+    if(recorder != nullptr) printf("recording thread: %ld allocations\n", recorder->allocations - recorder_start);
+    printf("data_mtx_      : %ld lock waits, %ld try_lock failures\n", mic.getDataMutex().waits() - waits_start,
+           mic.getDataMutex().tryLockFailures() - failures_start);
+    mic.finish();
+
+    if(chunks_read == 0) {
+        fprintf(stderr, "check_steady_state_allocations: ERROR: The reading thread stalled\n");
+        return 2;
+    }
+    if(record) return 0; //the recorder drains in batches of its own pace: frame buffers may still be taken
+    if(reader_allocs != 0) {
+        printf("FAILED: the capture loop allocates in the steady state\n");
+        return 1;
+    }
+    printf("OK: no allocations in the capture loop\n");
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+Scalability stress test of the reader / recorder pipeline with many concurrent high rate devices.
+Every simulated device is a sine generator thread (as in example_sine.cpp, one frequency per channel) playing
+into a playback substream of the ALSA loopback driver, while a real MicReadAlsa captures the matching capture
+substream and records it (WAV, optionally CSV, optionally through one shared IoWriter):
+    sudo modprobe snd-aloop pcm_substreams=8
+For every configuration (rate x channels x chunk frames) the number of devices is doubled until a level fails:
+ - chunks dropped, xruns or read errors
+ - less than 99% of the expected chunks read
+ - recorder lag (chunks read but not recorded yet, as time) above the latency budget
+and the largest passing device count is reported as the sustainable configuration of this machine.
+Usage: stress_harness [options]
+  -s <seconds>    run time per level (default 5)
+  -n <devices>    max devices (default 8)
+  -b <ms>         recorder lag budget (default 500)
+  -c <pattern>    capture device pattern (default hw:Loopback,1,%d)
+  -p <pattern>    playback device pattern (default hw:Loopback,0,%d), "" when the capture devices have own sources
+  -o <dir>        recording directory (default /tmp)
+  -w              share one IoWriter between the recorders
+  -x              record csv files too
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../micread_thread.hpp"
+
+struct stressConfig
+{
+    unsigned int rate;
+    int channels;
+    int frames;
+};
+
+struct stressOptions
+{
+    stressOptions(): seconds(5.), max_devices(8), budget_ms(500.), capture("hw:Loopback,1,%d"),
+                     playback("hw:Loopback,0,%d"), dir("/tmp"), shared_writer(false), csv(false) {}
+    double seconds;
+    int max_devices;
+    double budget_ms;
+    std::string capture;
+    std::string playback;
+    std::string dir;
+    bool shared_writer;
+    bool csv;
+};
+
+struct levelResult
+{
+    levelResult(): devices(0), chunks_read(0), chunks_expected(0), dropped(0), xruns(0), read_errors(0), max_lag_ms(0.), cpu(0.) {}
+    int devices;
+    long chunks_read;
+    long chunks_expected;
+    long dropped;
+    long xruns;
+    long read_errors;
+    double max_lag_ms;
+    double cpu; //process CPU time / wall time (1.0: one core busy)
+    bool passed(const stressOptions& opt) const {
+        // The readers start / stop one after the other: a couple of chunks per device are not a rate problem
+        return dropped == 0 && xruns == 0 && read_errors == 0 &&
+               chunks_read + 2 * devices >= 0.99 * chunks_expected && max_lag_ms <= opt.budget_ms;
+    }
+};
+
+static std::string deviceName(const std::string& pattern, int index)
+{
+    char name[256];
+    snprintf(name, sizeof(name), pattern.c_str(), index);
+    return name;
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// Synthetic source: plays a sine (one frequency per channel) into a loopback playback substream
+static void sineSource(std::string device, stressConfig config, int index, const std::atomic<bool>* run_fl)
+{
+    snd_pcm_t* handle;
+    int err;
+    if((err = snd_pcm_open(&handle, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+        fprintf(stderr, "stress_harness: ERROR: cannot open playback device %s (%s)\n", device.c_str(), snd_strerror(err));
+        return;
+    }
+    if((err = snd_pcm_set_params(handle, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+                                 config.channels, config.rate, 1, 100000)) < 0) {
+        fprintf(stderr, "stress_harness: ERROR: cannot configure playback device %s (%s)\n", device.c_str(), snd_strerror(err));
+        snd_pcm_close(handle);
+        return;
+    }
+    const double two_pi = 6.283185307179586476925286766559;
+    std::vector<int16_t> buffer((size_t)config.frames * config.channels);
+    int64_t n = 0;
+    while(*run_fl) {
+        for(int i = 0; i < config.frames; i++, n++) {
+            for(int ch = 0; ch < config.channels; ch++) {
+                double frequency = 220. * (1 + index) + 110. * ch;
+                buffer[(size_t)i * config.channels + ch] = (int16_t)(8000. * sin(two_pi * frequency * n / config.rate));
+            }
+        }
+        snd_pcm_sframes_t written = snd_pcm_writei(handle, buffer.data(), config.frames);
+        if(written < 0) {
+            snd_pcm_recover(handle, (int)written, 1);
+        }
+    }
+    snd_pcm_drop(handle);
+    snd_pcm_close(handle);
+}
+
+static levelResult runLevel(const stressOptions& opt, const stressConfig& config, int devices)
+{
+    std::atomic<bool> run_fl(true);
+    std::vector<std::thread> sources;
+    if(!opt.playback.empty()) {
+        for(int i = 0; i < devices; i++) {
+            sources.emplace_back(sineSource, deviceName(opt.playback, i), config, i, &run_fl);
+        }
+    }
+
+    std::unique_ptr<IoWriter> writer;
+    if(opt.shared_writer) writer.reset(new IoWriter());
+    std::vector<std::unique_ptr<MicReadAlsa> > readers;
+    auto t_start = std::chrono::steady_clock::now();
+    for(int i = 0; i < devices; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "Stress%d", i);
+        readers.emplace_back(new MicReadAlsa(t_start, true, true, true, opt.csv, MICREAD_DEF_REC_FREQ,
+                                             opt.dir + "/stress_" + std::to_string(i), deviceName(opt.capture, i),
+                                             config.frames, config.rate, config.channels, SND_PCM_FORMAT_S16_LE,
+                                             name, MICREAD_PROFILE_DEFAULT, writer.get()));
+    }
+
+    double cpu_start = cpuSeconds();
+    auto t0 = std::chrono::steady_clock::now();
+    for(auto& reader : readers) reader->start();
+
+    // Recorder lag: chunks read but not recorded yet, sampled every 10 ms
+    levelResult result;
+    result.devices = devices;
+    double chunk_ms = 1000. * config.frames / config.rate;
+    auto t_end = t0 + std::chrono::microseconds((long)(opt.seconds * 1e6));
+    while(std::chrono::steady_clock::now() < t_end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        for(auto& reader : readers) {
+            double lag_ms = (reader->getChunksRead() - reader->getChunksRecorded()) * chunk_ms;
+            if(lag_ms > result.max_lag_ms) result.max_lag_ms = lag_ms;
+        }
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    for(auto& reader : readers) reader->pause();
+    result.cpu = (cpuSeconds() - cpu_start) / wall;
+
+    for(auto& reader : readers) {
+        result.chunks_read += reader->getChunksRead();
+        result.dropped += reader->getChunksDropped();
+        result.xruns += reader->getXruns();
+        result.read_errors += reader->getReadErrors();
+    }
+    result.chunks_expected = (long)(devices * wall * config.rate / config.frames);
+
+    run_fl = false;
+    readers.clear();
+    if(writer) writer->finish();
+    for(auto& source : sources) source.join();
+    for(int i = 0; i < devices; i++) {
+        std::string base = opt.dir + "/stress_" + std::to_string(i);
+        unlink((base + ".wav").c_str());
+        unlink((base + ".csv").c_str());
+        unlink((base + ".idx").c_str()); //written by default (RECINDEX_DEF_INTERVAL)
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    stressOptions opt;
+    int c;
+    while((c = getopt(argc, argv, "s:n:b:c:p:o:wx")) != -1) {
+        switch(c) {
+            case 's': opt.seconds = atof(optarg); break;
+            case 'n': opt.max_devices = atoi(optarg); break;
+            case 'b': opt.budget_ms = atof(optarg); break;
+            case 'c': opt.capture = optarg; break;
+            case 'p': opt.playback = optarg; break;
+            case 'o': opt.dir = optarg; break;
+            case 'w': opt.shared_writer = true; break;
+            case 'x': opt.csv = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seconds] [-n max_devices] [-b budget_ms] [-c capture_pattern] "
+                                "[-p playback_pattern] [-o dir] [-w] [-x]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    const stressConfig configs[] = {
+        {44100, 1, 512},
+        {48000, 2, 256},
+        {96000, 4, 256},
+        {192000, 8, 512},
+        {192000, 8, 128},
+    };
+    std::vector<std::string> summary;
+    for(const stressConfig& config : configs) {
+        int sustainable = 0;
+        for(int devices = 1; devices <= opt.max_devices; devices *= 2) {
+            levelResult r = runLevel(opt, config, devices);
+            bool passed = r.passed(opt);
+            fprintf(stdout, "STRESS %6u Hz x %d ch x %3d frames, %2d devices: read %ld/%ld dropped %ld xruns %ld "
+                            "errors %ld max lag %.1f ms cpu %.0f%% -> %s\n",
+                    config.rate, config.channels, config.frames, devices, r.chunks_read, r.chunks_expected,
+                    r.dropped, r.xruns, r.read_errors, r.max_lag_ms, 100. * r.cpu, passed ? "ok" : "FAIL");
+            fflush(stdout);
+            if(!passed) break;
+            sustainable = devices;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "%6u Hz x %d ch x %3d frames: %d devices (%.1f MB/s recorded)",
+                 config.rate, config.channels, config.frames, sustainable,
+                 sustainable * config.rate * config.channels * 2. / 1e6);
+        summary.push_back(line);
+    }
+
+    fprintf(stdout, "\nMax sustainable configuration (%s, %.0f ms lag budget):\n",
+            opt.shared_writer ? "shared IoWriter" : "own file streams", opt.budget_ms);
+    for(const std::string& line : summary) fprintf(stdout, "  %s\n", line.c_str());
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+"""
+Exports the weights of a checkpoint saved by train_simple_puddle_classifier_on_mydata.py
+into the flat binary format read by lstm_classifier.cpp:
+ "PDLLSTM1", uint32 layers, input, hidden, classes, steps,
+ per layer: kernel [(input+hidden) x 4*hidden], bias [4*hidden] (float32, TF gate order i, j, f, o)
+ dense weight [hidden x classes], dense bias [classes]
+"""
+from __future__ import print_function
+import argparse
+import struct
+import numpy as np
+import tensorflow as tf
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Export LSTM classifier weights for the native (C++) inference",
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument("checkpoint", help="Checkpoint prefix (the .meta file name without the extension)")
+    parser.add_argument("-o", "--output", default=None, help="Output file (default: <checkpoint>.lstm)")
+    parser.add_argument("--steps", type=int, default=41, help="Time steps per window")
+    args = parser.parse_args()
+    output = args.output if args.output is not None else args.checkpoint + ".lstm"
+
+    reader = tf.train.NewCheckpointReader(args.checkpoint)
+    names = reader.get_variable_to_shape_map().keys()
+
+    kernels = []
+    biases = []
+    layer = 0
+    while True:
+        prefix = [n for n in names if n.endswith('cell_%d/lstm_cell/kernel' % layer) and 'Adam' not in n]
+        if not prefix:
+            break
+        kernel_name = prefix[0]
+        kernels.append(reader.get_tensor(kernel_name).astype(np.float32))
+        biases.append(reader.get_tensor(kernel_name[:-len('kernel')] + 'bias').astype(np.float32))
+        layer += 1
+    if not kernels:
+        raise ValueError('No LSTM layers found in %s' % args.checkpoint)
+
+    # Dense layer: the training script creates it with unnamed tf.Variable's
+    dense_w = reader.get_tensor('Variable').astype(np.float32)
+    dense_b = reader.get_tensor('Variable_1').astype(np.float32)
+
+    hidden = biases[0].shape[0] // 4
+    n_input = kernels[0].shape[0] - hidden
+    n_classes = dense_b.shape[0]
+    print('Layers: %d input: %d hidden: %d classes: %d' % (len(kernels), n_input, hidden, n_classes))
+
+    with open(output, 'wb') as out_file:
+        out_file.write(b'PDLLSTM1')
+        out_file.write(struct.pack('<IIIII', len(kernels), n_input, hidden, n_classes, args.steps))
+        for kernel, bias in zip(kernels, biases):
+            out_file.write(np.ascontiguousarray(kernel, dtype='<f4').tobytes())
+            out_file.write(np.ascontiguousarray(bias, dtype='<f4').tobytes())
+        out_file.write(np.ascontiguousarray(dense_w, dtype='<f4').tobytes())
+        out_file.write(np.ascontiguousarray(dense_b, dtype='<f4').tobytes())
+    print('Saved %s' % output)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,251 @@
+#include "feature_cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------
+// SHA-256
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256():
+    block_bytes_(0),
+    total_bytes_(0)
+{
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state_, init, sizeof(state_));
+}
+
+void Sha256::transform(const uint8_t* block)
+{
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+               (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+    }
+    for(int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for(int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+void Sha256::update(const void* data, size_t bytes)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    total_bytes_ += bytes;
+    if(block_bytes_ > 0) {
+        size_t take = std::min(bytes, 64 - block_bytes_);
+        memcpy(block_ + block_bytes_, p, take);
+        block_bytes_ += take;
+        p += take;
+        bytes -= take;
+        if(block_bytes_ < 64) return;
+        transform(block_);
+        block_bytes_ = 0;
+    }
+    for(; bytes >= 64; p += 64, bytes -= 64) transform(p);
+    memcpy(block_, p, bytes);
+    block_bytes_ = bytes;
+}
+
+std::string Sha256::hexdigest()
+{
+    uint64_t bits = total_bytes_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_bytes = (block_bytes_ < 56 ? 56 : 120) - block_bytes_;
+    update(pad, pad_bytes);
+    uint8_t length[8];
+    for(int i = 0; i < 8; i++) length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    update(length, 8);
+    uint8_t digest[32];
+    for(int i = 0; i < 8; i++) {
+        for(int k = 0; k < 4; k++) digest[4 * i + k] = (uint8_t)(state_[i] >> (24 - 8 * k));
+    }
+    static const char* digits = "0123456789abcdef";
+    std::string out;
+    for(int i = 0; i < 32; i++) {
+        out.push_back(digits[digest[i] >> 4]);
+        out.push_back(digits[digest[i] & 15]);
+    }
+    return out;
+}
+
+std::string Sha256::hex(const void* data, size_t bytes)
+{
+    Sha256 sha;
+    sha.update(data, bytes);
+    return sha.hexdigest();
+}
+
+//-----------------------------------------------------------------
+// CACHE
+
+FeatureCache::FeatureCache(std::string dir):
+    dir_(dir),
+    name_("FeatureCache"),
+    hits_(0),
+    misses_(0),
+    files_hashed_(0)
+{
+    while(dir_.size() > 1 && dir_.back() == '/') dir_.pop_back();
+}
+
+int FeatureCache::open()
+{
+    if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: ERROR: cannot create %s (%s)\n", name_.c_str(), dir_.c_str(), strerror(errno));
+        return -1;
+    }
+    std::lock_guard<std::mutex> lck(mtx_);
+    contents_.clear();
+    FILE* file = fopen((dir_ + "/" + FEATCACHE_CONTENTS_NAME).c_str(), "r");
+    if(file == nullptr) return 0;
+    // hash size mtime_ns inode path (later lines win)
+    char hash[65];
+    unsigned long long size, inode;
+    long long mtime_ns;
+    char path[4096];
+    while(fscanf(file, "%64s %llu %lld %llu %4095[^\n]\n", hash, &size, &mtime_ns, &inode, path) == 5) {
+        contentStamp stamp;
+        stamp.size = size;
+        stamp.mtime_ns = mtime_ns;
+        stamp.inode = inode;
+        stamp.hash = hash;
+        contents_[path] = stamp;
+    }
+    fclose(file);
+    return 0;
+}
+
+std::string FeatureCache::contentHash(const std::string& path)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) < 0) {
+        fprintf(stderr, "%s: ERROR: cannot stat %s (%s)\n", name_.c_str(), path.c_str(), strerror(errno));
+        return "";
+    }
+    char resolved[PATH_MAX];
+    std::string abs_path = realpath(path.c_str(), resolved) != nullptr ? resolved : path;
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto it = contents_.find(abs_path);
+        if(it != contents_.end() && it->second.size == (uint64_t)st.st_size &&
+           it->second.mtime_ns == mtime_ns && it->second.inode == (uint64_t)st.st_ino) {
+            return it->second.hash;
+        }
+    }
+
+    // Hashing outside of the lock: drives are hashed in parallel
+    FILE* file = fopen(path.c_str(), "rb");
+    if(file == nullptr) {
+        fprintf(stderr, "%s: ERROR: cannot open %s (%s)\n", name_.c_str(), path.c_str(), strerror(errno));
+        return "";
+    }
+    Sha256 sha;
+    std::vector<char> buffer(1 << 20);
+    size_t got;
+    while((got = fread(buffer.data(), 1, buffer.size(), file)) > 0) sha.update(buffer.data(), got);
+    fclose(file);
+    files_hashed_++;
+
+    contentStamp stamp;
+    stamp.size = st.st_size;
+    stamp.mtime_ns = mtime_ns;
+    stamp.inode = st.st_ino;
+    stamp.hash = sha.hexdigest();
+    std::lock_guard<std::mutex> lck(mtx_);
+    contents_[abs_path] = stamp;
+    FILE* memo = fopen((dir_ + "/" + FEATCACHE_CONTENTS_NAME).c_str(), "a");
+    if(memo != nullptr) {
+        fprintf(memo, "%s %llu %lld %llu %s\n", stamp.hash.c_str(), (unsigned long long)stamp.size,
+                (long long)stamp.mtime_ns, (unsigned long long)stamp.inode, abs_path.c_str());
+        fclose(memo);
+    }
+    return stamp.hash;
+}
+
+std::string FeatureCache::key(const std::vector<std::string>& files, const std::string& params)
+{
+    Sha256 sha;
+    for(const std::string& file : files) {
+        std::string hash = contentHash(file);
+        if(hash.empty()) return "";
+        sha.update(hash.data(), hash.size());
+    }
+    sha.update(params.data(), params.size());
+    return sha.hexdigest().substr(0, FEATCACHE_KEY_CHARS);
+}
+
+bool FeatureCache::contains(const std::string& key)
+{
+    std::string base = entry(key);
+    bool found = access((base + ".feat").c_str(), R_OK) == 0 && access((base + ".lbl").c_str(), R_OK) == 0;
+    if(found) hits_++; else misses_++;
+    return found;
+}
+
+std::string FeatureCache::pending(const std::string& key) const
+{
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".part%d_%zu", (int)getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return entry(key) + suffix;
+}
+
+int FeatureCache::commit(const std::string& key, const std::string& pending_base)
+{
+    // The labels go last: contains() needs both files
+    std::string base = entry(key);
+    if(rename((pending_base + ".feat").c_str(), (base + ".feat").c_str()) < 0 ||
+       rename((pending_base + ".lbl").c_str(), (base + ".lbl").c_str()) < 0) {
+        fprintf(stderr, "%s: ERROR: cannot publish %s (%s)\n", name_.c_str(), base.c_str(), strerror(errno));
+        discard(pending_base);
+        return -1;
+    }
+    return 0;
+}
+
+void FeatureCache::discard(const std::string& pending_base)
+{
+    unlink((pending_base + ".feat").c_str());
+    unlink((pending_base + ".lbl").c_str());
+}
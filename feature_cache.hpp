@@ -0,0 +1,103 @@
+/*
+Content addressed on-disk feature cache.
+An entry is a feature store (see feature_store.hpp) named by the key
+    sha256(sha256(file 1) + ... + sha256(file n) + params)[0:32]
+where the files are the inputs of the extraction (e.g. mic_rec.csv + timelabels.txt of a drive) and params is the
+canonical string of the extraction parameters (MFCC settings, window / shift, labels, dtype). Any change of a
+recording or a parameter gives a new key, i.e. stale features are never reused, and unchanged recordings
+are never extracted again. Entries are built under a temporary name and published with rename(), thus readers
+(other threads / processes) only ever see complete entries.
+Content hashes of the input files are memoized in <dir>/contents.txt by path, size, mtime and inode: a repeated run
+over unchanged recordings does not read them at all.
+The same scheme is implemented in python by feature_cache.py (the keys are identical).
+
+A minimal example:
+    FeatureCache cache("_data/feature_cache");
+    cache.open();
+    std::string key = cache.key({drive + "/mic_rec.csv", drive + "/timelabels.txt"}, params);
+    if(!cache.contains(key)) {
+        std::string pending = cache.pending(key);
+        //... FeatureStore::create(pending) and fill it ...
+        cache.commit(key, pending);
+    }
+    FeatureStore store;
+    store.open(cache.entry(key));
+ */
+
+#ifndef MIC_READ_THREAD_FEATURE_CACHE_HPP
+#define MIC_READ_THREAD_FEATURE_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <inttypes.h>
+
+#define FEATCACHE_CONTENTS_NAME "contents.txt"
+#define FEATCACHE_KEY_CHARS 32
+
+// SHA-256 (FIPS 180-4), incremental
+class Sha256
+{
+public:
+    Sha256();
+    void update(const void* data, size_t bytes);
+    std::string hexdigest(); //finishes the hash
+    static std::string hex(const void* data, size_t bytes);
+
+protected:
+    uint32_t state_[8];
+    uint8_t block_[64];
+    size_t block_bytes_;
+    uint64_t total_bytes_;
+
+    void transform(const uint8_t* block);
+};
+
+class FeatureCache
+{
+public:
+    explicit FeatureCache(std::string dir);
+
+    // Creates the cache directory and loads the content hash memo. Negative on error
+    int open();
+    const std::string& dir() const {return dir_;}
+
+    // Hex sha256 of the file contents (memoized by size / mtime / inode). Empty string on error. Thread safe
+    std::string contentHash(const std::string& path);
+    // Entry key of the extraction of files with params. Empty string if a file cannot be read
+    std::string key(const std::vector<std::string>& files, const std::string& params);
+
+    bool contains(const std::string& key); //complete entry exists (counts hits / misses)
+    std::string entry(const std::string& key) const {return dir_ + "/" + key;} //feature store base name
+    // Temporary base name to build an entry under (unique per thread and process)
+    std::string pending(const std::string& key) const;
+    // Publishes a built entry (rename of the .feat / .lbl files). Negative on error
+    int commit(const std::string& key, const std::string& pending_base);
+    // Drops a failed build
+    void discard(const std::string& pending_base);
+
+    long getHits() const {return hits_;}
+    long getMisses() const {return misses_;}
+    long getFilesHashed() const {return files_hashed_;} //content hashes not found in the memo
+
+protected:
+    struct contentStamp
+    {
+        uint64_t size;
+        int64_t mtime_ns;
+        uint64_t inode;
+        std::string hash;
+    };
+
+    std::string dir_;
+    std::string name_;
+    std::map<std::string, contentStamp> contents_; //by path
+    std::mutex mtx_;
+    std::atomic<long> hits_;
+    std::atomic<long> misses_;
+    std::atomic<long> files_hashed_;
+};
+
+#endif //MIC_READ_THREAD_FEATURE_CACHE_HPP
@@ -0,0 +1,128 @@
+#!/usr/bin/env python
+"""
+Content addressed on-disk feature cache (python side of feature_cache.hpp).
+An entry is a feature store (see feature_store.py) named by
+    sha256(sha256(file 1) + ... + sha256(file n) + params)[0:32]
+with the input files of the extraction (e.g. mic_rec.csv + timelabels.txt) and the canonical string of the extraction
+parameters. A change of a recording or a parameter gives a new key, so stale features are never reused.
+Content hashes are memoized in <dir>/contents.txt (hash size mtime_ns inode path), shared with the C++ cache:
+the same files and params give the same keys in both.
+
+    cache = FeatureCache('_data/feature_cache')
+    params = feature_params(bands=20, frames=41, shift=8)
+    store = cache.get([indir + '/mic_rec.csv', indir + '/timelabels.txt'], params, extract)
+"""
+from __future__ import print_function
+import os
+import hashlib
+import threading
+
+from feature_store import FeatureStore
+
+CONTENTS_NAME = 'contents.txt'
+KEY_CHARS = 32
+
+
+def feature_params(**params):
+    """
+    Canonical parameter string (sorted key=value pairs)
+    """
+    return ' '.join('%s=%s' % (k, params[k]) for k in sorted(params))
+
+
+class FeatureCache(object):
+    def __init__(self, cache_dir):
+        self.dir = cache_dir.rstrip('/') or '/'
+        self.hits = 0
+        self.misses = 0
+        self.files_hashed = 0
+        self._lock = threading.Lock()
+        if not os.path.isdir(self.dir):
+            os.makedirs(self.dir)
+        self._contents = {}
+        contents_name = os.path.join(self.dir, CONTENTS_NAME)
+        if os.path.exists(contents_name):
+            with open(contents_name) as contents_file:
+                for line in contents_file:
+                    fields = line.rstrip('\n').split(' ', 4)
+                    if len(fields) == 5:
+                        self._contents[fields[4]] = (fields[0], int(fields[1]), int(fields[2]), int(fields[3]))
+
+    def content_hash(self, path):
+        """
+        Hex sha256 of the file contents, memoized by size / mtime / inode
+        """
+        st = os.stat(path)
+        abs_path = os.path.realpath(path)
+        with self._lock:
+            memo = self._contents.get(abs_path)
+        if memo is not None and memo[1:] == (st.st_size, st.st_mtime_ns, st.st_ino):
+            return memo[0]
+        sha = hashlib.sha256()
+        with open(path, 'rb') as in_file:
+            for block in iter(lambda: in_file.read(1 << 20), b''):
+                sha.update(block)
+        digest = sha.hexdigest()
+        with self._lock:
+            self.files_hashed += 1
+            self._contents[abs_path] = (digest, st.st_size, st.st_mtime_ns, st.st_ino)
+            with open(os.path.join(self.dir, CONTENTS_NAME), 'a') as contents_file:
+                contents_file.write('%s %d %d %d %s\n' % (digest, st.st_size, st.st_mtime_ns, st.st_ino, abs_path))
+        return digest
+
+    def key(self, files, params):
+        sha = hashlib.sha256()
+        for filename in files:
+            sha.update(self.content_hash(filename).encode('ascii'))
+        sha.update(params.encode('utf-8'))
+        return sha.hexdigest()[:KEY_CHARS]
+
+    def entry(self, key):
+        """
+        Feature store base name of the entry
+        """
+        return os.path.join(self.dir, key)
+
+    def contains(self, key):
+        base = self.entry(key)
+        found = os.path.exists(base + '.feat') and os.path.exists(base + '.lbl')
+        with self._lock:
+            if found:
+                self.hits += 1
+            else:
+                self.misses += 1
+        return found
+
+    def pending(self, key):
+        """
+        Temporary base name to build an entry under (unique per thread and process)
+        """
+        return '%s.part%d_%d' % (self.entry(key), os.getpid(), threading.current_thread().ident)
+
+    def commit(self, key, pending_base):
+        # The labels go last: contains() needs both files
+        base = self.entry(key)
+        os.rename(pending_base + '.feat', base + '.feat')
+        os.rename(pending_base + '.lbl', base + '.lbl')
+
+    def discard(self, pending_base):
+        for ext in ('.feat', '.lbl'):
+            if os.path.exists(pending_base + ext):
+                os.remove(pending_base + ext)
+
+    def get(self, files, params, extract, dtype='float32', frames=41, bands=20):
+        """
+        Entry of files / params, extract(store) fills a new store (FeatureStore.append()) on a miss
+        :return: FeatureStore
+        """
+        key = self.key(files, params)
+        if not self.contains(key):
+            pending = self.pending(key)
+            self.discard(pending)
+            try:
+                extract(FeatureStore.create(pending, dtype=dtype, frames=frames, bands=bands))
+                self.commit(key, pending)
+            except BaseException:
+                self.discard(pending)
+                raise
+        return FeatureStore(self.entry(key))
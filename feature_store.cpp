@@ -0,0 +1,394 @@
+#include "feature_store.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------
+// HALF PRECISION
+
+uint16_t float_to_half(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((f >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = f & 0x7FFFFF;
+
+    if(((f >> 23) & 0xFF) == 0xFF) { //inf / nan
+        return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    }
+    if(exponent >= 0x1F) { //overflow -> inf
+        return (uint16_t)(sign | 0x7C00);
+    }
+    if(exponent <= 0) { //subnormal or zero
+        if(exponent < -10) return (uint16_t)sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half_mant = mantissa >> shift;
+        //round to nearest even
+        uint32_t rem = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (half_mant & 1))) half_mant++;
+        return (uint16_t)(sign | half_mant);
+    }
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    //round to nearest even (may carry into the exponent which is correct)
+    uint32_t rem = mantissa & 0x1FFF;
+    if(rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+    return (uint16_t)half;
+}
+
+float half_to_float(uint16_t value)
+{
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+    uint32_t f;
+
+    if(exponent == 0) {
+        if(mantissa == 0) {
+            f = sign;
+        } else { //subnormal: normalizing
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3FF;
+            f = sign | (exponent << 23) | (mantissa << 13);
+        }
+    } else if(exponent == 0x1F) {
+        f = sign | 0x7F800000 | (mantissa << 13);
+    } else {
+        f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float out;
+    memcpy(&out, &f, sizeof(out));
+    return out;
+}
+
+//-----------------------------------------------------------------
+// STORE
+
+FeatureStore::FeatureStore():
+    name_("FeatureStore"),
+    writable_(false),
+    feat_fd_(-1),
+    lbl_fd_(-1),
+    feat_map_(nullptr),
+    labels_(nullptr),
+    feat_map_size_(0),
+    lbl_map_size_(0),
+    records_num_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+FeatureStore::~FeatureStore()
+{
+    close();
+}
+
+size_t FeatureStore::recordBytes() const
+{
+    size_t value_bytes = (header_.dtype == FEATSTORE_FLOAT16) ? sizeof(uint16_t) : sizeof(float);
+    return recordSize() * value_bytes;
+}
+
+int FeatureStore::create(const std::string& filename_base,
+                         FeatureStoreDType dtype,
+                         int frames,
+                         int bands)
+{
+    close();
+    filename_base_ = filename_base;
+
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, FEATSTORE_FEAT_MAGIC, sizeof(header_.magic));
+    header_.version = FEATSTORE_VERSION;
+    header_.dtype = dtype;
+    header_.frames = frames;
+    header_.bands = bands;
+
+    featureStoreHeader lbl_header;
+    memset(&lbl_header, 0, sizeof(lbl_header));
+    memcpy(lbl_header.magic, FEATSTORE_LBL_MAGIC, sizeof(lbl_header.magic));
+    lbl_header.version = FEATSTORE_VERSION;
+
+    std::string feat_name = filename_base_ + ".feat";
+    std::string lbl_name = filename_base_ + ".lbl";
+    int feat_fd = ::open(feat_name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(feat_fd < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot create %s (%s)\n",
+                name_.c_str(),
+                feat_name.c_str(),
+                strerror(errno));
+        return -1;
+    }
+    int lbl_fd = ::open(lbl_name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(lbl_fd < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot create %s (%s)\n",
+                name_.c_str(),
+                lbl_name.c_str(),
+                strerror(errno));
+        ::close(feat_fd);
+        return -1;
+    }
+    bool ok = ::write(feat_fd, &header_, sizeof(header_)) == sizeof(header_) &&
+              ::write(lbl_fd, &lbl_header, sizeof(lbl_header)) == sizeof(lbl_header);
+    ::close(feat_fd);
+    ::close(lbl_fd);
+    if(!ok) {
+        fprintf(stderr, "%s: ERROR: Failed to write headers of %s\n",
+                name_.c_str(),
+                filename_base_.c_str());
+        return -2;
+    }
+    return open(filename_base_, true);
+}
+
+int FeatureStore::open(const std::string& filename_base, bool writable)
+{
+    close();
+    filename_base_ = filename_base;
+    writable_ = writable;
+
+    std::string feat_name = filename_base_ + ".feat";
+    std::string lbl_name = filename_base_ + ".lbl";
+    int flags = writable_ ? (O_RDWR | O_APPEND) : O_RDONLY;
+
+    if((feat_fd_ = ::open(feat_name.c_str(), flags)) < 0 ||
+       (lbl_fd_ = ::open(lbl_name.c_str(), flags)) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot open store %s (%s)\n",
+                name_.c_str(),
+                filename_base_.c_str(),
+                strerror(errno));
+        close();
+        return -1;
+    }
+
+    featureStoreHeader lbl_header;
+    if(pread(feat_fd_, &header_, sizeof(header_), 0) != sizeof(header_) ||
+       pread(lbl_fd_, &lbl_header, sizeof(lbl_header), 0) != sizeof(lbl_header) ||
+       memcmp(header_.magic, FEATSTORE_FEAT_MAGIC, sizeof(header_.magic)) != 0 ||
+       memcmp(lbl_header.magic, FEATSTORE_LBL_MAGIC, sizeof(lbl_header.magic)) != 0) {
+        fprintf(stderr, "%s: ERROR: %s is not a feature store\n",
+                name_.c_str(),
+                filename_base_.c_str());
+        close();
+        return -2;
+    }
+    if(header_.version != FEATSTORE_VERSION ||
+       (header_.dtype != FEATSTORE_FLOAT16 && header_.dtype != FEATSTORE_FLOAT32)) {
+        fprintf(stderr, "%s: ERROR: Unsupported store version %u / dtype %u\n",
+                name_.c_str(),
+                header_.version,
+                header_.dtype);
+        close();
+        return -3;
+    }
+    int err = map();
+    // Dropping a partially written tail so that appended records stay aligned in both files
+    if(err == 0 && writable_ && trim() < 0) {
+        fprintf(stderr, "%s: WARNING: Failed to trim store %s (%s)\n",
+                name_.c_str(),
+                filename_base_.c_str(),
+                strerror(errno));
+    }
+    return err;
+}
+
+int FeatureStore::trim()
+{
+    off_t feat_end = FEATSTORE_HEADER_SIZE + records_num_ * recordBytes();
+    off_t lbl_end = FEATSTORE_HEADER_SIZE + records_num_ * sizeof(featureLabelStamped);
+    if(ftruncate(feat_fd_, feat_end) < 0 || ftruncate(lbl_fd_, lbl_end) < 0 ||
+       lseek(feat_fd_, feat_end, SEEK_SET) < 0 || lseek(lbl_fd_, lbl_end, SEEK_SET) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void FeatureStore::close()
+{
+    unmap();
+    if(feat_fd_ >= 0) ::close(feat_fd_);
+    if(lbl_fd_ >= 0) ::close(lbl_fd_);
+    feat_fd_ = -1;
+    lbl_fd_ = -1;
+    records_num_ = 0;
+}
+
+int FeatureStore::refresh()
+{
+    if(!isOpen()) return -1;
+    unmap();
+    return map();
+}
+
+int FeatureStore::map()
+{
+    struct stat feat_st, lbl_st;
+    if(fstat(feat_fd_, &feat_st) < 0 || fstat(lbl_fd_, &lbl_st) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot stat store %s (%s)\n",
+                name_.c_str(),
+                filename_base_.c_str(),
+                strerror(errno));
+        return -4;
+    }
+
+    // A partially written tail record (e.g. a crashed writer) is ignored, a truncated header means no records
+    size_t feat_records = feat_st.st_size > FEATSTORE_HEADER_SIZE ?
+                ((size_t)feat_st.st_size - FEATSTORE_HEADER_SIZE) / recordBytes() : 0;
+    size_t lbl_records = lbl_st.st_size > FEATSTORE_HEADER_SIZE ?
+                ((size_t)lbl_st.st_size - FEATSTORE_HEADER_SIZE) / sizeof(featureLabelStamped) : 0;
+    records_num_ = std::min(feat_records, lbl_records);
+
+    // Mapping the whole files. Pages are only loaded on access, thus the store may exceed RAM.
+    // Writable stores map twice their records: the shared mapping shows appended records without remapping
+    // (only records below records_num_, i.e. inside the files, are ever accessed)
+    size_t capacity = records_num_;
+    if(writable_) capacity = std::max<size_t>(FEATSTORE_MIN_MAPPED_RECORDS, 2 * records_num_);
+    feat_map_size_ = FEATSTORE_HEADER_SIZE + capacity * recordBytes();
+    lbl_map_size_ = FEATSTORE_HEADER_SIZE + capacity * sizeof(featureLabelStamped);
+    if(capacity == 0) return 0;
+
+    void* feat_map = mmap(nullptr, feat_map_size_, PROT_READ, MAP_SHARED, feat_fd_, 0);
+    void* lbl_map = mmap(nullptr, lbl_map_size_, PROT_READ, MAP_SHARED, lbl_fd_, 0);
+    if(feat_map == MAP_FAILED || lbl_map == MAP_FAILED) {
+        fprintf(stderr, "%s: ERROR: Cannot map store %s (%s)\n",
+                name_.c_str(),
+                filename_base_.c_str(),
+                strerror(errno));
+        if(feat_map != MAP_FAILED) munmap(feat_map, feat_map_size_);
+        if(lbl_map != MAP_FAILED) munmap(lbl_map, lbl_map_size_);
+        records_num_ = 0;
+        return -5;
+    }
+    // Minibatches are sampled randomly, readahead only wastes IO
+    madvise(feat_map, feat_map_size_, MADV_RANDOM);
+
+    feat_map_ = (const uint8_t*)feat_map;
+    labels_ = (const featureLabelStamped*)((const uint8_t*)lbl_map + FEATSTORE_HEADER_SIZE);
+    return 0;
+}
+
+void FeatureStore::unmap()
+{
+    if(feat_map_ != nullptr) {
+        munmap((void*)feat_map_, feat_map_size_);
+    }
+    if(labels_ != nullptr) {
+        munmap((void*)((const uint8_t*)labels_ - FEATSTORE_HEADER_SIZE), lbl_map_size_);
+    }
+    feat_map_ = nullptr;
+    labels_ = nullptr;
+    feat_map_size_ = 0;
+    lbl_map_size_ = 0;
+}
+
+const void* FeatureStore::rawRecord(size_t i) const
+{
+    return feat_map_ + FEATSTORE_HEADER_SIZE + i * recordBytes();
+}
+
+int FeatureStore::getBatch(const size_t* indices, size_t n,
+                           float* features,
+                           int32_t* labels,
+                           int64_t* timestamps) const
+{
+    size_t record_size = recordSize();
+    for(size_t k = 0; k < n; k++)
+    {
+        size_t i = indices[k];
+        if(i >= records_num_) {
+            fprintf(stderr, "%s: ERROR: Record %zu out of range (%zu records)\n",
+                    name_.c_str(),
+                    i,
+                    records_num_);
+            return -1;
+        }
+        if(features != nullptr) {
+            float* out = features + k * record_size;
+            if(header_.dtype == FEATSTORE_FLOAT32) {
+                memcpy(out, rawRecord(i), record_size * sizeof(float));
+            } else {
+                const uint16_t* in = (const uint16_t*)rawRecord(i);
+                for(size_t j = 0; j < record_size; j++) {
+                    out[j] = half_to_float(in[j]);
+                }
+            }
+        }
+        if(labels != nullptr) labels[k] = labels_[i].label;
+        if(timestamps != nullptr) timestamps[k] = labels_[i].timestamp;
+    }
+    return 0;
+}
+
+int FeatureStore::append(const float* features,
+                         const int32_t* labels,
+                         const int64_t* timestamps,
+                         size_t n,
+                         const int32_t* sources)
+{
+    if(!isOpen() || !writable_) {
+        fprintf(stderr, "%s: ERROR: Store %s is not open for writing\n",
+                name_.c_str(),
+                filename_base_.c_str());
+        return -1;
+    }
+
+    // Records are written in one go per file. Features go first:
+    // a reader only sees a record once its label is there as well
+    size_t record_size = recordSize();
+    size_t feat_bytes = n * recordBytes();
+    const void* feat_buf = features;
+    std::vector<uint16_t> half_buf;
+    if(header_.dtype == FEATSTORE_FLOAT16) {
+        half_buf.resize(n * record_size);
+        for(size_t j = 0; j < half_buf.size(); j++) {
+            half_buf[j] = float_to_half(features[j]);
+        }
+        feat_buf = half_buf.data();
+    }
+
+    std::vector<featureLabelStamped> lbl_buf(n);
+    for(size_t k = 0; k < n; k++) {
+        lbl_buf[k].label = labels[k];
+        lbl_buf[k].source = (sources != nullptr) ? sources[k] : -1;
+        lbl_buf[k].timestamp = timestamps[k];
+    }
+    size_t lbl_bytes = n * sizeof(featureLabelStamped);
+
+    ssize_t feat_written = ::write(feat_fd_, feat_buf, feat_bytes);
+    ssize_t lbl_written = feat_written == (ssize_t)feat_bytes ? ::write(lbl_fd_, lbl_buf.data(), lbl_bytes) : 0;
+    if(feat_written != (ssize_t)feat_bytes || lbl_written != (ssize_t)lbl_bytes) {
+        // A short write (e.g. disk full) does not set errno
+        fprintf(stderr, "%s: ERROR: Failed to append to %s (%s)\n",
+                name_.c_str(),
+                filename_base_.c_str(),
+                (feat_written < 0 || lbl_written < 0) ? strerror(errno) : "short write");
+        // Rolling back the partial records, later appends must stay paired with their labels
+        if(trim() < 0) {
+            fprintf(stderr, "%s: ERROR: Failed to roll back store %s (%s)\n",
+                    name_.c_str(),
+                    filename_base_.c_str(),
+                    strerror(errno));
+        }
+        return -2;
+    }
+    // Remapped only when the records outgrow the mapping
+    size_t records = records_num_ + n;
+    if(feat_map_ != nullptr && FEATSTORE_HEADER_SIZE + records * recordBytes() <= feat_map_size_) {
+        records_num_ = records;
+        return 0;
+    }
+    return refresh();
+}
@@ -0,0 +1,137 @@
+/*
+Memory mapped feature store for training / evaluation data.
+A store consists of two files sharing the same base name:
+ <base>.feat - 64 byte header + N fixed stride records of [frames x bands] features (float16 or float32)
+ <base>.lbl  - 64 byte header + N fixed stride records of {int32 label, int32 source, int64 timestamp}
+The number of records is derived from the file sizes, thus appending is just writing
+to the end of both files (no header rewrite). Readers map the files and never load them into RAM.
+The same layout is read from python by feature_store.py (numpy.memmap).
+
+A minimal example:
+int main()
+{
+    FeatureStore store;
+    store.create("_data/train", FEATSTORE_FLOAT16); //41 x 20 by default
+    store.append(features, labels, timestamps, n); //features: n*41*20 floats
+    store.close();
+
+    store.open("_data/train");
+    std::vector<size_t> idx = {0, 5, 7};
+    std::vector<float> batch(idx.size() * store.recordSize());
+    store.getBatch(idx.data(), idx.size(), batch.data());
+    return 0;
+}
+ */
+
+#ifndef MIC_READ_THREAD_FEATURE_STORE_HPP
+#define MIC_READ_THREAD_FEATURE_STORE_HPP
+
+#include <cstdio>
+#include <string>
+#include <inttypes.h>
+#include <cstddef>
+
+#define FEATSTORE_DEF_FRAMES 41
+#define FEATSTORE_DEF_BANDS 20
+#define FEATSTORE_HEADER_SIZE 64
+#define FEATSTORE_FEAT_MAGIC "PDLFEAT1"
+#define FEATSTORE_LBL_MAGIC "PDLLBL01"
+#define FEATSTORE_VERSION 1
+#define FEATSTORE_MIN_MAPPED_RECORDS 1024 //records mapped at least by writable stores (room to append into)
+
+enum FeatureStoreDType
+{
+    FEATSTORE_FLOAT16 = 1,
+    FEATSTORE_FLOAT32 = 2
+};
+
+// Header of the .feat file (both files have the same header size)
+struct featureStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;  //FeatureStoreDType
+    uint32_t frames; //time steps per record (41 by default)
+    uint32_t bands;  //mfcc bands per time step (20 by default)
+    uint8_t reserved[FEATSTORE_HEADER_SIZE - 24];
+};
+
+// One record of the .lbl file
+struct featureLabelStamped
+{
+    int32_t label;     //class id (not one hot)
+    int32_t source;    //id of the recording the window was cut from (-1 if unknown)
+    int64_t timestamp; //microseconds time stamp of the window end
+};
+
+// Half precision conversions (IEEE 754 binary16)
+uint16_t float_to_half(float value);
+float half_to_float(uint16_t value);
+
+class FeatureStore
+{
+public:
+    FeatureStore();
+    ~FeatureStore();
+
+    // Creates a new (empty) store. Fails if the store already exists
+    int create(const std::string& filename_base,
+               FeatureStoreDType dtype=FEATSTORE_FLOAT32,
+               int frames=FEATSTORE_DEF_FRAMES,
+               int bands=FEATSTORE_DEF_BANDS);
+    // Opens an existing store. If writable is true records can be appended
+    int open(const std::string& filename_base, bool writable=false);
+    void close();
+    bool isOpen() const {return feat_fd_ >= 0;}
+
+    // Re-maps the files (i.e. picks up records appended by another process)
+    int refresh();
+
+    //--- Reading
+    size_t size() const {return records_num_;} //number of records
+    int frames() const {return header_.frames;}
+    int bands() const {return header_.bands;}
+    FeatureStoreDType dtype() const {return (FeatureStoreDType)header_.dtype;}
+    size_t recordSize() const {return (size_t)header_.frames * header_.bands;} //values per record
+    size_t recordBytes() const; //bytes per record in the .feat file
+
+    // Raw pointer to the record i in the mapped memory (float or uint16_t depending on dtype())
+    const void* rawRecord(size_t i) const;
+    const featureLabelStamped& label(size_t i) const {return labels_[i];}
+
+    // Random access minibatch: converts records to float. Any of the output pointers may be nullptr
+    // features must hold n*recordSize() floats
+    int getBatch(const size_t* indices, size_t n,
+                 float* features,
+                 int32_t* labels=nullptr,
+                 int64_t* timestamps=nullptr) const;
+
+    //--- Writing
+    // Appends n records. features holds n*recordSize() floats, sources may be nullptr
+    int append(const float* features,
+               const int32_t* labels,
+               const int64_t* timestamps,
+               size_t n,
+               const int32_t* sources=nullptr);
+
+protected:
+    std::string filename_base_;
+    std::string name_;
+    featureStoreHeader header_;
+    bool writable_;
+
+    int feat_fd_;
+    int lbl_fd_;
+    const uint8_t* feat_map_;
+    const featureLabelStamped* labels_;
+    size_t feat_map_size_; //mapped bytes (writable stores: beyond the end of the file, see map())
+    size_t lbl_map_size_;
+    size_t records_num_;
+
+    int map();
+    void unmap();
+    // Cuts both files back to the records_num_ complete records
+    int trim();
+};
+
+#endif //MIC_READ_THREAD_FEATURE_STORE_HPP
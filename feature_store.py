@@ -0,0 +1,115 @@
+#!/usr/bin/env python
+"""
+Memory mapped feature store (python side of feature_store.hpp).
+A store is a pair of files:
+ <base>.feat - 64 byte header + N records of [frames x bands] float16/float32 features
+ <base>.lbl  - 64 byte header + N records of (int32 label, int32 source, int64 timestamp)
+The number of records is derived from the file sizes, so appending never rewrites the files
+and opening a store is instant regardless of its size.
+"""
+from __future__ import print_function
+import os
+import struct
+import numpy as np
+
+HEADER_SIZE = 64
+FEAT_MAGIC = b'PDLFEAT1'
+LBL_MAGIC = b'PDLLBL01'
+VERSION = 1
+DTYPES = {1: np.dtype('<f2'), 2: np.dtype('<f4')}
+LABEL_DTYPE = np.dtype([('label', '<i4'), ('source', '<i4'), ('timestamp', '<i8')])
+
+
+def _header(magic, dtype_code=0, frames=0, bands=0):
+    header = magic + struct.pack('<IIII', VERSION, dtype_code, frames, bands)
+    return header + b'\0' * (HEADER_SIZE - len(header))
+
+
+class FeatureStore(object):
+    def __init__(self, filename_base):
+        """
+        Opens an existing store (read only). Use FeatureStore.create() for a new one
+        """
+        self.filename_base = filename_base
+        with open(filename_base + '.feat', 'rb') as feat_file:
+            header = feat_file.read(HEADER_SIZE)
+        with open(filename_base + '.lbl', 'rb') as lbl_file:
+            lbl_header = lbl_file.read(HEADER_SIZE)
+        if (len(header) < HEADER_SIZE or len(lbl_header) < HEADER_SIZE or
+                header[:8] != FEAT_MAGIC or lbl_header[:8] != LBL_MAGIC):
+            raise ValueError('%s is not a feature store' % filename_base)
+        version, dtype_code, self.frames, self.bands = struct.unpack('<IIII', header[8:24])
+        if version != VERSION or dtype_code not in DTYPES:
+            raise ValueError('Unsupported store version %d / dtype %d' % (version, dtype_code))
+        self.dtype = DTYPES[dtype_code]
+        self.refresh()
+
+    @staticmethod
+    def create(filename_base, dtype=np.float32, frames=41, bands=20):
+        dtype_code = [k for k, v in DTYPES.items() if v == np.dtype(dtype)][0]
+        for ext, header in (('.feat', _header(FEAT_MAGIC, dtype_code, frames, bands)),
+                            ('.lbl', _header(LBL_MAGIC))):
+            # 'xb' fails if the store already exists
+            with open(filename_base + ext, 'xb') as out_file:
+                out_file.write(header)
+        return FeatureStore(filename_base)
+
+    def refresh(self):
+        """
+        Re-maps the files, i.e. picks up records appended since opening
+        """
+        record_bytes = self.frames * self.bands * self.dtype.itemsize
+        feat_records = (os.path.getsize(self.filename_base + '.feat') - HEADER_SIZE) // record_bytes
+        lbl_records = (os.path.getsize(self.filename_base + '.lbl') - HEADER_SIZE) // LABEL_DTYPE.itemsize
+        n = min(feat_records, lbl_records) #negative for files shorter than the header
+        if n <= 0:
+            self.features = np.zeros([0, self.frames, self.bands], dtype=self.dtype)
+            self.meta = np.zeros([0], dtype=LABEL_DTYPE)
+            return
+        self.features = np.memmap(self.filename_base + '.feat', dtype=self.dtype, mode='r',
+                                  offset=HEADER_SIZE, shape=(n, self.frames, self.bands))
+        self.meta = np.memmap(self.filename_base + '.lbl', dtype=LABEL_DTYPE, mode='r',
+                              offset=HEADER_SIZE, shape=(n,))
+
+    def __len__(self):
+        return self.features.shape[0]
+
+    @property
+    def labels(self):
+        return self.meta['label']
+
+    @property
+    def timestamps(self):
+        return self.meta['timestamp']
+
+    def batch(self, indices, dtype=np.float32):
+        """
+        Random access minibatch. Only the requested records are read from disk
+        :return: features [len(indices) x frames x bands], labels, timestamps
+        """
+        indices = np.sort(np.asarray(indices))  # sorted access is friendlier to the page cache
+        return (self.features[indices].astype(dtype),
+                np.array(self.meta['label'][indices]),
+                np.array(self.meta['timestamp'][indices]))
+
+    def append(self, features, labels, timestamps=None, sources=None):
+        """
+        Appends records to the end of the store (features go first, see feature_store.hpp)
+        """
+        features = np.asarray(features, dtype=self.dtype).reshape(-1, self.frames, self.bands)
+        n = features.shape[0]
+        meta = np.zeros([n], dtype=LABEL_DTYPE)
+        meta['label'] = labels
+        meta['source'] = -1 if sources is None else sources
+        meta['timestamp'] = 0 if timestamps is None else timestamps
+        with open(self.filename_base + '.feat', 'ab') as feat_file:
+            feat_file.write(features.tobytes())
+        with open(self.filename_base + '.lbl', 'ab') as lbl_file:
+            lbl_file.write(meta.tobytes())
+        self.refresh()
+
+
+def open_or_create(filename_base, dtype=np.float32, frames=41, bands=20):
+    if os.path.isfile(filename_base + '.feat'):
+        return FeatureStore(filename_base)
+    return FeatureStore.create(filename_base, dtype=dtype, frames=frames, bands=bands)
@@ -0,0 +1,144 @@
+#include "fft.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+RealFFT::RealFFT(int size):
+    size_(size),
+    half_(size / 2)
+{
+    if(!isPowerOf2(size_) || size_ < 4) {
+        fprintf(stderr, "RealFFT: ERROR: size %d is not a power of 2 (>= 4)\n", size_);
+        size_ = 4;
+        half_ = 2;
+    }
+
+    // Bit reversal table
+    int bits = 0;
+    while((1 << bits) < half_) bits++;
+    bitrev_.resize(half_);
+    for(int i = 0; i < half_; i++) {
+        int r = 0;
+        for(int b = 0; b < bits; b++) {
+            if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        bitrev_[i] = r;
+    }
+
+    // Twiddles for every stage stored contiguously: stage with half length m uses m values
+    tw_re_.reserve(half_);
+    tw_im_.reserve(half_);
+    for(int m = 1; m < half_; m <<= 1) {
+        for(int j = 0; j < m; j++) {
+            double angle = -M_PI * j / m;
+            tw_re_.push_back((float)cos(angle));
+            tw_im_.push_back((float)sin(angle));
+        }
+    }
+
+    // Split step twiddles: W_N^k, k = 0 .. N/2
+    split_re_.resize(half_ + 1);
+    split_im_.resize(half_ + 1);
+    for(int k = 0; k <= half_; k++) {
+        double angle = -2.0 * M_PI * k / size_;
+        split_re_[k] = (float)cos(angle);
+        split_im_[k] = (float)sin(angle);
+    }
+
+    work_re_.resize(half_);
+    work_im_.resize(half_);
+}
+
+// One group of m contiguous butterflies. Separate restrict qualified arrays: the loop vectorizes
+static inline void butterflies(float* __restrict a_re, float* __restrict a_im,
+                               float* __restrict b_re, float* __restrict b_im,
+                               const float* __restrict tw_re, const float* __restrict tw_im, int m)
+{
+    for(int j = 0; j < m; j++)
+    {
+        float t_re = b_re[j] * tw_re[j] - b_im[j] * tw_im[j];
+        float t_im = b_re[j] * tw_im[j] + b_im[j] * tw_re[j];
+        b_re[j] = a_re[j] - t_re;
+        b_im[j] = a_im[j] - t_im;
+        a_re[j] = a_re[j] + t_re;
+        a_im[j] = a_im[j] + t_im;
+    }
+}
+
+void RealFFT::complexFFT(float* re, float* im)
+{
+    const float* tw_re = tw_re_.data();
+    const float* tw_im = tw_im_.data();
+
+    for(int m = 1; m < half_; m <<= 1)
+    {
+        for(int k = 0; k < half_; k += 2 * m)
+        {
+            butterflies(re + k, im + k, re + k + m, im + k + m, tw_re, tw_im, m);
+        }
+        tw_re += m;
+        tw_im += m;
+    }
+}
+
+// Bins 1 .. half-1 of the split step (restrict qualified: the mirrored loop vectorizes)
+static inline void split(const float* __restrict re, const float* __restrict im,
+                         const float* __restrict w_re, const float* __restrict w_im,
+                         float* __restrict out_re, float* __restrict out_im, int half)
+{
+    for(int k = 1; k < half; k++)
+    {
+        float zk_re = re[k];
+        float zk_im = im[k];
+        float zc_re = re[half - k];
+        float zc_im = -im[half - k];
+
+        float e_re = 0.5f * (zk_re + zc_re);
+        float e_im = 0.5f * (zk_im + zc_im);
+        float d_re = 0.5f * (zk_re - zc_re);
+        float d_im = 0.5f * (zk_im - zc_im);
+        // o = -i * d
+        float o_re = d_im;
+        float o_im = -d_re;
+
+        out_re[k] = e_re + w_re[k] * o_re - w_im[k] * o_im;
+        out_im[k] = e_im + w_re[k] * o_im + w_im[k] * o_re;
+    }
+}
+
+void RealFFT::forward(const float* in, float* out_re, float* out_im)
+{
+    float* re = work_re_.data();
+    float* im = work_im_.data();
+
+    // Packing even samples to the real part and odd ones to the imaginary part (bit reversed order)
+    for(int i = 0; i < half_; i++) {
+        int r = bitrev_[i];
+        re[r] = in[2 * i];
+        im[r] = in[2 * i + 1];
+    }
+
+    complexFFT(re, im);
+
+    // Splitting Z into the spectrum of the real signal:
+    // X[k] = (Z[k] + conj(Z[N/2-k])) / 2 - i/2 * W^k * (Z[k] - conj(Z[N/2-k]))
+    out_re[0] = re[0] + im[0];
+    out_im[0] = 0.f;
+    out_re[half_] = re[0] - im[0];
+    out_im[half_] = 0.f;
+    split(re, im, split_re_.data(), split_im_.data(), out_re, out_im, half_);
+}
+
+void RealFFT::power(const float* __restrict re, const float* __restrict im, float* __restrict out, int n)
+{
+    for(int i = 0; i < n; i++) {
+        out[i] = re[i] * re[i] + im[i] * im[i];
+    }
+}
+
+void RealFFT::magnitude(const float* __restrict re, const float* __restrict im, float* __restrict out, int n)
+{
+    for(int i = 0; i < n; i++) {
+        out[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+Radix-2 FFT of real signals with precomputed tables.
+A real signal of size N is packed into N/2 complex values, transformed by a complex FFT of size N/2
+and then split into N/2+1 bins of the real spectrum. All tables and the work buffers are allocated
+in the constructor, thus forward() never allocates.
+Complex data is kept as separate real / imaginary arrays (split layout) so that the butterfly loops
+are plain contiguous float loops the compiler can vectorize.
+
+A minimal example:
+    RealFFT fft(1024);
+    std::vector<float> re(fft.bins()), im(fft.bins());
+    fft.forward(signal, re.data(), im.data()); //signal: 1024 floats
+ */
+
+#ifndef MIC_READ_THREAD_FFT_HPP
+#define MIC_READ_THREAD_FFT_HPP
+
+#include <vector>
+#include <cstddef>
+
+class RealFFT
+{
+public:
+    // size must be a power of 2 (>= 4)
+    explicit RealFFT(int size);
+
+    int size() const {return size_;}
+    int bins() const {return size_ / 2 + 1;}
+
+    // in: size() real samples. out_re/out_im: bins() values each
+    void forward(const float* in, float* out_re, float* out_im);
+
+    // Helper: squared magnitudes of the last forward() output (or any split complex array)
+    static void power(const float* re, const float* im, float* out, int n);
+    static void magnitude(const float* re, const float* im, float* out, int n);
+
+    static bool isPowerOf2(int n) {return n > 0 && (n & (n - 1)) == 0;}
+
+protected:
+    int size_;
+    int half_; //size of the complex FFT
+
+    std::vector<int> bitrev_;       //bit reversal permutation of the complex FFT
+    std::vector<float> tw_re_;      //twiddles of all stages, stage after stage (1 + 2 + 4 + ... + half/2)
+    std::vector<float> tw_im_;
+    std::vector<float> split_re_;   //twiddles of the real spectrum split step
+    std::vector<float> split_im_;
+    std::vector<float> work_re_;    //work buffers of the complex FFT
+    std::vector<float> work_im_;
+
+    void complexFFT(float* re, float* im);
+};
+
+#endif //MIC_READ_THREAD_FFT_HPP
@@ -0,0 +1,181 @@
+#include "fft_fixed.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+static int16_t to_q15(double value)
+{
+    long q = lround(value * 32768.0);
+    return (int16_t)std::max(-32768L, std::min(32767L, q));
+}
+
+// Magnitude bound of x (|x| - 1 for negative values, enough for the bit length)
+static inline uint32_t magnitude_bits(int32_t x)
+{
+    return (uint32_t)(x ^ (x >> 31));
+}
+
+static inline int32_t shift_round(int32_t x, int shift)
+{
+    return shift > 0 ? (x + (1 << (shift - 1))) >> shift : x;
+}
+
+FixedRealFFT::FixedRealFFT(int size):
+    size_(size),
+    half_(size / 2)
+{
+    if(size_ < 4 || (size_ & (size_ - 1)) != 0) {
+        fprintf(stderr, "FixedRealFFT: ERROR: size %d is not a power of 2 (>= 4)\n", size_);
+        size_ = 4;
+        half_ = 2;
+    }
+
+    // Bit reversal table
+    int bits = 0;
+    while((1 << bits) < half_) bits++;
+    bitrev_.resize(half_);
+    for(int i = 0; i < half_; i++) {
+        int r = 0;
+        for(int b = 0; b < bits; b++) {
+            if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        bitrev_[i] = r;
+    }
+
+    // Twiddles for every stage stored contiguously: stage with half length m uses m values
+    tw_re_.reserve(half_);
+    tw_im_.reserve(half_);
+    for(int m = 1; m < half_; m <<= 1) {
+        for(int j = 0; j < m; j++) {
+            double angle = -M_PI * j / m;
+            tw_re_.push_back(to_q15(cos(angle)));
+            tw_im_.push_back(to_q15(sin(angle)));
+        }
+    }
+
+    // Split step twiddles: W_N^k, k = 0 .. N/2
+    split_re_.resize(half_ + 1);
+    split_im_.resize(half_ + 1);
+    for(int k = 0; k <= half_; k++) {
+        double angle = -2.0 * M_PI * k / size_;
+        split_re_[k] = to_q15(cos(angle));
+        split_im_[k] = to_q15(sin(angle));
+    }
+
+    work_re_.resize(half_);
+    work_im_.resize(half_);
+}
+
+int FixedRealFFT::complexFFT(int32_t* re, int32_t* im, uint32_t& mask)
+{
+    const int16_t* tw_re = tw_re_.data();
+    const int16_t* tw_im = tw_im_.data();
+    int exponent = 0;
+
+    for(int m = 1; m < half_; m <<= 1)
+    {
+        // The stage input back to FFT_FIXED_DATA_BITS: the products fit in 32 bits
+        int shift = std::max(0, bitLength(mask) - FFT_FIXED_DATA_BITS);
+        exponent += shift;
+        for(int k = 0; k < half_; k += 2 * m)
+        {
+            int32_t* __restrict a_re = re + k;
+            int32_t* __restrict a_im = im + k;
+            int32_t* __restrict b_re = re + k + m;
+            int32_t* __restrict b_im = im + k + m;
+            for(int j = 0; j < m; j++)
+            {
+                int32_t ar = shift_round(a_re[j], shift);
+                int32_t ai = shift_round(a_im[j], shift);
+                int32_t br = shift_round(b_re[j], shift);
+                int32_t bi = shift_round(b_im[j], shift);
+                int32_t t_re = (br * tw_re[j] - bi * tw_im[j] + (1 << 14)) >> 15;
+                int32_t t_im = (br * tw_im[j] + bi * tw_re[j] + (1 << 14)) >> 15;
+                b_re[j] = ar - t_re;
+                b_im[j] = ai - t_im;
+                a_re[j] = ar + t_re;
+                a_im[j] = ai + t_im;
+            }
+        }
+        // Magnitude bound of the stage output (a separate pass keeps the butterfly loop lean)
+        uint32_t out_mask = 0;
+        for(int i = 0; i < half_; i++) out_mask |= magnitude_bits(re[i]) | magnitude_bits(im[i]);
+        mask = out_mask;
+        tw_re += m;
+        tw_im += m;
+    }
+    return exponent;
+}
+
+int FixedRealFFT::forward(const int16_t* in, int32_t* out_re, int32_t* out_im)
+{
+    int32_t* re = work_re_.data();
+    int32_t* im = work_im_.data();
+
+    // Packing even samples to the real part and odd ones to the imaginary part (bit reversed order)
+    uint32_t mask = 0;
+    for(int i = 0; i < half_; i++) {
+        int r = bitrev_[i];
+        re[r] = in[2 * i];
+        im[r] = in[2 * i + 1];
+        mask |= magnitude_bits(in[2 * i]) | magnitude_bits(in[2 * i + 1]);
+    }
+    if(mask == 0) {
+        std::fill(out_re, out_re + bins(), 0);
+        std::fill(out_im, out_im + bins(), 0);
+        return 0;
+    }
+
+    // Quiet blocks are scaled up to the full data width
+    int exponent = 0;
+    int up = FFT_FIXED_DATA_BITS - bitLength(mask);
+    if(up > 0) {
+        for(int i = 0; i < half_; i++) {
+            re[i] <<= up;
+            im[i] <<= up;
+        }
+        mask <<= up;
+        exponent -= up;
+    }
+
+    exponent += complexFFT(re, im, mask);
+
+    // Splitting Z into the spectrum of the real signal, 2 X[k] is computed (the halving goes to the exponent):
+    // 2 X[k] = (Z[k] + conj(Z[N/2-k])) - i * W^k * (Z[k] - conj(Z[N/2-k]))
+    // One bit less than in the stages: sums and differences come before the products
+    int shift = std::max(0, bitLength(mask) - (FFT_FIXED_DATA_BITS - 1));
+    exponent += shift;
+    int32_t re0 = shift_round(re[0], shift);
+    int32_t im0 = shift_round(im[0], shift);
+    out_re[0] = 2 * (re0 + im0);
+    out_im[0] = 0;
+    out_re[half_] = 2 * (re0 - im0);
+    out_im[half_] = 0;
+    for(int k = 1; k < half_; k++)
+    {
+        int32_t zk_re = shift_round(re[k], shift);
+        int32_t zk_im = shift_round(im[k], shift);
+        int32_t zc_re = shift_round(re[half_ - k], shift);
+        int32_t zc_im = -shift_round(im[half_ - k], shift);
+
+        int32_t e_re = zk_re + zc_re;
+        int32_t e_im = zk_im + zc_im;
+        int32_t d_re = zk_re - zc_re;
+        int32_t d_im = zk_im - zc_im;
+        // o = -i * d
+        int32_t o_re = d_im;
+        int32_t o_im = -d_re;
+
+        out_re[k] = e_re + ((split_re_[k] * o_re - split_im_[k] * o_im + (1 << 14)) >> 15);
+        out_im[k] = e_im + ((split_re_[k] * o_im + split_im_[k] * o_re + (1 << 14)) >> 15);
+    }
+    return exponent - 1;
+}
+
+void FixedRealFFT::power(const int32_t* __restrict re, const int32_t* __restrict im, uint64_t* __restrict out, int n)
+{
+    for(int i = 0; i < n; i++) {
+        out[i] = (uint64_t)((int64_t)re[i] * re[i] + (int64_t)im[i] * im[i]);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+Fixed point radix-2 FFT of real int16 signals (block floating point), the integer counterpart of RealFFT.
+Same structure as RealFFT: the N real samples are packed into N/2 complex values, transformed by a complex
+FFT of size N/2 and split into the N/2+1 bins of the real spectrum. Twiddles are Q15, the data is int32.
+Instead of a fixed scaling of 1/2 per stage (which buries quiet signals in the rounding noise) the block is
+shifted only as far as needed: the input is normalized to 15 bits, every stage is shifted right by the bits
+the previous one grew over 15 bits (tracked with an OR of the magnitudes of the stage output), the
+common exponent of the block is returned. Products stay within 32 bits (15 bit data x Q15 twiddles), the only
+64 bit values are the power spectrum. All tables and work buffers are allocated in the constructor.
+
+A minimal example:
+    FixedRealFFT fft(2048);
+    std::vector<int32_t> re(fft.bins()), im(fft.bins());
+    int exponent = fft.forward(samples, re.data(), im.data()); //samples: 2048 int16, X[k] = re[k] * 2^exponent
+ */
+
+#ifndef MIC_READ_THREAD_FFT_FIXED_HPP
+#define MIC_READ_THREAD_FFT_FIXED_HPP
+
+#include <vector>
+#include <cstddef>
+#include <inttypes.h>
+
+#define FFT_FIXED_DATA_BITS 15 //magnitude bits of the data entering a butterfly stage
+
+class FixedRealFFT
+{
+public:
+    // size must be a power of 2 (>= 4)
+    explicit FixedRealFFT(int size);
+
+    int size() const {return size_;}
+    int bins() const {return size_ / 2 + 1;}
+
+    // in: size() samples. out_re/out_im: bins() values each (at most 17 bits).
+    // Returns the block exponent: the spectrum in units of the input is out * 2^exponent
+    int forward(const int16_t* in, int32_t* out_re, int32_t* out_im);
+
+    // Squared magnitudes (in units of 2^(2 * exponent))
+    static void power(const int32_t* re, const int32_t* im, uint64_t* out, int n);
+
+    // Bits needed for the magnitude bound m (an OR of magnitudes)
+    static int bitLength(uint32_t m) {return m == 0 ? 0 : 32 - __builtin_clz(m);}
+
+protected:
+    int size_;
+    int half_; //size of the complex FFT
+
+    std::vector<int> bitrev_;        //bit reversal permutation of the complex FFT
+    std::vector<int16_t> tw_re_;     //Q15 twiddles of all stages, stage after stage (1 + 2 + 4 + ... + half/2)
+    std::vector<int16_t> tw_im_;
+    std::vector<int16_t> split_re_;  //Q15 twiddles of the real spectrum split step
+    std::vector<int16_t> split_im_;
+    std::vector<int32_t> work_re_;   //work buffers of the complex FFT
+    std::vector<int32_t> work_im_;
+
+    // Returns the exponent added by the stage shifts. mask: magnitude bound of the input, on return of the output
+    int complexFFT(int32_t* re, int32_t* im, uint32_t& mask);
+};
+
+#endif //MIC_READ_THREAD_FFT_FIXED_HPP
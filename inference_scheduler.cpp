@@ -0,0 +1,172 @@
+#include "inference_scheduler.hpp"
+#include "trace.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+InferenceScheduler::InferenceScheduler(LstmClassifier& model,
+                                       int max_batch,
+                                       int deadline_us,
+                                       int max_pending):
+    model_(model),
+    max_batch_(max_batch),
+    deadline_(deadline_us),
+    run_fl_(false),
+    active_streams_(0),
+    windows_processed_(0),
+    windows_dropped_(0),
+    windows_flushed_(0),
+    batches_(0),
+    wait_us_total_(0),
+    wait_us_max_(0)
+{
+    if(model_.classes() > INFER_MAX_CLASSES) {
+        fprintf(stderr, "InferenceScheduler: ERROR: %d classes, only %d supported\n",
+                model_.classes(), INFER_MAX_CLASSES);
+    }
+    max_pending = std::max(max_pending, max_batch_);
+    slots_.resize((size_t)max_pending * model_.windowSize());
+    for(int i = max_pending - 1; i >= 0; i--) free_slots_.push_back(i);
+
+    batch_windows_.resize((size_t)max_batch_ * model_.windowSize());
+    batch_probs_.resize((size_t)max_batch_ * model_.classes());
+    batch_.reserve(max_batch_);
+}
+
+InferenceScheduler::~InferenceScheduler()
+{
+    finish();
+}
+
+int InferenceScheduler::addStream()
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    streams_.push_back(true);
+    active_streams_++;
+    return (int)streams_.size() - 1;
+}
+
+void InferenceScheduler::removeStream(int stream)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(stream >= 0 && stream < (int)streams_.size() && streams_[stream]) {
+        streams_[stream] = false;
+        active_streams_--;
+    }
+    cv_.notify_all(); //the remaining streams may complete a batch now
+}
+
+bool InferenceScheduler::submit(int stream, const float* window, long window_id, int64_t timestamp)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(free_slots_.empty()) {
+        windows_dropped_++;
+        return false;
+    }
+    pendingWindow item;
+    item.slot = free_slots_.back();
+    free_slots_.pop_back();
+    item.stream = stream;
+    item.window_id = window_id;
+    item.timestamp = timestamp;
+    item.submitted = std::chrono::steady_clock::now();
+    memcpy(&slots_[(size_t)item.slot * model_.windowSize()], window, model_.windowSize() * sizeof(float));
+    pending_.push_back(item);
+
+    if(batchReady(item.submitted)) {
+        cv_.notify_all();
+    }
+    return true;
+}
+
+bool InferenceScheduler::batchReady(std::chrono::steady_clock::time_point now) const
+{
+    if(pending_.empty()) return false;
+    if((int)pending_.size() >= max_batch_) return true;
+    if((int)pending_.size() >= active_streams_) return true;
+    return now - pending_.front().submitted >= deadline_;
+}
+
+void InferenceScheduler::start()
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(run_fl_) return;
+    run_fl_ = true;
+    th_ = std::thread(&InferenceScheduler::run, this);
+}
+
+void InferenceScheduler::finish()
+{
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if(!run_fl_) return;
+        run_fl_ = false;
+        cv_.notify_all();
+    }
+    th_.join();
+}
+
+void InferenceScheduler::run()
+{
+    const size_t window_size = model_.windowSize();
+    const int classes = model_.classes();
+    Trace::nameThread("inference");
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            while(run_fl_ && !batchReady(std::chrono::steady_clock::now())) {
+                if(pending_.empty()) {
+                    cv_.wait(lck);
+                } else {
+                    cv_.wait_until(lck, pending_.front().submitted + deadline_);
+                }
+            }
+            // finish(): the windows still pending are evaluated in partial batches, not dropped
+            if(!run_fl_ && pending_.empty()) break;
+            if(!run_fl_) windows_flushed_ += std::min((long)pending_.size(), (long)max_batch_);
+
+            // Taking the oldest windows into the contiguous batch buffer
+            batch_.clear();
+            while(!pending_.empty() && (int)batch_.size() < max_batch_) {
+                pendingWindow& item = pending_.front();
+                memcpy(&batch_windows_[batch_.size() * window_size],
+                       &slots_[(size_t)item.slot * window_size],
+                       window_size * sizeof(float));
+                free_slots_.push_back(item.slot);
+                batch_.push_back(item);
+                pending_.pop_front();
+            }
+        }
+
+        TraceSpan predict_span("inference");
+        auto batch_start = std::chrono::steady_clock::now();
+        model_.predict(batch_windows_.data(), (int)batch_.size(), batch_probs_.data());
+        auto batch_end = std::chrono::steady_clock::now();
+        predict_span.end();
+        batches_++;
+
+        for(size_t b = 0; b < batch_.size(); b++)
+        {
+            inferenceResult res;
+            res.stream = batch_[b].stream;
+            res.window_id = batch_[b].window_id;
+            res.timestamp = batch_[b].timestamp;
+            res.batch_size = (int)batch_.size();
+            const float* probs = &batch_probs_[b * classes];
+            res.label = (int)(std::max_element(probs, probs + classes) - probs);
+            for(int k = 0; k < classes && k < INFER_MAX_CLASSES; k++) res.probs[k] = probs[k];
+            res.wait_us = std::chrono::duration_cast<std::chrono::microseconds>(batch_start - batch_[b].submitted).count();
+            res.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(batch_end - batch_[b].submitted).count();
+
+            windows_processed_++;
+            wait_us_total_ += res.wait_us;
+            if(res.wait_us > wait_us_max_) wait_us_max_ = res.wait_us;
+            if(callback_) callback_(res);
+        }
+    }
+    printf("InferenceScheduler: Thread func finished. Windows %ld (%ld flushed at finish), batches %ld, avg batch %.2f ...\n",
+           getWindowsProcessed(), getWindowsFlushed(), getBatches(), getAvgBatchSize());
+}
@@ -0,0 +1,128 @@
+/*
+Cross-stream batched inference.
+Every capture stream (microphone) submits its ready [steps x input] feature windows. A single
+scheduler thread collects them and evaluates them with one batched LstmClassifier::predict() call.
+A batch is started as soon as
+ - as many windows are pending as there are active streams (i.e. one per stream), or
+ - max_batch windows are pending, or
+ - the oldest pending window waited deadline_us microseconds,
+thus a lone stream is never held back longer than the deadline.
+Window storage is preallocated (max_pending slots). If it is full submit() drops the window.
+finish() evaluates the windows still pending (in partial batches) before the thread stops.
+
+A minimal example:
+    LstmClassifier model;
+    model.load("micpred_rnn.lstm");
+    InferenceScheduler scheduler(model);
+    scheduler.setCallback([](const inferenceResult& res){ printf("%d: %d\n", res.stream, res.label); });
+    int stream = scheduler.addStream();
+    scheduler.start();
+    ...
+    scheduler.submit(stream, window, window_id, timestamp); //from the feature extraction of the stream
+ */
+
+#ifndef MIC_READ_THREAD_INFERENCE_SCHEDULER_HPP
+#define MIC_READ_THREAD_INFERENCE_SCHEDULER_HPP
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <inttypes.h>
+
+#include "lstm_classifier.hpp"
+
+#define INFER_DEF_MAX_BATCH 16
+#define INFER_DEF_DEADLINE_US 5000
+#define INFER_MAX_CLASSES 8
+
+struct inferenceResult
+{
+    int stream;
+    long window_id;
+    int64_t timestamp;  //time stamp passed to submit()
+    int label;          //argmax of probs
+    float probs[INFER_MAX_CLASSES];
+    int batch_size;     //size of the batch the window was evaluated in
+    int64_t wait_us;    //submit() -> batch start (latency added by batching)
+    int64_t latency_us; //submit() -> result
+};
+
+class InferenceScheduler
+{
+public:
+    InferenceScheduler(LstmClassifier& model,
+                       int max_batch=INFER_DEF_MAX_BATCH,
+                       int deadline_us=INFER_DEF_DEADLINE_US,
+                       int max_pending=4 * INFER_DEF_MAX_BATCH);
+    ~InferenceScheduler();
+
+    // Results are delivered from the scheduler thread
+    void setCallback(std::function<void(const inferenceResult&)> callback) {callback_ = callback;}
+
+    int addStream();             //returns the stream id
+    void removeStream(int stream);
+    int getActiveStreams() const {return active_streams_;}
+
+    // Copies the window (model.windowSize() floats). Returns false if it was dropped (queue full)
+    bool submit(int stream, const float* window, long window_id, int64_t timestamp);
+
+    void start();
+    void finish(); //pending windows are evaluated first (getWindowsFlushed())
+
+    // Counters
+    long getWindowsProcessed() const {return windows_processed_;}
+    long getWindowsDropped() const {return windows_dropped_;}
+    long getWindowsFlushed() const {return windows_flushed_;} //pending at finish(), evaluated while stopping
+    long getBatches() const {return batches_;}
+    double getAvgBatchSize() const {return batches_ > 0 ? (double)windows_processed_ / batches_ : 0.;}
+    double getAvgWaitUs() const {return windows_processed_ > 0 ? (double)wait_us_total_ / windows_processed_ : 0.;}
+    long getMaxWaitUs() const {return wait_us_max_;}
+
+protected:
+    struct pendingWindow
+    {
+        int slot;
+        int stream;
+        long window_id;
+        int64_t timestamp;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    LstmClassifier& model_;
+    int max_batch_;
+    std::chrono::microseconds deadline_;
+    std::function<void(const inferenceResult&)> callback_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread th_;
+    bool run_fl_;
+
+    std::vector<float> slots_;      //max_pending windows
+    std::vector<int> free_slots_;
+    std::deque<pendingWindow> pending_;
+    std::vector<bool> streams_;
+    int active_streams_;
+
+    // Batch work buffers (scheduler thread only)
+    std::vector<float> batch_windows_;
+    std::vector<float> batch_probs_;
+    std::vector<pendingWindow> batch_;
+
+    std::atomic<long> windows_processed_;
+    std::atomic<long> windows_dropped_;
+    std::atomic<long> windows_flushed_;
+    std::atomic<long> batches_;
+    std::atomic<long> wait_us_total_;
+    std::atomic<long> wait_us_max_;
+
+    void run();
+    bool batchReady(std::chrono::steady_clock::time_point now) const; //call with mtx_ locked
+};
+
+#endif //MIC_READ_THREAD_INFERENCE_SCHEDULER_HPP
@@ -0,0 +1,162 @@
+#include "instrument.hpp"
+
+#ifdef MICREAD_INSTRUMENT
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Static storage only: operator new may run before any constructor of this file
+static instrumentThreadStats g_threads[MICREAD_INSTRUMENT_MAX_THREADS];
+static std::atomic<int> g_threads_num(0);
+static thread_local instrumentThreadStats* t_stats = nullptr;
+
+instrumentThreadStats* Instrument::thread()
+{
+    if(t_stats == nullptr) {
+        int slot = g_threads_num++;
+        if(slot >= MICREAD_INSTRUMENT_MAX_THREADS) {
+            slot = MICREAD_INSTRUMENT_MAX_THREADS - 1;
+            g_threads_num = MICREAD_INSTRUMENT_MAX_THREADS;
+        }
+        t_stats = &g_threads[slot];
+        if(t_stats->name[0] == 0) t_stats->t_start = std::chrono::steady_clock::now();
+    }
+    return t_stats;
+}
+
+void Instrument::nameThread(const char* name)
+{
+    instrumentThreadStats* stats = thread();
+    strncpy(stats->name, name, MICREAD_INSTRUMENT_NAME_SIZE - 1);
+    stats->name[MICREAD_INSTRUMENT_NAME_SIZE - 1] = 0;
+    stats->t_start = std::chrono::steady_clock::now();
+}
+
+long Instrument::allocations()
+{
+    long total = 0;
+    for(int i = 0; i < g_threads_num; i++) total += g_threads[i].allocations;
+    return total;
+}
+
+long Instrument::allocatedBytes()
+{
+    long total = 0;
+    for(int i = 0; i < g_threads_num; i++) total += g_threads[i].allocated_bytes;
+    return total;
+}
+
+void Instrument::print(FILE* out, const instrumentThreadStats* stats)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats->t_start).count();
+    if(seconds <= 0.) seconds = 1e-9;
+    fprintf(out, "%-24s %6.1f s | allocations %9ld (%9.1f/s) %11ld bytes, frees %9ld | "
+            "locks %9ld, waits %7ld (%7.1f/s, %9.3f ms), try_lock failures %7ld (%7.1f/s)\n",
+            stats->name[0] ? stats->name : "(unnamed)", seconds,
+            (long)stats->allocations, stats->allocations / seconds, (long)stats->allocated_bytes, (long)stats->frees,
+            (long)stats->lock_acquires, (long)stats->lock_waits, stats->lock_waits / seconds, stats->lock_wait_ns * 1e-6,
+            (long)stats->try_lock_failures, stats->try_lock_failures / seconds);
+}
+
+void Instrument::report(FILE* out)
+{
+    for(int i = 0; i < g_threads_num; i++) print(out, &g_threads[i]);
+}
+
+void MicReadMutex::lock()
+{
+    instrumentThreadStats* stats = Instrument::thread();
+    acquires_++;
+    stats->lock_acquires++;
+    if(mtx_.try_lock()) return;
+
+    auto t_wait = std::chrono::steady_clock::now();
+    mtx_.lock();
+    long ns = (long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_wait).count();
+    waits_++;
+    wait_ns_ += ns;
+    stats->lock_waits++;
+    stats->lock_wait_ns += ns;
+}
+
+bool MicReadMutex::try_lock()
+{
+    instrumentThreadStats* stats = Instrument::thread();
+    if(mtx_.try_lock()) {
+        acquires_++;
+        stats->lock_acquires++;
+        return true;
+    }
+    try_lock_failures_++;
+    stats->try_lock_failures++;
+    return false;
+}
+
+void MicReadMutex::print(FILE* out, const char* name) const
+{
+    fprintf(out, "%-24s locks %9ld, waits %7ld (%.2f%%, %9.3f ms), try_lock failures %7ld\n", name, (long)acquires_,
+            (long)waits_, acquires_ > 0 ? 100. * waits_ / acquires_ : 0., wait_ns_ * 1e-6, (long)try_lock_failures_);
+}
+
+// Global allocation functions: every form ends in these two
+static inline void* counted_malloc(size_t size)
+{
+    instrumentThreadStats* stats = Instrument::thread();
+    stats->allocations++;
+    stats->allocated_bytes += (long)size;
+    return malloc(size > 0 ? size : 1);
+}
+
+static inline void counted_free(void* p)
+{
+    if(p == nullptr) return;
+    Instrument::thread()->frees++;
+    free(p);
+}
+
+void* operator new(size_t size)
+{
+    void* p = counted_malloc(size);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = counted_malloc(size);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    counted_free(p);
+}
+
+#endif //MICREAD_INSTRUMENT
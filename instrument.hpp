@@ -0,0 +1,100 @@
+/*
+Allocation and lock contention counters of instrumented builds (cmake -DMICREAD_INSTRUMENT=ON, which defines
+MICREAD_INSTRUMENT for the library and everything linking it):
+ - heap allocations: the global operator new / delete are replaced (instrument.cpp), every allocation and free is
+   counted for the calling thread. Threads get a slot of a static table on their first count, the slot is found
+   through a plain thread_local pointer: counting never allocates itself. C allocations (malloc() inside ALSA,
+   libc) are not seen
+ - locks: MicReadMutex counts the lock() calls that had to wait (and the time waited) and the failed try_lock()
+   calls, per mutex and per calling thread
+MicReadAlsa names its threads ("<name> read", "<name> record", ...) and prints their totals and rates at finish().
+Without MICREAD_INSTRUMENT MicReadMutex / MicReadCondition are std::mutex / std::condition_variable and nothing
+is replaced (no cost).
+A check of the steady state of the reading thread: examples/check_steady_state_allocations.cpp.
+
+A minimal example (instrumented build):
+    Instrument::nameThread("worker");
+    long before = Instrument::thread()->allocations;
+    work();
+    printf("allocations %ld\n", Instrument::thread()->allocations - before);
+    Instrument::report(stdout); //all threads
+ */
+
+#ifndef MIC_READ_THREAD_INSTRUMENT_HPP
+#define MIC_READ_THREAD_INSTRUMENT_HPP
+
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#ifdef MICREAD_INSTRUMENT
+
+#define MICREAD_INSTRUMENT_MAX_THREADS 256 //threads beyond share the last slot
+#define MICREAD_INSTRUMENT_NAME_SIZE 32
+
+// Counters of one thread (written by the thread, readable from any thread)
+struct instrumentThreadStats
+{
+    char name[MICREAD_INSTRUMENT_NAME_SIZE];
+    std::chrono::steady_clock::time_point t_start; //first count / nameThread()
+    std::atomic<long> allocations;
+    std::atomic<long> allocated_bytes;
+    std::atomic<long> frees;
+    std::atomic<long> lock_acquires;
+    std::atomic<long> lock_waits; //lock() calls that found the mutex locked
+    std::atomic<long> lock_wait_ns;
+    std::atomic<long> try_lock_failures;
+};
+
+class Instrument
+{
+public:
+    // Counters of the calling thread
+    static instrumentThreadStats* thread();
+    // Names the calling thread in the reports (truncated to MICREAD_INSTRUMENT_NAME_SIZE - 1 characters)
+    static void nameThread(const char* name);
+    // Process totals
+    static long allocations();
+    static long allocatedBytes();
+    // One line per thread: totals and rates since the thread's first count
+    static void print(FILE* out, const instrumentThreadStats* stats);
+    static void report(FILE* out);
+};
+
+// std::mutex counting its contention (see the header comment)
+class MicReadMutex
+{
+public:
+    MicReadMutex(): acquires_(0), waits_(0), wait_ns_(0), try_lock_failures_(0) {}
+    MicReadMutex(const MicReadMutex&) = delete;
+    MicReadMutex& operator=(const MicReadMutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock() {mtx_.unlock();}
+
+    long acquires() const {return acquires_;}
+    long waits() const {return waits_;}
+    long waitNs() const {return wait_ns_;}
+    long tryLockFailures() const {return try_lock_failures_;}
+    void print(FILE* out, const char* name) const;
+
+protected:
+    std::mutex mtx_;
+    std::atomic<long> acquires_;
+    std::atomic<long> waits_;
+    std::atomic<long> wait_ns_;
+    std::atomic<long> try_lock_failures_;
+};
+typedef std::condition_variable_any MicReadCondition;
+
+#else
+
+typedef std::mutex MicReadMutex;
+typedef std::condition_variable MicReadCondition;
+
+#endif //MICREAD_INSTRUMENT
+
+#endif //MIC_READ_THREAD_INSTRUMENT_HPP
@@ -0,0 +1,506 @@
+#include "io_writer.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+#if defined(MICREAD_HAVE_IO_URING) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define IO_WRITER_URING 1
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+IoWriter::IoWriter(IoWriterBackend backend,
+                   size_t block_size,
+                   int blocks,
+                   size_t batch_bytes,
+                   int flush_ms,
+                   int threads):
+    name_("IoWriter"),
+    backend_(backend),
+    block_size_(block_size),
+    batch_bytes_(batch_bytes),
+    flush_interval_(flush_ms),
+    threads_(threads),
+    run_fl_(true),
+    flush_requested_(false),
+    pool_remaining_(0),
+    pool_run_(false),
+    uring_fd_(-1),
+    uring_state_(nullptr),
+    bytes_written_(0),
+    submissions_(0),
+    iovs_submitted_(0),
+    queue_depth_(0),
+    queue_depth_max_(0),
+    latency_us_total_(0),
+    latency_us_max_(0),
+    stalls_(0),
+    errors_(0)
+{
+    // All the memory is allocated here
+    blocks_.resize(blocks);
+    free_blocks_.reserve(blocks);
+    for(size_t i = 0; i < blocks_.size(); i++) {
+        blocks_[i].data.resize(block_size_);
+        blocks_[i].used = 0;
+        free_blocks_.push_back(&blocks_[i]);
+    }
+    files_.resize(IO_WRITER_MAX_FILES);
+    for(size_t i = 0; i < files_.size(); i++) {
+        files_[i].state = IO_FILE_FREE;
+        files_[i].fd = -1;
+        files_[i].pending.reserve(blocks);
+    }
+    jobs_.reserve(IO_WRITER_MAX_FILES);
+
+    if(backend_ != IO_BACKEND_THREADS && !uringInit(IO_WRITER_MAX_FILES)) {
+        if(backend_ == IO_BACKEND_URING) {
+            fprintf(stderr, "%s: WARNING: io_uring is not available, using %d writer threads\n", name_.c_str(), threads_);
+        }
+    }
+    if(uring_fd_ < 0) {
+        pool_run_ = true;
+        for(int i = 0; i < std::max(threads_, 1); i++) pool_.push_back(std::thread(&IoWriter::pool_thread, this));
+    }
+    printf("%s: Backend %s, %zu x %zu KB blocks\n", name_.c_str(), usesUring() ? "io_uring" : "pwritev threads",
+           blocks_.size(), block_size_ / 1024);
+    th_ = std::thread(&IoWriter::run, this);
+}
+
+IoWriter::~IoWriter()
+{
+    finish();
+}
+
+void IoWriter::finish()
+{
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if(!run_fl_) return;
+        for(size_t i = 0; i < files_.size(); i++) {
+            if(files_[i].state == IO_FILE_OPEN) files_[i].state = IO_FILE_CLOSING;
+        }
+        run_fl_ = false;
+        cv_.notify_all();
+    }
+    th_.join();
+
+    {
+        std::unique_lock<std::mutex> lck(pool_mtx_);
+        pool_run_ = false;
+        pool_cv_.notify_all();
+    }
+    for(size_t i = 0; i < pool_.size(); i++) pool_[i].join();
+    pool_.clear();
+    uringClose();
+    printf("%s: Finished. Written %ld bytes in %ld submissions (%.1f iovecs each), write latency avg %.0f us max %ld us, stalls %ld, errors %ld\n",
+           name_.c_str(), getBytesWritten(), getSubmissions(), getAvgIovPerSubmission(),
+           getAvgWriteLatencyUs(), getMaxWriteLatencyUs(), getStalls(), getErrors());
+}
+
+int IoWriter::openFile(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot open %s (%s)\n", name_.c_str(), filename.c_str(), strerror(errno));
+        return -1;
+    }
+    std::unique_lock<std::mutex> lck(mtx_);
+    for(size_t i = 0; i < files_.size(); i++) {
+        ioFile& file = files_[i];
+        if(file.state != IO_FILE_FREE) continue;
+        file.state = IO_FILE_OPEN;
+        file.fd = fd;
+        file.name = filename;
+        file.offset = 0;
+        file.pending_bytes = 0;
+        file.pending.clear();
+        file.patches.clear();
+        return (int)i;
+    }
+    ::close(fd);
+    fprintf(stderr, "%s: ERROR: Too many open files (max %d)\n", name_.c_str(), IO_WRITER_MAX_FILES);
+    return -2;
+}
+
+void IoWriter::write(int file, const void* data, size_t bytes)
+{
+    const char* src = (const char*)data;
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(file < 0 || file >= (int)files_.size() || files_[file].state != IO_FILE_OPEN) {
+        errors_++;
+        return;
+    }
+    ioFile& f = files_[file];
+    while(bytes > 0) {
+        if(f.pending.empty() || f.pending.back()->used == block_size_) {
+            while(free_blocks_.empty()) {
+                // The disk does not keep up: the writer waits instead of growing the memory
+                stalls_++;
+                flush_requested_ = true;
+                cv_.notify_all();
+                free_cv_.wait(lck);
+            }
+            ioBlock* block = free_blocks_.back();
+            free_blocks_.pop_back();
+            block->used = 0;
+            f.pending.push_back(block);
+            long depth = ++queue_depth_;
+            if(depth > queue_depth_max_) queue_depth_max_ = depth;
+        }
+        ioBlock* block = f.pending.back();
+        size_t n = std::min(bytes, block_size_ - block->used);
+        memcpy(block->data.data() + block->used, src, n);
+        block->used += n;
+        f.pending_bytes += n;
+        src += n;
+        bytes -= n;
+    }
+    // Large batches (or a draining pool) go out before the flush interval
+    if(f.pending_bytes >= batch_bytes_ || free_blocks_.size() < blocks_.size() / 4) {
+        flush_requested_ = true;
+        cv_.notify_all();
+    }
+}
+
+void IoWriter::writeAt(int file, int64_t offset, const void* data, size_t bytes)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(file < 0 || file >= (int)files_.size() || files_[file].state != IO_FILE_OPEN || bytes > sizeof(ioPatch().data)) {
+        errors_++;
+        return;
+    }
+    ioPatch patch;
+    patch.offset = offset;
+    patch.bytes = bytes;
+    memcpy(patch.data, data, bytes);
+    files_[file].patches.push_back(patch);
+}
+
+void IoWriter::closeFile(int file)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(file < 0 || file >= (int)files_.size() || files_[file].state != IO_FILE_OPEN) return;
+    files_[file].state = IO_FILE_CLOSING;
+    flush_requested_ = true;
+    cv_.notify_all();
+    while(run_fl_ && files_[file].state == IO_FILE_CLOSING) free_cv_.wait(lck);
+}
+
+bool IoWriter::collectJobs()
+{
+    jobs_.clear();
+    for(size_t i = 0; i < files_.size(); i++) {
+        ioFile& f = files_[i];
+        if(f.state == IO_FILE_FREE) continue;
+        if(f.pending.empty() && f.patches.empty() && f.state != IO_FILE_CLOSING) continue;
+
+        jobs_.push_back(ioJob());
+        ioJob& job = jobs_.back();
+        job.file = (int)i;
+        job.fd = f.fd;
+        job.offset = f.offset;
+        job.bytes = f.pending_bytes;
+        job.blocks.swap(f.pending); //the partially filled last block goes as well
+        f.pending.reserve(blocks_.size());
+        job.iov.resize(job.blocks.size());
+        for(size_t b = 0; b < job.blocks.size(); b++) {
+            job.iov[b].iov_base = job.blocks[b]->data.data();
+            job.iov[b].iov_len = job.blocks[b]->used;
+        }
+        job.patches.swap(f.patches);
+        job.close = f.state == IO_FILE_CLOSING;
+        job.result = 0;
+        f.offset += f.pending_bytes;
+        f.pending_bytes = 0;
+    }
+    return !jobs_.empty();
+}
+
+void IoWriter::completeJob(ioJob& job)
+{
+    if(!job.iov.empty()) {
+        if(job.result < 0) {
+            errors_++;
+            fprintf(stderr, "%s: ERROR: Write to %s failed (%s)\n", name_.c_str(), files_[job.file].name.c_str(), strerror((int)-job.result));
+        } else {
+            bytes_written_ += job.result;
+        }
+        long latency = (long)std::chrono::duration_cast<std::chrono::microseconds>(job.completed - job.submitted).count();
+        latency_us_total_ += latency;
+        if(latency > latency_us_max_) latency_us_max_ = latency;
+        iovs_submitted_ += job.iov.size();
+        submissions_++;
+    }
+
+    for(size_t b = 0; b < job.blocks.size(); b++) free_blocks_.push_back(job.blocks[b]);
+    queue_depth_ -= job.blocks.size();
+
+    // Small patches after the data of the file (e.g. WAV header sizes)
+    for(size_t p = 0; p < job.patches.size(); p++) {
+        if(pwrite(job.fd, job.patches[p].data, job.patches[p].bytes, job.patches[p].offset) != (ssize_t)job.patches[p].bytes) {
+            errors_++;
+            fprintf(stderr, "%s: ERROR: Patch of %s failed (%s)\n", name_.c_str(), files_[job.file].name.c_str(), strerror(errno));
+        }
+    }
+    if(job.close) {
+        ::close(job.fd);
+        files_[job.file].state = IO_FILE_FREE;
+        files_[job.file].fd = -1;
+    }
+}
+
+void IoWriter::run()
+{
+    printf("%s: Flusher Thread ready ...\n", name_.c_str());
+    std::unique_lock<std::mutex> lck(mtx_);
+    while(true)
+    {
+        if(run_fl_ && !flush_requested_) cv_.wait_for(lck, flush_interval_);
+        flush_requested_ = false;
+        if(!collectJobs()) {
+            if(!run_fl_) break;
+            continue;
+        }
+
+        // The recorders keep filling new blocks while the jobs are written
+        lck.unlock();
+        if(usesUring()) uringRun(jobs_); else poolRun(jobs_);
+        lck.lock();
+
+        for(size_t j = 0; j < jobs_.size(); j++) completeJob(jobs_[j]);
+        free_cv_.notify_all();
+    }
+    free_cv_.notify_all();
+    printf("%s: Flusher Thread finished ...\n", name_.c_str());
+}
+
+void IoWriter::writeJob(ioJob& job, size_t done_bytes)
+{
+    // Skipping what was already written
+    size_t first = 0;
+    size_t skip = done_bytes;
+    while(first < job.iov.size() && skip >= job.iov[first].iov_len) skip -= job.iov[first++].iov_len;
+    if(first < job.iov.size()) {
+        job.iov[first].iov_base = (char*)job.iov[first].iov_base + skip;
+        job.iov[first].iov_len -= skip;
+    }
+
+    job.result = done_bytes;
+    while(first < job.iov.size()) {
+        int count = (int)std::min(job.iov.size() - first, (size_t)IOV_MAX);
+        ssize_t n = pwritev(job.fd, &job.iov[first], count, job.offset + job.result);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            job.result = -errno;
+            break;
+        }
+        job.result += n;
+        while(first < job.iov.size() && (size_t)n >= job.iov[first].iov_len) n -= job.iov[first++].iov_len;
+        if(first < job.iov.size()) {
+            job.iov[first].iov_base = (char*)job.iov[first].iov_base + n;
+            job.iov[first].iov_len -= n;
+        }
+    }
+}
+
+void IoWriter::poolRun(std::vector<ioJob>& jobs)
+{
+    std::unique_lock<std::mutex> lck(pool_mtx_);
+    for(size_t j = 0; j < jobs.size(); j++) {
+        jobs[j].submitted = std::chrono::steady_clock::now();
+        if(jobs[j].iov.empty()) {
+            jobs[j].completed = jobs[j].submitted;
+            continue;
+        }
+        pool_jobs_.push_back(&jobs[j]);
+        pool_remaining_++;
+    }
+    pool_cv_.notify_all();
+    while(pool_remaining_ > 0) pool_done_cv_.wait(lck);
+}
+
+void IoWriter::pool_thread()
+{
+    std::unique_lock<std::mutex> lck(pool_mtx_);
+    while(true)
+    {
+        while(pool_run_ && pool_jobs_.empty()) pool_cv_.wait(lck);
+        if(pool_jobs_.empty()) break;
+        ioJob* job = pool_jobs_.front();
+        pool_jobs_.pop_front();
+
+        lck.unlock();
+        writeJob(*job, 0);
+        job->completed = std::chrono::steady_clock::now();
+        lck.lock();
+
+        if(--pool_remaining_ == 0) pool_done_cv_.notify_all();
+    }
+}
+
+#ifdef IO_WRITER_URING
+// The rings shared with the kernel (what liburing wraps)
+struct uringState
+{
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned int entries;
+};
+
+bool IoWriter::uringInit(unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0) return false; //old kernel, seccomp, io_uring_disabled, ...
+
+    uringState* st = new uringState();
+    st->entries = p.sq_entries;
+    st->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    st->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) st->sq_size = st->cq_size = std::max(st->sq_size, st->cq_size);
+    st->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    st->sq_ptr = mmap(0, st->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    st->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? st->sq_ptr :
+                 mmap(0, st->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(0, st->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(st->sq_ptr == MAP_FAILED || st->cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+        if(st->sq_ptr != MAP_FAILED) munmap(st->sq_ptr, st->sq_size);
+        if(st->cq_ptr != MAP_FAILED && st->cq_ptr != st->sq_ptr) munmap(st->cq_ptr, st->cq_size);
+        if(sqes != MAP_FAILED) munmap(sqes, st->sqes_size);
+        ::close(fd);
+        delete st;
+        return false;
+    }
+    char* sq = (char*)st->sq_ptr;
+    char* cq = (char*)st->cq_ptr;
+    st->sq_head = (unsigned*)(sq + p.sq_off.head);
+    st->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    st->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    st->sq_array = (unsigned*)(sq + p.sq_off.array);
+    st->cq_head = (unsigned*)(cq + p.cq_off.head);
+    st->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    st->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    st->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    st->sqes = (struct io_uring_sqe*)sqes;
+
+    uring_fd_ = fd;
+    uring_state_ = st;
+    return true;
+}
+
+void IoWriter::uringClose()
+{
+    if(uring_fd_ < 0) return;
+    uringState* st = (uringState*)uring_state_;
+    munmap(st->sqes, st->sqes_size);
+    if(st->cq_ptr != st->sq_ptr) munmap(st->cq_ptr, st->cq_size);
+    munmap(st->sq_ptr, st->sq_size);
+    ::close(uring_fd_);
+    delete st;
+    uring_fd_ = -1;
+    uring_state_ = nullptr;
+}
+
+void IoWriter::uringRun(std::vector<ioJob>& jobs)
+{
+    uringState* st = (uringState*)uring_state_;
+
+    // One IORING_OP_WRITEV per file: the writes of all files are in flight together
+    unsigned int submitted = 0;
+    unsigned int tail = *st->sq_tail;
+    for(size_t j = 0; j < jobs.size(); j++) {
+        ioJob& job = jobs[j];
+        job.submitted = std::chrono::steady_clock::now();
+        if(job.iov.empty()) {
+            job.completed = job.submitted;
+            continue;
+        }
+        unsigned int idx = tail & *st->sq_mask;
+        struct io_uring_sqe* sqe = &st->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = job.fd;
+        sqe->addr = (uint64_t)(uintptr_t)job.iov.data();
+        sqe->len = (uint32_t)std::min(job.iov.size(), (size_t)IOV_MAX);
+        sqe->off = (uint64_t)job.offset;
+        sqe->user_data = j;
+        st->sq_array[idx] = idx;
+        tail++;
+        submitted++;
+    }
+    if(submitted == 0) return;
+    __atomic_store_n(st->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned int to_submit = submitted;
+    unsigned int completed = 0;
+    while(completed < submitted) {
+        int ret = (int)syscall(__NR_io_uring_enter, uring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "%s: ERROR: io_uring_enter failed (%s)\n", name_.c_str(), strerror(errno));
+            break;
+        }
+        to_submit -= std::min((unsigned int)ret, to_submit);
+
+        unsigned int head = *st->cq_head;
+        unsigned int cq_tail = __atomic_load_n(st->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != cq_tail; head++, completed++) {
+            struct io_uring_cqe* cqe = &st->cqes[head & *st->cq_mask];
+            ioJob& job = jobs[cqe->user_data];
+            job.completed = std::chrono::steady_clock::now();
+            job.result = cqe->res;
+            if(cqe->res >= 0 && (size_t)cqe->res < job.bytes) {
+                // Short write (e.g. disk full or more than IOV_MAX blocks): the rest synchronously
+                writeJob(job, cqe->res);
+                job.completed = std::chrono::steady_clock::now();
+            }
+        }
+        __atomic_store_n(st->cq_head, head, __ATOMIC_RELEASE);
+    }
+    if(completed < submitted) {
+        // The ring failed: whatever did not complete is written synchronously
+        for(size_t j = 0; j < jobs.size(); j++) {
+            if(!jobs[j].iov.empty() && jobs[j].result == 0 && jobs[j].bytes > 0) writeJob(jobs[j], 0);
+        }
+    }
+}
+#else
+bool IoWriter::uringInit(unsigned int)
+{
+    return false;
+}
+
+void IoWriter::uringClose()
+{
+}
+
+void IoWriter::uringRun(std::vector<ioJob>& jobs)
+{
+    poolRun(jobs);
+}
+#endif
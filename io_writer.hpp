@@ -0,0 +1,186 @@
+/*
+Shared I/O writer service for all recorders.
+Recorders append data (write()) to their files through one IoWriter. The data is copied into fixed size blocks
+of a preallocated pool; a flusher thread periodically (or when a file has batch_bytes pending) submits all
+pending blocks of a file as ONE vectored write (pwritev semantics, one iovec per block) at the file offset.
+Backends:
+ - io_uring (IORING_OP_WRITEV, raw syscalls, no liburing): the writes of all files are in flight at once
+ - thread pool calling pwritev(): used when io_uring is not compiled in or the kernel refuses it
+If the block pool is exhausted write() waits for the flusher (counted as a stall): the memory use is bounded.
+writeAt() patches small ranges (e.g. WAV header sizes) after the pending data of the file was written.
+
+A minimal example:
+    IoWriter writer; //one per process, shared by all recorders
+    int wav = writer.openFile("rec_mic.wav");
+    writer.write(wav, data, bytes);   //from any recording thread
+    writer.writeAt(wav, 4, &riff_size, 4);
+    writer.closeFile(wav);
+    writer.finish();                  //flushes everything
+The counters (queue depth, write latency, ...) can be read at any time.
+ */
+
+#ifndef MIC_READ_THREAD_IO_WRITER_HPP
+#define MIC_READ_THREAD_IO_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <inttypes.h>
+#include <sys/uio.h>
+
+#define IO_WRITER_DEF_BLOCK_SIZE (64 * 1024)
+#define IO_WRITER_DEF_BLOCKS 128          //8 MB pool
+#define IO_WRITER_DEF_BATCH_BYTES (512 * 1024) //a file with this much pending is flushed right away
+#define IO_WRITER_DEF_FLUSH_MS 200
+#define IO_WRITER_DEF_THREADS 2
+#define IO_WRITER_MAX_FILES 64
+
+enum IoWriterBackend
+{
+    IO_BACKEND_AUTO = 0, //io_uring if available, otherwise threads
+    IO_BACKEND_URING,
+    IO_BACKEND_THREADS
+};
+
+class IoWriter
+{
+public:
+    IoWriter(IoWriterBackend backend=IO_BACKEND_AUTO,
+             size_t block_size=IO_WRITER_DEF_BLOCK_SIZE,
+             int blocks=IO_WRITER_DEF_BLOCKS,
+             size_t batch_bytes=IO_WRITER_DEF_BATCH_BYTES,
+             int flush_ms=IO_WRITER_DEF_FLUSH_MS,
+             int threads=IO_WRITER_DEF_THREADS);
+    ~IoWriter();
+
+    void finish(); //writes everything pending, closes all files and stops the threads
+
+    // Returns the file id or a negative error
+    int openFile(const std::string& filename);
+    // Appends (copies) the data. Thread safe
+    void write(int file, const void* data, size_t bytes);
+    // Writes a small range (<= 64 bytes) at an absolute offset after the pending appends of the file
+    void writeAt(int file, int64_t offset, const void* data, size_t bytes);
+    // Flushes the file and closes it. Blocks until the file is closed
+    void closeFile(int file);
+
+    bool usesUring() const {return uring_fd_ >= 0;}
+
+    // Counters
+    long getBytesWritten() const {return bytes_written_;}
+    long getSubmissions() const {return submissions_;}  //vectored writes
+    double getAvgIovPerSubmission() const {return submissions_ > 0 ? (double)iovs_submitted_ / submissions_ : 0.;}
+    long getQueueDepth() const {return queue_depth_;}   //pending blocks
+    long getMaxQueueDepth() const {return queue_depth_max_;}
+    double getAvgWriteLatencyUs() const {return submissions_ > 0 ? (double)latency_us_total_ / submissions_ : 0.;}
+    long getMaxWriteLatencyUs() const {return latency_us_max_;}
+    long getStalls() const {return stalls_;}            //write() waited for a free block
+    long getErrors() const {return errors_;}
+
+protected:
+    struct ioBlock
+    {
+        std::vector<char> data;
+        size_t used;
+    };
+
+    struct ioPatch
+    {
+        int64_t offset;
+        size_t bytes;
+        char data[64];
+    };
+
+    enum ioFileState
+    {
+        IO_FILE_FREE = 0,
+        IO_FILE_OPEN,
+        IO_FILE_CLOSING
+    };
+
+    struct ioFile
+    {
+        ioFileState state;
+        int fd;
+        std::string name;
+        int64_t offset; //file offset of the first pending byte
+        size_t pending_bytes;
+        std::vector<ioBlock*> pending;
+        std::vector<ioPatch> patches;
+    };
+
+    // One vectored write of a flush round
+    struct ioJob
+    {
+        int file;
+        int fd;
+        int64_t offset;
+        std::vector<ioBlock*> blocks;
+        std::vector<struct iovec> iov;
+        size_t bytes;
+        std::vector<ioPatch> patches;
+        bool close;
+        long result; //bytes written or -errno
+        std::chrono::steady_clock::time_point submitted;
+        std::chrono::steady_clock::time_point completed;
+    };
+
+    std::string name_;
+    IoWriterBackend backend_;
+    size_t block_size_;
+    size_t batch_bytes_;
+    std::chrono::milliseconds flush_interval_;
+    int threads_;
+
+    std::vector<ioBlock> blocks_;
+    std::vector<ioBlock*> free_blocks_;
+    std::vector<ioFile> files_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;       //flusher wake up
+    std::condition_variable free_cv_;  //free blocks / closed files
+    std::thread th_;
+    bool run_fl_;
+    bool flush_requested_;
+    std::vector<ioJob> jobs_; //flusher thread only
+
+    // Thread pool backend
+    std::vector<std::thread> pool_;
+    std::deque<ioJob*> pool_jobs_;
+    std::mutex pool_mtx_;
+    std::condition_variable pool_cv_;
+    std::condition_variable pool_done_cv_;
+    int pool_remaining_;
+    bool pool_run_;
+
+    // io_uring backend (see io_writer.cpp)
+    int uring_fd_;
+    void* uring_state_;
+
+    std::atomic<long> bytes_written_;
+    std::atomic<long> submissions_;
+    std::atomic<long> iovs_submitted_;
+    std::atomic<long> queue_depth_;
+    std::atomic<long> queue_depth_max_;
+    std::atomic<long> latency_us_total_;
+    std::atomic<long> latency_us_max_;
+    std::atomic<long> stalls_;
+    std::atomic<long> errors_;
+
+    void run();
+    bool collectJobs(); //call with mtx_ locked
+    void completeJob(ioJob& job); //call with mtx_ locked
+    void writeJob(ioJob& job, size_t done_bytes); //pwritev loop (thread pool and short write fallback)
+    void poolRun(std::vector<ioJob>& jobs);
+    void pool_thread();
+    bool uringInit(unsigned int entries);
+    void uringClose();
+    void uringRun(std::vector<ioJob>& jobs);
+};
+
+#endif //MIC_READ_THREAD_IO_WRITER_HPP
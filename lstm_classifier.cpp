@@ -0,0 +1,248 @@
+#include "lstm_classifier.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <algorithm>
+
+LstmClassifier::LstmClassifier():
+    steps_(0),
+    input_(0),
+    hidden_(0),
+    classes_(0),
+    batch_capacity_(0)
+{
+}
+
+static bool read_floats(std::ifstream& f, std::vector<float>& out, size_t n)
+{
+    out.resize(n);
+    f.read((char*)out.data(), n * sizeof(float));
+    return (bool)f;
+}
+
+int LstmClassifier::load(const std::string& filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    char magic[8];
+    uint32_t shape[5]; //layers, input, hidden, classes, steps
+    f.read(magic, sizeof(magic));
+    f.read((char*)shape, sizeof(shape));
+    if(!f || memcmp(magic, LSTM_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "LstmClassifier: ERROR: %s is not a weights file\n", filename.c_str());
+        return -1;
+    }
+
+    int layers = shape[0];
+    input_ = shape[1];
+    hidden_ = shape[2];
+    classes_ = shape[3];
+    steps_ = shape[4];
+    kernels_.resize(layers);
+    biases_.resize(layers);
+    for(int l = 0; l < layers; l++) {
+        if(!read_floats(f, kernels_[l], (size_t)(layerInput(l) + hidden_) * 4 * hidden_) ||
+           !read_floats(f, biases_[l], 4 * hidden_)) {
+            fprintf(stderr, "LstmClassifier: ERROR: %s is truncated (layer %d)\n", filename.c_str(), l);
+            return -2;
+        }
+    }
+    if(!read_floats(f, dense_w_, (size_t)hidden_ * classes_) || !read_floats(f, dense_b_, classes_)) {
+        fprintf(stderr, "LstmClassifier: ERROR: %s is truncated (dense layer)\n", filename.c_str());
+        return -2;
+    }
+
+    batch_capacity_ = 0;
+    fprintf(stdout, "LstmClassifier: Loaded %s: %d layers, input %d, hidden %d, classes %d, steps %d\n",
+            filename.c_str(), layers, input_, hidden_, classes_, steps_);
+    return 0;
+}
+
+void LstmClassifier::initRandom(int layers, int input, int hidden, int classes, int steps, unsigned int seed)
+{
+    input_ = input;
+    hidden_ = hidden;
+    classes_ = classes;
+    steps_ = steps;
+
+    std::mt19937 gen(seed);
+    float scale = 1.0f / sqrtf((float)hidden_);
+    std::uniform_real_distribution<float> dist(-scale, scale);
+
+    kernels_.assign(layers, std::vector<float>());
+    biases_.assign(layers, std::vector<float>(4 * hidden_, 0.f));
+    for(int l = 0; l < layers; l++) {
+        kernels_[l].resize((size_t)(layerInput(l) + hidden_) * 4 * hidden_);
+        for(size_t i = 0; i < kernels_[l].size(); i++) kernels_[l][i] = dist(gen);
+    }
+    dense_w_.resize((size_t)hidden_ * classes_);
+    for(size_t i = 0; i < dense_w_.size(); i++) dense_w_[i] = dist(gen);
+    dense_b_.assign(classes_, 0.f);
+    batch_capacity_ = 0;
+}
+
+void LstmClassifier::reserve(int batch)
+{
+    if(batch <= batch_capacity_) return;
+    batch_capacity_ = batch;
+    xh_.resize((size_t)batch * (std::max(input_, hidden_) + hidden_));
+    gates_.resize((size_t)batch * 4 * hidden_);
+    h_.resize(layers());
+    c_.resize(layers());
+    for(int l = 0; l < layers(); l++) {
+        h_[l].resize((size_t)batch * hidden_);
+        c_[l].resize((size_t)batch * hidden_);
+    }
+}
+
+// Register blocked kernel: ROWS rows x VECS vectors of C stay in registers for the whole k loop,
+// every loaded segment of B is used for ROWS rows (i.e. for ROWS windows of the batch).
+// GCC vector extensions map to SSE on x86 and NEON on ARM
+typedef float gemm_vec __attribute__((vector_size(16)));
+#define GEMM_VEC_SIZE 4
+#define GEMM_STRIP 32 //columns of B kept in L1 while all rows of the batch use them
+
+static inline gemm_vec gemm_load(const float* p)
+{
+    gemm_vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void gemm_store(float* p, gemm_vec v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+template <int ROWS, int VECS>
+static void gemm_block(const float* a, const float* b, float* c, int k, int n, int j0)
+{
+    gemm_vec acc[ROWS][VECS];
+    for(int r = 0; r < ROWS; r++) {
+        for(int v = 0; v < VECS; v++) acc[r][v] = gemm_load(c + (size_t)r * n + j0 + v * GEMM_VEC_SIZE);
+    }
+    for(int p = 0; p < k; p++)
+    {
+        const float* b_row = b + (size_t)p * n + j0;
+        gemm_vec b_vec[VECS];
+        for(int v = 0; v < VECS; v++) b_vec[v] = gemm_load(b_row + v * GEMM_VEC_SIZE);
+        for(int r = 0; r < ROWS; r++) {
+            const float a_rp = a[(size_t)r * k + p];
+            for(int v = 0; v < VECS; v++) acc[r][v] += a_rp * b_vec[v];
+        }
+    }
+    for(int r = 0; r < ROWS; r++) {
+        for(int v = 0; v < VECS; v++) gemm_store(c + (size_t)r * n + j0 + v * GEMM_VEC_SIZE, acc[r][v]);
+    }
+}
+
+void gemm_accumulate(const float* a, const float* b, float* c, int m, int k, int n)
+{
+    int j0 = 0;
+    // Column strips outer: a k x GEMM_STRIP strip of B stays in cache while it is used for all rows
+    for(; j0 + GEMM_STRIP <= n; j0 += GEMM_STRIP)
+    {
+        int i = 0;
+        for(; i + 4 <= m; i += 4) {
+            for(int q = 0; q < GEMM_STRIP; q += 2 * GEMM_VEC_SIZE) {
+                gemm_block<4, 2>(a + (size_t)i * k, b, c + (size_t)i * n, k, n, j0 + q);
+            }
+        }
+        // Single rows (e.g. a batch of 1) use the whole strip: 8 independent accumulators
+        for(; i < m; i++) {
+            gemm_block<1, GEMM_STRIP / GEMM_VEC_SIZE>(a + (size_t)i * k, b, c + (size_t)i * n, k, n, j0);
+        }
+    }
+    for(; j0 + 2 * GEMM_VEC_SIZE <= n; j0 += 2 * GEMM_VEC_SIZE)
+    {
+        int i = 0;
+        for(; i + 4 <= m; i += 4) gemm_block<4, 2>(a + (size_t)i * k, b, c + (size_t)i * n, k, n, j0);
+        for(; i < m; i++) gemm_block<1, 2>(a + (size_t)i * k, b, c + (size_t)i * n, k, n, j0);
+    }
+    // Remaining columns (e.g. the dense layer with 2 classes)
+    for(int r = 0; r < m; r++) {
+        for(int p = 0; p < k; p++) {
+            const float a_rp = a[(size_t)r * k + p];
+            for(int j = j0; j < n; j++) {
+                c[(size_t)r * n + j] += a_rp * b[(size_t)p * n + j];
+            }
+        }
+    }
+}
+
+static inline float sigmoid(float x)
+{
+    return 1.0f / (1.0f + expf(-x));
+}
+
+void LstmClassifier::predict(const float* windows, int batch, float* probs)
+{
+    reserve(batch);
+    const int h4 = 4 * hidden_;
+    for(int l = 0; l < layers(); l++) {
+        std::fill(h_[l].begin(), h_[l].begin() + (size_t)batch * hidden_, 0.f);
+        std::fill(c_[l].begin(), c_[l].begin() + (size_t)batch * hidden_, 0.f);
+    }
+
+    for(int t = 0; t < steps_; t++)
+    {
+        for(int l = 0; l < layers(); l++)
+        {
+            const int in = layerInput(l);
+            const int row = in + hidden_;
+            // [x_t, h_{t-1}] for every window of the batch
+            for(int b = 0; b < batch; b++) {
+                const float* x = (l == 0) ? windows + ((size_t)b * steps_ + t) * input_
+                                          : &h_[l - 1][(size_t)b * hidden_];
+                memcpy(&xh_[(size_t)b * row], x, in * sizeof(float));
+                memcpy(&xh_[(size_t)b * row + in], &h_[l][(size_t)b * hidden_], hidden_ * sizeof(float));
+            }
+            for(int b = 0; b < batch; b++) {
+                memcpy(&gates_[(size_t)b * h4], biases_[l].data(), h4 * sizeof(float));
+            }
+            gemm_accumulate(xh_.data(), kernels_[l].data(), gates_.data(), batch, row, h4);
+
+            for(int b = 0; b < batch; b++)
+            {
+                const float* g = &gates_[(size_t)b * h4];
+                float* h = &h_[l][(size_t)b * hidden_];
+                float* c = &c_[l][(size_t)b * hidden_];
+                for(int j = 0; j < hidden_; j++) {
+                    float i_g = sigmoid(g[j]);
+                    float j_g = tanhf(g[hidden_ + j]);
+                    float f_g = sigmoid(g[2 * hidden_ + j] + LSTM_FORGET_BIAS);
+                    float o_g = sigmoid(g[3 * hidden_ + j]);
+                    c[j] = f_g * c[j] + i_g * j_g;
+                    h[j] = o_g * tanhf(c[j]);
+                }
+            }
+        }
+    }
+
+    // Dense + softmax on the last output of the top layer
+    const std::vector<float>& top = h_[layers() - 1];
+    for(int b = 0; b < batch; b++) {
+        memcpy(probs + (size_t)b * classes_, dense_b_.data(), classes_ * sizeof(float));
+    }
+    gemm_accumulate(top.data(), dense_w_.data(), probs, batch, hidden_, classes_);
+    for(int b = 0; b < batch; b++)
+    {
+        float* p = probs + (size_t)b * classes_;
+        float max_val = *std::max_element(p, p + classes_);
+        float sum = 0.f;
+        for(int k = 0; k < classes_; k++) {
+            p[k] = expf(p[k] - max_val);
+            sum += p[k];
+        }
+        for(int k = 0; k < classes_; k++) p[k] /= sum;
+    }
+}
+
+int LstmClassifier::predictClass(const float* window)
+{
+    std::vector<float> probs(classes_);
+    predict(window, 1, probs.data());
+    return (int)(std::max_element(probs.begin(), probs.end()) - probs.begin());
+}
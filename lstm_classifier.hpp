@@ -0,0 +1,86 @@
+/*
+Native inference of the puddle classifier trained by train_simple_puddle_classifier*.py:
+a stack of LSTMCells (tf.nn.rnn_cell.LSTMCell, forget_bias=1) over [steps x input] MFCC windows,
+the last output of the top layer goes through a dense layer and a softmax.
+Weights are exported from a TF checkpoint with export_lstm_weights.py.
+
+Windows are evaluated in batches: at every time step the [batch x (input+hidden)] activations are
+multiplied by the [(input+hidden) x 4*hidden] kernel as one matrix-matrix product, thus every kernel
+row is loaded once per batch instead of once per window.
+
+A minimal example:
+    LstmClassifier model;
+    model.load("_results_temp/mic_wet_predictor/micpred_rnn.lstm");
+    std::vector<float> probs(batch * model.classes());
+    model.predict(windows, batch, probs.data()); //windows: batch * steps * input floats
+ */
+
+#ifndef MIC_READ_THREAD_LSTM_CLASSIFIER_HPP
+#define MIC_READ_THREAD_LSTM_CLASSIFIER_HPP
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#define LSTM_MAGIC "PDLLSTM1"
+#define LSTM_DEF_STEPS 41
+#define LSTM_DEF_INPUT 20
+#define LSTM_DEF_HIDDEN 300
+#define LSTM_DEF_LAYERS 2
+#define LSTM_DEF_CLASSES 2
+#define LSTM_FORGET_BIAS 1.0f
+
+class LstmClassifier
+{
+public:
+    LstmClassifier();
+
+    // Loads weights written by export_lstm_weights.py. Returns a negative value on failure
+    int load(const std::string& filename);
+    // Random weights of the given shape (benchmarking without a trained model)
+    void initRandom(int layers=LSTM_DEF_LAYERS,
+                    int input=LSTM_DEF_INPUT,
+                    int hidden=LSTM_DEF_HIDDEN,
+                    int classes=LSTM_DEF_CLASSES,
+                    int steps=LSTM_DEF_STEPS,
+                    unsigned int seed=0);
+
+    // windows: batch x steps x input floats (the [41 x 20] layout of the feature store)
+    // probs: batch x classes softmax outputs
+    void predict(const float* windows, int batch, float* probs);
+    // Argmax helper
+    int predictClass(const float* window);
+
+    int steps() const {return steps_;}
+    int input() const {return input_;}
+    int hidden() const {return hidden_;}
+    int classes() const {return classes_;}
+    int layers() const {return (int)kernels_.size();}
+    size_t windowSize() const {return (size_t)steps_ * input_;}
+
+protected:
+    int steps_;
+    int input_;
+    int hidden_;
+    int classes_;
+
+    std::vector<std::vector<float> > kernels_; //per layer: (layer_input + hidden) x 4*hidden, gates i, j, f, o
+    std::vector<std::vector<float> > biases_;  //per layer: 4*hidden
+    std::vector<float> dense_w_;               //hidden x classes
+    std::vector<float> dense_b_;               //classes
+
+    // Work buffers (grown to the largest batch seen, then reused)
+    int batch_capacity_;
+    std::vector<float> xh_;    //batch x (max layer input + hidden)
+    std::vector<float> gates_; //batch x 4*hidden
+    std::vector<std::vector<float> > h_; //per layer: batch x hidden
+    std::vector<std::vector<float> > c_;
+
+    void reserve(int batch);
+    int layerInput(int layer) const {return layer == 0 ? input_ : hidden_;}
+};
+
+// C = A * B accumulated into C. A: m x k, B: k x n, C: m x n (row major)
+void gemm_accumulate(const float* a, const float* b, float* c, int m, int k, int n);
+
+#endif //MIC_READ_THREAD_LSTM_CLASSIFIER_HPP
@@ -0,0 +1,301 @@
+#include "metrics_exporter.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+MetricsExporter::MetricsExporter(std::string address):
+    address_(address),
+    name_("MetricsExporter"),
+    fd_(-1),
+    run_fl_(false),
+    scrapes_(0)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    finish();
+}
+
+void MetricsExporter::addReader(const MicReadAlsa* reader, std::string device)
+{
+    readerSource src;
+    src.reader = reader;
+    src.device = device;
+    src.chunks_read_prev = reader->getChunksRead();
+    src.chunks_recorded_prev = reader->getChunksRecorded();
+    src.read_rate = 0.;
+    src.record_rate = 0.;
+    readers_.push_back(src);
+}
+
+void MetricsExporter::addWriter(const IoWriter* writer, std::string name)
+{
+    writerSource src;
+    src.writer = writer;
+    src.name = name;
+    writers_.push_back(src);
+}
+
+int MetricsExporter::start()
+{
+    if(run_fl_) return 0;
+
+    if(address_.compare(0, 5, "unix:") == 0) {
+        unix_path_ = address_.substr(5);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(unix_path_.size() >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "%s: ERROR: Socket path too long: %s\n", name_.c_str(), unix_path_.c_str());
+            return -1;
+        }
+        strncpy(addr.sun_path, unix_path_.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(unix_path_.c_str()); //left over from a previous run
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd_ < 0 || bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "%s: ERROR: Cannot bind %s (%s)\n", name_.c_str(), address_.c_str(), strerror(errno));
+            if(fd_ >= 0) close(fd_);
+            fd_ = -1;
+            return -2;
+        }
+    } else {
+        size_t colon = address_.rfind(':');
+        std::string host = colon == std::string::npos ? "127.0.0.1" : address_.substr(0, colon);
+        int port = atoi(address_.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if(inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 || port <= 0) {
+            fprintf(stderr, "%s: ERROR: Invalid address %s\n", name_.c_str(), address_.c_str());
+            return -1;
+        }
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if(fd_ >= 0) setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(fd_ < 0 || bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "%s: ERROR: Cannot bind %s (%s)\n", name_.c_str(), address_.c_str(), strerror(errno));
+            if(fd_ >= 0) close(fd_);
+            fd_ = -1;
+            return -2;
+        }
+    }
+    if(listen(fd_, 4) < 0) {
+        fprintf(stderr, "%s: ERROR: Cannot listen on %s (%s)\n", name_.c_str(), address_.c_str(), strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return -3;
+    }
+
+    rates_time_ = std::chrono::steady_clock::now();
+    run_fl_ = true;
+    th_ = std::thread(&MetricsExporter::run, this);
+    printf("%s: Serving metrics on %s\n", name_.c_str(), address_.c_str());
+    return 0;
+}
+
+void MetricsExporter::finish()
+{
+    if(!run_fl_) return;
+    run_fl_ = false;
+    th_.join();
+    close(fd_);
+    fd_ = -1;
+    if(!unix_path_.empty()) unlink(unix_path_.c_str());
+}
+
+void MetricsExporter::run()
+{
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    while(run_fl_)
+    {
+        // The timeout doubles as the rate update tick
+        int ret = poll(&pfd, 1, 250);
+        if(std::chrono::steady_clock::now() - rates_time_ >= std::chrono::seconds(1)) updateRates();
+        if(ret <= 0 || !(pfd.revents & POLLIN)) continue;
+        int client = accept(fd_, nullptr, nullptr);
+        if(client < 0) continue;
+        serve(client);
+        close(client);
+    }
+}
+
+void MetricsExporter::updateRates()
+{
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - rates_time_).count();
+    rates_time_ = now;
+    for(size_t i = 0; i < readers_.size(); i++) {
+        readerSource& src = readers_[i];
+        long read = src.reader->getChunksRead();
+        long recorded = src.reader->getChunksRecorded();
+        src.read_rate = (read - src.chunks_read_prev) / dt;
+        src.record_rate = (recorded - src.chunks_recorded_prev) / dt;
+        src.chunks_read_prev = read;
+        src.chunks_recorded_prev = recorded;
+    }
+}
+
+void MetricsExporter::serve(int client)
+{
+    // The request itself does not matter: every path returns the metrics
+    struct timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char request[1024];
+    if(recv(client, request, sizeof(request), 0) <= 0) return;
+
+    std::string body = render();
+    char header[160];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+             body.size());
+    std::string response = header + body;
+    size_t sent = 0;
+    while(sent < response.size()) {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return;
+        sent += n;
+    }
+    scrapes_++;
+}
+
+// One "# HELP / # TYPE" block per metric, then one sample per source
+static void metric_header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+static void metric_sample(std::string& out, const char* name, const std::string& labels, double value)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%s{%s} %.9g\n", name, labels.c_str(), value);
+    out += line;
+}
+
+std::string MetricsExporter::render() const
+{
+    std::string out;
+    out.reserve(4096);
+
+    struct readerMetric
+    {
+        const char* name;
+        const char* type;
+        const char* help;
+    };
+    static const readerMetric reader_metrics[] = {
+        {"micread_chunks_read_total", "counter", "Chunks read from the device"},
+        {"micread_chunks_recorded_total", "counter", "Chunks written by the recording thread"},
+        {"micread_chunks_dropped_total", "counter", "Chunks dropped because a consumer held the buffer lock"},
+        {"micread_chunks_shed_total", "counter", "Chunks dropped by the queue policy"},
+        {"micread_chunks_decimated_total", "counter", "Chunks marked to be skipped by the processing"},
+        {"micread_processing_stride", "gauge", "Every k-th chunk is processed (1: full rate)"},
+        {"micread_xruns_total", "counter", "ALSA overruns"},
+        {"micread_read_errors_total", "counter", "Failed or short reads other than overruns"},
+        {"micread_queue_depth", "gauge", "Chunks waiting in the main buffer"},
+        {"micread_read_chunks_per_second", "gauge", "Chunks read per second"},
+        {"micread_record_chunks_per_second", "gauge", "Chunks recorded per second"},
+        {"micread_sample_rate_hz", "gauge", "Drift corrected sample rate of the device"},
+        {"micread_buffered_bytes", "gauge", "Memory of the buffered chunks"},
+        {"micread_chunks_spilled_total", "counter", "Chunks spilled to disk over the memory budget"},
+        {"micread_spill_file_bytes", "gauge", "Spilled audio waiting on disk"},
+    };
+    for(size_t m = 0; m < sizeof(reader_metrics) / sizeof(reader_metrics[0]); m++) {
+        if(readers_.empty()) break;
+        metric_header(out, reader_metrics[m].name, reader_metrics[m].type, reader_metrics[m].help);
+        for(size_t i = 0; i < readers_.size(); i++) {
+            const MicReadAlsa* r = readers_[i].reader;
+            double value = 0.;
+            switch(m) {
+            case 0: value = r->getChunksRead(); break;
+            case 1: value = r->getChunksRecorded(); break;
+            case 2: value = r->getChunksDropped(); break;
+            case 3: value = r->getChunksShed(); break;
+            case 4: value = r->getChunksDecimated(); break;
+            case 5: value = r->getProcessingStride(); break;
+            case 6: value = r->getXruns(); break;
+            case 7: value = r->getReadErrors(); break;
+            case 8: value = r->getQueueDepth(); break;
+            case 9: value = readers_[i].read_rate; break;
+            case 10: value = readers_[i].record_rate; break;
+            case 11: value = r->getRateEstimate(); break;
+            case 12: value = r->getBufferedBytes(); break;
+            case 13: value = r->getChunksSpilled(); break;
+            case 14: value = r->getSpillFileBytes(); break;
+            }
+            metric_sample(out, reader_metrics[m].name, "device=\"" + readers_[i].device + "\"", value);
+        }
+    }
+
+    // Stage latencies in the reading thread
+    static const readerMetric stage_metrics[] = {
+        {"micread_stage_calls_total", "counter", "Chunks processed by the stage"},
+        {"micread_stage_seconds_total", "counter", "Time spent in the stage"},
+        {"micread_stage_max_seconds", "gauge", "Longest single call of the stage"},
+    };
+    bool stages = false;
+    for(size_t i = 0; i < readers_.size(); i++) stages = stages || readers_[i].reader->getStageCount() > 0;
+    for(size_t m = 0; stages && m < sizeof(stage_metrics) / sizeof(stage_metrics[0]); m++) {
+        metric_header(out, stage_metrics[m].name, stage_metrics[m].type, stage_metrics[m].help);
+        for(size_t i = 0; i < readers_.size(); i++) {
+            const MicReadAlsa* r = readers_[i].reader;
+            for(size_t s = 0; s < r->getStageCount(); s++) {
+                const MicReadStageStats& stats = r->getStageStats(s);
+                double value = m == 0 ? (double)stats.calls : (m == 1 ? stats.total_ns * 1e-9 : stats.max_ns * 1e-9);
+                metric_sample(out, stage_metrics[m].name,
+                              "device=\"" + readers_[i].device + "\",stage=\"" + std::to_string(s) + "\"", value);
+            }
+        }
+    }
+
+    static const readerMetric writer_metrics[] = {
+        {"micread_io_queue_depth", "gauge", "Blocks waiting to be written"},
+        {"micread_io_queue_depth_max", "gauge", "Largest number of blocks waiting"},
+        {"micread_io_bytes_written_total", "counter", "Bytes written"},
+        {"micread_io_submissions_total", "counter", "Vectored writes submitted"},
+        {"micread_io_write_latency_avg_seconds", "gauge", "Mean latency of a vectored write"},
+        {"micread_io_write_latency_max_seconds", "gauge", "Longest vectored write"},
+        {"micread_io_stalls_total", "counter", "Writes that waited for a free block"},
+        {"micread_io_errors_total", "counter", "Failed writes"},
+    };
+    for(size_t m = 0; m < sizeof(writer_metrics) / sizeof(writer_metrics[0]); m++) {
+        if(writers_.empty()) break;
+        metric_header(out, writer_metrics[m].name, writer_metrics[m].type, writer_metrics[m].help);
+        for(size_t i = 0; i < writers_.size(); i++) {
+            const IoWriter* w = writers_[i].writer;
+            double value = 0.;
+            switch(m) {
+            case 0: value = w->getQueueDepth(); break;
+            case 1: value = w->getMaxQueueDepth(); break;
+            case 2: value = w->getBytesWritten(); break;
+            case 3: value = w->getSubmissions(); break;
+            case 4: value = w->getAvgWriteLatencyUs() * 1e-6; break;
+            case 5: value = w->getMaxWriteLatencyUs() * 1e-6; break;
+            case 6: value = w->getStalls(); break;
+            case 7: value = w->getErrors(); break;
+            }
+            metric_sample(out, writer_metrics[m].name, "writer=\"" + writers_[i].name + "\"", value);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,90 @@
+/*
+Prometheus metrics of the capture pipeline served over localhost HTTP or a Unix socket.
+Every scrape reads only atomic counters of the registered readers / writers: nothing is locked
+and the reading threads are not disturbed. The exporter thread also derives the read / record rates
+(chunks per second) from the counters once per second.
+Addresses:
+ - "127.0.0.1:9464"                 : TCP port (the exporter only binds to the loopback interface)
+ - "unix:/tmp/micread_metrics.sock" : Unix socket (curl --unix-socket /tmp/micread_metrics.sock http://localhost/metrics)
+Metrics (label device=<name given to addReader()>):
+    micread_chunks_read_total, micread_chunks_recorded_total, micread_chunks_dropped_total,
+    micread_chunks_shed_total, micread_chunks_decimated_total, micread_processing_stride (queue policy),
+    micread_xruns_total, micread_read_errors_total, micread_queue_depth,
+    micread_read_chunks_per_second, micread_record_chunks_per_second, micread_sample_rate_hz,
+    micread_stage_calls_total / micread_stage_seconds_total / micread_stage_max_seconds (label stage=<index>),
+    micread_io_* for IoWriter (label writer=<name>)
+
+A minimal example:
+    MetricsExporter metrics("127.0.0.1:9464");
+    metrics.addReader(&mic_reader, "front");
+    metrics.addWriter(&io_writer, "disk");
+    metrics.start();
+    ...
+    metrics.finish();
+ */
+
+#ifndef MIC_READ_THREAD_METRICS_EXPORTER_HPP
+#define MIC_READ_THREAD_METRICS_EXPORTER_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "micread_thread.hpp"
+#include "io_writer.hpp"
+
+#define MICREAD_DEF_METRICS_ADDRESS "127.0.0.1:9464"
+
+class MetricsExporter
+{
+public:
+    MetricsExporter(std::string address=MICREAD_DEF_METRICS_ADDRESS);
+    ~MetricsExporter();
+
+    // Register the sources before start() (the lists are not protected by a mutex)
+    void addReader(const MicReadAlsa* reader, std::string device);
+    void addWriter(const IoWriter* writer, std::string name);
+
+    int start(); //opens the socket and starts the thread. Negative on error
+    void finish();
+
+    long getScrapes() const {return scrapes_;}
+
+protected:
+    struct readerSource
+    {
+        const MicReadAlsa* reader;
+        std::string device;
+        long chunks_read_prev;
+        long chunks_recorded_prev;
+        double read_rate;   //chunks per second
+        double record_rate;
+    };
+
+    struct writerSource
+    {
+        const IoWriter* writer;
+        std::string name;
+    };
+
+    std::string address_;
+    std::string unix_path_;
+    std::string name_;
+    int fd_;
+    std::thread th_;
+    std::atomic<bool> run_fl_;
+    std::atomic<long> scrapes_;
+
+    std::vector<readerSource> readers_;
+    std::vector<writerSource> writers_;
+    std::chrono::steady_clock::time_point rates_time_;
+
+    void run();
+    void updateRates(); //exporter thread only
+    std::string render() const; //Prometheus text format of the current values
+    void serve(int client);
+};
+
+#endif //MIC_READ_THREAD_METRICS_EXPORTER_HPP
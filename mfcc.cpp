@@ -0,0 +1,172 @@
+#include "mfcc.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+// Slaney mel scale (librosa htk=False): linear below 1 kHz, logarithmic above
+static double hz_to_mel(double hz)
+{
+    const double f_sp = 200.0 / 3;
+    const double min_log_hz = 1000.0;
+    const double min_log_mel = min_log_hz / f_sp;
+    const double logstep = log(6.4) / 27.0;
+    if(hz >= min_log_hz) return min_log_mel + log(hz / min_log_hz) / logstep;
+    return hz / f_sp;
+}
+
+static double mel_to_hz(double mel)
+{
+    const double f_sp = 200.0 / 3;
+    const double min_log_hz = 1000.0;
+    const double min_log_mel = min_log_hz / f_sp;
+    const double logstep = log(6.4) / 27.0;
+    if(mel >= min_log_mel) return min_log_hz * exp(logstep * (mel - min_log_mel));
+    return mel * f_sp;
+}
+
+MfccExtractor::MfccExtractor(unsigned int rate,
+                             int n_mfcc,
+                             int fft_size,
+                             int hop,
+                             int n_mels,
+                             float top_db):
+    rate_(rate),
+    n_mfcc_(std::min(n_mfcc, n_mels)),
+    hop_(hop),
+    n_mels_(n_mels),
+    top_db_(top_db),
+    fft_(fft_size)
+{
+    int n = fft_.size();
+    if(hop_ <= 0) {
+        fprintf(stderr, "MfccExtractor: WARNING: hop %d is out of range. Using %d\n", hop_, n / 4);
+        hop_ = n / 4;
+    }
+
+    // Periodic hann (scipy.signal.get_window('hann', n_fft, fftbins=True))
+    window_.resize(n);
+    for(int i = 0; i < n; i++) {
+        window_[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+    }
+
+    melFilterBank(rate_, n, n_mels_, mel_start_, mel_len_, mel_offset_, mel_weights_);
+
+    // Orthonormal DCT-II: c_k = s_k * sum_m x_m cos(pi k (2m + 1) / (2 M))
+    dct_.resize((size_t)n_mfcc_ * n_mels_);
+    for(int k = 0; k < n_mfcc_; k++) {
+        double scale = k == 0 ? sqrt(1.0 / n_mels_) : sqrt(2.0 / n_mels_);
+        for(int m = 0; m < n_mels_; m++) {
+            dct_[(size_t)k * n_mels_ + m] = (float)(scale * cos(M_PI * k * (2 * m + 1) / (2.0 * n_mels_)));
+        }
+    }
+
+    frame_.resize(n);
+    spec_re_.resize(fft_.bins());
+    spec_im_.resize(fft_.bins());
+    power_.resize(fft_.bins());
+}
+
+void MfccExtractor::melFilterBank(unsigned int rate, int fft_size, int n_mels, std::vector<int>& start,
+                                  std::vector<int>& len, std::vector<int>& offset, std::vector<float>& weights)
+{
+    int bins = fft_size / 2 + 1;
+    std::vector<double> mel_f(n_mels + 2);
+    double mel_min = hz_to_mel(0.0);
+    double mel_max = hz_to_mel(rate / 2.0);
+    for(int i = 0; i < n_mels + 2; i++) {
+        mel_f[i] = mel_to_hz(mel_min + (mel_max - mel_min) * i / (n_mels + 1));
+    }
+
+    start.resize(n_mels);
+    len.resize(n_mels);
+    offset.resize(n_mels);
+    weights.clear();
+    for(int m = 0; m < n_mels; m++) {
+        double lower_f = mel_f[m], center_f = mel_f[m + 1], upper_f = mel_f[m + 2];
+        double enorm = 2.0 / (upper_f - lower_f);
+        start[m] = -1;
+        len[m] = 0;
+        offset[m] = (int)weights.size();
+        for(int b = 0; b < bins; b++) {
+            double f = (double)rate * b / fft_size;
+            double lower = (f - lower_f) / (center_f - lower_f);
+            double upper = (upper_f - f) / (upper_f - center_f);
+            double w = std::max(0.0, std::min(lower, upper));
+            if(w <= 0.0) {
+                if(start[m] >= 0) break;
+                continue;
+            }
+            if(start[m] < 0) start[m] = b;
+            weights.push_back((float)(w * enorm));
+            len[m]++;
+        }
+        if(start[m] < 0) start[m] = 0; //empty band (too many mels for the fft size)
+    }
+}
+
+void MfccExtractor::compute(const int16_t* samples, size_t n, float* out, int channels)
+{
+    mono_.resize(n);
+    float scale = 1.f / (32768.f * channels);
+    for(size_t i = 0; i < n; i++) {
+        int sum = 0;
+        for(int c = 0; c < channels; c++) sum += samples[i * channels + c];
+        mono_[i] = sum * scale;
+    }
+    compute(mono_.data(), n, out);
+}
+
+void MfccExtractor::compute(const float* signal, size_t n, float* out)
+{
+    const int size = fft_.size();
+    const int pad = size / 2;
+    const int bins = fft_.bins();
+    size_t frames_num = frames(n);
+
+    // Centered frames: reflect padding (the edge sample is not repeated)
+    padded_.resize(n + 2 * pad);
+    for(int i = 0; i < pad; i++) {
+        long left = pad - i;               //mirror of x[-left]
+        long right = (long)n - 2 - i;      //mirror of x[n + i]
+        padded_[i] = signal[std::min<long>(left, n - 1)];
+        padded_[pad + n + i] = signal[std::max<long>(right, 0)];
+    }
+    std::copy(signal, signal + n, padded_.begin() + pad);
+
+    // Mel power spectrogram in dB (the top_db floor needs the maximum of all frames)
+    mel_db_.resize(frames_num * n_mels_);
+    const double amin = 1e-10;
+    float max_db = -1e30f;
+    for(size_t t = 0; t < frames_num; t++) {
+        const float* x = &padded_[t * hop_];
+        for(int k = 0; k < size; k++) frame_[k] = x[k] * window_[k];
+        fft_.forward(frame_.data(), spec_re_.data(), spec_im_.data());
+        RealFFT::power(spec_re_.data(), spec_im_.data(), power_.data(), bins);
+
+        float* db = &mel_db_[t * n_mels_];
+        for(int m = 0; m < n_mels_; m++) {
+            const float* w = &mel_weights_[mel_offset_[m]];
+            const float* p = &power_[mel_start_[m]];
+            float sum = 0.f;
+            for(int k = 0; k < mel_len_[m]; k++) sum += w[k] * p[k];
+            db[m] = (float)(10.0 * log10(std::max<double>(sum, amin)));
+            max_db = std::max(max_db, db[m]);
+        }
+    }
+    if(top_db_ > 0.f) {
+        float floor_db = max_db - top_db_;
+        for(size_t i = 0; i < mel_db_.size(); i++) mel_db_[i] = std::max(mel_db_[i], floor_db);
+    }
+
+    for(size_t t = 0; t < frames_num; t++) {
+        const float* db = &mel_db_[t * n_mels_];
+        float* o = &out[t * n_mfcc_];
+        for(int k = 0; k < n_mfcc_; k++) {
+            const float* d = &dct_[(size_t)k * n_mels_];
+            float sum = 0.f;
+            for(int m = 0; m < n_mels_; m++) sum += d[m] * db[m];
+            o[k] = sum;
+        }
+    }
+}
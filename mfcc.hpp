@@ -0,0 +1,82 @@
+/*
+MFCC features matching librosa.feature.mfcc(y, sr, n_mfcc) with the librosa defaults used by the training scripts:
+ - STFT: n_fft 2048, hop 512, periodic hann window, centered frames (reflect padding of n_fft/2, the pad mode
+   of the librosa versions the models were trained with), power spectrum
+ - 128 mel bands from 0 Hz to sr/2 (Slaney mel scale, Slaney area normalization)
+ - power_to_db(ref=1, amin=1e-10, top_db=80): the floor is relative to the maximum of the whole signal
+ - DCT-II (orthonormal) of the mel bands, first n_mfcc coefficients
+A window of 20480 samples (40 chunks of 512) gives the [41 x 20] features of the LSTM classifier.
+All tables are built in the constructor; compute() only grows its work buffers for longer signals.
+
+A minimal example:
+    MfccExtractor mfcc(44100);
+    std::vector<float> features(mfcc.frames(20480) * mfcc.coefficients()); //41 x 20, time major
+    mfcc.compute(signal, 20480, features.data()); //signal: floats in [-1, 1) (int16 / 32768)
+ */
+
+#ifndef MIC_READ_THREAD_MFCC_HPP
+#define MIC_READ_THREAD_MFCC_HPP
+
+#include <vector>
+#include <cstddef>
+#include <inttypes.h>
+
+#include "fft.hpp"
+
+#define MFCC_DEF_COEFFS 20
+#define MFCC_DEF_FFT_SIZE 2048
+#define MFCC_DEF_HOP 512
+#define MFCC_DEF_MELS 128
+#define MFCC_DEF_TOP_DB 80.f
+
+class MfccExtractor
+{
+public:
+    MfccExtractor(unsigned int rate=44100,
+                  int n_mfcc=MFCC_DEF_COEFFS,
+                  int fft_size=MFCC_DEF_FFT_SIZE,
+                  int hop=MFCC_DEF_HOP,
+                  int n_mels=MFCC_DEF_MELS,
+                  float top_db=MFCC_DEF_TOP_DB);
+
+    int coefficients() const {return n_mfcc_;}
+    int mels() const {return n_mels_;}
+    int hop() const {return hop_;}
+    size_t frames(size_t samples) const {return 1 + samples / hop_;} //centered frames
+
+    // signal: n samples (n > fft_size / 2 for the reflect padding). out: frames(n) x coefficients(), time major
+    void compute(const float* signal, size_t n, float* out);
+    // Same for int16 samples (scaled by 1/32768). channels > 1: interleaved samples, averaged to mono (n frames)
+    void compute(const int16_t* samples, size_t n, float* out, int channels=1);
+
+    // librosa.filters.mel(sr, n_fft, n_mels, fmin=0, fmax=sr/2, htk=False, norm='slaney') as a sparse filter bank:
+    // band m covers the bins [start[m], start[m] + len[m]), its weights are weights[offset[m] ...]
+    static void melFilterBank(unsigned int rate, int fft_size, int n_mels, std::vector<int>& start,
+                              std::vector<int>& len, std::vector<int>& offset, std::vector<float>& weights);
+
+protected:
+    unsigned int rate_;
+    int n_mfcc_;
+    int hop_;
+    int n_mels_;
+    float top_db_;
+    RealFFT fft_;
+
+    std::vector<float> window_;
+    // Sparse mel filter bank: band m covers the bins [mel_start_[m], mel_start_[m] + mel_len_[m])
+    std::vector<int> mel_start_;
+    std::vector<int> mel_len_;
+    std::vector<float> mel_weights_; //concatenated weights of all bands, offsets in mel_offset_
+    std::vector<int> mel_offset_;
+    std::vector<float> dct_;         //n_mfcc x n_mels
+
+    std::vector<float> mono_;        //int16 / multichannel input converted to float
+    std::vector<float> padded_;      //reflect padded signal
+    std::vector<float> frame_;
+    std::vector<float> spec_re_;
+    std::vector<float> spec_im_;
+    std::vector<float> power_;
+    std::vector<float> mel_db_;      //frames x n_mels
+};
+
+#endif //MIC_READ_THREAD_MFCC_HPP
@@ -0,0 +1,163 @@
+#include "mfcc_fixed.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+FixedMfccExtractor::FixedMfccExtractor(unsigned int rate,
+                                       int n_mfcc,
+                                       int fft_size,
+                                       int hop,
+                                       int n_mels,
+                                       float top_db):
+    rate_(rate),
+    n_mfcc_(std::min(n_mfcc, n_mels)),
+    hop_(hop),
+    n_mels_(n_mels),
+    top_db_q_((int32_t)lround(top_db * (1 << MFCC_FIXED_FRAC_BITS))),
+    amin_log2_((int32_t)lround(log2(1e-10) * 65536.0)),
+    db_per_log2_((int32_t)lround(10.0 * log10(2.0) * 65536.0)),
+    fft_(fft_size)
+{
+    int n = fft_.size();
+    if(hop_ <= 0) {
+        fprintf(stderr, "FixedMfccExtractor: WARNING: hop %d is out of range. Using %d\n", hop_, n / 4);
+        hop_ = n / 4;
+    }
+
+    // Periodic hann in Q15
+    window_.resize(n);
+    for(int i = 0; i < n; i++) {
+        window_[i] = (int16_t)std::min(32767L, lround((0.5 - 0.5 * cos(2.0 * M_PI * i / n)) * 32768.0));
+    }
+
+    const int table_size = 1 << MFCC_FIXED_LOG_TABLE_BITS;
+    log_table_.resize(table_size + 1);
+    for(int i = 0; i <= table_size; i++) {
+        log_table_[i] = (int32_t)lround(log2(1.0 + (double)i / table_size) * 65536.0);
+    }
+
+    // The float filter bank quantized band by band: the largest weight of a band gets the full 16 bits
+    std::vector<float> weights;
+    MfccExtractor::melFilterBank(rate_, n, n_mels_, mel_start_, mel_len_, mel_offset_, weights);
+    mel_weights_.resize(weights.size());
+    mel_shift_.resize(n_mels_);
+    for(int m = 0; m < n_mels_; m++) {
+        float w_max = 0.f;
+        for(int k = 0; k < mel_len_[m]; k++) w_max = std::max(w_max, weights[mel_offset_[m] + k]);
+        mel_shift_[m] = w_max > 0.f ? (int)floor(log2(65535.0 / w_max)) : 0;
+        for(int k = 0; k < mel_len_[m]; k++) {
+            double w = ldexp((double)weights[mel_offset_[m] + k], mel_shift_[m]);
+            mel_weights_[mel_offset_[m] + k] = (uint16_t)std::min(65535L, lround(w));
+        }
+    }
+
+    // Orthonormal DCT-II in Q15
+    dct_.resize((size_t)n_mfcc_ * n_mels_);
+    for(int k = 0; k < n_mfcc_; k++) {
+        double scale = k == 0 ? sqrt(1.0 / n_mels_) : sqrt(2.0 / n_mels_);
+        for(int m = 0; m < n_mels_; m++) {
+            dct_[(size_t)k * n_mels_ + m] = (int16_t)lround(scale * cos(M_PI * k * (2 * m + 1) / (2.0 * n_mels_)) * 32768.0);
+        }
+    }
+
+    frame_.resize(n);
+    spec_re_.resize(fft_.bins());
+    spec_im_.resize(fft_.bins());
+    power_.resize(fft_.bins());
+}
+
+int32_t FixedMfccExtractor::log2Q16(uint64_t v) const
+{
+    int exponent = 63 - __builtin_clzll(v);
+    // The 32 bits below the leading one: 8 bits table index, the next 16 bits interpolate
+    uint32_t mantissa = (uint32_t)(exponent >= 32 ? v >> (exponent - 32) : v << (32 - exponent));
+    uint32_t index = mantissa >> (32 - MFCC_FIXED_LOG_TABLE_BITS);
+    int32_t fraction = (int32_t)((mantissa >> (16 - MFCC_FIXED_LOG_TABLE_BITS)) & 0xffff);
+    int32_t low = log_table_[index];
+    int32_t high = log_table_[index + 1];
+    return (exponent << 16) + low + (int32_t)(((int64_t)(high - low) * fraction) >> 16);
+}
+
+void FixedMfccExtractor::compute(const int16_t* samples, size_t n, float* out, int channels)
+{
+    out_q_.resize(frames(n) * n_mfcc_);
+    compute(samples, n, out_q_.data(), channels);
+    const float scale = 1.f / (1 << MFCC_FIXED_FRAC_BITS);
+    for(size_t i = 0; i < out_q_.size(); i++) out[i] = out_q_[i] * scale;
+}
+
+void FixedMfccExtractor::compute(const int16_t* samples, size_t n, int32_t* out, int channels)
+{
+    const int size = fft_.size();
+    const int pad = size / 2;
+    const int bins = fft_.bins();
+    size_t frames_num = frames(n);
+
+    const int16_t* signal = samples;
+    if(channels > 1) {
+        mono_.resize(n);
+        for(size_t i = 0; i < n; i++) {
+            int sum = 0;
+            for(int c = 0; c < channels; c++) sum += samples[i * channels + c];
+            mono_[i] = (int16_t)((sum + (sum >= 0 ? channels / 2 : -channels / 2)) / channels);
+        }
+        signal = mono_.data();
+    }
+
+    // Centered frames: reflect padding (the edge sample is not repeated)
+    padded_.resize(n + 2 * pad);
+    for(int i = 0; i < pad; i++) {
+        long left = pad - i;               //mirror of x[-left]
+        long right = (long)n - 2 - i;      //mirror of x[n + i]
+        padded_[i] = signal[std::min<long>(left, n - 1)];
+        padded_[pad + n + i] = signal[std::max<long>(right, 0)];
+    }
+    std::copy(signal, signal + n, padded_.begin() + pad);
+
+    // Mel power spectrogram in dB, Q8 (the top_db floor needs the maximum of all frames).
+    // In float units (samples / 32768) a band is sum * 2^(2 (exponent - 15) - mel_shift)
+    mel_db_.resize(frames_num * n_mels_);
+    int32_t max_db = INT32_MIN;
+    for(size_t t = 0; t < frames_num; t++) {
+        // Quiet frames keep their resolution: the windowed frame is scaled up by 2^gain to the full 15 bits
+        const int16_t* x = &padded_[t * hop_];
+        uint32_t mask = 0;
+        for(int k = 0; k < size; k++) mask |= (uint32_t)(x[k] ^ (x[k] >> 15)) & 0xffff;
+        const int gain = std::min(14, std::max(0, FFT_FIXED_DATA_BITS - FixedRealFFT::bitLength(mask)));
+        const int shift = 15 - gain;
+        for(int k = 0; k < size; k++) frame_[k] = (int16_t)((x[k] * window_[k] + (1 << (shift - 1))) >> shift);
+        int exponent = fft_.forward(frame_.data(), spec_re_.data(), spec_im_.data()) - gain;
+        FixedRealFFT::power(spec_re_.data(), spec_im_.data(), power_.data(), bins);
+        const int32_t frame_log2 = 2 * (exponent - 15) * 65536;
+
+        int32_t* db = &mel_db_[t * n_mels_];
+        for(int m = 0; m < n_mels_; m++) {
+            const uint16_t* w = &mel_weights_[mel_offset_[m]];
+            const uint64_t* p = &power_[mel_start_[m]];
+            uint64_t sum = 0;
+            for(int k = 0; k < mel_len_[m]; k++) sum += w[k] * p[k];
+            int32_t log2_q16 = amin_log2_;
+            if(sum > 0) log2_q16 = std::max(amin_log2_, log2Q16(sum) + frame_log2 - (mel_shift_[m] << 16));
+            // Q16 x Q16 -> Q8
+            db[m] = (int32_t)(((int64_t)log2_q16 * db_per_log2_ + (1LL << (31 - MFCC_FIXED_FRAC_BITS)))
+                              >> (32 - MFCC_FIXED_FRAC_BITS));
+            max_db = std::max(max_db, db[m]);
+        }
+    }
+    if(top_db_q_ > 0) {
+        int32_t floor_db = max_db - top_db_q_;
+        for(size_t i = 0; i < mel_db_.size(); i++) mel_db_[i] = std::max(mel_db_[i], floor_db);
+    }
+
+    for(size_t t = 0; t < frames_num; t++) {
+        const int32_t* db = &mel_db_[t * n_mels_];
+        int32_t* o = &out[t * n_mfcc_];
+        for(int k = 0; k < n_mfcc_; k++) {
+            const int16_t* d = &dct_[(size_t)k * n_mels_];
+            int64_t sum = 0;
+            for(int m = 0; m < n_mels_; m++) sum += (int32_t)d[m] * db[m];
+            o[k] = (int32_t)((sum + (1 << 14)) >> 15);
+        }
+    }
+}
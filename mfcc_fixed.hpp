@@ -0,0 +1,88 @@
+/*
+Integer MFCC path for cores without a fast FPU: the same features as MfccExtractor (librosa defaults, see mfcc.hpp),
+computed from the int16 samples without floating point:
+ - reflect padded centered frames of int16 samples, periodic hann window in Q15 (quiet frames are scaled up to
+   15 bits on the way: their resolution is not lost in the rounding of the window)
+ - block floating point FFT (FixedRealFFT) and a 64 bit power spectrum; the block exponent of every frame is kept
+ - mel filter bank with per band Q-format weights (16 bit, every band scaled to its own full range), 64 bit sums
+ - log2 approximation: leading bit + 256 entry Q16 table of the mantissa with linear interpolation (~1e-5),
+   dB = 10 log10(2) * log2 in Q8, with the exponents of the frame and the band added as integers
+ - power_to_db floors (amin 1e-10, top_db) and the orthonormal DCT-II (Q15 coefficients) in Q8
+The output is MFCC in Q8 (int32, MFCC_FIXED_FRAC_BITS) or converted to float for the LSTM classifier.
+Error against MfccExtractor (the librosa reference) and the classifier agreement: examples/benchmark_mfcc_fixed.cpp.
+All tables are built in the constructor (with floating point, once); compute() only grows its work buffers.
+
+A minimal example:
+    FixedMfccExtractor mfcc(44100);
+    std::vector<int32_t> features(mfcc.frames(20480) * mfcc.coefficients()); //41 x 20, time major, Q8
+    mfcc.compute(samples, 20480, features.data()); //samples: int16
+ */
+
+#ifndef MIC_READ_THREAD_MFCC_FIXED_HPP
+#define MIC_READ_THREAD_MFCC_FIXED_HPP
+
+#include <vector>
+#include <cstddef>
+#include <inttypes.h>
+
+#include "fft_fixed.hpp"
+#include "mfcc.hpp"
+
+#define MFCC_FIXED_FRAC_BITS 8 //fractional bits of the dB values and of the coefficients
+#define MFCC_FIXED_LOG_TABLE_BITS 8
+
+class FixedMfccExtractor
+{
+public:
+    FixedMfccExtractor(unsigned int rate=44100,
+                       int n_mfcc=MFCC_DEF_COEFFS,
+                       int fft_size=MFCC_DEF_FFT_SIZE,
+                       int hop=MFCC_DEF_HOP,
+                       int n_mels=MFCC_DEF_MELS,
+                       float top_db=MFCC_DEF_TOP_DB);
+
+    int coefficients() const {return n_mfcc_;}
+    int mels() const {return n_mels_;}
+    int hop() const {return hop_;}
+    size_t frames(size_t samples) const {return 1 + samples / hop_;} //centered frames
+
+    // n frames of int16 samples (n > fft_size / 2). channels > 1: interleaved samples, averaged to mono.
+    // out: frames(n) x coefficients(), time major, Q8
+    void compute(const int16_t* samples, size_t n, int32_t* out, int channels=1);
+    // Same, converted to float (drop-in for MfccExtractor::compute())
+    void compute(const int16_t* samples, size_t n, float* out, int channels=1);
+
+    // log2(v) in Q16 (v > 0)
+    int32_t log2Q16(uint64_t v) const;
+
+protected:
+    unsigned int rate_;
+    int n_mfcc_;
+    int hop_;
+    int n_mels_;
+    int32_t top_db_q_;   //Q8
+    int32_t amin_log2_;  //log2(amin) in Q16
+    int32_t db_per_log2_; //10 log10(2) in Q16
+    FixedRealFFT fft_;
+
+    std::vector<int16_t> window_;     //Q15
+    std::vector<int32_t> log_table_;  //log2(1 + i / 256) in Q16, 257 entries
+    // Sparse mel filter bank (see MfccExtractor::melFilterBank()), weights of band m in Q(mel_shift_[m])
+    std::vector<int> mel_start_;
+    std::vector<int> mel_len_;
+    std::vector<int> mel_offset_;
+    std::vector<uint16_t> mel_weights_;
+    std::vector<int> mel_shift_;
+    std::vector<int16_t> dct_;        //n_mfcc x n_mels, Q15
+
+    std::vector<int16_t> mono_;       //multichannel input averaged
+    std::vector<int16_t> padded_;     //reflect padded signal
+    std::vector<int16_t> frame_;
+    std::vector<int32_t> spec_re_;
+    std::vector<int32_t> spec_im_;
+    std::vector<uint64_t> power_;
+    std::vector<int32_t> mel_db_;     //frames x n_mels, Q8
+    std::vector<int32_t> out_q_;      //output of the float variant
+};
+
+#endif //MIC_READ_THREAD_MFCC_FIXED_HPP
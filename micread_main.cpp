@@ -19,7 +19,7 @@ bool manual_start=false;
 bool record=true;
 bool record_only=true;
 bool record_csv=true;
-MicReadAlsa mic_reader(manual_start, record, record_only, record_csv);
+MicReadAlsa mic_reader(std::chrono::steady_clock::now(), manual_start, record, record_only, record_csv);
 
 bool run_main_thread;
 
@@ -34,6 +34,10 @@ int main(int argc, char**argv)
 {
     run_main_thread = true;
 
+    // MICREAD_TRACE=<file.json>: timeline of the pipeline threads, written at exit (see trace.hpp)
+    const char* trace_path = getenv("MICREAD_TRACE");
+    if(trace_path != nullptr) Trace::enable();
+
     // Handling ctrl-c
     struct sigaction sigIntHandler;
     sigIntHandler.sa_handler = signal_handler;
@@ -47,13 +51,16 @@ int main(int argc, char**argv)
     mic_reader.start();
 
     int iterations = 1000;
+    std::vector<micDataStamped> chunks; //reused: the loop does not allocate in the steady state
 
     for(int i=0; i<iterations && run_main_thread; i++){
         std::cout<<"Main thread running:"<<run_main_thread<<std::endl;
-        //10ms in my case was sort of optimal, i.e. it spits one frame per step
-        std::this_thread::sleep_for (std::chrono::milliseconds(10));
         if(record && !record_only) {
-            std::cout << mic_reader.getData();
+            // Returns as soon as recorded chunks are available (no polling delay, no wakeups while idle)
+            mic_reader.waitData(chunks, std::chrono::milliseconds(100));
+            std::cout << chunks;
+        } else {
+            std::this_thread::sleep_for (std::chrono::milliseconds(10));
         }
         std::cout << std::endl;
         std::cout << "Freq: " << mic_reader.estReadFreq() << std::endl << std::flush;
@@ -76,6 +83,8 @@ int main(int argc, char**argv)
 //        }
 //    }
 
+    if(trace_path != nullptr) Trace::write(trace_path);
+
     // One does not have to call finish() since destructor will do the same job
     //mic_reader.finish();
     return 0;
@@ -0,0 +1,330 @@
+/*
+Compile time configured microphone reader.
+MicRead<Format, Channels, FramesPerChunk> is the fixed configuration counterpart of MicReadAlsa:
+ - chunks (micDataFixed) hold a fixed size, aligned std::array payload (interleaved int16 samples)
+ - the conversion from the device format runs with a compile time trip count (sample_format.hpp),
+   thus it is unrolled / vectorized, and the recording thread writes whole chunks at once
+ - chunks live in a ring preallocated in the constructor: nothing is allocated while capturing
+Time stamps come from the ALSA status time stamps and the drift corrected sample clock, as in MicReadAlsa.
+If record is set the recording thread is the consumer of the ring (record only mode), otherwise use getData().
+Use MicReadAlsa when the format / channels / chunk size are only known at run time.
+
+A minimal example:
+    typedef MicRead<SND_PCM_FORMAT_S16_LE, 1, 512> Mic;
+    Mic mic(std::chrono::steady_clock::now(), "hw:2,0");
+    mic.start();
+    std::vector<Mic::Chunk> chunks(16);
+    while(...) {
+        size_t n = mic.getData(chunks.data(), chunks.size());
+        ...
+    }
+ */
+
+#ifndef MIC_READ_THREAD_MICREAD_STATIC_HPP
+#define MIC_READ_THREAD_MICREAD_STATIC_HPP
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+#include "micread_thread.hpp"
+#include "sample_format.hpp"
+
+#define MICREAD_STATIC_DEF_RING 256 //chunks (~3 s of 512 frame chunks at 44100)
+
+template <int Channels, int FramesPerChunk>
+struct micDataFixed
+{
+    micDataFixed(): id(0), timestamp(0), sample_index(0), rate(0.) {}
+    long int id; //counter of the chunk
+    int64_t timestamp; //microseconds time stamp of the first sample (since t_start)
+    int64_t sample_index; //index of the first frame since the stream start
+    double rate; //estimated real sample rate (Hz)
+    alignas(16) std::array<int16_t, Channels * FramesPerChunk> frames; //interleaved samples
+};
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+class MicRead
+{
+public:
+    typedef micDataFixed<Channels, FramesPerChunk> Chunk;
+    static const int samples_per_chunk = Channels * FramesPerChunk;
+    static const int bytes_per_chunk = samples_per_chunk * MicReadFormat<Format>::bytes;
+
+    MicRead(std::chrono::steady_clock::time_point t_start,
+            std::string device=MICREAD_DEF_DEVICE,
+            unsigned int rate=MICREAD_DEF_RATE,
+            int ring_chunks=MICREAD_STATIC_DEF_RING,
+            bool record=false,
+            std::string filename_base=MICREAD_DEF_REC_FILENAME,
+            alsaPeriodParams period_params=alsaPeriodParams(),
+            std::string name=MICREAD_DEF_NAME);
+    ~MicRead() {finish();}
+
+    int openDevice(); //called by the constructor
+    void start();
+    void finish();
+    bool isRunning() const {return run_fl_;}
+
+    // Moves up to max_chunks chunks (oldest first) into out. Returns their number
+    size_t getData(Chunk* out, size_t max_chunks);
+
+    unsigned int getRate() const {return rate_;}
+    double getRateEstimate() const {return rate_estimate_;}
+    long getChunksRead() const {return chunks_read_;}
+    long getChunksDropped() const {return chunks_dropped_;} //ring full
+    long getChunksRecorded() const {return chunks_recorded_;}
+
+protected:
+    std::string name_;
+    std::string device_;
+    unsigned int rate_;
+    alsaPeriodParams period_params_;
+    bool record_;
+    std::string filename_base_;
+    std::chrono::steady_clock::time_point t_start_;
+
+    snd_pcm_t *capture_handle_;
+    snd_pcm_status_t *status_;
+    bool htstamp_monotonic_;
+    SampleClock sample_clock_;
+    std::atomic<double> rate_estimate_;
+
+    std::atomic<bool> run_fl_;
+    std::thread th_;
+    std::thread th_rec_;
+
+    // Ring of chunks: [head_, head_ + count_) is filled. Only the reading thread writes the slot after it
+    std::vector<Chunk> ring_;
+    size_t head_;
+    size_t count_;
+    std::mutex data_mtx_;
+    alignas(16) std::array<uint8_t, bytes_per_chunk> raw_; //device format buffer
+
+    std::atomic<long> chunks_read_;
+    std::atomic<long> chunks_dropped_;
+    std::atomic<long> chunks_recorded_;
+    int64_t samples_read_;
+
+    void run();
+    void record_thread();
+    void updateSampleClock();
+};
+
+//-----------------------------------------------------------------
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+MicRead<Format, Channels, FramesPerChunk>::MicRead(std::chrono::steady_clock::time_point t_start,
+                                                    std::string device,
+                                                    unsigned int rate,
+                                                    int ring_chunks,
+                                                    bool record,
+                                                    std::string filename_base,
+                                                    alsaPeriodParams period_params,
+                                                    std::string name):
+    name_(name),
+    device_(device),
+    rate_(rate),
+    period_params_(period_params),
+    record_(record),
+    filename_base_(filename_base),
+    t_start_(t_start),
+    capture_handle_(nullptr),
+    status_(nullptr),
+    htstamp_monotonic_(false),
+    sample_clock_(rate),
+    rate_estimate_(rate),
+    run_fl_(false),
+    ring_(ring_chunks),
+    head_(0),
+    count_(0),
+    chunks_read_(0),
+    chunks_dropped_(0),
+    chunks_recorded_(0),
+    samples_read_(0)
+{
+    if(openDevice() < 0) {
+        fprintf(stderr, "%s: ERROR: Failed to open device %s. Please openDevice() manually ...\n",
+                name_.c_str(), device_.c_str());
+    }
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+int MicRead<Format, Channels, FramesPerChunk>::openDevice()
+{
+    if(capture_handle_ != nullptr) return 0;
+    int err = alsa_open_capture(device_, Format, Channels, rate_, period_params_, &capture_handle_, name_, &htstamp_monotonic_);
+    if(err < 0) {
+        capture_handle_ = nullptr;
+        return err;
+    }
+    sample_clock_ = SampleClock(rate_);
+    rate_estimate_ = rate_;
+    fprintf(stdout, "%s: %s opened: %u Hz, %d channels, %d frames per chunk, period %lu, buffer %lu\n",
+            name_.c_str(), device_.c_str(), rate_, Channels, FramesPerChunk,
+            period_params_.period_frames, period_params_.buffer_frames);
+    return 0;
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+void MicRead<Format, Channels, FramesPerChunk>::start()
+{
+    if(run_fl_ || capture_handle_ == nullptr) return;
+    run_fl_ = true;
+    th_ = std::thread(&MicRead::run, this);
+    if(record_) {
+        th_rec_ = std::thread(&MicRead::record_thread, this);
+    }
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+void MicRead<Format, Channels, FramesPerChunk>::finish()
+{
+    if(run_fl_.exchange(false)) {
+        th_.join();
+        if(record_) th_rec_.join();
+    }
+    if(capture_handle_ != nullptr) {
+        snd_pcm_drop(capture_handle_);
+        snd_pcm_close(capture_handle_);
+        capture_handle_ = nullptr;
+    }
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+void MicRead<Format, Channels, FramesPerChunk>::updateSampleClock()
+{
+    // Same observation as MicReadAlsa::updateSampleClock()
+    double time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_start_).count();
+    int64_t newest = samples_read_;
+    if(snd_pcm_status(capture_handle_, status_) == 0) {
+        snd_htimestamp_t htstamp;
+        snd_pcm_status_get_htstamp(status_, &htstamp);
+        newest += snd_pcm_status_get_avail(status_);
+        if(htstamp_monotonic_ && (htstamp.tv_sec != 0 || htstamp.tv_nsec != 0)) {
+            int64_t t_start_us = std::chrono::duration_cast<std::chrono::microseconds>(t_start_.time_since_epoch()).count();
+            time_us = htstamp.tv_sec * 1000000.0 + htstamp.tv_nsec / 1000.0 - t_start_us;
+        }
+    }
+    sample_clock_.update(newest, time_us);
+    rate_estimate_ = sample_clock_.getRate();
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+void MicRead<Format, Channels, FramesPerChunk>::run()
+{
+    snd_pcm_status_malloc(&status_);
+    printf("%s: Reading Thread ready ...\n", name_.c_str());
+
+    while(run_fl_)
+    {
+        snd_pcm_sframes_t err = snd_pcm_readi(capture_handle_, raw_.data(), FramesPerChunk);
+        if(err != FramesPerChunk) {
+            fprintf(stderr, "%s: ERROR: Read from audio interface failed (%s)\n",
+                    name_.c_str(), snd_strerror((int)err));
+            if(err < 0) snd_pcm_recover(capture_handle_, (int)err, 1);
+            sample_clock_.reset();
+            continue;
+        }
+        samples_read_ += FramesPerChunk;
+        updateSampleClock();
+        long id = chunks_read_++;
+
+        // The slot after the filled part belongs to this thread until count_ is incremented
+        size_t slot;
+        {
+            std::lock_guard<std::mutex> lck(data_mtx_);
+            if(count_ == ring_.size()) {
+                chunks_dropped_++;
+                continue;
+            }
+            slot = (head_ + count_) % ring_.size();
+        }
+        Chunk& chunk = ring_[slot];
+        chunk.id = id;
+        chunk.sample_index = samples_read_ - FramesPerChunk;
+        chunk.timestamp = llround(sample_clock_.timeOf(chunk.sample_index));
+        chunk.rate = rate_estimate_;
+        convert_samples<Format, samples_per_chunk>(raw_.data(), chunk.frames.data());
+        {
+            std::lock_guard<std::mutex> lck(data_mtx_);
+            count_++;
+        }
+    }
+
+    snd_pcm_status_free(status_);
+    status_ = nullptr;
+    printf("%s: Thread func finished. Chunks read %ld, dropped %ld ...\n",
+           name_.c_str(), getChunksRead(), getChunksDropped());
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+size_t MicRead<Format, Channels, FramesPerChunk>::getData(Chunk* out, size_t max_chunks)
+{
+    std::lock_guard<std::mutex> lck(data_mtx_);
+    size_t n = std::min(max_chunks, count_);
+    for(size_t i = 0; i < n; i++) {
+        out[i] = ring_[(head_ + i) % ring_.size()];
+    }
+    head_ = (head_ + n) % ring_.size();
+    count_ -= n;
+    return n;
+}
+
+static inline void micread_write_le(std::ostream& os, uint32_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++, value >>= 8) os.put((char)(value & 0xFF));
+}
+
+template <snd_pcm_format_t Format, int Channels, int FramesPerChunk>
+void MicRead<Format, Channels, FramesPerChunk>::record_thread()
+{
+    // WAV holds the samples (16 bits), the csv the time stamps of every chunk
+    std::ofstream csv_file(filename_base_ + ".csv");
+    csv_file << "id,timestamp,sample_index,rate" << std::endl;
+
+    std::ofstream f(filename_base_ + ".wav", std::ios::binary);
+    f << "RIFF----WAVEfmt ";
+    micread_write_le(f, 16, 4);
+    micread_write_le(f, 1, 2);
+    micread_write_le(f, Channels, 2);
+    micread_write_le(f, rate_, 4);
+    micread_write_le(f, rate_ * Channels * 2, 4);
+    micread_write_le(f, Channels * 2, 2);
+    micread_write_le(f, 16, 2);
+    size_t data_chunk_pos = f.tellp();
+    f << "data----";
+
+    std::vector<Chunk> batch(ring_.size());
+    printf("%s: Recording Thread ready ...\n", name_.c_str());
+    while(true)
+    {
+        bool running = run_fl_;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / MICREAD_DEF_REC_FREQ));
+        size_t n = getData(batch.data(), batch.size());
+        for(size_t i = 0; i < n; i++) {
+            // Whole chunk at once: the payload already is little endian int16
+            f.write((const char*)batch[i].frames.data(), sizeof(batch[i].frames));
+            csv_file << batch[i].id << "," << batch[i].timestamp << "," << batch[i].sample_index << "," << batch[i].rate << "\n";
+        }
+        chunks_recorded_ += n;
+        if(!running && n == 0) break;
+    }
+
+    size_t file_length = f.tellp();
+    f.seekp(data_chunk_pos + 4);
+    micread_write_le(f, file_length - data_chunk_pos - 8, 4);
+    f.seekp(4);
+    micread_write_le(f, file_length - 8, 4);
+    printf("%s: Chunks recorded %ld ...\n", name_.c_str(), getChunksRecorded());
+}
+
+#endif //MIC_READ_THREAD_MICREAD_STATIC_HPP
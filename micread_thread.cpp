@@ -1,8 +1,17 @@
 #include "micread_thread.hpp"
+#include "sample_format.hpp"
+#include "rec_index.hpp"
 
 #include <fstream>
 #include <iostream>
 #include <climits>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
 
 MicReadAlsa::MicReadAlsa(std::chrono::steady_clock::time_point t_start,
                          bool manual_start,
@@ -16,34 +25,108 @@ MicReadAlsa::MicReadAlsa(std::chrono::steady_clock::time_point t_start,
                          unsigned int rate,
                          int channels,
                          snd_pcm_format_t format,
-                         std::string name):
+                         std::string name,
+                         MicReadLatencyProfile profile,
+                         IoWriter* writer):
+    data(NodeAllocator<micDataStamped>(&data_nodes_)),
     run_fl_(false),
     ready_fl_(true),
     name_(name),
     buffer_frames_(buffer_frames_num),
     rate_(rate),
-    format_(format),
-    device_(device),
     buffer_(nullptr),
-    freq_(0.0),
-    filename_base_(filename_base),
+    device_(device),
+    format_(format),
     channels_(channels),
+    freq_(0.0),
+    rec_freq_estimate_(0.),
+    max_est_size_(100.),
+    read_est_pos_(0),
+    rec_est_pos_(0),
     record_only_(record_only),
     record_(record),
     record_csv_(record_csv),
+    queue_policy_(MICREAD_QUEUE_UNBOUNDED),
+    queue_max_(0),
+    block_timeout_(0),
+    staged_num_(0),
+    stride_raised_at_(0),
+    memory_budget_(0),
+    chunk_bytes_(0),
+    spill_fd_(-1),
+    spill_write_pos_(0),
+    spill_in_flight_(false),
+    buffered_bytes_(0),
+    chunks_spilled_(0),
+    bytes_spilled_(0),
+    spill_file_bytes_(0),
+    chunks_read_back_(0),
+    read_back_ns_(0),
+    read_back_max_ns_(0),
+    chunks_dispatched_(0),
+    dispatch_wakeups_(0),
     chunks_read_(0),
+    samples_read_(0),
+    sample_clock_(rate),
+    status_(nullptr),
+    htstamp_monotonic_(false),
+    rate_estimate_(rate),
     chunks_recorded_(0),
-    rec_freq_estimate_(0.),
-    max_est_size_(100.),
-    t_start_(t_start)
+    chunks_dropped_(0),
+    xruns_(0),
+    read_errors_(0),
+    queue_depth_(0),
+    chunks_shed_(0),
+    chunks_decimated_(0),
+    block_waits_(0),
+    block_timeouts_(0),
+    shedding_episodes_(0),
+    shedding_(false),
+    stride_(1),
+    queue_high_water_(0),
+    t_start_(t_start),
+    filename_base_(filename_base),
+    writer_(writer),
+    index_interval_(RECINDEX_DEF_INTERVAL)
 {
-    rec_freq_estimates.resize(100);
-    read_freq_estimates.resize(100);
-    read_fps_estimates.resize(100);
+#ifdef MICREAD_INSTRUMENT
+    for(int i = 0; i < THREADS_NUM; i++) thread_stats_[i] = nullptr;
+#endif
+    // Period / buffer autotuning: the sweep only runs once per device / profile
+    if(profile != MICREAD_PROFILE_DEFAULT) {
+        // Low latency: measured (and later read) one period at a time
+        AlsaTuner tuner(device_, rate_, channels_, format_, profile == MICREAD_PROFILE_LOW_LATENCY ? 0 : buffer_frames_);
+        if(tuner.load(MICREAD_DEF_TUNE_FILENAME, profile, period_params_) < 0) {
+            std::vector<alsaTuneResult> results;
+            if(tuner.sweep(results) == 0 && tuner.choose(results, profile, period_params_) == 0) {
+                tuner.save(MICREAD_DEF_TUNE_FILENAME, profile, period_params_);
+            } else {
+                fprintf(stderr, "%s: WARNING: Tuning failed, using driver defaults\n", name_.c_str());
+                period_params_ = alsaPeriodParams();
+            }
+        }
+        // A chunk of buffer_frames_ would wait for several of the short periods: the chunks follow the period
+        if(profile == MICREAD_PROFILE_LOW_LATENCY && period_params_.period_frames > 0) {
+            buffer_frames_ = (int)period_params_.period_frames;
+        }
+    }
+
+    frames_pool_.reserve(MICREAD_FRAMES_POOL_SIZE);
+    // A consumer holding a few more chunks than usual must not make the reading thread allocate
+    frames_pool_.resize(MICREAD_FRAMES_PREALLOC);
+    for(size_t i = 0; i < frames_pool_.size(); i++) frames_pool_[i].reserve(buffer_frames_ * channels_);
+    chunk_bytes_ = sizeof(micDataStamped) + (size_t)buffer_frames_ * channels_ * sizeof(int16_t);
+    staged_.resize(MICREAD_STAGING_CHUNKS);
+    for(size_t i = 0; i < staged_.size(); i++) staged_[i].frames.reserve(buffer_frames_ * channels_);
+    rec_freq_estimates.resize(max_est_size_);
+    read_freq_estimates.resize(max_est_size_);
+    read_fps_estimates.resize(max_est_size_);
     setRecFreq(record_freq);
 
-    bits_per_sample_ = snd_pcm_format_width(format_);
-    if(openDevice() < 0){
+    // Recorded sample width: the frames are converted to int16 whatever the device format (S24 / S32 included)
+    bits_per_sample_ = 8 * sizeof(int16_t);
+
+    if(openDevice(device_, buffer_frames_, rate_) < 0){
         fprintf(stderr,"%s: ERROR: Failed to open device %s. Please openDevice() manually and start() the thread ...\n",
                 name_.c_str(),
                 device_.c_str());
@@ -71,6 +154,10 @@ MicReadAlsa::~MicReadAlsa() {
         delete[] buffer_;
         buffer_ = nullptr;
     }
+    if(spill_fd_ >= 0) {
+        close(spill_fd_);
+        spill_fd_ = -1;
+    }
 }
 
 
@@ -105,8 +192,10 @@ int8_t* swap_endian(int8_t* value, int size)
 
 void MicReadAlsa::run() {
     int err; //Reporting ALSA errors
+    nameThread(THREAD_READ, "read");
 
-    buffer_ = new int8_t[buffer_frames_ * snd_pcm_format_width(format_) * channels_/ 8];
+    buffer_ = new int8_t[buffer_frames_ * snd_pcm_format_physical_width(format_) * channels_/ 8];
+    snd_pcm_status_malloc(&status_);
 
     //Time to measure freq
     auto time_prev = std::chrono::duration_cast<std::chrono::microseconds>(
@@ -131,7 +220,7 @@ void MicReadAlsa::run() {
             // First, waiting until we give permission to start running
             // See explanation of using mutex together with condvar
             // https://github.com/angrave/SystemProgramming/wiki/Synchronization,-Part-5:-Condition-Variables
-            std::unique_lock<std::mutex> lck(mtx_);
+            std::unique_lock<MicReadMutex> lck(mtx_);
             cv_.wait(lck);
         }
 
@@ -143,50 +232,97 @@ void MicReadAlsa::run() {
         auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_start_);
 //        chrono::duration<double> fsec = std::chrono::duration_cast<std::chrono::microseconds>(t_now - t_start_);
 
-        if ((err = snd_pcm_readi(capture_handle_, buffer_, buffer_frames_)) != buffer_frames_)
+        TraceSpan read_span("snd_pcm_readi");
+        err = snd_pcm_readi(capture_handle_, buffer_, buffer_frames_);
+        read_span.end();
+        if (err != buffer_frames_)
         {
+            if(err == -EPIPE) xruns_++; else read_errors_++;
             fprintf(stderr, "%s: ERROR: Read from audio interface failed (%s)\n",
                     name_.c_str(),
                     snd_strerror(err));
+            // Samples were lost, the time of the next sample is unknown
+            sample_clock_.reset();
+            // An overrun (or suspend) leaves the stream stopped until it is prepared again
+            if(err < 0 && snd_pcm_recover(capture_handle_, err, 1) < 0) {
+                fprintf(stderr, "%s: ERROR: Cannot recover the audio interface\n", name_.c_str());
+            }
         }
         // Copy data to my buffer
         else {
-            if(data_mtx_.try_lock())
-            {
-                micDataStamped chunk_stamped;
-                chunk_stamped.id = chunks_read_;
-                chunk_stamped.flags.recorded = !record_ || (record_ && record_only_);
-                chunks_read_ += 1;
-
-                long timestamp = time.count(); //count milliseconds
-                chunk_stamped.timestamp = timestamp;
-
-                //Only for a single channel
-                int i_incr = bits_per_sample_ / 8;
-                int buffer_bytes = buffer_frames_ * channels_* bits_per_sample_ / 8;
-                for (int i = 0; i < buffer_bytes; i+=i_incr)
-                {
-                    // swap_endian(buffer_ + i, bits_per_sample_ / 8);
-                    auto val_ptr = (int16_t *) (buffer_ + i);
-                    chunk_stamped.frames.push_back(*val_ptr);
-                }
+            micDataStamped chunk_stamped;
+            chunk_stamped.frames.swap(spare_frames_); //recycled buffer (no allocation in the steady state)
+            chunk_stamped.frames.clear();
+            chunk_stamped.frames.reserve(buffer_frames_ * channels_);
+            chunk_stamped.id = chunks_read_;
+            chunk_stamped.flags.recorded = !record_ || (record_ && record_only_);
+            chunks_read_ += 1;
+
+            // The time before the read is only when we started waiting: the time stamp comes from the device
+            samples_read_ += buffer_frames_;
+            updateSampleClock(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_start_));
+            chunk_stamped.sample_index = samples_read_ - buffer_frames_;
+            chunk_stamped.timestamp = llround(sample_clock_.timeOf(chunk_stamped.sample_index));
+            chunk_stamped.rate = rate_estimate_;
+
+            // Conversion to int16 (interleaved): the runtime format dispatches to the compile time
+            // loops of sample_format.hpp (see MicRead<> in micread_static.hpp for a fully static reader)
+            TraceSpan convert_span("convert");
+            chunk_stamped.frames.resize(buffer_frames_ * channels_);
+            if (!convert_samples_runtime(format_, (const uint8_t*)buffer_, chunk_stamped.frames.data(), chunk_stamped.frames.size())) {
+                fprintf(stderr, "%s: ERROR: Unsupported sample format %d\n", name_.c_str(), (int)format_);
+            }
+            convert_span.end();
+
+            // Processing stages see every chunk, even if the main buffer is busy
+            for(size_t s = 0; s < stages_.size(); s++) {
+                TraceSpan stage_span(stages_[s]->name());
+                auto t_stage = std::chrono::steady_clock::now();
+                stages_[s]->process(chunk_stamped);
+                long ns = (long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_stage).count();
+                MicReadStageStats& stats = stage_stats_[s];
+                stats.calls++;
+                stats.total_ns += ns;
+                if(ns > stats.max_ns) stats.max_ns = ns;
+            }
 
+            // A consumer holding the lock does not cost chunks: they wait in staged_ until the next chunk.
+            // Only MICREAD_QUEUE_BLOCK waits for the lock
+            TraceSpan enqueue_span("enqueue");
+            std::unique_lock<MicReadMutex> lck(data_mtx_, std::try_to_lock);
+            if(!lck.owns_lock() && queue_policy_ == MICREAD_QUEUE_BLOCK) lck.lock();
+            if(lck.owns_lock())
+            {
                 //Calculating freq
                 freq_ = (double) 1.0 / (double)(time - time_prev).count() * 1000000.0;
                 fps_est_= (double) buffer_frames_ / (double)(time - time_prev).count() * 1000000.0;
-                read_freq_estimates.push_back(freq_);
-                read_fps_estimates.push_back(fps_est_);
-                if(read_freq_estimates.size() > max_est_size_) {
-                  read_freq_estimates.pop_front();
-                  read_fps_estimates.pop_front();
-                }
+                read_freq_estimates[read_est_pos_] = freq_;
+                read_fps_estimates[read_est_pos_] = fps_est_;
+                read_est_pos_ = (read_est_pos_ + 1) % read_freq_estimates.size();
 //                std::cout << "Read freq: " << estReadFreq() << " FPS:" << estFPS() << std::endl;
                 time_prev = time;
 
-                //Push data to the main data buffer
-                data.push_back(chunk_stamped);
-
-                data_mtx_.unlock();
+                //Push data to the main data buffer (held back chunks first)
+                for(size_t i = 0; i < staged_num_; i++) {
+                    if(!enqueue(staged_[i], lck)) recycleFrames(staged_[i].frames);
+                    takeFrames(staged_[i].frames);
+                }
+                staged_num_ = 0;
+                if(enqueue(chunk_stamped, lck)) takeFrames(spare_frames_);
+                else spare_frames_.swap(chunk_stamped.frames); //shed, its buffer is reused for the next one
+                queue_depth_ = data.size();
+                if(queue_depth_ > queue_high_water_) queue_high_water_ = (long)queue_depth_;
+                updateBufferedBytes();
+                if(memory_budget_ > 0 && (size_t)buffered_bytes_ > memory_budget_) spill_cv_.notify_one();
+                arrived(lck);
+            } else if(staged_num_ < staged_.size()) {
+                // The staged slot's (reserved) buffer becomes the buffer of the next chunk
+                std::swap(staged_[staged_num_++], chunk_stamped);
+                spare_frames_.swap(chunk_stamped.frames);
+            } else {
+                // The chunk is dropped, its buffer is reused for the next one
+                chunks_dropped_++;
+                spare_frames_.swap(chunk_stamped.frames);
             }
         }
 
@@ -195,6 +331,8 @@ void MicReadAlsa::run() {
     // Cleaning, closing
     delete[] buffer_;
     buffer_ = nullptr;
+    snd_pcm_status_free(status_);
+    status_ = nullptr;
 
     snd_pcm_drain(capture_handle_);
     snd_pcm_close (capture_handle_);
@@ -204,8 +342,102 @@ void MicReadAlsa::run() {
     printf("%s: Chunks read %ld ...\n",  name_.c_str(), getChunksRead());
 }
 
+void MicReadAlsa::setQueuePolicy(MicReadQueuePolicy policy, int max_chunks, long block_us)
+{
+    std::lock_guard<MicReadMutex> lck(data_mtx_);
+    queue_policy_ = max_chunks > 0 ? policy : MICREAD_QUEUE_UNBOUNDED;
+    queue_max_ = max_chunks > 0 ? max_chunks : 0;
+    block_timeout_ = std::chrono::microseconds(block_us >= 0 ? block_us : (long)buffer_frames_ * 1000000L / rate_);
+    shedding_ = false;
+    stride_ = 1;
+}
+
+bool MicReadAlsa::enqueue(micDataStamped& chunk, std::unique_lock<MicReadMutex>& lck)
+{
+    if(queue_policy_ == MICREAD_QUEUE_UNBOUNDED) {
+        data.push_back(std::move(chunk));
+        return true;
+    }
+
+    // Controller: behind from full (half full for decimation) until the backlog is down to the low watermark
+    const size_t low = queue_max_ / 4;
+    const size_t full = queue_policy_ == MICREAD_QUEUE_DECIMATE ? std::max<size_t>(queue_max_ / 2, 1) : queue_max_;
+    if(shedding_ && data.size() <= low) {
+        shedding_ = false;
+        stride_ = 1; //full rate processing again
+    }
+    if(!shedding_ && data.size() >= full) {
+        shedding_ = true;
+        shedding_episodes_++;
+    }
+
+    switch(queue_policy_) {
+    case MICREAD_QUEUE_BLOCK:
+        if(data.size() >= queue_max_) {
+            block_waits_++;
+            space_cv_.wait_for(lck, block_timeout_, [this]{ return data.size() < queue_max_ || !ready_fl_; });
+            if(data.size() >= queue_max_) {
+                block_timeouts_++;
+                chunks_shed_++;
+                return false;
+            }
+        }
+        break;
+    case MICREAD_QUEUE_DROP_NEWEST:
+        if(shedding_) {
+            chunks_shed_++;
+            return false;
+        }
+        break;
+    case MICREAD_QUEUE_DECIMATE:
+        // k doubles while the backlog keeps growing (at most every low chunks)
+        if(shedding_ && stride_ < MICREAD_MAX_STRIDE && data.size() >= full &&
+           chunk.id - stride_raised_at_ >= (long)std::max<size_t>(low, 1)) {
+            stride_ = stride_ * 2;
+            stride_raised_at_ = chunk.id;
+        }
+        if(stride_ > 1 && chunk.id % stride_ != 0) {
+            chunk.flags.skip = 1;
+            chunks_decimated_++;
+        }
+        //no break: the bound is kept by dropping the oldest chunk
+    case MICREAD_QUEUE_DROP_OLDEST:
+        while(data.size() >= queue_max_) {
+            if(data.front().flags.spilled) dropSpilledFront();
+            else recycleFrames(data.front().frames);
+            data.pop_front();
+            chunks_shed_++;
+        }
+        break;
+    default:
+        break;
+    }
+    data.push_back(std::move(chunk));
+    return true;
+}
+
+void MicReadAlsa::updateSampleClock(std::chrono::microseconds read_end)
+{
+    // Observation: the sample (samples_read_ + avail) was the newest one at the status time stamp,
+    // i.e. the last period interrupt. The time stamp is CLOCK_MONOTONIC, the clock steady_clock uses on Linux
+    double time_us = read_end.count();
+    int64_t newest = samples_read_;
+    if (snd_pcm_status(capture_handle_, status_) == 0) {
+        snd_htimestamp_t htstamp;
+        snd_pcm_status_get_htstamp(status_, &htstamp);
+        newest += snd_pcm_status_get_avail(status_);
+        if (htstamp_monotonic_ && (htstamp.tv_sec != 0 || htstamp.tv_nsec != 0)) {
+            int64_t t_start_us = std::chrono::duration_cast<std::chrono::microseconds>(t_start_.time_since_epoch()).count();
+            time_us = htstamp.tv_sec * 1000000.0 + htstamp.tv_nsec / 1000.0 - t_start_us;
+        }
+        // else: no driver time stamps, the end of the read is the best estimate
+    }
+    sample_clock_.update(newest, time_us);
+    rate_estimate_ = sample_clock_.getRate();
+}
+
 void MicReadAlsa::start() {
-    std::unique_lock<std::mutex> lck(mtx_);
+    std::unique_lock<MicReadMutex> lck(mtx_);
     ready_fl_ = true;
     run_fl_ = true;
     int err = snd_pcm_pause(capture_handle_, 0);
@@ -220,7 +452,7 @@ void MicReadAlsa::start() {
 
 void MicReadAlsa::pause() {
     if(ready_fl_) {
-        std::unique_lock<std::mutex> lck(mtx_);
+        std::unique_lock<MicReadMutex> lck(mtx_);
         run_fl_ = false;
     }
 }
@@ -228,6 +460,13 @@ void MicReadAlsa::pause() {
 void MicReadAlsa::finish() {
     cv_.notify_all();
     ready_fl_ = false;
+    space_cv_.notify_all();
+    {
+        std::lock_guard<MicReadMutex> lck(data_mtx_);
+        for(auto& promise : data_promises_) promise.set_value(0);
+        data_promises_.clear();
+    }
+    data_cv_.notify_all();
     //    run_fl_ = false;
     printf("%s: Waiting for the reading thread to finish ...\n", name_.c_str());
     th_.join();
@@ -235,7 +474,43 @@ void MicReadAlsa::finish() {
         printf("%s: Waiting for the recording thread to finish ...\n", name_.c_str());
         th_rec_.join();
     }
+    if(th_dispatch_.joinable()) {
+        printf("%s: Waiting for the dispatch thread to finish ...\n", name_.c_str());
+        th_dispatch_.join();
+    }
+    if(th_spill_.joinable()) {
+        spill_cv_.notify_all();
+        th_spill_.join();
+    }
+#ifdef MICREAD_INSTRUMENT
+    reportInstrumentation();
+#endif
+}
+
+void MicReadAlsa::nameThread(MicReadThread thread, const char* role)
+{
+    std::string name = name_ + " " + role;
+    Trace::nameThread(name.c_str());
+#ifdef MICREAD_INSTRUMENT
+    Instrument::nameThread(name.c_str());
+    thread_stats_[thread] = Instrument::thread();
+#endif
+}
+
+#ifdef MICREAD_INSTRUMENT
+
+void MicReadAlsa::reportInstrumentation()
+{
+    printf("%s: Allocations and lock contention per thread (totals, rates since the thread start):\n", name_.c_str());
+    for(int i = 0; i < THREADS_NUM; i++) {
+        if(thread_stats_[i] != nullptr) Instrument::print(stdout, thread_stats_[i]);
+    }
+    std::string name = name_ + " data_mtx_";
+    data_mtx_.print(stdout, name.c_str());
+    name = name_ + " mtx_";
+    mtx_.print(stdout, name.c_str());
 }
+#endif
 
 int MicReadAlsa::openDevice(std::string device,
                             int buffer_frames,
@@ -247,141 +522,426 @@ int MicReadAlsa::openDevice(std::string device,
         restart = true;
     }
 
-    int i;
-    int err;
-
     device_ = device;
     rate_ = rate;
     buffer_frames_ = buffer_frames;
-
-    if ((err = snd_pcm_open (&capture_handle_, device_.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        fprintf (stderr, "%s: ERROR: cannot open audio device %s (%s)\n",
-                 name_.c_str(),
-                 device_.c_str(),
-                 snd_strerror (err));
-        return -1;
+    samples_read_ = 0;
+
+    // The open path shared with AlsaTuner and MicRead<> (alsa_tuner.hpp): hw_params, the optional period /
+    // buffer sizes, sw_params thresholds and monotonic status time stamps
+    int err = alsa_open_capture(device_, format_, channels_, rate_, period_params_, &capture_handle_, name_,
+                                &htstamp_monotonic_);
+    if (err < 0) {
+        capture_handle_ = nullptr;
+        return err;
     }
-    fprintf(stdout, "%s: Audio interface opened\n", name_.c_str());
-
+    sample_clock_ = SampleClock(rate_);
+    rate_estimate_ = rate_;
+    fprintf(stdout, "%s: Audio interface prepared: %u Hz, period %lu frames, buffer %lu frames\n", name_.c_str(),
+            rate_, period_params_.period_frames, period_params_.buffer_frames);
 
-    if ((err = snd_pcm_hw_params_malloc (&hw_params_)) < 0) {
-        fprintf (stderr, "%s: ERROR: cannot allocate hardware parameter structure (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -2;
+    if(restart){
+        start();
     }
-    fprintf(stdout, "%s: hw_params allocated\n", name_.c_str());
+    return 0;
+}
 
+std::vector<micDataStamped> MicReadAlsa::getData(){
+    std::vector<micDataStamped> data_temp;
+    data_mtx_.lock();
+    while(!data.empty() && data.front().flags.recorded) {
+        if(data.front().flags.spilled) readBack(data.front());
+        data_temp.push_back(std::move(data.front())); //Not not sure if move actually makes difference
+        data.pop_front();
+    }
+    queue_depth_ = data.size();
+    updateBufferedBytes();
+    data_mtx_.unlock();
+    drained();
+    return data_temp; //Theoretically should return by rval since C11 to avoid copying
+}
 
-    if ((err = snd_pcm_hw_params_any (capture_handle_, hw_params_)) < 0) {
-        fprintf (stderr, "%s: ERROR: Cannot initialize hardware parameter structure (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -3;
+int MicReadAlsa::setMemoryBudget(size_t bytes, const std::string& spill_dir)
+{
+    if(bytes == 0) {
+        memory_budget_ = 0;
+        return 0;
     }
-    fprintf(stdout, "%s: hw_params initialized\n", name_.c_str());
+    if(spill_fd_ < 0) {
+        // The file is unlinked right away: nothing is left behind, whatever happens to the process
+        std::string path = spill_dir + "/" + name_ + "_spill_XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        spill_fd_ = mkstemp(name.data());
+        if(spill_fd_ < 0) {
+            fprintf(stderr, "%s: ERROR: Cannot create a spill file in %s (%s)\n", name_.c_str(), spill_dir.c_str(),
+                    strerror(errno));
+            return -1;
+        }
+        unlink(name.data());
+    }
+    memory_budget_ = bytes;
+    if(!th_spill_.joinable()) th_spill_ = std::thread(&MicReadAlsa::spill_thread, this);
+    return 0;
+}
 
+size_t MicReadAlsa::spillRunBegin() const
+{
+    if(spill_records_.empty()) return data.size();
+    size_t i = 0;
+    while(i < data.size() && !data[i].flags.spilled) i++; //the run starts at the front or right after it
+    return i;
+}
 
-    if ((err = snd_pcm_hw_params_set_access (capture_handle_, hw_params_, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-        fprintf (stderr, "%s: ERROR: cannot set access type (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -4;
+void MicReadAlsa::updateBufferedBytes()
+{
+    size_t spilled = spill_records_.size();
+    buffered_bytes_ = (long)((data.size() - spilled) * chunk_bytes_ +
+                             spilled * (sizeof(micDataStamped) + sizeof(spillRecord)));
+}
+
+void MicReadAlsa::readSpilled(size_t k, std::vector<int16_t>& frames)
+{
+    const spillRecord& record = spill_records_[k];
+    frames.resize(record.samples);
+    size_t bytes = record.samples * sizeof(int16_t);
+    if(pread(spill_fd_, frames.data(), bytes, record.offset) != (ssize_t)bytes) {
+        fprintf(stderr, "%s: ERROR: Cannot read back a spilled chunk (%s)\n", name_.c_str(), strerror(errno));
+        std::fill(frames.begin(), frames.end(), 0);
     }
-    fprintf(stdout, "%s: hw_params access setted\n", name_.c_str());
+}
 
+void MicReadAlsa::readBack(micDataStamped& chunk)
+{
+    auto t_read = std::chrono::steady_clock::now();
+    takeFrames(chunk.frames);
+    readSpilled(0, chunk.frames);
+    chunk.flags.spilled = 0;
+    dropSpilledFront();
+    long ns = (long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_read).count();
+    chunks_read_back_++;
+    read_back_ns_ += ns;
+    if(ns > read_back_max_ns_) read_back_max_ns_ = ns;
+}
 
-    if ((err = snd_pcm_hw_params_set_format (capture_handle_, hw_params_, format_)) < 0) {
-        fprintf (stderr, "%s: ERROR: Cannot set sample format (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -5;
+void MicReadAlsa::dropSpilledFront()
+{
+    spill_file_bytes_ -= spill_records_.front().samples * sizeof(int16_t);
+    spill_records_.pop_front();
+    // Everything read: the file starts over (unless the spill thread is writing a batch behind the records)
+    if(spill_records_.empty() && !spill_in_flight_) {
+        if(ftruncate(spill_fd_, 0) < 0) {
+            fprintf(stderr, "%s: WARNING: Cannot truncate the spill file (%s)\n", name_.c_str(), strerror(errno));
+        }
+        spill_write_pos_ = 0;
+        spill_file_bytes_ = 0;
     }
-    fprintf(stdout, "%s: hw_params format setted\n", name_.c_str());
+}
 
+void MicReadAlsa::spill_thread()
+{
+    std::vector<int16_t> batch; //samples of the batch
+    std::vector<long> ids;
+    std::vector<uint32_t> samples;
+    nameThread(THREAD_SPILL, "spill");
+    printf("%s: Spill Thread ready ...\n", name_.c_str());
+    std::unique_lock<MicReadMutex> lck(data_mtx_);
+    while(ready_fl_)
+    {
+        spill_cv_.wait_for(lck, std::chrono::milliseconds(100));
+        while(ready_fl_ && memory_budget_ > 0 && (size_t)buffered_bytes_ > memory_budget_)
+        {
+            // The oldest chunks in memory: right after the spilled run (or from the front)
+            size_t first = spillRunBegin();
+            first = first < data.size() ? first + spill_records_.size() : 0;
+            batch.clear();
+            ids.clear();
+            samples.clear();
+            size_t excess = (size_t)buffered_bytes_ - memory_budget_;
+            for(size_t i = first; i < data.size() && ids.size() < MICREAD_SPILL_BATCH; i++) {
+                if((ids.size() + 1) * chunk_bytes_ > excess + chunk_bytes_) break;
+                batch.insert(batch.end(), data[i].frames.begin(), data[i].frames.end());
+                ids.push_back(data[i].id);
+                samples.push_back((uint32_t)data[i].frames.size());
+            }
+            if(ids.empty()) break;
+            uint64_t pos = spill_write_pos_;
+            spill_in_flight_ = true;
+
+            // The file is written without the lock: consumers and the reading thread go on meanwhile
+            lck.unlock();
+            TraceSpan write_span("spill write");
+            size_t bytes = batch.size() * sizeof(int16_t);
+            ssize_t written = pwrite(spill_fd_, batch.data(), bytes, pos);
+            write_span.end();
+            lck.lock();
+            spill_in_flight_ = false;
+            if(written != (ssize_t)bytes) {
+                fprintf(stderr, "%s: ERROR: Cannot write the spill file (%s), spilling stops\n", name_.c_str(),
+                        strerror(errno));
+                memory_budget_ = 0;
+                break;
+            }
 
-    if ((err = snd_pcm_hw_params_set_rate_near (capture_handle_, hw_params_, &rate_, 0)) < 0) {
-        fprintf (stderr, "%s: ERROR: Cannot set sample rate (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -6;
+            // Consumers may have taken (or partially drained) chunks of the batch meanwhile, only at the front:
+            // those stay in memory
+            size_t at = spillRunBegin();
+            at = at < data.size() ? at + spill_records_.size() : 0;
+            uint64_t offset = pos;
+            for(size_t b = 0; b < ids.size(); b++) {
+                if(at < data.size() && data[at].id == ids[b]) {
+                    if(data[at].frames.size() == samples[b]) {
+                        spillRecord record = {offset, samples[b]};
+                        spill_records_.push_back(record);
+                        recycleFrames(data[at].frames);
+                        data[at].flags.spilled = 1;
+                        spill_file_bytes_ += samples[b] * sizeof(int16_t);
+                        chunks_spilled_++;
+                    }
+                    at++;
+                }
+                offset += samples[b] * sizeof(int16_t);
+            }
+            if(spill_records_.empty()) {
+                spill_write_pos_ = 0; //nothing of the batch stayed
+            } else {
+                spill_write_pos_ = pos + bytes;
+            }
+            bytes_spilled_ += bytes;
+            updateBufferedBytes();
+        }
     }
-    fprintf(stdout, "%s: hw_params rate setted\n", name_.c_str());
+    printf("%s: Chunks spilled %ld ...\n", name_.c_str(), getChunksSpilled());
+}
+
+size_t MicReadAlsa::consumable() const
+{
+    size_t n = 0;
+    while(n < data.size() && data[n].flags.recorded) n++;
+    return n;
+}
 
-    if ((err = snd_pcm_hw_params_set_channels (capture_handle_, hw_params_, channels_)) < 0) {
-        fprintf (stderr, "%s: ERROR: cannot set channel count (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -7;
+void MicReadAlsa::arrived(std::unique_lock<MicReadMutex>& lck)
+{
+    size_t n = consumable();
+    if(n > 0 && !data_promises_.empty()) {
+        for(auto& promise : data_promises_) promise.set_value(n);
+        data_promises_.clear();
     }
-    fprintf(stdout, "%s: hw_params channels setted\n", name_.c_str());
+    lck.unlock();
+    if(n > 0) data_cv_.notify_all(); //no system call without waiters
+}
 
+size_t MicReadAlsa::waitData(std::chrono::microseconds timeout)
+{
+    std::unique_lock<MicReadMutex> lck(data_mtx_);
+    data_cv_.wait_for(lck, timeout, [this]{ return consumable() > 0 || !ready_fl_; });
+    return consumable();
+}
 
-    if ((err = snd_pcm_hw_params (capture_handle_, hw_params_)) < 0) {
-        fprintf (stderr, "%s: ERROR: Cannot set parameters (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -8;
+size_t MicReadAlsa::waitData(std::vector<micDataStamped>& out, std::chrono::microseconds timeout, size_t max_chunks)
+{
+    if(waitData(timeout) == 0) {
+        // Buffers of the previous batch go back like with getData(out)
+        if(!out.empty()) getData(out, 0);
+        return 0;
     }
-    fprintf(stdout, "%s: hw_params setted\n", name_.c_str());
+    return getData(out, max_chunks);
+}
 
+std::future<size_t> MicReadAlsa::nextData()
+{
+    std::promise<size_t> promise;
+    std::future<size_t> future = promise.get_future();
+    std::lock_guard<MicReadMutex> lck(data_mtx_);
+    size_t n = consumable();
+    if(n > 0 || !ready_fl_) promise.set_value(n);
+    else data_promises_.push_back(std::move(promise));
+    return future;
+}
 
-    snd_pcm_hw_params_free (hw_params_);
-    fprintf(stdout, "%s: hw_params freed\n", name_.c_str());
+void MicReadAlsa::addCallback(const MicReadCallback& callback)
+{
+    std::lock_guard<std::mutex> lck(callbacks_mtx_);
+    callbacks_.push_back(callback);
+    if(!th_dispatch_.joinable()) {
+        th_dispatch_ = std::thread(&MicReadAlsa::dispatch_thread, this);
+    }
+}
 
+void MicReadAlsa::dispatch_thread()
+{
+    std::vector<micDataStamped> chunks; //reused, the frame buffers go back to the reading thread
+    nameThread(THREAD_DISPATCH, "dispatch");
+    printf("%s: Dispatch Thread ready ...\n", name_.c_str());
+    bool last = false;
+    while(!last)
+    {
+        // After finish() the reading thread is joined first: one more pass delivers the remaining chunks
+        last = !ready_fl_;
+        if(last) getData(chunks);
+        else if(waitData(chunks, std::chrono::milliseconds(100)) == 0) continue;
+        if(chunks.empty()) continue;
+        dispatch_wakeups_++;
+        TraceSpan callbacks_span("callbacks");
+        std::lock_guard<std::mutex> lck(callbacks_mtx_);
+        for(const micDataStamped& chunk : chunks) {
+            for(const MicReadCallback& callback : callbacks_) callback(chunk);
+        }
+        chunks_dispatched_ += chunks.size();
+    }
+    printf("%s: Chunks dispatched %ld ...\n", name_.c_str(), getChunksDispatched());
+}
 
-    if ((err = snd_pcm_prepare (capture_handle_)) < 0) {
-        fprintf (stderr, "%s: ERROR: Cannot prepare audio interface for use (%s)\n",
-                 name_.c_str(),
-                 snd_strerror (err));
-        return -9;
+void MicReadAlsa::recycleFrames(std::vector<int16_t>& frames)
+{
+    if(frames.capacity() > 0 && frames_pool_.size() < MICREAD_FRAMES_POOL_SIZE) {
+        frames_pool_.push_back(std::move(frames)); //pool capacity is reserved in the constructor
     }
-    fprintf(stdout, "%s: Audio interface prepared\n", name_.c_str());
+    frames.clear();
+}
 
-    if(restart){
-        start();
+void MicReadAlsa::takeFrames(std::vector<int16_t>& frames)
+{
+    if(!frames_pool_.empty()) {
+        frames.swap(frames_pool_.back());
+        frames_pool_.pop_back();
     }
-    return 0;
 }
 
-std::vector<micDataStamped> MicReadAlsa::getData(){
-    std::vector<micDataStamped> data_temp;
+size_t MicReadAlsa::getData(std::vector<micDataStamped>& out, size_t max_chunks){
     data_mtx_.lock();
-    while(!data.empty() && data.front().flags.recorded) {
-        data_temp.push_back(std::move(data.front())); //Not not sure if move actually makes difference
+    // Buffers of the previous batch go back to the reading thread
+    for(size_t i = 0; i < out.size(); i++) {
+        recycleFrames(out[i].frames);
+    }
+    out.clear(); //keeps the capacity of out
+    while(!data.empty() && data.front().flags.recorded && out.size() < max_chunks) {
+        if(data.front().flags.spilled) readBack(data.front());
+        out.push_back(std::move(data.front()));
         data.pop_front();
     }
+    queue_depth_ = data.size();
+    updateBufferedBytes();
     data_mtx_.unlock();
-    return data_temp; //Theoretically should return by rval since C11 to avoid copying
+    drained();
+    return out.size();
+}
+
+size_t MicReadAlsa::getSamples(int16_t* out, size_t max_samples, int64_t* timestamp){
+    size_t copied = 0;
+    data_mtx_.lock();
+    if(timestamp != nullptr && !data.empty()) {
+        *timestamp = data.front().timestamp;
+    }
+    while(copied < max_samples && !data.empty() && data.front().flags.recorded)
+    {
+        micDataStamped& chunk = data.front();
+        if(chunk.flags.spilled) readBack(chunk);
+        // Whole interleaved frames only
+        size_t n = std::min(chunk.frames.size(), max_samples - copied);
+        n -= n % channels_;
+        if(n == 0) break;
+        memcpy(out + copied, chunk.frames.data(), n * sizeof(int16_t));
+        copied += n;
+        if(n == chunk.frames.size()) {
+            recycleFrames(chunk.frames);
+            data.pop_front();
+        } else {
+            // Partially drained: the remainder starts n / channels_ frames later
+            size_t frames_num = n / channels_;
+            chunk.frames.erase(chunk.frames.begin(), chunk.frames.begin() + n);
+            chunk.timestamp += (int64_t)(frames_num * 1000000.0 / (chunk.rate > 0. ? chunk.rate : rate_));
+            chunk.sample_index += frames_num;
+        }
+    }
+    queue_depth_ = data.size();
+    updateBufferedBytes();
+    data_mtx_.unlock();
+    drained();
+    return copied;
 }
 
 std::vector<micDataStamped> MicReadAlsa::copyUnrecordedData(){
     std::vector<micDataStamped> data_temp;
     data_mtx_.lock();
+    size_t spilled = 0;
     for(auto it = data.begin(); it != data.end(); it++)
     {
         if(!(it->flags.recorded))
         {
             data_temp.push_back(*it); //hopefully default copy constructor will do the job
+            if(it->flags.spilled) {
+                readSpilled(spilled, data_temp.back().frames);
+                data_temp.back().flags.spilled = 0;
+            }
             it->flags.recorded = 1;
         }
+        if(it->flags.spilled) spilled++;
     }
-    data_mtx_.unlock();
+    std::unique_lock<MicReadMutex> lck(data_mtx_, std::adopt_lock);
+    arrived(lck); //recorded chunks are consumable
     return data_temp; //Theoretically should return by rval since C11 to avoid copying
 }
 
+size_t MicReadAlsa::copyUnrecordedData(std::vector<micDataStamped>& out){
+    data_mtx_.lock();
+    for(size_t i = 0; i < out.size(); i++) {
+        recycleFrames(out[i].frames);
+    }
+    out.clear();
+    size_t spilled = 0;
+    for(auto it = data.begin(); it != data.end(); it++)
+    {
+        if(!(it->flags.recorded))
+        {
+            out.push_back(micDataStamped());
+            micDataStamped& chunk = out.back();
+            takeFrames(chunk.frames);
+            if(it->flags.spilled) readSpilled(spilled, chunk.frames);
+            else chunk.frames.assign(it->frames.begin(), it->frames.end());
+            chunk.id = it->id;
+            chunk.timestamp = it->timestamp;
+            chunk.sample_index = it->sample_index;
+            chunk.rate = it->rate;
+            chunk.flags = it->flags;
+            chunk.flags.spilled = 0;
+            it->flags.recorded = 1;
+        }
+        if(it->flags.spilled) spilled++;
+    }
+    std::unique_lock<MicReadMutex> lck(data_mtx_, std::adopt_lock);
+    arrived(lck); //recorded chunks are consumable
+    return out.size();
+}
+
 // Try not to use this function either since it will interfere with the recording mechanism
 std::deque<micDataStamped> MicReadAlsa::moveData(){
     data_mtx_.lock();
-    std::deque<micDataStamped> data_temp = std::move(data); //After moving the data vector should be empty
+    for(auto it = data.begin(); it != data.end(); it++) {
+        if(it->flags.spilled) readBack(*it);
+    }
+    // Moved element by element: the blocks of data stay with its pool (used under data_mtx_ only)
+    std::deque<micDataStamped> data_temp(std::make_move_iterator(data.begin()), std::make_move_iterator(data.end()));
+    data.clear();
+    queue_depth_ = 0;
+    buffered_bytes_ = 0;
     data_mtx_.unlock();
+    drained();
     return data_temp; //Theoretically should return by rval since C11 to avoid copying
 }
 
 // DON'T USE THIS FUNCTION: I left it specifically to point out / demonstrate unsafe behavior
 std::deque<micDataStamped> MicReadAlsa::copyData(){
     data_mtx_.lock();
-    std::deque<micDataStamped> data_temp = data; //Just copying data
+    std::deque<micDataStamped> data_temp(data.begin(), data.end()); //Just copying data
+    size_t spilled = 0;
+    for(auto it = data_temp.begin(); it != data_temp.end(); it++) {
+        if(it->flags.spilled) {
+            readSpilled(spilled++, it->frames);
+            it->flags.spilled = 0;
+        }
+    }
     data_mtx_.unlock();
     return data_temp; //Theoretically should return by rval since C11 to avoid copying
 }
@@ -437,44 +997,92 @@ std::ostream& write_word_swap_endian( std::ostream& outs, Word value, unsigned s
 }
 
 
+// Appends a little endian word to a batch buffer (string counterpart of write_word_swap_endian)
+template <typename Word>
+void append_word_swap_endian( std::string& out, Word value, unsigned size = sizeof( Word ) )
+{
+    for (; size; --size, value >>= 8)
+        out.push_back( static_cast <char> (value & 0xFF) );
+}
+
 void MicReadAlsa::record_thread()
 {
+    nameThread(THREAD_RECORD, "record");
     //-----------------------------------------------------------------
-    // Opening CSV
+    // Opening files: through the shared IoWriter (batched vectored writes) or with own streams
     std::ofstream csv_file;
-    csv_file.open(filename_base_ + ".csv");
+    std::ofstream f;
+    std::ofstream idx_file;
+    int csv_id = -1, wav_id = -1, idx_id = -1;
+    bool index = index_interval_ > 0;
+    if(writer_ != nullptr) {
+        csv_id = writer_->openFile(filename_base_ + ".csv");
+        wav_id = writer_->openFile(filename_base_ + ".wav");
+        if(index) idx_id = writer_->openFile(filename_base_ + ".idx");
+    } else {
+        csv_file.open(filename_base_ + ".csv");
+        f.open(filename_base_ + ".wav", std::ios::binary);
+        if(index) idx_file.open(filename_base_ + ".idx", std::ios::binary);
+    }
+    auto write_csv = [&](const std::string& batch) {
+        if(batch.empty()) return;
+        if(writer_ != nullptr) writer_->write(csv_id, batch.data(), batch.size());
+        else csv_file.write(batch.data(), batch.size());
+    };
+    auto write_wav = [&](const char* bytes, size_t size) {
+        if(writer_ != nullptr) writer_->write(wav_id, bytes, size);
+        else f.write(bytes, size);
+    };
+    auto write_idx = [&](const std::string& batch) {
+        if(batch.empty()) return;
+        if(writer_ != nullptr) writer_->write(idx_id, batch.data(), batch.size());
+        else idx_file.write(batch.data(), batch.size());
+    };
+
+    // Every iteration goes out as one write per file
+    std::string csv_batch;
+    std::string wav_batch;
+    std::string idx_batch;
+    uint64_t csv_pos = 0; //bytes written to the csv file (index offsets)
     if(record_csv_) {
-        csv_file << "id" << "," <<
-                    "timestamp" << "," <<
-                    "flag" << "," <<
-                    "frames" << std::endl;
+        csv_batch = "id,timestamp,flag,sample_index,rate,frames\n";
+        write_csv(csv_batch);
+        csv_pos = csv_batch.size();
     }
 
     //-----------------------------------------------------------------
     // PREPARING WAV HEADER
-    std::ofstream f( filename_base_ + ".wav", std::ios::binary );
-
-    int total_bitrate = rate_ * bits_per_sample_ * channels_; //sample rate
+    int total_bitrate = rate_ * bits_per_sample_ * channels_ / 8; //byte rate
     int data_block_size = (int) channels_ * bits_per_sample_ / 8;
 
-    f << "RIFF----WAVEfmt ";     // (chunk size to be filled in later)
-    write_word_swap_endian( f,               16, 4 );  // no extension data
-    write_word_swap_endian( f,                1, 2 );  // PCM - integer samples
-    write_word_swap_endian( f,        channels_, 2 );  // one channel (mono file)
-    write_word_swap_endian( f,            rate_, 4 );  // samples per second (Hz)
-    write_word_swap_endian( f,    total_bitrate, 4 );  // (Sample Rate * BitsPerSample * Channels) / 8 == 176400 for 2 channels with 16 bits per sample
-    write_word_swap_endian( f,  data_block_size, 2 );  // data block size (size of all integer sample, one for each channel, in bytes)
-    write_word_swap_endian( f, bits_per_sample_, 2 );  // number of bits per sample (use a multiple of 8)
+    wav_batch = "RIFF----WAVEfmt ";     // (chunk size to be filled in later)
+    append_word_swap_endian( wav_batch,               16, 4 );  // no extension data
+    append_word_swap_endian( wav_batch,                1, 2 );  // PCM - integer samples
+    append_word_swap_endian( wav_batch,        channels_, 2 );  // one channel (mono file)
+    append_word_swap_endian( wav_batch,            rate_, 4 );  // samples per second (Hz)
+    append_word_swap_endian( wav_batch,    total_bitrate, 4 );  // (Sample Rate * BitsPerSample * Channels) / 8 == 176400 for 2 channels with 16 bits per sample
+    append_word_swap_endian( wav_batch,  data_block_size, 2 );  // data block size (size of all integer sample, one for each channel, in bytes)
+    append_word_swap_endian( wav_batch, bits_per_sample_, 2 );  // number of bits per sample (use a multiple of 8)
 
     // Write the data chunk header
-    size_t data_chunk_pos = f.tellp();
-    f << "data----";  // (chunk size to be filled in later)
+    size_t data_chunk_pos = wav_batch.size();
+    wav_batch += "data----";  // (chunk size to be filled in later)
+    write_wav(wav_batch.data(), wav_batch.size());
+    uint32_t data_bytes = 0;
+    uint64_t wav_pos = wav_batch.size(); //64 bit: the index stays valid past the 4 GB wav limit
+
+    RecIndexBuilder index_builder(channels_, index_interval_);
+    if(index) {
+        index_builder.appendHeader(idx_batch, rate_, bits_per_sample_, wav_pos);
+        write_idx(idx_batch);
+    }
 
     //Time to measure freq
     auto rec_time_prev = std::chrono::duration_cast<std::chrono::microseconds>(
                 std::chrono::system_clock::now().time_since_epoch()
                 );
 
+    std::vector<micDataStamped> data; //reused between iterations
     printf("%s: Recording Thread ready ...\n", name_.c_str());
     //-----------------------------------------------------------------
     // RECORDING WAV and CSV
@@ -483,7 +1091,7 @@ void MicReadAlsa::record_thread()
         // Pausing together with the reading thread
         if(!run_fl_){
             printf("%s: Record Thread is paused ...\n",  name_.c_str());
-            std::unique_lock<std::mutex> lck(mtx_);
+            std::unique_lock<MicReadMutex> lck(mtx_);
             cv_.wait(lck);
         }
 
@@ -495,50 +1103,65 @@ void MicReadAlsa::record_thread()
         // Sleeping
         std::this_thread::sleep_for (std::chrono::milliseconds(rec_delay_));
         // Checking data
-        auto data = (record_only_) ? getData() : copyUnrecordedData();
+        TraceSpan dequeue_span("dequeue");
+        if(record_only_) getData(data); else copyUnrecordedData(data);
+        dequeue_span.end();
         // If data empty - let's wait more
         if(data.empty()) continue;
 
         int chunks_recorded_cur = 0;
+        csv_batch.clear();
+        idx_batch.clear();
 
         for (auto iter=data.begin(); iter != data.end(); iter++)
         {
             chunks_recorded_ ++;
             chunks_recorded_cur ++;
 
+            if(index) {
+                index_builder.addChunk(*iter, wav_pos, record_csv_ ? csv_pos + csv_batch.size() : 0, idx_batch);
+            }
+
             // CSV nonframe information
+            TraceSpan csv_span("csv format");
             if(record_csv_) {
-                csv_file << std::to_string(iter->id) << "," <<
-                            std::to_string(iter->timestamp) << "," <<
-                            std::to_string(iter->flags.all) << ",";
+                csv_batch += std::to_string(iter->id) + "," +
+                             std::to_string(iter->timestamp) + "," +
+                             std::to_string(iter->flags.all) + "," +
+                             std::to_string(iter->sample_index) + "," +
+                             std::to_string(iter->rate) + ",";
             }
 
-            // WAV and CSV frames writing
-            for(int i=0; i<iter->frames.size(); i++)
-            {
-                //Recording data frame (only 1 channel)
-                write_word_swap_endian(f, iter->frames[i], (int)bits_per_sample_/8);
-                // write_word(f, iter->frame[i]);
+            csv_span.end();
 
-                if(record_csv_) { //Space separation for easy splitting
-                    csv_file << " " << std::to_string(iter->frames[i]);
+            // WAV and CSV frames writing
+            TraceSpan wav_span("wav write");
+            // The frames already are little endian int16: the whole chunk at once
+            write_wav((const char*)iter->frames.data(), iter->frames.size() * sizeof(int16_t));
+            data_bytes += iter->frames.size() * bits_per_sample_ / 8;
+            wav_pos += iter->frames.size() * bits_per_sample_ / 8;
+            wav_span.end();
+
+            if(record_csv_) { //Space separation for easy splitting
+                TraceSpan csv_frames_span("csv format");
+                for(size_t i=0; i<iter->frames.size(); i++) {
+                    csv_batch += " " + std::to_string(iter->frames[i]);
                 }
-
-            }
-
-            // CSV ENDLINE
-            if(record_csv_) {
-                csv_file<<std::endl;
+                // CSV ENDLINE
+                csv_batch += "\n";
             }
 
         }
+        TraceSpan write_span("csv write");
+        write_csv(csv_batch);
+        csv_pos += csv_batch.size();
+        write_idx(idx_batch);
+        write_span.end();
 
         //Calculating freq
         rec_freq_estimate_ = (double) 1.0 / (rec_time - rec_time_prev).count() * 1000000;
-        rec_freq_estimates.push_back(rec_freq_estimate_);
-        if(rec_freq_estimates.size() > max_est_size_) {
-          rec_freq_estimates.pop_front();
-        }
+        rec_freq_estimates[rec_est_pos_] = rec_freq_estimate_;
+        rec_est_pos_ = (rec_est_pos_ + 1) % rec_freq_estimates.size();
 
         if (chunks_recorded_ % 500 == 0) {
 //          std::cout << "Rec freq: " << estRecFreq() << " Chunks recorded:" << chunks_recorded_cur << std::endl;
@@ -548,28 +1171,36 @@ void MicReadAlsa::record_thread()
                   estReadFreq(),
                   estFPS(),
                   estRecFreq(),
-                  chunks_recorded_);
+                  getChunksRecorded());
         }
         rec_time_prev = rec_time;
 
 
     }
-    //-----------------------------------------------------------------
-    // --- CLOSING CSV
-    csv_file.close();
-
     //-----------------------------------------------------------------
     // --- CLOSING WAV RECODRING
-    // We'll need the final file size to fix the chunk sizes above
-    size_t file_length = f.tellp();
-
-    // Fix the data chunk header to contain the data size
-    f.seekp( data_chunk_pos + 4 );
-    write_word_swap_endian( f, file_length - data_chunk_pos + 8 );
-
-    // Fix the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
-    f.seekp( 0 + 4 );
-    write_word_swap_endian( f, file_length - 8, 4 );
+    // Fix the data chunk header to contain the data size and
+    // the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
+    size_t file_length = data_chunk_pos + 8 + data_bytes;
+    std::string data_size, riff_size;
+    append_word_swap_endian( data_size, data_bytes, 4 );
+    append_word_swap_endian( riff_size, (uint32_t)(file_length - 8), 4 );
+
+    if(writer_ != nullptr) {
+        writer_->writeAt(wav_id, data_chunk_pos + 4, data_size.data(), 4);
+        writer_->writeAt(wav_id, 0 + 4, riff_size.data(), 4);
+        writer_->closeFile(csv_id);
+        writer_->closeFile(wav_id);
+        if(index) writer_->closeFile(idx_id);
+    } else {
+        csv_file.close();
+        idx_file.close();
+        f.seekp( data_chunk_pos + 4 );
+        f.write( data_size.data(), 4 );
+        f.seekp( 0 + 4 );
+        f.write( riff_size.data(), 4 );
+        f.close();
+    }
 
     printf("%s: Chunks recorded %ld ...\n",  name_.c_str(), getChunksRecorded());
 }
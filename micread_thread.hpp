@@ -43,10 +43,20 @@ See more about ALSA programming here: https://www.linuxjournal.com/article/6735
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <numeric>
+#include <functional>
+#include <future>
 
 #include <alsa/asoundlib.h>
 
+#include "alsa_tuner.hpp"
+#include "sample_clock.hpp"
+#include "io_writer.hpp"
+#include "instrument.hpp"
+#include "node_pool.hpp"
+#include "trace.hpp"
+
 // Buffer size in terms of frames.
 // Smaller buffers resulted in the same millisecond time stamp
 #define MICREAD_DEF_BUF_SIZE 512
@@ -57,6 +67,25 @@ See more about ALSA programming here: https://www.linuxjournal.com/article/6735
 #define MICREAD_DEF_NAME "MicRead"
 #define MICREAD_DEF_REC_FILENAME "rec_mic"
 #define MICREAD_DEF_REC_FREQ 100
+#define MICREAD_FRAMES_POOL_SIZE 256 //frame buffers kept for reuse by the reading thread
+#define MICREAD_FRAMES_PREALLOC 16 //frame buffers allocated up front (chunks in flight of a late consumer)
+#define MICREAD_STAGING_CHUNKS 8 //chunks the reading thread holds back while a consumer has the buffer locked
+#define MICREAD_MAX_STRIDE 16 //largest decimation of MICREAD_QUEUE_DECIMATE
+#define MICREAD_SPILL_BATCH 16 //chunks per write of the spill thread
+#define MICREAD_DEF_SPILL_DIR "/tmp"
+
+// What the reading thread does when the main buffer (MicReadAlsa::data) is full (see setQueuePolicy()).
+// Full means max_chunks chunks, the controller leaves the shedding state below max_chunks / 4 (hysteresis)
+enum MicReadQueuePolicy
+{
+    MICREAD_QUEUE_UNBOUNDED = 0, //the buffer grows while the consumer is behind (no bound)
+    MICREAD_QUEUE_BLOCK,         //the reading thread waits for space, at most block_us, then the chunk is dropped
+    MICREAD_QUEUE_DROP_OLDEST,   //the oldest chunk makes room: bounded latency, the newest audio is kept
+    MICREAD_QUEUE_DROP_NEWEST,   //new chunks are dropped until the backlog is cleared: few, long gaps
+    MICREAD_QUEUE_DECIMATE       //all chunks are kept, but while behind only every k-th chunk is marked for
+                                 //processing (flags.skip on the others, k doubles while the backlog grows).
+                                 //A full buffer drops the oldest chunk
+};
 
 //---SND_PCM_FORMAT options:
 //SND_PCM_FORMAT_U8:
@@ -70,17 +99,52 @@ struct micDataStamped
     micDataStamped(){
         id = 0;
         timestamp = 0;
+        sample_index = 0;
+        rate = 0.;
         flags.all = 0;
     }
     union {
         uint8_t all; //summary of all flags (i.e. a byte containing them all)
-        uint8_t recorded:1;
+        struct {
+            uint8_t recorded:1;
+            uint8_t skip:1; //consumers may skip the processing of the chunk (decimated, see MICREAD_QUEUE_DECIMATE)
+            uint8_t spilled:1; //frames are in the spill file (see setMemoryBudget()), never set in delivered chunks
+        };
     } flags;
     long int id; //counter of the chunk
-    int64_t timestamp; //milliseconds time stamp
+    int64_t timestamp; //microseconds time stamp of the first sample (since t_start, from the sample clock model)
+    int64_t sample_index; //index of the first sample since the stream start
+    double rate; //estimated real sample rate (Hz): sample i of the chunk is at timestamp + i * 1e6 / rate
     std::vector<int16_t> frames; //mic data itself
 };
 
+// Main buffer of MicReadAlsa: its blocks are recycled (see node_pool.hpp), queuing does not allocate
+typedef std::deque<micDataStamped, NodeAllocator<micDataStamped> > micDataQueue;
+
+// Processing stage attached to the reader (see MicReadAlsa::addStage()).
+// process() is called from the reading thread right after every chunk is read from the device,
+// i.e. it must be fast and must not block. The chunk is only valid during the call.
+class MicReadStage
+{
+public:
+    virtual ~MicReadStage() {}
+    virtual void process(const micDataStamped& chunk) = 0;
+    virtual const char* name() const {return "stage";} //span name on the trace timeline (see trace.hpp)
+};
+
+// Push delivery (see MicReadAlsa::addCallback()): called on the dispatch thread for every chunk.
+// The chunk is only valid during the call
+typedef std::function<void(const micDataStamped& chunk)> MicReadCallback;
+
+// Run time of a processing stage in the reading thread (see MicReadAlsa::getStageStats())
+struct MicReadStageStats
+{
+    MicReadStageStats(): calls(0), total_ns(0), max_ns(0) {}
+    std::atomic<long> calls;
+    std::atomic<long> total_ns;
+    std::atomic<long> max_ns;
+};
+
 class MicReadAlsa
 {
 public:
@@ -96,10 +160,15 @@ public:
                 unsigned int rate=MICREAD_DEF_RATE,
                 int channels=1,
                 snd_pcm_format_t format=SND_PCM_FORMAT_S16_LE,
-                std::string name=MICREAD_DEF_NAME);
+                std::string name=MICREAD_DEF_NAME,
+                MicReadLatencyProfile profile=MICREAD_PROFILE_DEFAULT,
+                IoWriter* writer=nullptr);
     /// \param manual_start  if you don't want automatic start set to True and use start() later
     /// \param record_only  if set True the recording thread will clear the buffer automatically
     /// \param channels ONLY 1 CHANNEL SUPPORTED. Parameter left for future extensions
+    /// \param profile  ALSA period / buffer sizes (see alsa_tuner.hpp). Tuned on the first use, loaded from MICREAD_DEF_TUNE_FILENAME later.
+    ///                 MICREAD_PROFILE_LOW_LATENCY reads chunks of one period (buffer_frames_num is ignored)
+    /// \param writer  shared I/O writer (see io_writer.hpp) for the WAV / CSV files. nullptr: own file streams
 
     ~MicReadAlsa();
 
@@ -117,14 +186,54 @@ public:
     // If record is false it just moves all the data.
     // If record_only is true then the record thread calls this function and clears the data
     std::vector<micDataStamped> getData();
+    // Allocation free variants for consumer loops (the containers are reused between calls):
+    // getData(out) moves the chunks into out and returns their number. The frame buffers of the chunks
+    // previously held by out go back to the reading thread, thus in the steady state neither side allocates.
+    // max_chunks: at most that many chunks (oldest first), the backlog stays in the buffer under the queue policy
+    size_t getData(std::vector<micDataStamped>& out, size_t max_chunks=SIZE_MAX);
+    // Drains up to max_samples samples (whole frames of all channels) into a contiguous buffer.
+    // A partially drained chunk stays in the buffer.
+    // timestamp (optional): microseconds time stamp of the first returned sample. Returns the number of samples
+    size_t getSamples(int16_t* out, size_t max_samples, int64_t* timestamp=nullptr);
+
+    //--- Push delivery: consumers react as soon as a chunk lands instead of polling getData()
+    // Blocks until consumable chunks are in the buffer (or timeout / finish()). Returns their number (0: none)
+    size_t waitData(std::chrono::microseconds timeout);
+    // waitData() followed by getData(out, max_chunks)
+    size_t waitData(std::vector<micDataStamped>& out, std::chrono::microseconds timeout, size_t max_chunks=SIZE_MAX);
+    // Future of the next data: ready (number of consumable chunks) as soon as there are some, 0 on finish().
+    // For event loops / coroutine adapters that wait on futures instead of threads
+    std::future<size_t> nextData();
+    // Callbacks run on a dedicated dispatch thread (started by the first callback) which drains the buffer as soon
+    // as chunks land, in order, every chunk to every callback. The dispatch thread is then the consumer of the
+    // buffer: do not mix callbacks with getData()
+    void addCallback(const MicReadCallback& callback);
+    long getChunksDispatched() const {return chunks_dispatched_;}
+    long getDispatchWakeups() const {return dispatch_wakeups_;} //batches delivered (chunks / wakeups: batch size)
+
     double estReadFreq() const {return std::accumulate( read_freq_estimates.begin(), read_freq_estimates.end(), 0.0)/read_freq_estimates.size();} //Frequency of data reading
     double estFPS() const {return std::accumulate( read_fps_estimates.begin(), read_fps_estimates.end(), 0.0)/read_fps_estimates.size();} //Frames per Second estimate
 
-    std::deque<micDataStamped> data; //Direct data access - unsafe. Better use getData() !!!
+    NodePool data_nodes_; //free blocks of data (declared before it: outlives it)
+    micDataQueue data; //Direct data access - unsafe. Better use getData() !!!
 
     // Frame counters
     long getChunksRead() const; //num of frames received from the device
     long getChunksRecorded() const; //num of frames recorded from the device
+    // Pipeline counters (atomics: safe to read from any thread without disturbing the reading thread)
+    long getChunksDropped() const {return chunks_dropped_;} //main buffer was locked by a consumer (staging full)
+    long getXruns() const {return xruns_;}
+    long getReadErrors() const {return read_errors_;} //failed / short reads other than xruns
+    long getQueueDepth() const {return queue_depth_;} //chunks in the main buffer
+    // Queue policy counters (see setQueuePolicy())
+    long getChunksShed() const {return chunks_shed_;}         //dropped by the policy (incl. block timeouts)
+    long getChunksDecimated() const {return chunks_decimated_;} //marked skip
+    long getBlockWaits() const {return block_waits_;}         //chunks the reading thread waited for space for
+    long getBlockTimeouts() const {return block_timeouts_;}
+    long getSheddingEpisodes() const {return shedding_episodes_;} //times the buffer got full
+    bool isShedding() const {return shedding_;}               //behind: between full and the low watermark
+    int getProcessingStride() const {return stride_;}         //current k of MICREAD_QUEUE_DECIMATE (1: full rate)
+    long getQueueHighWater() const {return queue_high_water_;} //deepest buffer seen
 
     //--- Device handling
     //If constructor fails to open the device, use this function manually
@@ -137,20 +246,67 @@ public:
         rec_delay_ = (long) 1./ rec_freq * 1000; //ms
     }
 
+    // Bound of the main buffer and what happens when it is full. max_chunks 0: MICREAD_QUEUE_UNBOUNDED.
+    // block_us: longest wait of MICREAD_QUEUE_BLOCK (negative: one chunk period; beyond the ALSA buffer it overruns)
+    // Set before start()
+    void setQueuePolicy(MicReadQueuePolicy policy, int max_chunks, long block_us=-1);
+    MicReadQueuePolicy getQueuePolicy() const {return queue_policy_;}
+
+    // Memory budget of the buffered chunks in bytes (0: none). Past the budget the oldest chunks spill to a
+    // temporary (unlinked) file in spill_dir, written by a spill thread. getData() & co read them back
+    // transparently and in order. Spilled chunks keep their metadata (~100 bytes) in memory. Call before start().
+    // Negative on error
+    int setMemoryBudget(size_t bytes, const std::string& spill_dir=MICREAD_DEF_SPILL_DIR);
+    long getBufferedBytes() const {return buffered_bytes_;}  //memory of the buffered chunks (incl. spilled metadata)
+    long getChunksSpilled() const {return chunks_spilled_;}
+    long getBytesSpilled() const {return bytes_spilled_;}    //written to the spill file in total
+    long getSpillFileBytes() const {return spill_file_bytes_;} //currently waiting on disk
+    long getChunksReadBack() const {return chunks_read_back_;}
+    double getReadBackLatencyUs() const {return chunks_read_back_ > 0 ? read_back_ns_ * 1e-3 / chunks_read_back_ : 0.;}
+    double getReadBackMaxUs() const {return read_back_max_ns_ * 1e-3;}
+
+    // Chunks between the entries of the recording index <filename_base>.idx (see rec_index.hpp). 0: no index.
+    // Set before start()
+    void setIndexInterval(int chunks) {index_interval_ = chunks;}
+
+    // Attaches a processing stage to the reading thread. Stages run in the order they were added.
+    // Add stages before start() (the list is not protected by a mutex)
+    void addStage(MicReadStage* stage) {stages_.push_back(stage); stage_stats_.emplace_back();}
+    size_t getStageCount() const {return stages_.size();}
+    const MicReadStageStats& getStageStats(size_t stage) const {return stage_stats_[stage];}
+
+    // Threads of the reader. They are named "<name> read", "<name> record", ... (trace.hpp, instrument.hpp)
+    enum MicReadThread {THREAD_READ, THREAD_RECORD, THREAD_DISPATCH, THREAD_SPILL, THREADS_NUM};
+#ifdef MICREAD_INSTRUMENT
+    // Instrumented builds (see instrument.hpp): counters of the threads of the reader (nullptr until the thread
+    // started) and of its mutexes. finish() prints them
+    const instrumentThreadStats* getThreadStats(MicReadThread thread) const {return thread_stats_[thread];}
+    const MicReadMutex& getDataMutex() const {return data_mtx_;}
+    const MicReadMutex& getPauseMutex() const {return mtx_;}
+#endif
+
+    unsigned int getRate() const {return rate_;}
+    double getRateEstimate() const {return rate_estimate_;} //drift corrected rate (see sample_clock.hpp)
+
+    // Period / buffer sizes used by the next openDevice(). Zeros mean driver defaults
+    void setPeriodParams(const alsaPeriodParams& params) {period_params_ = params;}
+    const alsaPeriodParams& getPeriodParams() const {return period_params_;}
+
     // Get measured recording freq
     float estRecFreq() const {return std::accumulate( rec_freq_estimates.begin(), rec_freq_estimates.end(), 0.0)/rec_freq_estimates.size();}
 
 
 protected:
-    std::mutex mtx_; //thread pause mutex
-    std::condition_variable cv_;
-    std::mutex data_mtx_;
+    MicReadMutex mtx_; //thread pause mutex
+    MicReadCondition cv_;
+    MicReadMutex data_mtx_;
 
     bool run_fl_; //pause flag
     bool ready_fl_; //thread alive flag (not exited)
     std::string name_; //object name (for messaging)
     std::thread th_; //reading thread
     std::thread th_rec_;//recording thread
+    std::thread th_dispatch_; //callback dispatch thread (see addCallback())
 
     int buffer_frames_; //128 default
     unsigned int rate_; //44100 default
@@ -159,38 +315,132 @@ protected:
     int8_t *buffer_; //temporary data buffer for ALSA
     snd_pcm_t *capture_handle_;
     std::string device_; //Devices are in the format: "hw:X,Y", where X - card #, Y - device #. Both are int
-    snd_pcm_hw_params_t *hw_params_;
     snd_pcm_format_t format_;
+    alsaPeriodParams period_params_; //requested before openDevice(), actual after it
 
     // Wav stuff
     int channels_;
-    int bits_per_sample_;
+    int bits_per_sample_; //of the recorded WAV / index: the int16 frames
 
     // Thread stuff
     void run(); //Thread functions
     void record_thread();
     double freq_; // estimated frequency of the reading thread
     double rec_freq_estimate_;
-    std::deque<float> rec_freq_estimates;
+    std::deque<float> rec_freq_estimates; //rings of max_est_size_ values (overwritten in place)
     std::deque<float> read_freq_estimates;
     std::deque<float> read_fps_estimates;
     int max_est_size_;
+    size_t read_est_pos_;
+    size_t rec_est_pos_;
     double fps_est_;
     bool record_only_;
     bool record_;
     bool record_csv_;
-
-    long chunks_read_; //how many frames we received from the device
-    long chunks_recorded_; //how many frames we actually recorded
+    std::vector<MicReadStage*> stages_;
+    std::deque<MicReadStageStats> stage_stats_; //same order as stages_
+
+    // Frame buffer recycling (protected by data_mtx_): drained buffers return to the pool,
+    // the reading thread takes its next buffer from it
+    std::vector<std::vector<int16_t> > frames_pool_;
+    std::vector<int16_t> spare_frames_; //next chunk buffer (reading thread only)
+    void recycleFrames(std::vector<int16_t>& frames); //call with data_mtx_ locked
+    void takeFrames(std::vector<int16_t>& frames);    //call with data_mtx_ locked
+
+    // Queue policy (see setQueuePolicy()). Chunks that meet a locked buffer wait in staged_ (reading thread only)
+    MicReadQueuePolicy queue_policy_;
+    size_t queue_max_;
+    std::chrono::microseconds block_timeout_;
+    MicReadCondition space_cv_; //a consumer drained the buffer (MICREAD_QUEUE_BLOCK)
+    std::vector<micDataStamped> staged_;
+    size_t staged_num_;
+    long stride_raised_at_; //chunk id of the last decimation increase
+    // Puts the chunk into the main buffer according to the policy. false: shed (the chunk keeps its frames).
+    // Call with data_mtx_ locked
+    bool enqueue(micDataStamped& chunk, std::unique_lock<MicReadMutex>& lck);
+    void drained() {space_cv_.notify_all();} //consumers: chunks were removed
+
+    // Spilling (protected by data_mtx_). The spilled chunks are one contiguous run of data, oldest first,
+    // spill_records_ holds their file positions in the same order
+    struct spillRecord
+    {
+        uint64_t offset;
+        uint32_t samples;
+    };
+    size_t memory_budget_;
+    size_t chunk_bytes_; //memory of one buffered chunk
+    int spill_fd_;
+    std::thread th_spill_;
+    MicReadCondition spill_cv_;
+    std::deque<spillRecord> spill_records_;
+    uint64_t spill_write_pos_;
+    bool spill_in_flight_; //a batch is being written (no truncation)
+    std::atomic<long> buffered_bytes_;
+    std::atomic<long> chunks_spilled_;
+    std::atomic<long> bytes_spilled_;
+    std::atomic<long> spill_file_bytes_;
+    std::atomic<long> chunks_read_back_;
+    std::atomic<long> read_back_ns_;
+    std::atomic<long> read_back_max_ns_;
+    void spill_thread();
+    size_t spillRunBegin() const; //index of the first spilled chunk (data.size() if none)
+    void updateBufferedBytes();
+    // Loads the frames of chunk (the first spilled one) back into memory. Call with data_mtx_ locked
+    void readBack(micDataStamped& chunk);
+    // Frames of the k-th spilled chunk without loading it. Call with data_mtx_ locked
+    void readSpilled(size_t k, std::vector<int16_t>& frames);
+    void dropSpilledFront(); //the first spilled chunk leaves the buffer without being read
+
+    // Push delivery
+    MicReadCondition data_cv_; //consumable chunks arrived (waitData())
+    std::vector<std::promise<size_t> > data_promises_; //nextData() (protected by data_mtx_)
+    std::vector<MicReadCallback> callbacks_;
+    std::mutex callbacks_mtx_;
+    std::atomic<long> chunks_dispatched_;
+    std::atomic<long> dispatch_wakeups_;
+    size_t consumable() const; //leading chunks getData() would return. Call with data_mtx_ locked
+    void arrived(std::unique_lock<MicReadMutex>& lck); //wakes the waiters (unlocks data_mtx_)
+    void dispatch_thread();
+
+    std::atomic<long> chunks_read_; //how many frames we received from the device
+    int64_t samples_read_; //samples (frames in ALSA terms) read since the stream start
+
+    // Sample accurate time stamps: ALSA status time stamps filtered by the sample clock model
+    SampleClock sample_clock_;
+    snd_pcm_status_t *status_;
+    bool htstamp_monotonic_; //status time stamps are on the steady_clock time base
+    std::atomic<double> rate_estimate_;
+    void updateSampleClock(std::chrono::microseconds read_end);
+    std::atomic<long> chunks_recorded_; //how many frames we actually recorded
+    std::atomic<long> chunks_dropped_;
+    std::atomic<long> xruns_;
+    std::atomic<long> read_errors_;
+    std::atomic<long> queue_depth_;
+    std::atomic<long> chunks_shed_;
+    std::atomic<long> chunks_decimated_;
+    std::atomic<long> block_waits_;
+    std::atomic<long> block_timeouts_;
+    std::atomic<long> shedding_episodes_;
+    std::atomic<bool> shedding_;
+    std::atomic<int> stride_;
+    std::atomic<long> queue_high_water_;
     std::chrono::steady_clock::time_point t_start_;
+    void nameThread(MicReadThread thread, const char* role); //called by the thread itself
+#ifdef MICREAD_INSTRUMENT
+    std::atomic<const instrumentThreadStats*> thread_stats_[THREADS_NUM];
+    void reportInstrumentation();
+#endif
 
     bool openFiles();//Opens files that we are recording into
     std::string filename_base_;//We will modify this base to record csv and wav files
+    IoWriter* writer_; //shared by the recorders of all devices (optional)
 
     // This function copies only unrecorded data and marks the data as recorded
     // It is also safe since it lock the thread
     std::vector<micDataStamped> copyUnrecordedData();
+    size_t copyUnrecordedData(std::vector<micDataStamped>& out); //reuses the containers like getData(out)
     long rec_delay_;
+    int index_interval_; //recording index interval (chunks), 0: no index
 
     // The copyData() is inherently unsafe to use: it locks the mutex, copies the data.
     // Beware it does not clean anything.
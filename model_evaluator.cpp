@@ -0,0 +1,181 @@
+#include "model_evaluator.hpp"
+
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+void evaluationResult::add(const evaluationResult& other)
+{
+    windows += other.windows;
+    skipped += other.skipped;
+    correct += other.correct;
+    seconds += other.seconds;
+    if(confusion.size() < other.confusion.size()) confusion.resize(other.confusion.size(), 0);
+    for(size_t i = 0; i < other.confusion.size(); i++) confusion[i] += other.confusion[i];
+}
+
+ModelEvaluator::ModelEvaluator(const LstmClassifier& model, int threads, int batch, int block_windows):
+    model_(model),
+    name_("ModelEvaluator"),
+    threads_(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    batch_(batch > 0 ? batch : EVAL_DEF_BATCH),
+    block_windows_(block_windows > 0 ? block_windows : EVAL_DEF_BLOCK_WINDOWS),
+    steals_(0),
+    seconds_(0.)
+{
+}
+
+void ModelEvaluator::addShard(const std::string& filename_base)
+{
+    shards_.push_back(filename_base);
+}
+
+int ModelEvaluator::run()
+{
+    auto t_start = std::chrono::steady_clock::now();
+    const int classes = model_.classes();
+    results_.assign(shards_.size(), evaluationResult());
+    total_ = evaluationResult();
+    total_.confusion.assign((size_t)classes * classes, 0);
+    steals_ = 0;
+
+    // Seed the queues: shard i goes to worker i % threads, split into blocks
+    std::vector<workerQueue> queues(threads_);
+    queues_.swap(queues);
+    for(size_t i = 0; i < shards_.size(); i++) {
+        results_[i].shard = shards_[i];
+        results_[i].confusion.assign((size_t)classes * classes, 0);
+        FeatureStore store;
+        if(store.open(shards_[i]) < 0) {
+            results_[i].error = -1;
+            continue;
+        }
+        if(store.frames() != model_.steps() || store.bands() != model_.input()) {
+            fprintf(stderr, "%s: ERROR: %s has %d x %d windows, the model expects %d x %d\n", name_.c_str(),
+                    shards_[i].c_str(), store.frames(), store.bands(), model_.steps(), model_.input());
+            results_[i].error = -2;
+            continue;
+        }
+        for(size_t first = 0; first < store.size(); first += block_windows_) {
+            evaluationTask task = {i, first, std::min(block_windows_, store.size() - first)};
+            queues_[i % threads_].tasks.push_back(task);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads_; i++) {
+        workers.emplace_back(&ModelEvaluator::worker, this, i);
+    }
+    for(auto& worker : workers) worker.join();
+
+    int failed = 0;
+    for(const evaluationResult& res : results_) {
+        if(res.error < 0) failed++;
+        else total_.add(res);
+    }
+    seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    return failed;
+}
+
+bool ModelEvaluator::nextTask(int id, evaluationTask& task)
+{
+    {
+        std::lock_guard<std::mutex> lck(queues_[id].mtx);
+        if(!queues_[id].tasks.empty()) {
+            task = queues_[id].tasks.back();
+            queues_[id].tasks.pop_back();
+            return true;
+        }
+    }
+    // Steal from the front (the blocks the owner reaches last) of the fullest queue. The sizes are only a hint,
+    // tasks are never added during run(): no task left anywhere means done
+    while(true) {
+        int victim = -1;
+        size_t most = 0;
+        for(int i = 0; i < threads_; i++) {
+            if(i == id) continue;
+            std::lock_guard<std::mutex> lck(queues_[i].mtx);
+            if(queues_[i].tasks.size() > most) {
+                most = queues_[i].tasks.size();
+                victim = i;
+            }
+        }
+        if(victim < 0) return false;
+        std::lock_guard<std::mutex> lck(queues_[victim].mtx);
+        if(queues_[victim].tasks.empty()) continue;
+        task = queues_[victim].tasks.front();
+        queues_[victim].tasks.pop_front();
+        steals_++;
+        return true;
+    }
+}
+
+void ModelEvaluator::worker(int id)
+{
+    LstmClassifier model(model_); //own work buffers
+    const int classes = model.classes();
+    std::vector<size_t> indices(batch_);
+    std::vector<float> windows((size_t)batch_ * model.windowSize());
+    std::vector<int32_t> labels(batch_);
+    std::vector<float> probs((size_t)batch_ * classes);
+    FeatureStore store;
+    size_t store_shard = (size_t)-1;
+
+    evaluationTask task;
+    evaluationResult res;
+    while(nextTask(id, task)) {
+        auto t_start = std::chrono::steady_clock::now();
+        if(task.shard != store_shard) {
+            store.close();
+            store_shard = (size_t)-1;
+            if(store.open(shards_[task.shard]) < 0) {
+                std::lock_guard<std::mutex> lck(results_mtx_);
+                results_[task.shard].error = -1;
+                continue;
+            }
+            store_shard = task.shard;
+        }
+        res.windows = res.skipped = res.correct = 0;
+        res.confusion.assign((size_t)classes * classes, 0);
+        int error = evaluate(task, store, model, indices, windows, labels, probs, res);
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+        std::lock_guard<std::mutex> lck(results_mtx_);
+        if(error < 0) results_[task.shard].error = error;
+        else results_[task.shard].add(res);
+    }
+}
+
+int ModelEvaluator::evaluate(const evaluationTask& task, FeatureStore& store, LstmClassifier& model,
+                             std::vector<size_t>& indices, std::vector<float>& windows, std::vector<int32_t>& labels,
+                             std::vector<float>& probs, evaluationResult& res)
+{
+    const int classes = model.classes();
+    size_t next = task.first;
+    const size_t end = task.first + task.count;
+    while(next < end) {
+        // Gather the next batch of labeled windows
+        int n = 0;
+        for(; next < end && n < batch_; next++) {
+            int32_t label = store.label(next).label;
+            if(label < 0 || label >= classes) {
+                res.skipped++;
+                continue;
+            }
+            indices[n++] = next;
+        }
+        if(n == 0) continue;
+        if(store.getBatch(indices.data(), n, windows.data(), labels.data()) < 0) return -3;
+        model.predict(windows.data(), n, probs.data());
+
+        for(int b = 0; b < n; b++) {
+            const float* p = &probs[(size_t)b * classes];
+            int predicted = (int)(std::max_element(p, p + classes) - p);
+            res.confusion[(size_t)labels[b] * classes + predicted]++;
+            if(predicted == labels[b]) res.correct++;
+        }
+        res.windows += n;
+    }
+    return 0;
+}
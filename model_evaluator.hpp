@@ -0,0 +1,105 @@
+/*
+Offline evaluation of the LSTM classifier over feature shards (e.g. a whole drive archive built by build_dataset).
+Every shard is split into blocks of windows, the blocks are the tasks of a work stealing pool: each worker owns a
+deque seeded with the blocks of "its" shards (consecutive blocks of a shard stay on one worker, i.e. one mapping and
+sequential reads), takes its own tasks from the back and, when out of work, steals from the front of the fullest
+other deque. A few long drives thus never leave the other workers idle.
+Memory stays bounded regardless of the archive size: shards are memory mapped one at a time per worker, the windows
+of a block are converted in batches into one preallocated buffer per worker, every worker has its own copy of the
+model (the LstmClassifier work buffers). Windows with a label outside [0, classes) are skipped.
+
+A minimal example:
+    LstmClassifier model;
+    model.load("micpred_rnn.lstm");
+    ModelEvaluator evaluator(model);
+    evaluator.addShard("_data/features/2018_Aug_22_15:16:34__wet");
+    evaluator.run();
+    printf("accuracy %.3f\n", evaluator.total().accuracy());
+ */
+
+#ifndef MIC_READ_THREAD_MODEL_EVALUATOR_HPP
+#define MIC_READ_THREAD_MODEL_EVALUATOR_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#include "lstm_classifier.hpp"
+#include "feature_store.hpp"
+
+#define EVAL_DEF_BATCH 64          //windows per predict() call
+#define EVAL_DEF_BLOCK_WINDOWS 2048 //windows per task
+
+struct evaluationResult
+{
+    evaluationResult(): windows(0), skipped(0), correct(0), seconds(0.), error(0) {}
+    std::string shard;
+    long windows;               //evaluated windows
+    long skipped;               //windows without a valid label
+    long correct;
+    std::vector<long> confusion; //classes x classes, row: true label, column: predicted label
+    double seconds;             //worker time spent on the shard (summed over workers)
+    int error;                  //negative on failure
+
+    double accuracy() const {return windows > 0 ? (double)correct / windows : 0.;}
+    void add(const evaluationResult& other);
+};
+
+class ModelEvaluator
+{
+public:
+    ModelEvaluator(const LstmClassifier& model,
+                   int threads=0, //0: hardware concurrency
+                   int batch=EVAL_DEF_BATCH,
+                   int block_windows=EVAL_DEF_BLOCK_WINDOWS);
+
+    void addShard(const std::string& filename_base);
+    // Evaluates all shards. Returns the number of failed shards
+    int run();
+
+    const std::vector<evaluationResult>& results() const {return results_;}
+    const evaluationResult& total() const {return total_;} //all shards
+    double getSeconds() const {return seconds_;}            //wall clock time of run()
+    double getWindowsPerSecond() const {return seconds_ > 0 ? total_.windows / seconds_ : 0.;}
+    long getSteals() const {return steals_;}                //tasks taken from another worker
+    int getThreads() const {return threads_;}
+
+protected:
+    struct evaluationTask
+    {
+        size_t shard;
+        size_t first;
+        size_t count;
+    };
+
+    struct workerQueue
+    {
+        std::mutex mtx;
+        std::deque<evaluationTask> tasks;
+    };
+
+    const LstmClassifier& model_;
+    std::string name_;
+    int threads_;
+    int batch_;
+    size_t block_windows_;
+
+    std::vector<std::string> shards_;
+    std::vector<evaluationResult> results_;
+    evaluationResult total_;
+    std::mutex results_mtx_;
+    std::vector<workerQueue> queues_;
+    std::atomic<long> steals_;
+    double seconds_;
+
+    void worker(int id);
+    bool nextTask(int id, evaluationTask& task);
+    // Scores one block of windows into res (counts only)
+    int evaluate(const evaluationTask& task, FeatureStore& store, LstmClassifier& model, std::vector<size_t>& indices,
+                 std::vector<float>& windows, std::vector<int32_t>& labels, std::vector<float>& probs,
+                 evaluationResult& res);
+};
+
+#endif //MIC_READ_THREAD_MODEL_EVALUATOR_HPP
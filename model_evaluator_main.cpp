@@ -0,0 +1,131 @@
+//
+// Scores the LSTM classifier over feature shards and / or drive folders, see model_evaluator.hpp
+// Usage: evaluate_model [-j threads] [-b batch] [-B block_windows] [-o out_dir] [-C cache_dir] [-l dry,wet]
+//                       [-d default_label] [-Q] weights.lstm|random input ...
+//   input: a feature shard base name (<input>.feat) or a drive folder (mic_rec.csv + timelabels.txt). Drive folders
+//          are turned into shards in out_dir first (with -C only new / changed drives are extracted, a rescore
+//          after a retrain is then inference only)
+//   random: random weights of the default shape (throughput measurements without a trained model)
+//   -Q: drive folders are extracted with the integer MFCC (mfcc_fixed.hpp): the accuracy of the fixed point path
+//
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "model_evaluator.hpp"
+#include "dataset_builder.hpp"
+
+static void print_confusion(const std::vector<long>& confusion, int classes, const std::vector<std::string>& names)
+{
+    printf("%12s", "true\\pred");
+    for(int j = 0; j < classes; j++) printf(" %10s", j < (int)names.size() ? names[j].c_str() : std::to_string(j).c_str());
+    printf("\n");
+    for(int i = 0; i < classes; i++) {
+        printf("%12s", i < (int)names.size() ? names[i].c_str() : std::to_string(i).c_str());
+        for(int j = 0; j < classes; j++) printf(" %10ld", confusion[(size_t)i * classes + j]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int threads = 0;
+    int batch = EVAL_DEF_BATCH;
+    int block_windows = EVAL_DEF_BLOCK_WINDOWS;
+    std::string out_dir = "_data/features";
+    std::string cache_dir;
+    std::vector<std::string> label_names = {"dry", "wet"};
+    int default_label = -1;
+    bool fixed_point = false;
+
+    int c;
+    while((c = getopt(argc, argv, "j:b:B:o:C:l:d:Q")) != -1) {
+        switch(c) {
+            case 'j': threads = atoi(optarg); break;
+            case 'b': batch = atoi(optarg); break;
+            case 'B': block_windows = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 'C': cache_dir = optarg; break;
+            case 'l': {
+                label_names.clear();
+                std::string names = optarg;
+                size_t start = 0, pos;
+                while((pos = names.find(',', start)) != std::string::npos) {
+                    label_names.push_back(names.substr(start, pos - start));
+                    start = pos + 1;
+                }
+                label_names.push_back(names.substr(start));
+                break;
+            }
+            case 'd': default_label = atoi(optarg); break;
+            case 'Q': fixed_point = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-j threads] [-b batch] [-B block_windows] [-o out_dir] [-C cache_dir] "
+                                "[-l dry,wet] [-d default_label] [-Q] weights.lstm|random input ...\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind + 1 >= argc) {
+        fprintf(stderr, "%s: no weights / inputs given\n", argv[0]);
+        return 1;
+    }
+
+    LstmClassifier model;
+    std::string weights = argv[optind];
+    if(weights == "random") model.initRandom();
+    else if(model.load(weights) < 0) return 1;
+
+    // Drive folders -> shards
+    std::vector<std::string> shards;
+    DatasetBuilder builder(out_dir, model.steps(), model.input(), DATASET_DEF_SHIFT_CHUNKS, FEATSTORE_FLOAT32, threads);
+    builder.setLabelNames(label_names);
+    builder.setDefaultLabel(default_label);
+    builder.setFixedPoint(fixed_point);
+    FeatureCache cache(cache_dir);
+    if(!cache_dir.empty()) {
+        if(cache.open() < 0) return 1;
+        builder.setCache(&cache);
+    }
+    int drives = 0;
+    for(int i = optind + 1; i < argc; i++) {
+        std::string input = argv[i];
+        if(access((input + "/" + DATASET_CSV_NAME).c_str(), R_OK) == 0) {
+            builder.addDrive(input);
+            drives++;
+        } else {
+            shards.push_back(input);
+        }
+    }
+    if(drives > 0) {
+        int failed = builder.run();
+        for(const datasetDriveResult& res : builder.results()) {
+            if(res.error == 0) shards.push_back(res.shard);
+        }
+        printf("%d drives -> shards (%d failed)", drives, failed);
+        if(!cache_dir.empty()) printf(", cache: %ld hits, %ld misses", cache.getHits(), cache.getMisses());
+        printf("\n");
+    }
+
+    ModelEvaluator evaluator(model, threads, batch, block_windows);
+    for(const std::string& shard : shards) evaluator.addShard(shard);
+    int failed = evaluator.run();
+
+    for(const evaluationResult& res : evaluator.results()) {
+        if(res.error < 0) {
+            printf("%s: FAILED (%d)\n", res.shard.c_str(), res.error);
+            continue;
+        }
+        printf("%s: %ld windows (%ld skipped), accuracy %.4f\n", res.shard.c_str(), res.windows, res.skipped,
+               res.accuracy());
+        print_confusion(res.confusion, model.classes(), label_names);
+    }
+    const evaluationResult& total = evaluator.total();
+    printf("TOTAL: %zu shards (%d failed), %ld windows (%ld skipped), accuracy %.4f\n", shards.size(), failed,
+           total.windows, total.skipped, total.accuracy());
+    print_confusion(total.confusion, model.classes(), label_names);
+    printf("%.2f s, %.0f windows/s, %d threads, %ld steals\n", evaluator.getSeconds(),
+           evaluator.getWindowsPerSecond(), evaluator.getThreads(), evaluator.getSteals());
+    return failed > 0 ? 1 : 0;
+}
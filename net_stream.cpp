@@ -0,0 +1,544 @@
+#include "net_stream.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static_assert(sizeof(netMsgHeader) == 32, "message header layout");
+static_assert(sizeof(netChunkHeader) == 56, "chunk header layout");
+
+static int64_t steady_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t netstream_encode_delta(const int16_t* samples, size_t n, int channels, uint8_t* out)
+{
+    uint8_t* p = out;
+    for(size_t i = 0; i < n; i++) {
+        int32_t prev = i >= (size_t)channels ? samples[i - channels] : 0;
+        int32_t delta = (int32_t)samples[i] - prev;
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        while(zigzag >= 0x80) {
+            *p++ = (uint8_t)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        *p++ = (uint8_t)zigzag;
+    }
+    return p - out;
+}
+
+size_t netstream_decode_delta(const uint8_t* in, size_t in_bytes, int channels, int16_t* samples, size_t n)
+{
+    const uint8_t* p = in;
+    const uint8_t* end = in + in_bytes;
+    for(size_t i = 0; i < n; i++) {
+        uint32_t zigzag = 0;
+        int shift = 0;
+        while(true) {
+            if(p == end || shift > 14) return 0;
+            uint8_t byte = *p++;
+            zigzag |= (uint32_t)(byte & 0x7F) << shift;
+            shift += 7;
+            if(!(byte & 0x80)) break;
+        }
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        int32_t prev = i >= (size_t)channels ? samples[i - channels] : 0;
+        samples[i] = (int16_t)(prev + delta);
+    }
+    return p - in;
+}
+
+//-----------------------------------------------------------------
+// SENDER
+
+NetStreamSender::NetStreamSender(std::string host,
+                                 int port,
+                                 NetStreamTransport transport,
+                                 int channels,
+                                 int max_batch_chunks,
+                                 int max_batch_ms,
+                                 int queue_chunks,
+                                 NetStreamDropPolicy policy,
+                                 int chunk_frames):
+    host_(host),
+    port_(port),
+    transport_(transport),
+    channels_(channels),
+    max_batch_chunks_(max_batch_chunks),
+    max_batch_delay_(max_batch_ms),
+    policy_(policy),
+    compress_(false),
+    name_("NetStreamSender"),
+    fd_(-1),
+    queue_head_(0),
+    queue_count_(0),
+    run_fl_(false),
+    message_seq_(0),
+    chunks_sent_(0),
+    chunks_dropped_(0),
+    bytes_sent_(0),
+    messages_sent_(0),
+    queue_depth_(0)
+{
+    // All chunk storage is allocated here: the reading thread only copies into reserved slots
+    queue_.resize(queue_chunks);
+    for(size_t i = 0; i < queue_.size(); i++) queue_[i].chunk.frames.reserve(chunk_frames * channels_);
+    batch_.resize(max_batch_chunks_);
+    for(size_t i = 0; i < batch_.size(); i++) batch_[i].chunk.frames.reserve(chunk_frames * channels_);
+    message_.resize(NETSTREAM_MAX_MESSAGE);
+}
+
+NetStreamSender::~NetStreamSender()
+{
+    finish();
+}
+
+void NetStreamSender::start()
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(run_fl_) return;
+    run_fl_ = true;
+    t_start_ = std::chrono::steady_clock::now();
+    th_ = std::thread(&NetStreamSender::sender_thread, this);
+}
+
+void NetStreamSender::finish()
+{
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if(!run_fl_) return;
+        run_fl_ = false;
+        cv_.notify_all();
+    }
+    th_.join();
+    if(fd_ >= 0) close(fd_);
+    fd_ = -1;
+}
+
+double NetStreamSender::getBytesPerSecond() const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start_).count();
+    return seconds > 0. ? bytes_sent_ / seconds : 0.;
+}
+
+void NetStreamSender::process(const micDataStamped& chunk)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(queue_count_ == queue_.size()) {
+        chunks_dropped_++;
+        if(policy_ == NETSTREAM_DROP_NEWEST) return;
+        // NETSTREAM_DROP_OLDEST: the oldest slot is reused for this chunk
+        queue_head_ = (queue_head_ + 1) % queue_.size();
+        queue_count_--;
+    }
+    pendingChunk& item = queue_[(queue_head_ + queue_count_) % queue_.size()];
+    item.chunk.id = chunk.id;
+    item.chunk.timestamp = chunk.timestamp;
+    item.chunk.sample_index = chunk.sample_index;
+    item.chunk.rate = chunk.rate;
+    item.chunk.flags = chunk.flags;
+    item.chunk.frames.assign(chunk.frames.begin(), chunk.frames.end());
+    item.capture_us = steady_us();
+    queue_count_++;
+    queue_depth_ = queue_count_;
+    if(queue_count_ >= max_batch_chunks_) cv_.notify_all();
+}
+
+bool NetStreamSender::connect()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = transport_ == NETSTREAM_TCP ? SOCK_STREAM : SOCK_DGRAM;
+    struct addrinfo* res = nullptr;
+    std::string port = std::to_string(port_);
+    if(getaddrinfo(host_.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
+        fprintf(stderr, "%s: ERROR: Cannot resolve %s\n", name_.c_str(), host_.c_str());
+        return false;
+    }
+    fd_ = socket(res->ai_family, res->ai_socktype, 0);
+    if(fd_ < 0 || ::connect(fd_, res->ai_addr, res->ai_addrlen) < 0) {
+        if(fd_ >= 0) close(fd_);
+        fd_ = -1;
+        freeaddrinfo(res);
+        return false;
+    }
+    freeaddrinfo(res);
+    if(transport_ == NETSTREAM_TCP) {
+        int on = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); //batching is done here
+    }
+    printf("%s: Connected to %s:%d (%s)\n", name_.c_str(), host_.c_str(), port_, transport_ == NETSTREAM_TCP ? "tcp" : "udp");
+    return true;
+}
+
+bool NetStreamSender::sendBatch(size_t n)
+{
+    // Encoding: chunks are added while they fit into one message
+    size_t pos = sizeof(netMsgHeader);
+    size_t count = 0;
+    size_t first = 0;
+    bool ok = true;
+    while(first < n && ok) {
+        pos = sizeof(netMsgHeader);
+        count = 0;
+        for(size_t i = first; i < n; i++) {
+            const micDataStamped& chunk = batch_[i].chunk;
+            size_t samples = chunk.frames.size();
+            size_t max_bytes = compress_ ? samples * 3 : samples * sizeof(int16_t);
+            if(pos + sizeof(netChunkHeader) + max_bytes > message_.size()) {
+                if(count == 0) { //cannot be sent at all
+                    chunks_dropped_++;
+                    first++;
+                }
+                break;
+            }
+            netChunkHeader hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.id = chunk.id;
+            hdr.timestamp = chunk.timestamp;
+            hdr.sample_index = chunk.sample_index;
+            hdr.rate = chunk.rate;
+            hdr.capture_us = batch_[i].capture_us;
+            hdr.samples = (uint32_t)samples;
+            hdr.channels = (uint16_t)channels_;
+            hdr.flags = chunk.flags.all;
+            uint8_t* payload = message_.data() + pos + sizeof(hdr);
+            if(compress_) {
+                hdr.encoded_bytes = (uint32_t)netstream_encode_delta(chunk.frames.data(), samples, channels_, payload);
+            } else {
+                hdr.encoded_bytes = (uint32_t)(samples * sizeof(int16_t));
+                memcpy(payload, chunk.frames.data(), hdr.encoded_bytes);
+            }
+            memcpy(message_.data() + pos, &hdr, sizeof(hdr));
+            pos += sizeof(hdr) + hdr.encoded_bytes;
+            count++;
+        }
+        if(count == 0) continue;
+
+        netMsgHeader msg;
+        msg.magic = NETSTREAM_MAGIC;
+        msg.version = NETSTREAM_VERSION;
+        msg.flags = compress_ ? NETSTREAM_FLAG_DELTA : 0;
+        msg.chunks = (uint32_t)count;
+        msg.payload_bytes = (uint32_t)(pos - sizeof(msg));
+        msg.seq = message_seq_++;
+        msg.send_time_us = steady_us();
+        memcpy(message_.data(), &msg, sizeof(msg));
+
+        size_t sent = 0;
+        while(sent < pos) {
+            ssize_t ret = send(fd_, message_.data() + sent, pos - sent, MSG_NOSIGNAL);
+            if(ret < 0 && errno == EINTR) continue;
+            if(ret < 0) {
+                if(transport_ == NETSTREAM_UDP && errno == ECONNREFUSED) break; //no receiver yet: the datagram is gone
+                fprintf(stderr, "%s: ERROR: Send failed (%s)\n", name_.c_str(), strerror(errno));
+                ok = false;
+                break;
+            }
+            sent += ret;
+        }
+        if(sent == pos) {
+            bytes_sent_ += pos;
+            messages_sent_++;
+            chunks_sent_ += count;
+        } else {
+            chunks_dropped_ += count;
+        }
+        first += count;
+    }
+    chunks_dropped_ += n - first; //not sent after a failure
+    return ok;
+}
+
+void NetStreamSender::sender_thread()
+{
+    printf("%s: Sender Thread ready ...\n", name_.c_str());
+    auto next_connect = std::chrono::steady_clock::now();
+    while(true)
+    {
+        size_t n = 0;
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            // A batch is complete when it is full or its oldest chunk waited max_batch_ms
+            while(run_fl_ && queue_count_ < max_batch_chunks_) {
+                if(queue_count_ == 0) {
+                    cv_.wait(lck);
+                } else {
+                    auto deadline = std::chrono::steady_clock::time_point(
+                                std::chrono::microseconds(queue_[queue_head_].capture_us)) + max_batch_delay_;
+                    if(cv_.wait_until(lck, deadline) == std::cv_status::timeout) break;
+                }
+            }
+            if(!run_fl_ && queue_count_ == 0) break;
+
+            // The slot buffers are swapped, not copied: both sides keep preallocated buffers
+            n = std::min(queue_count_, max_batch_chunks_);
+            for(size_t i = 0; i < n; i++) {
+                pendingChunk& item = queue_[(queue_head_ + i) % queue_.size()];
+                batch_[i].chunk.frames.swap(item.chunk.frames);
+                batch_[i].chunk.id = item.chunk.id;
+                batch_[i].chunk.timestamp = item.chunk.timestamp;
+                batch_[i].chunk.sample_index = item.chunk.sample_index;
+                batch_[i].chunk.rate = item.chunk.rate;
+                batch_[i].chunk.flags = item.chunk.flags;
+                batch_[i].capture_us = item.capture_us;
+            }
+            queue_head_ = (queue_head_ + n) % queue_.size();
+            queue_count_ -= n;
+            queue_depth_ = queue_count_;
+        }
+
+        if(fd_ < 0) {
+            // Reconnecting at most once per second, meanwhile the batches are dropped
+            if(std::chrono::steady_clock::now() < next_connect || !connect()) {
+                next_connect = std::max(next_connect, std::chrono::steady_clock::now() + std::chrono::seconds(1));
+                chunks_dropped_ += n;
+                continue;
+            }
+        }
+        if(!sendBatch(n)) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+    printf("%s: Sender Thread finished. Chunks sent %ld, dropped %ld, %ld bytes in %ld messages ...\n",
+           name_.c_str(), getChunksSent(), getChunksDropped(), getBytesSent(), getMessagesSent());
+}
+
+//-----------------------------------------------------------------
+// RECEIVER
+
+NetStreamReceiver::NetStreamReceiver(int port,
+                                     NetStreamTransport transport,
+                                     std::string bind_address,
+                                     int queue_chunks):
+    port_(port),
+    transport_(transport),
+    bind_address_(bind_address),
+    queue_chunks_(queue_chunks),
+    name_("NetStreamReceiver"),
+    fd_(-1),
+    run_fl_(false),
+    next_id_(-1),
+    chunks_received_(0),
+    chunks_lost_(0),
+    messages_received_(0),
+    bytes_received_(0),
+    errors_(0),
+    latency_us_total_(0),
+    latency_us_max_(0),
+    net_latency_us_total_(0)
+{
+    message_.resize(NETSTREAM_MAX_MESSAGE);
+    frames_pool_.reserve(queue_chunks_);
+}
+
+NetStreamReceiver::~NetStreamReceiver()
+{
+    finish();
+}
+
+int NetStreamReceiver::start()
+{
+    if(run_fl_) return 0;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    if(inet_pton(AF_INET, bind_address_.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "%s: ERROR: Invalid address %s\n", name_.c_str(), bind_address_.c_str());
+        return -1;
+    }
+    fd_ = socket(AF_INET, transport_ == NETSTREAM_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+    int on = 1;
+    if(fd_ >= 0) setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(fd_ < 0 || bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            (transport_ == NETSTREAM_TCP && listen(fd_, 1) < 0)) {
+        fprintf(stderr, "%s: ERROR: Cannot bind %s:%d (%s)\n", name_.c_str(), bind_address_.c_str(), port_, strerror(errno));
+        if(fd_ >= 0) close(fd_);
+        fd_ = -1;
+        return -2;
+    }
+    t_start_ = std::chrono::steady_clock::now();
+    run_fl_ = true;
+    th_ = std::thread(&NetStreamReceiver::receiver_thread, this);
+    return 0;
+}
+
+void NetStreamReceiver::finish()
+{
+    if(!run_fl_) return;
+    run_fl_ = false;
+    th_.join();
+    close(fd_);
+    fd_ = -1;
+}
+
+double NetStreamReceiver::getBytesPerSecond() const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start_).count();
+    return seconds > 0. ? bytes_received_ / seconds : 0.;
+}
+
+size_t NetStreamReceiver::getData(std::vector<micDataStamped>& out)
+{
+    std::unique_lock<std::mutex> lck(data_mtx_);
+    for(size_t i = 0; i < out.size(); i++) {
+        if(frames_pool_.size() < queue_chunks_) frames_pool_.push_back(std::move(out[i].frames));
+    }
+    out.clear();
+    while(!data_.empty()) {
+        out.push_back(std::move(data_.front()));
+        data_.pop_front();
+    }
+    return out.size();
+}
+
+bool NetStreamReceiver::readStream(int fd, uint8_t* buf, size_t bytes)
+{
+    size_t got = 0;
+    while(got < bytes) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, 200);
+        if(!run_fl_) return false;
+        if(ret <= 0) continue;
+        ssize_t n = recv(fd, buf + got, bytes - got, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+void NetStreamReceiver::handleMessage(const uint8_t* msg, size_t bytes)
+{
+    int64_t now = steady_us();
+    netMsgHeader hdr;
+    memcpy(&hdr, msg, sizeof(hdr));
+    messages_received_++;
+    bytes_received_ += bytes;
+    net_latency_us_total_ += now - hdr.send_time_us;
+
+    size_t pos = sizeof(hdr);
+    for(uint32_t c = 0; c < hdr.chunks; c++) {
+        netChunkHeader ch;
+        if(pos + sizeof(ch) > bytes) {
+            errors_++;
+            return;
+        }
+        memcpy(&ch, msg + pos, sizeof(ch));
+        pos += sizeof(ch);
+        if(pos + ch.encoded_bytes > bytes || ch.channels == 0 ||
+                (!(hdr.flags & NETSTREAM_FLAG_DELTA) && ch.encoded_bytes != ch.samples * sizeof(int16_t)) ||
+                ch.samples > NETSTREAM_MAX_MESSAGE) {
+            errors_++;
+            return;
+        }
+        chunk_.frames.resize(ch.samples);
+        if(hdr.flags & NETSTREAM_FLAG_DELTA) {
+            if(netstream_decode_delta(msg + pos, ch.encoded_bytes, ch.channels, chunk_.frames.data(), ch.samples) != ch.encoded_bytes) {
+                errors_++;
+                return;
+            }
+        } else {
+            memcpy(chunk_.frames.data(), msg + pos, ch.encoded_bytes);
+        }
+        pos += ch.encoded_bytes;
+
+        chunk_.id = ch.id;
+        chunk_.timestamp = ch.timestamp;
+        chunk_.sample_index = ch.sample_index;
+        chunk_.rate = ch.rate;
+        chunk_.flags.all = ch.flags;
+
+        // Sequence: gaps are lost chunks (sender drops or lost datagrams), a reset restarts the count
+        if(next_id_ >= 0 && ch.id > next_id_) chunks_lost_ += ch.id - next_id_;
+        next_id_ = ch.id + 1;
+        chunks_received_++;
+        long latency = (long)(now - ch.capture_us);
+        latency_us_total_ += latency;
+        if(latency > latency_us_max_) latency_us_max_ = latency;
+
+        // Replay: the stages see the chunk as if it was read here
+        for(size_t s = 0; s < stages_.size(); s++) {
+            stages_[s]->process(chunk_);
+        }
+
+        std::unique_lock<std::mutex> lck(data_mtx_);
+        if(data_.size() == queue_chunks_) {
+            if(frames_pool_.size() < queue_chunks_) frames_pool_.push_back(std::move(data_.front().frames));
+            data_.pop_front();
+        }
+        data_.push_back(micDataStamped());
+        micDataStamped& queued = data_.back();
+        if(!frames_pool_.empty()) { //drained buffers are reused
+            queued.frames.swap(frames_pool_.back());
+            frames_pool_.pop_back();
+        }
+        queued.frames.assign(chunk_.frames.begin(), chunk_.frames.end());
+        queued.id = chunk_.id;
+        queued.timestamp = chunk_.timestamp;
+        queued.sample_index = chunk_.sample_index;
+        queued.rate = chunk_.rate;
+        queued.flags = chunk_.flags;
+    }
+}
+
+void NetStreamReceiver::receiver_thread()
+{
+    printf("%s: Receiving Thread ready on %s:%d (%s) ...\n", name_.c_str(), bind_address_.c_str(), port_,
+           transport_ == NETSTREAM_TCP ? "tcp" : "udp");
+    while(run_fl_)
+    {
+        if(transport_ == NETSTREAM_UDP) {
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            if(poll(&pfd, 1, 200) <= 0) continue;
+            ssize_t n = recv(fd_, message_.data(), message_.size(), 0);
+            if(n < (ssize_t)sizeof(netMsgHeader)) continue;
+            netMsgHeader hdr;
+            memcpy(&hdr, message_.data(), sizeof(hdr));
+            if(hdr.magic != NETSTREAM_MAGIC || hdr.version != NETSTREAM_VERSION ||
+                    sizeof(hdr) + hdr.payload_bytes != (size_t)n) {
+                errors_++;
+                continue;
+            }
+            handleMessage(message_.data(), n);
+            continue;
+        }
+
+        // TCP: one sender at a time
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        if(poll(&pfd, 1, 200) <= 0) continue;
+        int client = accept(fd_, nullptr, nullptr);
+        if(client < 0) continue;
+        printf("%s: Sender connected\n", name_.c_str());
+        next_id_ = -1;
+        while(run_fl_) {
+            netMsgHeader hdr;
+            if(!readStream(client, message_.data(), sizeof(hdr))) break;
+            memcpy(&hdr, message_.data(), sizeof(hdr));
+            if(hdr.magic != NETSTREAM_MAGIC || hdr.version != NETSTREAM_VERSION ||
+                    sizeof(hdr) + hdr.payload_bytes > message_.size()) {
+                fprintf(stderr, "%s: ERROR: Malformed stream, closing the connection\n", name_.c_str());
+                errors_++;
+                break;
+            }
+            if(!readStream(client, message_.data() + sizeof(hdr), hdr.payload_bytes)) break;
+            handleMessage(message_.data(), sizeof(hdr) + hdr.payload_bytes);
+        }
+        close(client);
+        printf("%s: Sender disconnected\n", name_.c_str());
+    }
+    printf("%s: Receiving Thread finished. Chunks received %ld, lost %ld, %ld bytes ...\n",
+           name_.c_str(), getChunksReceived(), getChunksLost(), getBytesReceived());
+}
@@ -0,0 +1,231 @@
+/*
+Batched network streaming of captured chunks.
+NetStreamSender is a processing stage: the reading thread copies each chunk into a preallocated queue and
+a sender thread batches up to max_batch_chunks chunks (or whatever arrived within max_batch_ms) into one
+framed binary message over TCP or UDP. The receiver side (NetStreamReceiver) is a chunk source like
+MicReadAlsa: received chunks run through its stages (addStage()) and can be drained with getData(out),
+so the processing pipeline of the capture host runs unchanged on the processing node.
+
+Message (little endian): netMsgHeader, then per chunk netChunkHeader + payload
+ - payload: int16 samples, or with NETSTREAM_FLAG_DELTA the per channel sample deltas as zigzag varints
+   (lossless; pays off for low level / low pass signals, noisy signals may even grow)
+ - chunk sequence numbers are the micDataStamped ids: gaps at the receiver are lost chunks
+   (dropped by the sender queue policy or lost UDP datagrams)
+ - send / capture times are steady_clock microseconds: latencies are meaningful on one host (loopback)
+   or with synchronized clocks
+Backpressure: a slow network / receiver blocks the sender thread (TCP) and the queue fills up.
+The reading thread never waits: the drop policy decides which chunk goes (NETSTREAM_DROP_OLDEST keeps the
+stream live, NETSTREAM_DROP_NEWEST keeps it contiguous).
+
+A minimal example:
+    // capture host
+    NetStreamSender sender("192.168.1.10", 5600, NETSTREAM_TCP);
+    sender.setCompression(true);
+    mic_reader.addStage(&sender);
+    sender.start();
+    // processing node
+    NetStreamReceiver receiver(5600, NETSTREAM_TCP);
+    receiver.addStage(&stft);
+    receiver.start();
+ */
+
+#ifndef MIC_READ_THREAD_NET_STREAM_HPP
+#define MIC_READ_THREAD_NET_STREAM_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <inttypes.h>
+
+#include "micread_thread.hpp"
+
+#define NETSTREAM_MAGIC 0x534E524D //"MRNS"
+#define NETSTREAM_VERSION 1
+#define NETSTREAM_FLAG_DELTA 1
+#define NETSTREAM_MAX_MESSAGE 60000 //fits one UDP datagram
+#define NETSTREAM_DEF_BATCH_CHUNKS 8
+#define NETSTREAM_DEF_BATCH_MS 50
+#define NETSTREAM_DEF_QUEUE_CHUNKS 256
+#define NETSTREAM_DEF_RECV_QUEUE 256
+
+enum NetStreamTransport
+{
+    NETSTREAM_TCP = 0,
+    NETSTREAM_UDP
+};
+
+enum NetStreamDropPolicy
+{
+    NETSTREAM_DROP_OLDEST = 0,
+    NETSTREAM_DROP_NEWEST
+};
+
+struct netMsgHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t chunks;
+    uint32_t payload_bytes; //after this header
+    uint64_t seq;           //message counter
+    int64_t send_time_us;   //steady_clock
+};
+
+struct netChunkHeader
+{
+    int64_t id;
+    int64_t timestamp;
+    int64_t sample_index;
+    double rate;
+    int64_t capture_us;     //steady_clock when the reading thread handed the chunk over
+    uint32_t samples;
+    uint32_t encoded_bytes; //payload bytes of this chunk
+    uint16_t channels;
+    uint8_t flags;
+    uint8_t reserved[5];
+};
+
+// Lossless int16 codec: per channel deltas, zigzag, LEB128 varints. Returns the encoded bytes
+size_t netstream_encode_delta(const int16_t* samples, size_t n, int channels, uint8_t* out);
+// Returns the bytes consumed or 0 if the input is malformed
+size_t netstream_decode_delta(const uint8_t* in, size_t in_bytes, int channels, int16_t* samples, size_t n);
+
+class NetStreamSender : public MicReadStage
+{
+public:
+    NetStreamSender(std::string host,
+                    int port,
+                    NetStreamTransport transport=NETSTREAM_TCP,
+                    int channels=1,
+                    int max_batch_chunks=NETSTREAM_DEF_BATCH_CHUNKS,
+                    int max_batch_ms=NETSTREAM_DEF_BATCH_MS,
+                    int queue_chunks=NETSTREAM_DEF_QUEUE_CHUNKS,
+                    NetStreamDropPolicy policy=NETSTREAM_DROP_OLDEST,
+                    int chunk_frames=MICREAD_DEF_BUF_SIZE);
+    ~NetStreamSender();
+
+    void setCompression(bool delta) {compress_ = delta;}
+    void start(); //starts the sender thread (it connects / reconnects by itself)
+    void finish(); //sends what is queued and stops
+
+    // MicReadStage: called by the reading thread
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "net stream";}
+
+    long getChunksSent() const {return chunks_sent_;}
+    long getChunksDropped() const {return chunks_dropped_;} //queue policy + failed sends
+    long getBytesSent() const {return bytes_sent_;}
+    long getMessagesSent() const {return messages_sent_;}
+    long getQueueDepth() const {return queue_depth_;}
+    double getBytesPerSecond() const; //since start()
+
+protected:
+    struct pendingChunk
+    {
+        micDataStamped chunk;
+        int64_t capture_us;
+    };
+
+    std::string host_;
+    int port_;
+    NetStreamTransport transport_;
+    int channels_;
+    size_t max_batch_chunks_;
+    std::chrono::milliseconds max_batch_delay_;
+    NetStreamDropPolicy policy_;
+    bool compress_;
+    std::string name_;
+    int fd_;
+
+    // Preallocated queue (ring of slots)
+    std::vector<pendingChunk> queue_;
+    size_t queue_head_;
+    size_t queue_count_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread th_;
+    bool run_fl_;
+
+    std::vector<pendingChunk> batch_; //sender thread only, buffers swapped with the queue slots
+    std::vector<uint8_t> message_;
+    uint64_t message_seq_;
+    std::chrono::steady_clock::time_point t_start_;
+
+    std::atomic<long> chunks_sent_;
+    std::atomic<long> chunks_dropped_;
+    std::atomic<long> bytes_sent_;
+    std::atomic<long> messages_sent_;
+    std::atomic<long> queue_depth_;
+
+    void sender_thread();
+    bool connect();
+    bool sendBatch(size_t n);
+};
+
+class NetStreamReceiver
+{
+public:
+    NetStreamReceiver(int port,
+                      NetStreamTransport transport=NETSTREAM_TCP,
+                      std::string bind_address="0.0.0.0",
+                      int queue_chunks=NETSTREAM_DEF_RECV_QUEUE);
+    ~NetStreamReceiver();
+
+    // Stages run in the receiving thread for every received chunk. Add them before start()
+    void addStage(MicReadStage* stage) {stages_.push_back(stage);}
+    int start(); //binds / listens, negative on error
+    void finish();
+
+    // Drains the received chunks (the oldest are dropped if nobody drains). Buffers of out are reused
+    size_t getData(std::vector<micDataStamped>& out);
+
+    long getChunksReceived() const {return chunks_received_;}
+    long getChunksLost() const {return chunks_lost_;} //gaps in the chunk ids
+    long getMessagesReceived() const {return messages_received_;}
+    long getBytesReceived() const {return bytes_received_;}
+    long getErrors() const {return errors_;} //malformed messages
+    double getBytesPerSecond() const; //since start()
+    double getAvgLatencyUs() const {return chunks_received_ > 0 ? (double)latency_us_total_ / chunks_received_ : 0.;} //capture -> received
+    long getMaxLatencyUs() const {return latency_us_max_;}
+    double getAvgNetLatencyUs() const {return messages_received_ > 0 ? (double)net_latency_us_total_ / messages_received_ : 0.;} //send -> received
+
+protected:
+    int port_;
+    NetStreamTransport transport_;
+    std::string bind_address_;
+    size_t queue_chunks_;
+    std::string name_;
+    int fd_;
+    std::thread th_;
+    std::atomic<bool> run_fl_;
+    std::vector<MicReadStage*> stages_;
+
+    std::deque<micDataStamped> data_;
+    std::vector<std::vector<int16_t> > frames_pool_;
+    std::mutex data_mtx_;
+
+    std::vector<uint8_t> message_;
+    micDataStamped chunk_; //receiving thread only
+    int64_t next_id_;
+    std::chrono::steady_clock::time_point t_start_;
+
+    std::atomic<long> chunks_received_;
+    std::atomic<long> chunks_lost_;
+    std::atomic<long> messages_received_;
+    std::atomic<long> bytes_received_;
+    std::atomic<long> errors_;
+    std::atomic<long> latency_us_total_;
+    std::atomic<long> latency_us_max_;
+    std::atomic<long> net_latency_us_total_;
+
+    void receiver_thread();
+    bool readStream(int fd, uint8_t* buf, size_t bytes); //TCP: exactly bytes (false on close / finish)
+    void handleMessage(const uint8_t* msg, size_t bytes);
+};
+
+#endif //MIC_READ_THREAD_NET_STREAM_HPP
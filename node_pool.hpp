@@ -0,0 +1,101 @@
+/*
+Recycling allocator of std::deque blocks.
+A deque used as a queue (push_back by a producer, pop_front by a consumer) frees its front block every time the
+consumer crosses a block boundary and allocates a new back block just as often: a steady stream of heap
+allocations even at a constant depth. NodeAllocator<T, Node> keeps the freed blocks of elements of type Node in
+a NodePool free list and hands them out again, all other allocations (e.g. the block map, T != Node) go to the
+heap. Once the queue reached its deepest state nothing is allocated anymore. The pool frees the blocks in its
+destructor: declare it before the containers using it.
+The pool is not thread safe: use it under the lock protecting the container.
+
+A minimal example:
+    NodePool pool;
+    std::deque<Item, NodeAllocator<Item> > queue((NodeAllocator<Item>(&pool)));
+ */
+
+#ifndef MIC_READ_THREAD_NODE_POOL_HPP
+#define MIC_READ_THREAD_NODE_POOL_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+class NodePool
+{
+public:
+    NodePool(): head_(nullptr), bytes_(0), size_(0) {}
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    ~NodePool() {
+        while(head_ != nullptr) {
+            FreeNode* next = head_->next;
+            ::operator delete(head_);
+            head_ = next;
+        }
+    }
+
+    // Blocks of one size are kept (the first size seen, deques always allocate full blocks)
+    void* allocate(size_t bytes) {
+        if(bytes_ == 0) bytes_ = bytes;
+        if(bytes == bytes_ && head_ != nullptr) {
+            FreeNode* node = head_;
+            head_ = node->next;
+            size_--;
+            return node;
+        }
+        return ::operator new(bytes);
+    }
+    void deallocate(void* p, size_t bytes) {
+        if(bytes != bytes_ || bytes < sizeof(FreeNode)) {
+            ::operator delete(p);
+            return;
+        }
+        FreeNode* node = static_cast<FreeNode*>(p);
+        node->next = head_;
+        head_ = node;
+        size_++;
+    }
+    size_t size() const {return size_;} //blocks waiting for reuse
+
+protected:
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+    FreeNode* head_;
+    size_t bytes_;
+    size_t size_;
+};
+
+template <typename T, typename Node=T>
+class NodeAllocator
+{
+public:
+    typedef T value_type;
+    template <typename U> struct rebind {typedef NodeAllocator<U, Node> other;};
+
+    NodeAllocator(): pool_(nullptr) {}
+    explicit NodeAllocator(NodePool* pool): pool_(pool) {}
+    template <typename U> NodeAllocator(const NodeAllocator<U, Node>& other): pool_(other.pool()) {}
+
+    T* allocate(size_t n) {
+        if(pool_ != nullptr && isNode()) return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        if(pool_ != nullptr && isNode()) pool_->deallocate(p, n * sizeof(T));
+        else ::operator delete(p);
+    }
+    NodePool* pool() const {return pool_;}
+
+protected:
+    NodePool* pool_;
+    static bool isNode() {return std::is_same<T, Node>::value;}
+};
+
+template <typename T, typename U, typename Node>
+bool operator==(const NodeAllocator<T, Node>& a, const NodeAllocator<U, Node>& b) {return a.pool() == b.pool();}
+template <typename T, typename U, typename Node>
+bool operator!=(const NodeAllocator<T, Node>& a, const NodeAllocator<U, Node>& b) {return a.pool() != b.pool();}
+
+#endif //MIC_READ_THREAD_NODE_POOL_HPP
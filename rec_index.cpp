@@ -0,0 +1,193 @@
+#include "rec_index.hpp"
+
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------
+// BUILDER
+
+RecIndexBuilder::RecIndexBuilder(int channels, int interval_chunks):
+    channels_(channels > 0 ? channels : 1),
+    interval_chunks_(interval_chunks > 0 ? interval_chunks : 1),
+    chunks_since_entry_(0),
+    next_sample_index_(-1)
+{
+}
+
+void RecIndexBuilder::appendHeader(std::string& out, unsigned int rate, int bits_per_sample, uint64_t wav_data_offset) const
+{
+    recIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECINDEX_MAGIC, sizeof(header.magic));
+    header.version = RECINDEX_VERSION;
+    header.rate = rate;
+    header.channels = (uint16_t)channels_;
+    header.bits_per_sample = (uint16_t)bits_per_sample;
+    header.interval_chunks = (uint32_t)interval_chunks_;
+    header.wav_data_offset = wav_data_offset;
+    out.append((const char*)&header, sizeof(header));
+}
+
+void RecIndexBuilder::addChunk(const micDataStamped& chunk, uint64_t wav_offset, uint64_t csv_offset, std::string& out)
+{
+    // A gap in the sample indices breaks the contiguity assumed between entries
+    bool gap = next_sample_index_ >= 0 && chunk.sample_index != next_sample_index_;
+    if(next_sample_index_ < 0 || gap || chunks_since_entry_ >= interval_chunks_) {
+        recIndexEntry entry;
+        entry.id = chunk.id;
+        entry.timestamp = chunk.timestamp;
+        entry.sample_index = chunk.sample_index;
+        entry.rate = chunk.rate;
+        entry.wav_offset = wav_offset;
+        entry.csv_offset = csv_offset;
+        out.append((const char*)&entry, sizeof(entry));
+        chunks_since_entry_ = 0;
+    }
+    chunks_since_entry_++;
+    // sample_index counts frames (ALSA terms), frames holds the interleaved samples of all channels
+    next_sample_index_ = chunk.sample_index + (int64_t)chunk.frames.size() / channels_;
+}
+
+//-----------------------------------------------------------------
+// READER
+
+RecIndexReader::RecIndexReader():
+    name_("RecIndexReader"),
+    wav_fd_(-1),
+    wav_end_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+RecIndexReader::~RecIndexReader()
+{
+    close();
+}
+
+int RecIndexReader::open(const std::string& filename_base)
+{
+    close();
+    FILE* idx_file = fopen((filename_base + ".idx").c_str(), "rb");
+    if(idx_file == nullptr) {
+        fprintf(stderr, "%s: ERROR: cannot open %s.idx (%s)\n", name_.c_str(), filename_base.c_str(), strerror(errno));
+        return -1;
+    }
+    if(fread(&header_, sizeof(header_), 1, idx_file) != 1 ||
+       memcmp(header_.magic, RECINDEX_MAGIC, sizeof(header_.magic)) != 0 ||
+       header_.version != RECINDEX_VERSION) {
+        fprintf(stderr, "%s: ERROR: %s.idx is not a recording index\n", name_.c_str(), filename_base.c_str());
+        fclose(idx_file);
+        return -2;
+    }
+    if(header_.bits_per_sample != 16 || header_.channels == 0) {
+        fprintf(stderr, "%s: ERROR: only 16 bit recordings are supported\n", name_.c_str());
+        fclose(idx_file);
+        return -3;
+    }
+    // A recording still in progress may end with a partially written entry: it is ignored
+    recIndexEntry entry;
+    while(fread(&entry, sizeof(entry), 1, idx_file) == 1) {
+        entries_.push_back(entry);
+    }
+    fclose(idx_file);
+
+    wav_fd_ = ::open((filename_base + ".wav").c_str(), O_RDONLY);
+    if(wav_fd_ < 0) {
+        fprintf(stderr, "%s: ERROR: cannot open %s.wav (%s)\n", name_.c_str(), filename_base.c_str(), strerror(errno));
+        return -4;
+    }
+    // The data size of the wav header is only written when the recording is closed: the file size is used
+    struct stat st;
+    fstat(wav_fd_, &st);
+    uint64_t data_bytes = st.st_size > (off_t)header_.wav_data_offset ? st.st_size - header_.wav_data_offset : 0;
+    wav_end_ = header_.wav_data_offset + data_bytes / frameBytes() * frameBytes();
+    return 0;
+}
+
+void RecIndexReader::close()
+{
+    if(wav_fd_ >= 0) {
+        ::close(wav_fd_);
+        wav_fd_ = -1;
+    }
+    entries_.clear();
+    wav_end_ = 0;
+}
+
+uint64_t RecIndexReader::segmentFrames(size_t entry) const
+{
+    uint64_t end = entry + 1 < entries_.size() ? entries_[entry + 1].wav_offset : wav_end_;
+    end = std::min(end, wav_end_);
+    return end > entries_[entry].wav_offset ? (end - entries_[entry].wav_offset) / frameBytes() : 0;
+}
+
+long RecIndexReader::findTime(int64_t timestamp) const
+{
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), timestamp,
+                               [](int64_t t, const recIndexEntry& e){ return t < e.timestamp; });
+    return (long)(it - entries_.begin()) - 1;
+}
+
+long RecIndexReader::findChunk(int64_t id) const
+{
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), id,
+                               [](int64_t i, const recIndexEntry& e){ return i < e.id; });
+    return (long)(it - entries_.begin()) - 1;
+}
+
+int64_t RecIndexReader::startTime() const
+{
+    return entries_.empty() ? 0 : entries_.front().timestamp;
+}
+
+int64_t RecIndexReader::endTime() const
+{
+    if(entries_.empty()) return 0;
+    const recIndexEntry& last = entries_.back();
+    return last.timestamp + (int64_t)(segmentFrames(entries_.size() - 1) * 1e6 / last.rate);
+}
+
+long RecIndexReader::read(int64_t t0, int64_t t1, std::vector<int16_t>& out, int64_t* first_timestamp)
+{
+    out.clear();
+    if(wav_fd_ < 0) return -1;
+    if(entries_.empty() || t1 <= t0) return 0;
+
+    long frames_total = 0;
+    bool first = true;
+    for(size_t e = (size_t)std::max(findTime(t0), 0L); e < entries_.size(); e++) {
+        const recIndexEntry& entry = entries_[e];
+        if(entry.timestamp >= t1) break;
+        double us_per_frame = 1e6 / (entry.rate > 0. ? entry.rate : header_.rate);
+        int64_t frames = (int64_t)segmentFrames(e);
+        // Frames of this segment with time stamps in [t0, t1)
+        int64_t begin = t0 > entry.timestamp ? (int64_t)ceil((t0 - entry.timestamp) / us_per_frame) : 0;
+        int64_t end = (int64_t)ceil((t1 - entry.timestamp) / us_per_frame);
+        begin = std::min(begin, frames);
+        end = std::min(end, frames);
+        if(end <= begin) continue;
+
+        size_t offset = out.size();
+        size_t bytes = (size_t)(end - begin) * frameBytes();
+        out.resize(offset + bytes / sizeof(int16_t));
+        ssize_t got = pread(wav_fd_, out.data() + offset, bytes, entry.wav_offset + begin * frameBytes());
+        if(got < 0) {
+            fprintf(stderr, "%s: ERROR: wav read failed (%s)\n", name_.c_str(), strerror(errno));
+            out.resize(offset);
+            return -2;
+        }
+        out.resize(offset + (size_t)got / frameBytes() * header_.channels);
+        if(first && first_timestamp != nullptr) {
+            *first_timestamp = entry.timestamp + (int64_t)(begin * us_per_frame);
+        }
+        first = false;
+        frames_total += got / frameBytes();
+    }
+    return frames_total;
+}
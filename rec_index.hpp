@@ -0,0 +1,109 @@
+/*
+Sparse time stamp index of a recording.
+The recorder (MicReadAlsa::record_thread) writes <filename_base>.idx next to the wav / csv files:
+ - 64 byte header: magic, version, rate, channels, bits per sample, index interval, wav data offset
+ - 48 byte entries {chunk id, time stamp, sample index, rate, wav byte offset, csv byte offset} for the first
+   chunk, every interval_chunks chunks and every chunk after a gap (dropped chunks are missing in the wav)
+Between two entries the wav samples are contiguous, thus the time of a sample follows from the preceding entry
+(time stamp + (sample - sample_index) * 1e6 / rate) and a [t0, t1) range is a binary search + one pread per
+index interval, no matter how long the recording is. Range boundaries may differ by one frame from the per chunk
+time stamps of the csv (the times are extrapolated from the entry). The csv offsets point at the first byte of the chunk line.
+The same layout is read from python by rec_index.py.
+
+A minimal example:
+    RecIndexReader recording;
+    if(recording.open("_data/drive/mic_rec") < 0) return 1;
+    std::vector<int16_t> samples;
+    int64_t first;
+    recording.read(60000000, 65000000, samples, &first); //[60 s, 65 s) interleaved samples
+ */
+
+#ifndef MIC_READ_THREAD_REC_INDEX_HPP
+#define MIC_READ_THREAD_REC_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "micread_thread.hpp"
+
+#define RECINDEX_MAGIC "MRRECIDX"
+#define RECINDEX_VERSION 1
+#define RECINDEX_HEADER_SIZE 64
+#define RECINDEX_DEF_INTERVAL 64 //chunks between entries (~0.75 s with 512 frames at 44.1 kHz)
+
+struct recIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t rate;           //nominal sample rate
+    uint16_t channels;
+    uint16_t bits_per_sample;
+    uint32_t interval_chunks;
+    uint64_t wav_data_offset; //first sample byte in the wav file
+    uint8_t reserved[RECINDEX_HEADER_SIZE - 32];
+};
+
+struct recIndexEntry
+{
+    int64_t id;           //chunk id
+    int64_t timestamp;    //microseconds time stamp of the first sample of the chunk
+    int64_t sample_index; //index of the first sample since the stream start
+    double rate;          //estimated real sample rate at the chunk
+    uint64_t wav_offset;  //byte offset of the chunk in the wav file
+    uint64_t csv_offset;  //byte offset of the chunk line in the csv file (0 if no csv is recorded)
+};
+
+// Recorder side: decides which chunks get an entry and serializes header / entries into write batches
+class RecIndexBuilder
+{
+public:
+    RecIndexBuilder(int channels=1, int interval_chunks=RECINDEX_DEF_INTERVAL);
+
+    void appendHeader(std::string& out, unsigned int rate, int bits_per_sample, uint64_t wav_data_offset) const;
+    // Call for every recorded chunk in order. Appends an entry to out if the chunk starts a new index interval
+    void addChunk(const micDataStamped& chunk, uint64_t wav_offset, uint64_t csv_offset, std::string& out);
+
+protected:
+    int channels_;
+    int interval_chunks_;
+    long chunks_since_entry_;
+    int64_t next_sample_index_; //expected sample index of the next chunk (-1: none yet)
+};
+
+class RecIndexReader
+{
+public:
+    RecIndexReader();
+    ~RecIndexReader();
+
+    // Loads <filename_base>.idx and opens <filename_base>.wav. Negative on error
+    int open(const std::string& filename_base);
+    void close();
+
+    // Interleaved samples with time stamps in [t0, t1) (microseconds, recording time base) into out.
+    // Gaps (dropped chunks) are skipped. first_timestamp (optional): time of the first returned frame.
+    // Returns the number of frames or a negative value on error
+    long read(int64_t t0, int64_t t1, std::vector<int16_t>& out, int64_t* first_timestamp=nullptr);
+
+    // Entry lookups (binary search): the last entry at or before the time stamp / chunk id, -1 if none
+    long findTime(int64_t timestamp) const;
+    long findChunk(int64_t id) const;
+
+    const recIndexHeader& header() const {return header_;}
+    const std::vector<recIndexEntry>& entries() const {return entries_;}
+    int64_t startTime() const; //time stamp of the first sample
+    int64_t endTime() const;   //time stamp after the last sample
+
+protected:
+    std::string name_;
+    recIndexHeader header_;
+    std::vector<recIndexEntry> entries_;
+    int wav_fd_;
+    uint64_t wav_end_; //end of the sample data in the wav file
+
+    size_t frameBytes() const {return (size_t)header_.channels * header_.bits_per_sample / 8;}
+    uint64_t segmentFrames(size_t entry) const; //contiguous frames from the entry to the next one
+};
+
+#endif //MIC_READ_THREAD_REC_INDEX_HPP
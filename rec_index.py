@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+"""
+Recording index reader (python side of rec_index.hpp).
+The recorder writes <base>.idx next to <base>.wav / <base>.csv:
+ header (64 bytes): magic b'MRRECIDX', version, rate (uint32), channels, bits_per_sample (uint16),
+                    interval_chunks (uint32), wav_data_offset (uint64)
+ entries (48 bytes): id, timestamp, sample_index (int64), rate (double), wav_offset, csv_offset (uint64)
+An entry is written for the first chunk, every interval_chunks chunks and after every gap, the wav samples between
+two entries are contiguous. Extracting a [t0, t1) range (microseconds, the time base of the csv timestamp column)
+is a binary search in the index plus seeks into the wav / csv file instead of parsing the whole recording.
+
+Usage:
+    rec = RecordingIndex('_data/drive/mic_rec')
+    samples, first_timestamp = rec.read(60e6, 65e6)   # int16 [frames x channels]
+    rows = rec.read_csv_rows(60e6, 65e6)              # csv columns (as read_csv) of the overlapping chunks
+"""
+from __future__ import print_function
+import os
+import struct
+import numpy as np
+
+MAGIC = b'MRRECIDX'
+VERSION = 1
+HEADER_SIZE = 64
+ENTRY_DTYPE = np.dtype([('id', '<i8'), ('timestamp', '<i8'), ('sample_index', '<i8'), ('rate', '<f8'),
+                        ('wav_offset', '<u8'), ('csv_offset', '<u8')])
+CSV_COLUMNS = ['id', 'timestamp', 'flag', 'sample_index', 'rate', 'frames']
+
+
+class RecordingIndex(object):
+    def __init__(self, filename_base):
+        """
+        Loads <filename_base>.idx (a recording still in progress is fine: its current end is used)
+        """
+        self.filename_base = filename_base
+        with open(filename_base + '.idx', 'rb') as idx_file:
+            header = idx_file.read(HEADER_SIZE)
+            if len(header) < HEADER_SIZE or header[:8] != MAGIC:
+                raise ValueError('%s.idx is not a recording index' % filename_base)
+            (version, self.rate, self.channels, self.bits_per_sample, self.interval_chunks,
+             self.wav_data_offset) = struct.unpack_from('<IIHHIQ', header, 8)
+            if version != VERSION or self.bits_per_sample != 16:
+                raise ValueError('Unsupported index version %d / %d bits' % (version, self.bits_per_sample))
+            data = idx_file.read()
+        # A partially written last entry is ignored
+        self.entries = np.frombuffer(data[:len(data) // ENTRY_DTYPE.itemsize * ENTRY_DTYPE.itemsize],
+                                     dtype=ENTRY_DTYPE)
+        self.frame_bytes = self.channels * self.bits_per_sample // 8
+        wav_size = os.path.getsize(filename_base + '.wav')
+        self.wav_end = self.wav_data_offset + \
+            max(wav_size - self.wav_data_offset, 0) // self.frame_bytes * self.frame_bytes
+
+    def __len__(self):
+        return len(self.entries)
+
+    def find_time(self, timestamp):
+        """
+        Index of the last entry at or before timestamp, -1 if none
+        """
+        return int(np.searchsorted(self.entries['timestamp'], timestamp, side='right')) - 1
+
+    def find_chunk(self, chunk_id):
+        """
+        Index of the last entry at or before the chunk id, -1 if none
+        """
+        return int(np.searchsorted(self.entries['id'], chunk_id, side='right')) - 1
+
+    def _segment_frames(self, e):
+        end = self.entries['wav_offset'][e + 1] if e + 1 < len(self.entries) else self.wav_end
+        end = min(int(end), self.wav_end)
+        return max(end - int(self.entries['wav_offset'][e]), 0) // self.frame_bytes
+
+    def start_time(self):
+        return int(self.entries['timestamp'][0]) if len(self.entries) else 0
+
+    def end_time(self):
+        if not len(self.entries):
+            return 0
+        last = self.entries[-1]
+        return int(last['timestamp'] + self._segment_frames(len(self.entries) - 1) * 1e6 / last['rate'])
+
+    def read(self, t0, t1):
+        """
+        Samples with time stamps in [t0, t1) (gaps of dropped chunks are skipped)
+        :return: (int16 array [frames x channels], time stamp of the first frame or None)
+        """
+        parts = []
+        first_timestamp = None
+        if len(self.entries) == 0 or t1 <= t0:
+            return np.zeros((0, self.channels), dtype=np.int16), None
+        with open(self.filename_base + '.wav', 'rb') as wav_file:
+            for e in range(max(self.find_time(t0), 0), len(self.entries)):
+                entry = self.entries[e]
+                if entry['timestamp'] >= t1:
+                    break
+                us_per_frame = 1e6 / (entry['rate'] if entry['rate'] > 0 else self.rate)
+                frames = self._segment_frames(e)
+                begin = int(np.ceil((t0 - entry['timestamp']) / us_per_frame)) if t0 > entry['timestamp'] else 0
+                end = int(np.ceil((t1 - entry['timestamp']) / us_per_frame))
+                begin, end = min(begin, frames), min(end, frames)
+                if end <= begin:
+                    continue
+                wav_file.seek(int(entry['wav_offset']) + begin * self.frame_bytes)
+                data = np.frombuffer(wav_file.read((end - begin) * self.frame_bytes), dtype='<i2')
+                parts.append(data[:len(data) // self.channels * self.channels].reshape(-1, self.channels))
+                if first_timestamp is None:
+                    first_timestamp = int(entry['timestamp'] + begin * us_per_frame)
+        if not parts:
+            return np.zeros((0, self.channels), dtype=np.int16), None
+        return np.concatenate(parts), first_timestamp
+
+    def read_csv_rows(self, t0, t1):
+        """
+        The csv rows of the chunks overlapping [t0, t1) as a dict of columns (same layout as read_csv() of
+        test_simple_puddle_classifier.py, values are strings)
+        """
+        out = dict((column, []) for column in CSV_COLUMNS)
+        if len(self.entries) == 0 or t1 <= t0 or self.entries['csv_offset'][0] == 0:
+            return out
+        e = max(self.find_time(t0), 0)
+        with open(self.filename_base + '.csv', 'rb') as csv_file:
+            csv_file.seek(int(self.entries['csv_offset'][e]))
+            for line in csv_file:
+                row = line.decode().rstrip('\n').split(',', len(CSV_COLUMNS) - 1)
+                if len(row) < len(CSV_COLUMNS):
+                    break  # partially written line of a recording in progress
+                timestamp, rate = int(row[1]), float(row[4])
+                if timestamp >= t1:
+                    break
+                samples = row[5].count(' ')
+                chunk_end = timestamp + samples // self.channels * 1e6 / (rate if rate > 0 else self.rate)
+                if chunk_end <= t0:
+                    continue
+                for column, value in zip(CSV_COLUMNS, row):
+                    out[column].append(value)
+        return out
+
+
+if __name__ == '__main__':
+    import argparse
+    import time
+    parser = argparse.ArgumentParser(description='Extracts a time range of a recording through its index')
+    parser.add_argument('filename_base', help='recording without extension (e.g. rec_mic)')
+    parser.add_argument('t0', type=float, help='start (seconds, recording time base)')
+    parser.add_argument('t1', type=float, help='end (seconds)')
+    parser.add_argument('--out', help='wav file for the extracted range')
+    args = parser.parse_args()
+    rec = RecordingIndex(args.filename_base)
+    print('%s: %d entries, %d Hz, %d channels, %.1f .. %.1f s' % (args.filename_base, len(rec), rec.rate,
+                                                                 rec.channels, rec.start_time() * 1e-6,
+                                                                 rec.end_time() * 1e-6))
+    start = time.time()
+    samples, first = rec.read(args.t0 * 1e6, args.t1 * 1e6)
+    print('%d frames from %s s in %.2f ms' % (len(samples), None if first is None else first * 1e-6,
+                                             (time.time() - start) * 1e3))
+    if args.out:
+        from scipy.io import wavfile
+        wavfile.write(args.out, rec.rate, samples)
@@ -0,0 +1,162 @@
+#include "resampler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while(b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Modified Bessel function of the first kind (order 0), for the Kaiser window
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for(int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if(term < 1e-12 * sum) break;
+    }
+    return sum;
+}
+
+PolyphaseResampler::PolyphaseResampler(unsigned int in_rate,
+                                       unsigned int out_rate,
+                                       int zero_crossings,
+                                       double rolloff,
+                                       double kaiser_beta):
+    in_rate_(in_rate),
+    out_rate_(out_rate)
+{
+    unsigned int g = gcd(in_rate_, out_rate_);
+    up_ = out_rate_ / g;
+    down_ = in_rate_ / g;
+
+    // Prototype filter runs at in_rate * L. Cutoff at the lower of both Nyquist frequencies
+    double ratio = std::min(1.0, (double)up_ / down_);
+    double cutoff = rolloff * ratio; //relative to the input Nyquist frequency
+    taps_ = (int)ceil(2.0 * zero_crossings / ratio);
+    int length = taps_ * up_;
+    double center = (length - 1) / 2.0;
+
+    std::vector<double> proto(length);
+    for(int i = 0; i < length; i++)
+    {
+        double t = (i - center) / up_; //in input samples
+        double x = cutoff * t;
+        double sinc = (fabs(x) < 1e-12) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+        double r = (i - center) / (length / 2.0);
+        double w = (fabs(r) <= 1.0) ? bessel_i0(kaiser_beta * sqrt(1.0 - r * r)) / bessel_i0(kaiser_beta) : 0.0;
+        proto[i] = cutoff * sinc * w;
+    }
+
+    // Polyphase split: phase p uses proto[p + k*L]. Every phase is normalized to unity DC gain
+    phases_.resize(up_ * taps_);
+    for(int p = 0; p < up_; p++)
+    {
+        double sum = 0.0;
+        for(int k = 0; k < taps_; k++) sum += proto[p + k * up_];
+        for(int k = 0; k < taps_; k++) {
+            //reversed: coefficient for x[n-k] sits at index taps_-1-k
+            phases_[p * taps_ + (taps_ - 1 - k)] = (float)(proto[p + k * up_] / sum);
+        }
+    }
+
+    reset();
+}
+
+void PolyphaseResampler::reset()
+{
+    history_.assign(taps_ - 1, 0.f);
+    pos_ = taps_ - 1;
+    phase_ = 0;
+    out_samples_ = 0;
+}
+
+double PolyphaseResampler::getDelay() const
+{
+    return (taps_ * up_ - 1) / 2.0 / up_;
+}
+
+size_t PolyphaseResampler::run(float* out)
+{
+    size_t out_num = 0;
+    const size_t end = history_.size();
+    const float* x = history_.data();
+
+    while(pos_ < end)
+    {
+        const float* __restrict h = &phases_[phase_ * taps_];
+        const float* __restrict s = x + pos_ - (taps_ - 1);
+        float acc = 0.f;
+        for(int k = 0; k < taps_; k++) {
+            acc += h[k] * s[k];
+        }
+        out[out_num++] = acc;
+
+        phase_ += down_;
+        pos_ += phase_ / up_;
+        phase_ %= up_;
+    }
+
+    // Keeping taps-1 samples of state (history_ keeps its capacity, no reallocation)
+    size_t keep = taps_ - 1;
+    size_t consumed = end - keep;
+    memmove(history_.data(), history_.data() + consumed, keep * sizeof(float));
+    history_.resize(keep);
+    pos_ -= consumed;
+    return out_num;
+}
+
+size_t PolyphaseResampler::process(const float* in, size_t n, float* out)
+{
+    history_.insert(history_.end(), in, in + n);
+    return run(out);
+}
+
+size_t PolyphaseResampler::process(const int16_t* in, size_t n, int16_t* out)
+{
+    size_t start = history_.size();
+    history_.resize(start + n);
+    for(size_t i = 0; i < n; i++) {
+        history_[start + i] = in[i];
+    }
+
+    out_buf_.resize(maxOutput(n));
+    size_t out_num = run(out_buf_.data());
+    for(size_t i = 0; i < out_num; i++) {
+        float v = std::round(out_buf_[i]);
+        out[i] = (int16_t)std::max(-32768.f, std::min(32767.f, v));
+    }
+    return out_num;
+}
+
+void PolyphaseResampler::process(const micDataStamped& chunk)
+{
+    // Time of the first output sample (relative to the chunk start) minus the filter delay
+    double first = (double)pos_ - (taps_ - 1) + (double)phase_ / up_ - getDelay();
+
+    // Measured input rate if the reader provides it
+    double in_rate = chunk.rate > 0. ? chunk.rate : (double)in_rate_;
+
+    chunk_out_.id = chunk.id;
+    chunk_out_.flags = chunk.flags;
+    chunk_out_.timestamp = chunk.timestamp + (int64_t)(first * 1000000.0 / in_rate);
+    chunk_out_.rate = in_rate * out_rate_ / in_rate_;
+    chunk_out_.sample_index = out_samples_;
+    chunk_out_.frames.resize(maxOutput(chunk.frames.size()));
+    size_t out_num = process(chunk.frames.data(), chunk.frames.size(), chunk_out_.frames.data());
+    chunk_out_.frames.resize(out_num);
+    out_samples_ += out_num;
+
+    for(size_t s = 0; s < stages_.size(); s++) {
+        stages_[s]->process(chunk_out_);
+    }
+}
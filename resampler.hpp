@@ -0,0 +1,77 @@
+/*
+Polyphase rational resampler (out_rate / in_rate = L / M) with a Kaiser windowed sinc low-pass.
+The filter state (last taps-1 input samples and the phase) is kept between calls, thus the signal
+can be fed chunk by chunk without discontinuities.
+Supported are all rational ratios, e.g. 44100 -> 22050 (L/M = 1/2), 44100 -> 16000 (160/441).
+
+It is also a MicReadStage: attached to MicReadAlsa it resamples every chunk and passes the result
+to its own downstream stages (e.g. StftStream), i.e. they process 2x+ fewer samples:
+    MicReadAlsa mic_reader(std::chrono::steady_clock::now(), true);
+    PolyphaseResampler resampler(mic_reader.getRate(), 22050);
+    StftStream stft(22050);
+    resampler.addStage(&stft);
+    mic_reader.addStage(&resampler);
+    mic_reader.start();
+ */
+
+#ifndef MIC_READ_THREAD_RESAMPLER_HPP
+#define MIC_READ_THREAD_RESAMPLER_HPP
+
+#include <vector>
+#include <inttypes.h>
+
+#include "micread_thread.hpp"
+
+// Zero crossings of the sinc on each side. More = steeper transition band, more MACs per sample
+#define RESAMPLER_DEF_ZERO_CROSSINGS 16
+#define RESAMPLER_DEF_ROLLOFF 0.9 //cutoff as a fraction of the output Nyquist frequency
+#define RESAMPLER_DEF_KAISER_BETA 8.0
+
+class PolyphaseResampler : public MicReadStage
+{
+public:
+    PolyphaseResampler(unsigned int in_rate,
+                       unsigned int out_rate,
+                       int zero_crossings=RESAMPLER_DEF_ZERO_CROSSINGS,
+                       double rolloff=RESAMPLER_DEF_ROLLOFF,
+                       double kaiser_beta=RESAMPLER_DEF_KAISER_BETA);
+
+    // Resamples n input samples. out must hold maxOutput(n) values. Returns the number of output samples
+    size_t process(const int16_t* in, size_t n, int16_t* out);
+    size_t process(const float* in, size_t n, float* out);
+    size_t maxOutput(size_t n) const {return n * up_ / down_ + 2;}
+    void reset();
+
+    // MicReadStage: resamples the chunk and passes it to the downstream stages
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "resampler";}
+    void addStage(MicReadStage* stage) {stages_.push_back(stage);}
+
+    unsigned int getInRate() const {return in_rate_;}
+    unsigned int getOutRate() const {return out_rate_;}
+    int getUp() const {return up_;}
+    int getDown() const {return down_;}
+    int getTapsPerPhase() const {return taps_;}
+    double getDelay() const; //group delay in input samples
+
+protected:
+    unsigned int in_rate_;
+    unsigned int out_rate_;
+    int up_;   //L
+    int down_; //M
+    int taps_; //taps per phase
+
+    std::vector<float> phases_;  //up_ x taps_ coefficients, every phase reversed (oldest sample first)
+    std::vector<float> history_; //taps_-1 samples of state followed by the current input
+    std::vector<float> out_buf_;
+    size_t pos_;                 //index in history_ of the newest sample used by the next output
+    int phase_;                  //phase of the next output (0 .. up_-1)
+
+    std::vector<MicReadStage*> stages_;
+    micDataStamped chunk_out_; //reused output chunk for the downstream stages
+    int64_t out_samples_;      //output samples emitted since reset() (sample_index of the output chunks)
+
+    size_t run(float* out); //filters history_ (input already appended)
+};
+
+#endif //MIC_READ_THREAD_RESAMPLER_HPP
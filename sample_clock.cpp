@@ -0,0 +1,65 @@
+#include "sample_clock.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+SampleClock::SampleClock(double nominal_rate, double bandwidth_hz):
+    nominal_rate_(nominal_rate),
+    bandwidth_(bandwidth_hz),
+    first_index_(0),
+    index_(0),
+    time_us_(0.),
+    period_us_(1000000.0 / nominal_rate),
+    last_error_us_(0.),
+    updates_(0),
+    resets_(0)
+{
+}
+
+void SampleClock::reset()
+{
+    updates_ = 0;
+    last_error_us_ = 0.;
+    resets_++;
+}
+
+void SampleClock::update(int64_t sample_index, double time_us)
+{
+    if(updates_ == 0) {
+        first_index_ = sample_index;
+        index_ = sample_index;
+        time_us_ = time_us;
+        updates_++;
+        return;
+    }
+    int64_t dn = sample_index - index_;
+    if(dn <= 0) return;
+
+    double predicted = time_us_ + dn * period_us_;
+    double err = time_us - predicted;
+    last_error_us_ = err;
+    if(std::fabs(err) > SAMPLE_CLOCK_MAX_ERROR_US) {
+        // Lost samples or a clock jump: the model is no longer valid
+        reset();
+        update(sample_index, time_us);
+        return;
+    }
+
+    // Loop coefficients for this update interval (critically damped).
+    // Wide bandwidth right after the start for fast convergence, narrowing with 1 / elapsed time
+    double elapsed_s = (sample_index - first_index_) / nominal_rate_;
+    double bandwidth = std::max(bandwidth_, SAMPLE_CLOCK_START_BANDWIDTH / (1.0 + elapsed_s));
+    double omega = 2.0 * M_PI * bandwidth * dn * period_us_ * 1e-6;
+    double b = std::min(M_SQRT2 * omega, 1.0);
+    double c = omega * omega;
+
+    index_ = sample_index;
+    time_us_ = predicted + b * err;
+    period_us_ += c * err / dn;
+    updates_++;
+}
+
+double SampleClock::timeOf(int64_t sample_index) const
+{
+    return time_us_ + (double)(sample_index - index_) * period_us_;
+}
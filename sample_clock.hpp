@@ -0,0 +1,56 @@
+/*
+Drift corrected sample clock.
+Maps sample indices of a capture stream to time. Every read provides an observation "sample N was
+captured at time T" (from the ALSA status time stamp). The observations are noisy (interrupt latency,
+scheduling), thus they are filtered by a second order delay locked loop (F. Adriaensen, "Using a DLL
+to filter time", 2005) which tracks both the time offset and the real sample rate of the device
+(a "44100 Hz" sound card typically runs tens of ppm off).
+
+A minimal example:
+    SampleClock clock(44100);
+    ...
+    clock.update(sample_index, time_us);       //after every read
+    int64_t t = clock.timeOf(chunk_first_index); //exact time of the first sample of the chunk
+    double rate = clock.getRate();
+ */
+
+#ifndef MIC_READ_THREAD_SAMPLE_CLOCK_HPP
+#define MIC_READ_THREAD_SAMPLE_CLOCK_HPP
+
+#include <inttypes.h>
+
+#define SAMPLE_CLOCK_DEF_BANDWIDTH 0.05 //Hz. Lower: smoother time stamps / rate, slower tracking
+#define SAMPLE_CLOCK_START_BANDWIDTH 1.0 //Hz. The loop starts wide and narrows down to the bandwidth
+#define SAMPLE_CLOCK_MAX_ERROR_US 50000. //larger observation errors restart the model (e.g. after an xrun)
+
+class SampleClock
+{
+public:
+    SampleClock(double nominal_rate, double bandwidth_hz=SAMPLE_CLOCK_DEF_BANDWIDTH);
+
+    // Observation: the sample with this index (counted from the stream start) was captured at time_us
+    void update(int64_t sample_index, double time_us);
+    // Forgets the state (e.g. the stream restarted). The rate estimate is kept
+    void reset();
+
+    bool isValid() const {return updates_ > 0;}
+    double timeOf(int64_t sample_index) const; //us, extrapolated from the last update
+    double getRate() const {return 1000000.0 / period_us_;} //estimated samples per second
+    double getDriftPpm() const {return (getRate() / nominal_rate_ - 1.0) * 1e6;}
+    double getLastErrorUs() const {return last_error_us_;} //observation - model (timing jitter)
+    long getUpdates() const {return updates_;}
+    long getResets() const {return resets_;}
+
+protected:
+    double nominal_rate_;
+    double bandwidth_;
+    int64_t first_index_; //sample index of the first update (after a reset)
+    int64_t index_;      //sample index of the model anchor
+    double time_us_;     //filtered time of the anchor sample
+    double period_us_;   //filtered sample period
+    double last_error_us_;
+    long updates_;
+    long resets_;
+};
+
+#endif //MIC_READ_THREAD_SAMPLE_CLOCK_HPP
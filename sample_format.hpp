@@ -0,0 +1,86 @@
+/*
+Compile time sample format conversion.
+MicReadFormat<Format> describes an ALSA sample format (bytes per sample, conversion of one sample to int16).
+convert_samples<Format, Samples>() converts a whole chunk with a compile time trip count, thus the loop is
+unrolled / vectorized; convert_samples<Format>(in, out, n) is the same loop with a runtime count and
+convert_samples_runtime() dispatches a runtime format (used by MicReadAlsa).
+Supported: S16_LE, S32_LE, S24_LE (24 bits in 4 bytes), S24_3LE, U8. Samples are interleaved as read.
+ */
+
+#ifndef MIC_READ_THREAD_SAMPLE_FORMAT_HPP
+#define MIC_READ_THREAD_SAMPLE_FORMAT_HPP
+
+#include <cstring>
+#include <cstddef>
+#include <inttypes.h>
+
+#include <alsa/asoundlib.h>
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "sample_format.hpp: only little endian hosts are supported (_LE formats are converted by plain loads)"
+#endif
+
+// Unsupported formats do not compile
+template <snd_pcm_format_t Format> struct MicReadFormat;
+
+template <> struct MicReadFormat<SND_PCM_FORMAT_S16_LE>
+{
+    static const int bytes = 2;
+    static inline int16_t toS16(const uint8_t* p) {int16_t v; memcpy(&v, p, 2); return v;}
+};
+
+template <> struct MicReadFormat<SND_PCM_FORMAT_S32_LE>
+{
+    static const int bytes = 4;
+    static inline int16_t toS16(const uint8_t* p) {int32_t v; memcpy(&v, p, 4); return (int16_t)(v >> 16);}
+};
+
+template <> struct MicReadFormat<SND_PCM_FORMAT_S24_LE>
+{
+    static const int bytes = 4;
+    //24 bits in the low bytes of 32: sign extension through the shifts
+    static inline int16_t toS16(const uint8_t* p) {int32_t v; memcpy(&v, p, 4); return (int16_t)((int32_t)((uint32_t)v << 8) >> 16);}
+};
+
+template <> struct MicReadFormat<SND_PCM_FORMAT_S24_3LE>
+{
+    static const int bytes = 3;
+    static inline int16_t toS16(const uint8_t* p) {return (int16_t)(p[1] | ((int8_t)p[2] << 8));}
+};
+
+template <> struct MicReadFormat<SND_PCM_FORMAT_U8>
+{
+    static const int bytes = 1;
+    static inline int16_t toS16(const uint8_t* p) {return (int16_t)((p[0] - 128) << 8);}
+};
+
+template <snd_pcm_format_t Format, int Samples>
+inline void convert_samples(const uint8_t* in, int16_t* out)
+{
+    for(int i = 0; i < Samples; i++) {
+        out[i] = MicReadFormat<Format>::toS16(in + i * MicReadFormat<Format>::bytes);
+    }
+}
+
+template <snd_pcm_format_t Format>
+inline void convert_samples(const uint8_t* in, int16_t* out, size_t samples)
+{
+    for(size_t i = 0; i < samples; i++) {
+        out[i] = MicReadFormat<Format>::toS16(in + i * MicReadFormat<Format>::bytes);
+    }
+}
+
+// Returns false for unsupported formats
+inline bool convert_samples_runtime(snd_pcm_format_t format, const uint8_t* in, int16_t* out, size_t samples)
+{
+    switch(format) {
+    case SND_PCM_FORMAT_S16_LE: convert_samples<SND_PCM_FORMAT_S16_LE>(in, out, samples); return true;
+    case SND_PCM_FORMAT_S32_LE: convert_samples<SND_PCM_FORMAT_S32_LE>(in, out, samples); return true;
+    case SND_PCM_FORMAT_S24_LE: convert_samples<SND_PCM_FORMAT_S24_LE>(in, out, samples); return true;
+    case SND_PCM_FORMAT_S24_3LE: convert_samples<SND_PCM_FORMAT_S24_3LE>(in, out, samples); return true;
+    case SND_PCM_FORMAT_U8: convert_samples<SND_PCM_FORMAT_U8>(in, out, samples); return true;
+    default: return false;
+    }
+}
+
+#endif //MIC_READ_THREAD_SAMPLE_FORMAT_HPP
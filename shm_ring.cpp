@@ -0,0 +1,265 @@
+#include "shm_ring.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// The layout is shared with shm_ring.py
+static_assert(sizeof(shmRingHeader) == SHMRING_HEADER_SIZE, "ring header layout");
+static_assert(sizeof(shmSlotHeader) == SHMRING_SLOT_HEADER_SIZE, "slot header layout");
+
+// Shared (not FUTEX_PRIVATE) futex: the waiters are in other processes
+static void futex_wake(uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static void futex_wait(uint32_t* word, uint32_t value, const struct timespec* timeout)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, nullptr, 0);
+}
+
+ShmRing::ShmRing(std::string name):
+    name_(name),
+    path_("/micread_" + name),
+    fd_(-1),
+    base_(nullptr),
+    size_(0),
+    header_(nullptr)
+{
+}
+
+ShmRing::~ShmRing()
+{
+    close();
+}
+
+void ShmRing::close()
+{
+    if(base_ != nullptr) munmap(base_, size_);
+    if(fd_ >= 0) ::close(fd_);
+    base_ = nullptr;
+    header_ = nullptr;
+    fd_ = -1;
+}
+
+int ShmRing::map(bool create)
+{
+    struct stat st;
+    if(fstat(fd_, &st) < 0 || (size_t)st.st_size < SHMRING_HEADER_SIZE) {
+        fprintf(stderr, "ShmRing: ERROR: %s is not a ring\n", path_.c_str());
+        return -2;
+    }
+    size_ = st.st_size;
+    // Readers map it writable too: futex waits need the header word
+    base_ = (uint8_t*)mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | (create ? MAP_POPULATE : 0), fd_, 0);
+    if(base_ == MAP_FAILED) {
+        base_ = nullptr;
+        fprintf(stderr, "ShmRing: ERROR: Cannot map %s (%s)\n", path_.c_str(), strerror(errno));
+        return -3;
+    }
+    header_ = (shmRingHeader*)base_;
+    return 0;
+}
+
+ShmRingPublisher::ShmRingPublisher(std::string name,
+                                   unsigned int rate,
+                                   int channels,
+                                   int slot_count,
+                                   int slot_samples):
+    ShmRing(name),
+    rate_(rate),
+    channels_(channels),
+    slot_count_(slot_count),
+    slot_samples_(slot_samples > 0 ? slot_samples : MICREAD_DEF_BUF_SIZE * channels),
+    published_(0),
+    truncated_(0)
+{
+}
+
+ShmRingPublisher::~ShmRingPublisher()
+{
+    if(base_ != nullptr) {
+        close();
+        shm_unlink(path_.c_str());
+    }
+}
+
+int ShmRingPublisher::create()
+{
+    close();
+    shm_unlink(path_.c_str()); //readers still mapping an old ring keep it until they close
+    fd_ = shm_open(path_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd_ < 0) {
+        fprintf(stderr, "ShmRingPublisher: ERROR: Cannot create %s (%s)\n", path_.c_str(), strerror(errno));
+        return -1;
+    }
+    // Slots are cache line aligned
+    size_t stride = (SHMRING_SLOT_HEADER_SIZE + slot_samples_ * sizeof(int16_t) + 63) / 64 * 64;
+    size_t size = SHMRING_HEADER_SIZE + stride * slot_count_;
+    if(ftruncate(fd_, size) < 0) {
+        fprintf(stderr, "ShmRingPublisher: ERROR: Cannot size %s (%s)\n", path_.c_str(), strerror(errno));
+        close();
+        return -1;
+    }
+    int err = map(true);
+    if(err < 0) {
+        close();
+        return err;
+    }
+
+    // The magic goes last: a reader opening the ring meanwhile sees an invalid ring
+    header_->version = SHMRING_VERSION;
+    header_->slot_count = slot_count_;
+    header_->slot_samples = slot_samples_;
+    header_->slot_stride = (uint32_t)stride;
+    header_->rate = rate_;
+    header_->channels = channels_;
+    __atomic_store_n(&header_->write_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&header_->futex, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header_->magic, SHMRING_MAGIC, 8);
+    printf("ShmRingPublisher: %s: %d slots of %d samples (%zu KB)\n", path_.c_str(), slot_count_, slot_samples_, size / 1024);
+    return 0;
+}
+
+void ShmRingPublisher::process(const micDataStamped& chunk)
+{
+    if(header_ == nullptr) return;
+    uint64_t n = __atomic_load_n(&header_->write_count, __ATOMIC_RELAXED); //the only writer
+    shmSlotHeader* s = slot(n);
+
+    // Seqlock: odd while the slot is written
+    __atomic_store_n(&s->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    size_t samples = chunk.frames.size();
+    if(samples > (size_t)slot_samples_) {
+        samples = slot_samples_;
+        truncated_++;
+    }
+    s->id = chunk.id;
+    s->timestamp = chunk.timestamp;
+    s->sample_index = chunk.sample_index;
+    s->rate = chunk.rate;
+    s->flags = chunk.flags.all;
+    s->samples = (uint32_t)samples;
+    memcpy((uint8_t*)s + SHMRING_SLOT_HEADER_SIZE, chunk.frames.data(), samples * sizeof(int16_t));
+    __atomic_store_n(&s->seq, 2 * n + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&header_->write_count, n + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&header_->futex, 1, __ATOMIC_RELEASE);
+    // Waking without waiters is a cheap syscall: no waiter bookkeeping shared with (python) readers
+    futex_wake(&header_->futex);
+    published_++;
+}
+
+ShmRingReader::ShmRingReader(std::string name):
+    ShmRing(name),
+    next_(0),
+    lost_(0)
+{
+}
+
+int ShmRingReader::open()
+{
+    close();
+    fd_ = shm_open(path_.c_str(), O_RDWR, 0);
+    if(fd_ < 0) {
+        fprintf(stderr, "ShmRingReader: ERROR: Cannot open %s (%s)\n", path_.c_str(), strerror(errno));
+        return -1;
+    }
+    int err = map(false);
+    if(err < 0) {
+        close();
+        return err;
+    }
+    if(memcmp(header_->magic, SHMRING_MAGIC, 8) != 0 || header_->version != SHMRING_VERSION ||
+            size_ < SHMRING_HEADER_SIZE + (size_t)header_->slot_count * header_->slot_stride) {
+        fprintf(stderr, "ShmRingReader: ERROR: %s is not a ring (version %d)\n", path_.c_str(), SHMRING_VERSION);
+        close();
+        return -2;
+    }
+    next_ = __atomic_load_n(&header_->write_count, __ATOMIC_ACQUIRE);
+    lost_ = 0;
+    return 0;
+}
+
+long ShmRingReader::getLag() const
+{
+    if(header_ == nullptr) return 0;
+    return (long)(__atomic_load_n(&header_->write_count, __ATOMIC_ACQUIRE) - next_);
+}
+
+int ShmRingReader::read(micDataStamped& chunk, int timeout_ms)
+{
+    if(header_ == nullptr) return -1;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while(true)
+    {
+        uint32_t futex = __atomic_load_n(&header_->futex, __ATOMIC_ACQUIRE);
+        uint64_t written = __atomic_load_n(&header_->write_count, __ATOMIC_ACQUIRE);
+        if(next_ < written) {
+            // Too far behind: the oldest slot may be rewritten right now, skipping to the second oldest
+            if(written - next_ >= header_->slot_count) {
+                uint64_t skip_to = written - header_->slot_count + 1;
+                lost_ += skip_to - next_;
+                next_ = skip_to;
+            }
+            shmSlotHeader* s = slot(next_);
+            uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+            if(seq != 2 * next_ + 2) {
+                lost_++; //lapped while we were looking
+                next_++;
+                continue;
+            }
+            uint32_t samples = std::min(s->samples, header_->slot_samples);
+            chunk.id = s->id;
+            chunk.timestamp = s->timestamp;
+            chunk.sample_index = s->sample_index;
+            chunk.rate = s->rate;
+            chunk.flags.all = s->flags;
+            chunk.frames.resize(samples);
+            memcpy(chunk.frames.data(), (const uint8_t*)s + SHMRING_SLOT_HEADER_SIZE, samples * sizeof(int16_t));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+                lost_++; //overwritten during the copy
+                next_++;
+                continue;
+            }
+            next_++;
+            return 1;
+        }
+
+        // Waiting for the next publish
+        if(timeout_ms == 0) return 0;
+        struct timespec timeout;
+        struct timespec* timeout_ptr = nullptr;
+        if(timeout_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long ns = (deadline.tv_sec - now.tv_sec) * 1000000000L + (deadline.tv_nsec - now.tv_nsec);
+            if(ns <= 0) return 0;
+            timeout.tv_sec = ns / 1000000000L;
+            timeout.tv_nsec = ns % 1000000000L;
+            timeout_ptr = &timeout;
+        }
+        futex_wait(&header_->futex, futex, timeout_ptr);
+    }
+}
@@ -0,0 +1,143 @@
+/*
+Shared memory ring transport: live chunks for other processes without files or serialization.
+ShmRingPublisher is a processing stage: the reading thread copies every chunk (header + int16 payload)
+into the next slot of a POSIX shared memory ring (/dev/shm/micread_<name>) and wakes the readers with a
+futex on the ring header (a futex works across processes without passing file descriptors, unlike eventfd).
+The publisher never waits for readers: a reader that falls more than slot_count chunks behind loses the
+oldest chunks (counted). Every slot is a seqlock, thus a reader never returns a half overwritten chunk.
+Readers: ShmRingReader (C++) and shm_ring.py (python, numpy).
+
+Layout (little endian, also documented in shm_ring.py):
+ header (128 bytes): magic "MRSHRING", version, slot_count, slot_samples, slot_stride, rate, channels,
+                     write_count (uint64, chunks published), futex (uint32, bumped on every publish)
+ slot (slot_stride bytes): seq (uint64: 2n+1 while chunk n is written, 2n+2 when done), id, timestamp,
+                           sample_index (int64), rate (double), flags, samples (uint32), int16 payload
+
+A minimal example:
+    // capture process
+    ShmRingPublisher publisher("front", mic_reader.getRate());
+    publisher.create();
+    mic_reader.addStage(&publisher);
+    // consumer process
+    ShmRingReader reader("front");
+    reader.open();
+    micDataStamped chunk;
+    while(reader.read(chunk, 1000) >= 0) {...}
+ */
+
+#ifndef MIC_READ_THREAD_SHM_RING_HPP
+#define MIC_READ_THREAD_SHM_RING_HPP
+
+#include <string>
+#include <atomic>
+#include <inttypes.h>
+
+#include "micread_thread.hpp"
+
+#define SHMRING_MAGIC "MRSHRING"
+#define SHMRING_VERSION 1
+#define SHMRING_HEADER_SIZE 128
+#define SHMRING_SLOT_HEADER_SIZE 64
+#define SHMRING_DEF_SLOTS 256 //~3 s of 512 frame chunks at 44.1 kHz
+#define SHMRING_DEF_SLOT_SAMPLES 0 //0: one default chunk of all channels (MICREAD_DEF_BUF_SIZE * channels)
+
+struct shmRingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_samples; //max int16 samples per slot (larger chunks are truncated)
+    uint32_t slot_stride;  //bytes per slot
+    uint32_t rate;
+    uint32_t channels;
+    uint64_t write_count;  //chunks published (atomic)
+    uint32_t futex;        //futex word, bumped on every publish (atomic)
+    uint8_t reserved[SHMRING_HEADER_SIZE - 44];
+};
+
+struct shmSlotHeader
+{
+    uint64_t seq;          //seqlock (atomic)
+    int64_t id;
+    int64_t timestamp;
+    int64_t sample_index;
+    double rate;
+    uint32_t flags;
+    uint32_t samples;
+    uint8_t reserved[SHMRING_SLOT_HEADER_SIZE - 48];
+};
+
+// Maps / unmaps the ring (shared by the publisher and the reader)
+class ShmRing
+{
+public:
+    ShmRing(std::string name);
+    ~ShmRing();
+
+    void close();
+    const std::string& getPath() const {return path_;}
+
+protected:
+    std::string name_;
+    std::string path_; //shm_open() name
+    int fd_;
+    uint8_t* base_;
+    size_t size_;
+    shmRingHeader* header_;
+
+    shmSlotHeader* slot(uint64_t n) const {
+        return (shmSlotHeader*)(base_ + SHMRING_HEADER_SIZE + (n % header_->slot_count) * header_->slot_stride);
+    }
+    int map(bool create);
+};
+
+class ShmRingPublisher : public ShmRing, public MicReadStage
+{
+public:
+    ShmRingPublisher(std::string name,
+                     unsigned int rate,
+                     int channels=1,
+                     int slot_count=SHMRING_DEF_SLOTS,
+                     int slot_samples=SHMRING_DEF_SLOT_SAMPLES);
+    ~ShmRingPublisher(); //removes the ring
+
+    int create(); //creates (or replaces) the ring. Negative on error
+
+    // MicReadStage: called by the reading thread
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "shm ring";}
+
+    long getChunksPublished() const {return published_;}
+    long getChunksTruncated() const {return truncated_;}
+
+protected:
+    unsigned int rate_;
+    int channels_;
+    int slot_count_;
+    int slot_samples_;
+    std::atomic<long> published_;
+    std::atomic<long> truncated_;
+};
+
+class ShmRingReader : public ShmRing
+{
+public:
+    ShmRingReader(std::string name);
+
+    // Opens the ring of a running publisher. Reading starts with the next published chunk
+    int open();
+
+    // Waits up to timeout_ms (-1: forever) for the next chunk. 1: chunk read, 0: timeout, negative: error
+    int read(micDataStamped& chunk, int timeout_ms=-1);
+
+    long getChunksLost() const {return lost_;} //overwritten before they were read
+    long getLag() const; //published but not read yet
+    unsigned int getRate() const {return header_ ? header_->rate : 0;}
+    int getChannels() const {return header_ ? (int)header_->channels : 0;}
+
+protected:
+    uint64_t next_; //next chunk to read
+    long lost_;
+};
+
+#endif //MIC_READ_THREAD_SHM_RING_HPP
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+"""
+Shared memory ring reader (python side of shm_ring.hpp).
+The capture process publishes every chunk into /dev/shm/micread_<name> (ShmRingPublisher stage).
+Layout (little endian):
+ header (128 bytes): magic b'MRSHRING', version, slot_count, slot_samples, slot_stride, rate, channels (uint32),
+                     write_count (uint64, chunks published), futex (uint32, bumped on every publish)
+ slot (slot_stride bytes): seq (uint64: 2n+1 while chunk n is written, 2n+2 when done), id, timestamp,
+                           sample_index (int64), rate (double), flags, samples (uint32), 16 bytes reserved,
+                           int16 payload
+Waiting uses the futex of the header (Linux x86_64 / arm / aarch64), otherwise a 1 ms poll.
+
+Usage:
+    reader = ShmRingReader('front')
+    while True:
+        chunk = reader.read(timeout=1.0)
+        if chunk is not None:
+            print(chunk['id'], chunk['timestamp'], chunk['frames'].shape)
+"""
+from __future__ import print_function
+import ctypes
+import mmap
+import os
+import platform
+import struct
+import time
+import numpy as np
+
+MAGIC = b'MRSHRING'
+VERSION = 1
+HEADER_SIZE = 128
+SLOT_HEADER_SIZE = 64
+WRITE_COUNT_OFFSET = 32
+FUTEX_OFFSET = 40
+SLOT_HEADER = struct.Struct('<Qqqqd II')
+FUTEX_WAIT = 0
+SYS_FUTEX = {'x86_64': 202, 'aarch64': 98, 'armv7l': 240, 'armv6l': 240}.get(platform.machine())
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
+
+class ShmRingReader(object):
+    def __init__(self, name):
+        """
+        Opens the ring of a running publisher. Reading starts with the next published chunk
+        """
+        self.path = '/dev/shm/micread_' + name
+        with open(self.path, 'r+b') as ring_file:
+            self.mm = mmap.mmap(ring_file.fileno(), 0)
+        if self.mm[:8] != MAGIC:
+            raise ValueError('%s is not a ring' % self.path)
+        (version, self.slot_count, self.slot_samples, self.slot_stride,
+         self.rate, self.channels) = struct.unpack_from('<IIIIII', self.mm, 8)
+        if version != VERSION:
+            raise ValueError('Unsupported ring version %d' % version)
+        self.next = self._write_count()
+        self.lost = 0
+        self._futex = None
+        if SYS_FUTEX is not None:
+            self._libc = ctypes.CDLL(None, use_errno=True)
+            self._futex = ctypes.c_uint32.from_buffer(self.mm, FUTEX_OFFSET)
+
+    def _write_count(self):
+        return struct.unpack_from('<Q', self.mm, WRITE_COUNT_OFFSET)[0]
+
+    def lag(self):
+        """
+        Chunks published but not read yet
+        """
+        return self._write_count() - self.next
+
+    def _wait(self, futex_value, timeout):
+        if self._futex is None:
+            time.sleep(0.001)
+            return
+        timespec = None
+        if timeout is not None:
+            timespec = ctypes.byref(_Timespec(int(timeout), int((timeout % 1.0) * 1e9)))
+        self._libc.syscall(SYS_FUTEX, ctypes.byref(self._futex), FUTEX_WAIT, ctypes.c_uint32(futex_value),
+                           timespec, None, 0)
+
+    def read(self, timeout=None):
+        """
+        Waits up to timeout seconds (None: forever) for the next chunk
+        :return: dict(id, timestamp, sample_index, rate, flags, frames=int16 array) or None on timeout
+        """
+        deadline = None if timeout is None else time.time() + timeout
+        while True:
+            futex_value = struct.unpack_from('<I', self.mm, FUTEX_OFFSET)[0]
+            written = self._write_count()
+            if self.next < written:
+                if written - self.next >= self.slot_count:
+                    # Too far behind: the oldest slot may be rewritten right now
+                    skip_to = written - self.slot_count + 1
+                    self.lost += skip_to - self.next
+                    self.next = skip_to
+                offset = HEADER_SIZE + (self.next % self.slot_count) * self.slot_stride
+                seq, chunk_id, timestamp, sample_index, rate, flags, samples = SLOT_HEADER.unpack_from(self.mm, offset)
+                if seq == 2 * self.next + 2:
+                    samples = min(samples, self.slot_samples)
+                    frames = np.frombuffer(self.mm, dtype='<i2', count=samples,
+                                           offset=offset + SLOT_HEADER_SIZE).copy()
+                    # Seqlock: the slot must not have changed during the copy
+                    if struct.unpack_from('<Q', self.mm, offset)[0] == seq:
+                        self.next += 1
+                        return dict(id=chunk_id, timestamp=timestamp, sample_index=sample_index,
+                                    rate=rate, flags=flags, frames=frames)
+                self.lost += 1
+                self.next += 1
+                continue
+            if deadline is not None and time.time() >= deadline:
+                return None
+            self._wait(futex_value, None if deadline is None else max(deadline - time.time(), 0.))
+
+    def close(self):
+        if self._futex is not None:
+            del self._futex  # the exported buffer must be released before closing the map
+            self._futex = None
+        self.mm.close()
+
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser(description='Prints the chunks published into a shared memory ring')
+    parser.add_argument('name', help='ring name (ShmRingPublisher name)')
+    args = parser.parse_args()
+    reader = ShmRingReader(args.name)
+    print('%s: %d slots, rate %d, channels %d' % (reader.path, reader.slot_count, reader.rate, reader.channels))
+    while True:
+        chunk = reader.read(timeout=1.0)
+        if chunk is None:
+            print('timeout')
+            continue
+        print('id %d timestamp %d samples %d lost %d' % (chunk['id'], chunk['timestamp'],
+                                                         len(chunk['frames']), reader.lost))
@@ -0,0 +1,143 @@
+#include "stft_stream.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+StftStream::StftStream(unsigned int rate,
+                       int fft_size,
+                       int hop,
+                       StftWindow window,
+                       int ring_frames):
+    rate_(rate),
+    hop_(hop),
+    fft_(fft_size),
+    history_pos_(0),
+    history_filled_(0),
+    since_hop_(0),
+    ring_frames_(ring_frames),
+    ring_head_(0),
+    ring_tail_(0),
+    frames_computed_(0),
+    frames_dropped_(0)
+{
+    int n = fft_.size();
+    if(hop_ <= 0 || hop_ > n) {
+        fprintf(stderr, "StftStream: WARNING: hop %d is out of range (1..%d). Using %d\n", hop_, n, n / 4);
+        hop_ = n / 4;
+    }
+
+    // Window is scaled by 1/32768 so that magnitudes match librosa on int16 / 32768 signals
+    window_.resize(n);
+    for(int i = 0; i < n; i++) {
+        double w = 1.0;
+        if(window == STFT_WINDOW_HANN) w = 0.5 - 0.5 * cos(2.0 * M_PI * i / n);
+        if(window == STFT_WINDOW_HAMMING) w = 0.54 - 0.46 * cos(2.0 * M_PI * i / n);
+        window_[i] = (float)(w / 32768.0);
+    }
+
+    history_.assign(n, 0.f);
+    windowed_.resize(n);
+    spec_re_.resize(fft_.bins());
+    spec_im_.resize(fft_.bins());
+
+    ring_.resize(ring_frames_ * fft_.bins());
+    ring_stamps_.resize(ring_frames_);
+}
+
+void StftStream::process(const micDataStamped& chunk)
+{
+    push(chunk.frames.data(), chunk.frames.size(), chunk.timestamp, chunk.rate);
+}
+
+void StftStream::push(const int16_t* samples, size_t n, int64_t timestamp, double rate)
+{
+    if(rate <= 0.) rate = rate_;
+    const int size = fft_.size();
+    size_t i = 0;
+    while(i < n)
+    {
+        // Copying up to the next frame boundary at once
+        long to_frame = std::max<long>(hop_ - since_hop_, size - history_filled_);
+        size_t count = std::min<size_t>(n - i, std::max<long>(to_frame, 1));
+        for(size_t k = 0; k < count; k++) {
+            history_[history_pos_] = samples[i + k];
+            history_pos_ = (history_pos_ + 1) & (size - 1);
+        }
+        i += count;
+        since_hop_ += count;
+        history_filled_ += count;
+
+        if(history_filled_ >= size && since_hop_ >= hop_) {
+            int64_t frame_end = timestamp + (int64_t)((double)(i - 1) * 1000000.0 / rate);
+            computeFrame(frame_end);
+            since_hop_ = 0;
+        }
+    }
+}
+
+void StftStream::computeFrame(int64_t timestamp)
+{
+    const int size = fft_.size();
+    const float* __restrict w = window_.data();
+    const float* __restrict h = history_.data();
+    float* __restrict out = windowed_.data();
+
+    // history_pos_ points at the oldest sample. Two contiguous runs to keep the loops vectorizable
+    int first = size - history_pos_;
+    for(int k = 0; k < first; k++) out[k] = h[history_pos_ + k] * w[k];
+    for(int k = first; k < size; k++) out[k] = h[k - first] * w[k];
+
+    fft_.forward(windowed_.data(), spec_re_.data(), spec_im_.data());
+    frames_computed_++;
+
+    size_t head = ring_head_.load(std::memory_order_relaxed);
+    if(head - ring_tail_.load(std::memory_order_acquire) >= ring_frames_) {
+        frames_dropped_++;
+        return;
+    }
+    size_t slot = head % ring_frames_;
+    RealFFT::magnitude(spec_re_.data(), spec_im_.data(), &ring_[slot * bins()], bins());
+    ring_stamps_[slot] = timestamp;
+    ring_head_.store(head + 1, std::memory_order_release);
+}
+
+void StftStream::reset()
+{
+    std::fill(history_.begin(), history_.end(), 0.f);
+    history_pos_ = 0;
+    history_filled_ = 0;
+    since_hop_ = 0;
+    ring_tail_.store(ring_head_.load());
+}
+
+size_t StftStream::framesAvailable() const
+{
+    return ring_head_.load(std::memory_order_acquire) - ring_tail_.load(std::memory_order_relaxed);
+}
+
+const float* StftStream::peekFrame(int64_t* timestamp) const
+{
+    size_t tail = ring_tail_.load(std::memory_order_relaxed);
+    if(tail == ring_head_.load(std::memory_order_acquire)) return nullptr;
+    size_t slot = tail % ring_frames_;
+    if(timestamp != nullptr) *timestamp = ring_stamps_[slot];
+    return &ring_[slot * bins()];
+}
+
+void StftStream::releaseFrame()
+{
+    size_t tail = ring_tail_.load(std::memory_order_relaxed);
+    if(tail != ring_head_.load(std::memory_order_acquire)) {
+        ring_tail_.store(tail + 1, std::memory_order_release);
+    }
+}
+
+bool StftStream::popFrame(float* magnitudes, int64_t* timestamp)
+{
+    const float* frame = peekFrame(timestamp);
+    if(frame == nullptr) return false;
+    memcpy(magnitudes, frame, bins() * sizeof(float));
+    releaseFrame();
+    return true;
+}
@@ -0,0 +1,108 @@
+/*
+Streaming STFT (spectrogram) stage for MicReadAlsa.
+The stage keeps the last fft_size samples, computes a windowed FFT every hop samples and stores
+the magnitude spectrum (fft_size/2+1 bins) into a preallocated ring of frames.
+Everything is allocated in the constructor: the reading thread never allocates while processing.
+The ring is single producer (reading thread) / single consumer (any other thread).
+If the consumer does not keep up the newest frames are dropped (see getFramesDropped()).
+
+A minimal example:
+    MicReadAlsa mic_reader(std::chrono::steady_clock::now(), true);
+    StftStream stft(mic_reader.getRate(), 2048, 512, STFT_WINDOW_HANN);
+    mic_reader.addStage(&stft);
+    mic_reader.start();
+
+    std::vector<float> column(stft.bins());
+    int64_t timestamp;
+    while(true) {
+        while(stft.popFrame(column.data(), &timestamp)) {
+            //use the spectrogram column
+        }
+        std::this_thread::sleep_for (std::chrono::milliseconds(10));
+    }
+ */
+
+#ifndef MIC_READ_THREAD_STFT_STREAM_HPP
+#define MIC_READ_THREAD_STFT_STREAM_HPP
+
+#include <vector>
+#include <atomic>
+#include <inttypes.h>
+
+#include "micread_thread.hpp"
+#include "fft.hpp"
+
+// Defaults match librosa (n_fft=2048, hop_length=512)
+#define STFT_DEF_FFT_SIZE 2048
+#define STFT_DEF_HOP 512
+#define STFT_DEF_RING_FRAMES 256
+
+enum StftWindow
+{
+    STFT_WINDOW_RECT,
+    STFT_WINDOW_HANN,
+    STFT_WINDOW_HAMMING
+};
+
+class StftStream : public MicReadStage
+{
+public:
+    StftStream(unsigned int rate=MICREAD_DEF_RATE,
+               int fft_size=STFT_DEF_FFT_SIZE,
+               int hop=STFT_DEF_HOP,
+               StftWindow window=STFT_WINDOW_HANN,
+               int ring_frames=STFT_DEF_RING_FRAMES);
+
+    // MicReadStage: called by the reading thread
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "stft";}
+    // Feeds raw samples (e.g. from a file). timestamp: microseconds of the first sample,
+    // rate: measured sample rate for the frame time stamps (0: nominal rate)
+    void push(const int16_t* samples, size_t n, int64_t timestamp, double rate=0.);
+    // Forgets the signal history and all frames (call when the producer is stopped)
+    void reset();
+
+    int bins() const {return fft_.bins();}
+    int fftSize() const {return fft_.size();}
+    int hop() const {return hop_;}
+
+    //--- Consumer side
+    size_t framesAvailable() const;
+    // Copies the oldest frame (bins() magnitudes) and releases it. Returns false if there is none.
+    // timestamp: microseconds time stamp of the last sample of the frame
+    bool popFrame(float* magnitudes, int64_t* timestamp=nullptr);
+    // Zero copy access: the oldest frame stays valid until releaseFrame(). nullptr if there is none
+    const float* peekFrame(int64_t* timestamp=nullptr) const;
+    void releaseFrame();
+
+    long getFramesComputed() const {return frames_computed_;}
+    long getFramesDropped() const {return frames_dropped_;}
+
+protected:
+    unsigned int rate_;
+    int hop_;
+    RealFFT fft_;
+
+    std::vector<float> window_;   //precomputed window (includes 1/32768 int16 scaling)
+    std::vector<float> history_;  //circular buffer of the last fft_size samples
+    std::vector<float> windowed_; //FFT input
+    std::vector<float> spec_re_;
+    std::vector<float> spec_im_;
+    int history_pos_;
+    long history_filled_;
+    int since_hop_;
+
+    // Output ring
+    size_t ring_frames_;
+    std::vector<float> ring_;
+    std::vector<int64_t> ring_stamps_;
+    std::atomic<size_t> ring_head_; //frames written (producer)
+    std::atomic<size_t> ring_tail_; //frames read (consumer)
+
+    std::atomic<long> frames_computed_;
+    std::atomic<long> frames_dropped_;
+
+    void computeFrame(int64_t timestamp);
+};
+
+#endif //MIC_READ_THREAD_STFT_STREAM_HPP
@@ -21,6 +21,9 @@ import datetime
 import copy
 import subprocess
 
+from rec_index import RecordingIndex
+from feature_cache import FeatureCache, feature_params
+
 
 def windows(data, window_size):
     start = int(0)
@@ -91,14 +94,21 @@ def frames2stream(data_frames):
         data_stream.append([np.int16(val) for val in row.strip(' ').split(' ')])
     return np.concatenate(data_stream)
 
-def frames2stream_with_timestamps(data_frames, timestamps):
+def frames2stream_with_timestamps(data_frames, timestamps, rates=None):
+    """
+    Per sample timestamps (microseconds).
+    If rates (the "rate" column of recent recordings) is given the timestamp of a chunk is the exact time
+    of its first sample and sample i is at timestamp + i * 1e6 / rate, otherwise the chunk timestamps are interpolated.
+    """
     data_stream = []
     timestamps_interpolated = []
     dt = 1.0/44100
     for frame_id, frame in tqdm(enumerate(data_frames)):
         frame_flat = [np.int16(val) for val in frame.strip(' ').split(' ')]
         data_stream.append(frame_flat)
-        if frame_id < len(timestamps) - 1:
+        if rates is not None and float(rates[frame_id]) > 0:
+            interm_timestamps = timestamps[frame_id] + np.arange(len(frame_flat)) * 1e6 / float(rates[frame_id])
+        elif frame_id < len(timestamps) - 1:
             dt = (timestamps[frame_id + 1] - timestamps[frame_id]) / (len(timestamps) - 1)
             interm_timestamps = np.linspace(timestamps[frame_id], timestamps[frame_id+1], len(frame_flat))
         else:
@@ -172,6 +182,9 @@ def main():
     prepickled_data_filename = None
     # prepickled_data_filename = '_data/thunderhill/thunderhill_2018_08_22/wetness_data.pkl'
 
+    ## Features of the csv are cached by recording contents + parameters (None: always extracted)
+    feature_cache_dir = "_data/feature_cache"
+
     wav_file = None
     # wav_file = "_data/thunderhill/thunderhill_2018_08_22/source/dry/2018_Aug_22_13:20:45__dry__slowspeed__short/mic_rec.wav" 
     # wav_label = 0 
@@ -201,18 +214,57 @@ def main():
             ts_features = data_dic['ts_features']
             ts_labels = data_dic['ts_labels']
     else:
-        print("Extracting features from csv file: ", csv_file)
-        ## Load csv file with audio
-        csv_audio_data = read_csv(csv_file)
-        csv_timestamps = convert_timestamp(csv_audio_data["timestamp"])
-        ## Get features and labels
-        time_and_labels = read_csv(indir + os.sep + "timelabels.txt")
-        label_timestamps = convert_datetimestamp(time_and_labels["start_time"])
-
-        ## Extranct features and timestamps of the features
-        ts_features,feat_time = extract_features(
-            data=csv_audio_data["frames"], 
-            timestamps=csv_timestamps)
+        ## With a recording index only the labeled time ranges are read: seeking through the index instead of
+        ## parsing the whole csv
+        index_file = indir + os.sep + "mic_rec.idx"
+        label_timestamps = None
+        if os.path.exists(index_file):
+            time_and_labels = read_csv(indir + os.sep + "timelabels.txt")
+            label_timestamps = convert_datetimestamp(time_and_labels["start_time"])
+
+        def extract_csv():
+            if label_timestamps is not None:
+                print("Extracting features from the labeled ranges of: ", csv_file)
+                rec = RecordingIndex(indir + os.sep + "mic_rec")
+                range_ends = label_timestamps[1:] + [rec.end_time()]
+                features_list = []
+                time_list = []
+                for t0, t1 in zip(label_timestamps, range_ends):
+                    rows = rec.read_csv_rows(t0, t1)
+                    if len(rows["frames"]) < frames:
+                        continue
+                    range_features, range_time = extract_features(
+                        data=rows["frames"],
+                        timestamps=convert_timestamp(rows["timestamp"]),
+                        frames=frames)
+                    features_list.append(range_features)
+                    time_list.append(range_time[:range_features.shape[0]])
+                return np.concatenate(features_list), np.concatenate(time_list)
+            print("Extracting features from csv file: ", csv_file)
+            csv_audio_data = read_csv(csv_file)
+            csv_features, feat_time = extract_features(
+                data=csv_audio_data["frames"],
+                timestamps=convert_timestamp(csv_audio_data["timestamp"]),
+                frames=frames)
+            return csv_features, feat_time[:csv_features.shape[0]]
+
+        if feature_cache_dir is not None:
+            ## Keyed by the csv contents only: the labels of this script are csv_label, timelabels.txt only selects
+            ## the ranges read through the index (their start times are part of the parameters)
+            print("Features of csv file (cached): ", csv_file)
+            def extract_to_store(store):
+                csv_features, feat_time = extract_csv()
+                store.append(csv_features, np.full(csv_features.shape[0], csv_label), timestamps=feat_time)
+            ranges = "all" if label_timestamps is None else ",".join(str(t) for t in label_timestamps)
+            cache = FeatureCache(feature_cache_dir)
+            store = cache.get([csv_file],
+                              feature_params(extractor="librosa", bands=20, frames=frames, shift=8, label=csv_label,
+                                             ranges=ranges),
+                              extract_to_store, frames=frames)
+            print("Feature cache: %d hits, %d misses" % (cache.hits, cache.misses))
+            ts_features = np.asarray(store.features, dtype=np.float32)
+        else:
+            ts_features, _ = extract_csv()
         ts_labels = np.zeros([ts_features.shape[0], 2])
         ts_labels[:, csv_label] = 1
 
@@ -0,0 +1,151 @@
+#include "trace.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+struct traceEvent
+{
+    const char* name;
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+// Ring of one thread (power of 2 size). Only the thread writes events / count, write() reads them
+struct traceBuffer
+{
+    std::vector<traceEvent> events;
+    uint64_t mask; //size - 1
+    std::atomic<uint64_t> count; //spans recorded, the next one goes to events[count & mask]
+    long tid;
+    char name[TRACE_NAME_SIZE];
+};
+
+std::atomic<bool> Trace::enabled_(false);
+static std::atomic<size_t> g_events_per_thread(TRACE_DEF_EVENTS);
+static std::mutex g_buffers_mtx;
+static std::vector<traceBuffer*> g_buffers; //never freed: the spans of finished threads stay until the dump
+static thread_local traceBuffer* t_buffer = nullptr;
+static thread_local char t_name[TRACE_NAME_SIZE] = {0};
+
+static traceBuffer* thread_buffer()
+{
+    if(t_buffer != nullptr) return t_buffer;
+    traceBuffer* buffer = new traceBuffer();
+    size_t size = 1;
+    while(size < g_events_per_thread) size <<= 1;
+    buffer->events.resize(size);
+    buffer->mask = size - 1;
+    buffer->count = 0;
+    buffer->tid = (long)syscall(SYS_gettid);
+    memcpy(buffer->name, t_name, TRACE_NAME_SIZE);
+    std::lock_guard<std::mutex> lck(g_buffers_mtx);
+    g_buffers.push_back(buffer);
+    t_buffer = buffer;
+    return buffer;
+}
+
+void Trace::enable(size_t events_per_thread)
+{
+    g_events_per_thread = events_per_thread;
+    enabled_ = true;
+}
+
+void Trace::disable()
+{
+    enabled_ = false;
+}
+
+void Trace::nameThread(const char* name)
+{
+    strncpy(t_name, name, TRACE_NAME_SIZE - 1);
+    t_name[TRACE_NAME_SIZE - 1] = 0;
+    if(t_buffer != nullptr) {
+        std::lock_guard<std::mutex> lck(g_buffers_mtx);
+        memcpy(t_buffer->name, t_name, TRACE_NAME_SIZE);
+    }
+}
+
+void Trace::record(const char* name, int64_t begin_ns, int64_t end_ns)
+{
+    traceBuffer* buffer = thread_buffer();
+    uint64_t i = buffer->count.load(std::memory_order_relaxed);
+    traceEvent& event = buffer->events[i & buffer->mask];
+    event.name = name;
+    event.begin_ns = begin_ns;
+    event.end_ns = end_ns;
+    buffer->count.store(i + 1, std::memory_order_release);
+}
+
+long Trace::spans()
+{
+    std::lock_guard<std::mutex> lck(g_buffers_mtx);
+    long total = 0;
+    for(size_t b = 0; b < g_buffers.size(); b++) total += (long)g_buffers[b]->count;
+    return total;
+}
+
+static void write_escaped(FILE* f, const char* s)
+{
+    for(; *s != 0; s++) {
+        if(*s == '"' || *s == '\\') fputc('\\', f);
+        if((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+}
+
+int Trace::write(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if(f == nullptr) {
+        fprintf(stderr, "Trace: ERROR: Cannot open %s\n", path.c_str());
+        return -1;
+    }
+    long pid = (long)getpid();
+    long written = 0;
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    std::lock_guard<std::mutex> lck(g_buffers_mtx);
+    std::vector<traceEvent> events;
+    for(size_t b = 0; b < g_buffers.size(); b++)
+    {
+        traceBuffer* buffer = g_buffers[b];
+        const uint64_t size = buffer->events.size();
+
+        // The thread may still be recording: spans overwritten during the copy are dropped
+        uint64_t end = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = end > size ? end - size : 0;
+        events.assign(size, traceEvent());
+        for(uint64_t i = begin; i < end; i++) events[i - begin] = buffer->events[i & buffer->mask];
+        uint64_t end_after = buffer->count.load(std::memory_order_acquire);
+        uint64_t valid = end_after >= size ? end_after - size + 1 : 0;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"",
+                first ? "" : ",\n", pid, buffer->tid);
+        if(buffer->name[0] != 0) write_escaped(f, buffer->name);
+        else fprintf(f, "thread %ld", buffer->tid);
+        fprintf(f, "\"}}");
+        first = false;
+
+        for(uint64_t i = std::max(begin, valid); i < end; i++) {
+            const traceEvent& event = events[i - begin];
+            fprintf(f, ",\n{\"name\":\"");
+            write_escaped(f, event.name);
+            fprintf(f, "\",\"cat\":\"micread\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                    event.begin_ns * 1e-3, (event.end_ns - event.begin_ns) * 1e-3, pid, buffer->tid);
+            written++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    bool failed = ferror(f) != 0;
+    if(fclose(f) != 0 || failed) {
+        fprintf(stderr, "Trace: ERROR: Failed to write %s\n", path.c_str());
+        return -1;
+    }
+    printf("Trace: %ld spans of %zu threads written to %s\n", written, g_buffers.size(), path.c_str());
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+Opt-in timeline tracing of the pipeline, exported as Chrome trace JSON (chrome://tracing, https://ui.perfetto.dev).
+Spans (TraceSpan, scoped) record their begin and end time into a ring buffer of the calling thread; write() dumps
+the rings of all threads as complete ("X") events with the thread ids and names, so stalls within a chunk period
+and the interaction of the threads show on one timeline.
+ - disabled (the default) a span costs one relaxed atomic load
+ - enabled: two clock reads and a store into the thread's ring: no locks, no allocations (the ring of a thread is
+   allocated at its first span). A full ring overwrites its oldest spans: the dump holds the last
+   events_per_thread spans of every thread. Rings outlive their threads (dump after finish())
+Spans of the pipeline:
+ - reading thread: "snd_pcm_readi" (the wait for the device), "convert", every stage (MicReadStage::name()),
+   "enqueue" (incl. waiting for data_mtx_)
+ - recording thread: "dequeue", "wav write", "csv format" (per chunk), "csv write"
+ - dispatch thread: "callbacks", spill thread: "spill write", InferenceScheduler: "inference"
+Span names must be string literals (only the pointer is stored).
+
+A minimal example:
+    Trace::enable(); //before the threads do their work
+    MicReadAlsa mic(...);
+    ...
+    mic.finish();
+    Trace::write("micread_trace.json");
+ */
+
+#ifndef MIC_READ_THREAD_TRACE_HPP
+#define MIC_READ_THREAD_TRACE_HPP
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <inttypes.h>
+
+#define TRACE_DEF_EVENTS 65536 //spans kept per thread
+#define TRACE_NAME_SIZE 32
+
+class Trace
+{
+public:
+    // Rings created from now on keep events_per_thread spans (rounded up to a power of 2)
+    static void enable(size_t events_per_thread=TRACE_DEF_EVENTS);
+    static void disable();
+    static bool enabled() {return enabled_.load(std::memory_order_relaxed);}
+
+    // Names the calling thread on the timeline (kept even if tracing is enabled later)
+    static void nameThread(const char* name);
+
+    // Steady clock in nanoseconds
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static void record(const char* name, int64_t begin_ns, int64_t end_ns);
+
+    // Chrome trace JSON of the spans of all threads. Negative on error
+    static int write(const std::string& path);
+    static long spans(); //recorded since enable() (all threads, incl. overwritten ones)
+
+protected:
+    static std::atomic<bool> enabled_;
+};
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name): name_(name), begin_ns_(Trace::enabled() ? Trace::now() : -1) {}
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    ~TraceSpan() {end();}
+    // Ends the span before the end of the scope
+    void end() {
+        if(begin_ns_ < 0) return;
+        Trace::record(name_, begin_ns_, Trace::now());
+        begin_ns_ = -1;
+    }
+
+protected:
+    const char* name_;
+    int64_t begin_ns_;
+};
+
+#endif //MIC_READ_THREAD_TRACE_HPP
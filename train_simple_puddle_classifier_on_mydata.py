@@ -11,6 +11,7 @@ import numpy as np
 # %matplotlib inline
 plt.style.use('ggplot')
 from tqdm import tqdm
+from feature_store import FeatureStore
 
 def windows(data, window_size):
     start = int(0)
@@ -80,9 +81,10 @@ def extract_features_lbldirs(parent_dir, label_names, file_ext="*.wav", bands =
     features = np.asarray(mfccs).reshape(len(mfccs),frames,bands)
     return np.array(features), np.array(labels, dtype = np.int)
 
-def one_hot_encode(labels):
+def one_hot_encode(labels, n_unique_labels=None):
     n_labels = len(labels)
-    n_unique_labels = len(np.unique(labels))
+    if n_unique_labels is None:
+        n_unique_labels = len(np.unique(labels))
     one_hot_encode = np.zeros((n_labels,n_unique_labels))
     one_hot_encode[np.arange(n_labels), labels] = 1
     return one_hot_encode
@@ -99,55 +101,40 @@ label_max = len(label_names) - 1
 train_parent_dir = "_data/thunderhill/thunderhill_2018_08_22/train"
 val_parent_dir = "_data/thunderhill/thunderhill_2018_08_22/val"
 
-prepickled_data_filename = '_data/thunderhill/thunderhill_2018_08_22/wetness_data.pkl'
+# Features are kept in memory mapped stores (see feature_store.py) instead of a pickle:
+# opening is instant and minibatches are read from disk on demand
+feature_store_base = '_data/thunderhill/thunderhill_2018_08_22/wetness_data'
 outdir = "_results_temp/mic_wet_predictor"
 os.makedirs(outdir, exist_ok=True)
 
 
-if os.path.isfile(prepickled_data_filename):
-    print('Loading pickled data %s ...' % prepickled_data_filename)
-    with open(prepickled_data_filename, 'rb') as pkl_file:
-        data_dic = pickle.load(pkl_file)
-    tr_features = data_dic['tr_features']
-    tr_labels = data_dic['tr_labels']
-    ts_features = data_dic['ts_features']
-    ts_labels = data_dic['ts_labels']
+if os.path.isfile(feature_store_base + '_train.feat'):
+    print('Opening feature stores %s_{train,test} ...' % feature_store_base)
+    tr_store = FeatureStore(feature_store_base + '_train')
+    ts_store = FeatureStore(feature_store_base + '_test')
 
 else:
     print('Extracting training features ...')
     tr_features,tr_labels = extract_features_lbldirs(train_parent_dir, label_names=label_names)
-    tr_labels = one_hot_encode(tr_labels)
-
     print('Extracting test features ...')
     ts_features,ts_labels = extract_features_lbldirs(val_parent_dir, label_names=label_names)
-    ts_labels = one_hot_encode(ts_labels)
-
-print('Data shapes: train/test  data/lbl', tr_features.shape, tr_labels.shape, ts_features.shape, ts_labels.shape)
-if np.any(np.isnan(tr_features)) or not np.all(np.isfinite(tr_features)):
-    raise ValueError('Data contains nan or inf features ...')
-print('Shuffling data ...')
-def unison_shuffle(a, b):
-    assert len(a) == len(b)
-    p = np.random.permutation(len(a))
-    return a[p], b[p]
-# tr_features,tr_labels = unison_shuffle(tr_features,tr_labels)
-# print('Data shapes after shuffling: train/test  data/lbl', tr_features.shape, tr_labels.shape, ts_features.shape, ts_labels.shape)
-# print('Labels: ', tr_labels)
-
-# Pickling data for the future
-if not os.path.isfile(prepickled_data_filename):
-    print('Saving data to %s ...' % prepickled_data_filename)
-    data_dic = {'tr_features': tr_features, 'tr_labels': tr_labels,
-                'ts_features': ts_features, 'ts_labels': ts_labels}
-    try:
-        with open(prepickled_data_filename, 'wb') as output_pkl:
-            # Pickle dictionary using protocol 0.
-            pickle.dump(data_dic, output_pkl)
-    except Exception as e:
-        os.remove(prepickled_data_filename)
-        raise
 
+    if np.any(np.isnan(tr_features)) or not np.all(np.isfinite(tr_features)):
+        raise ValueError('Data contains nan or inf features ...')
+
+    print('Saving data to %s_{train,test} ...' % feature_store_base)
+    tr_store = FeatureStore.create(feature_store_base + '_train')
+    tr_store.append(tr_features, tr_labels)
+    ts_store = FeatureStore.create(feature_store_base + '_test')
+    ts_store.append(ts_features, ts_labels)
+    del tr_features, ts_features
 
+n_classes = len(label_names)
+# The validation set is small, thus it is loaded completely
+ts_features = np.array(ts_store.features, dtype=np.float32)
+ts_labels = one_hot_encode(ts_store.labels, n_classes)
+
+print('Data shapes: train/test  data/lbl', tr_store.features.shape, tr_store.labels.shape, ts_features.shape, ts_labels.shape)
 
 print('Constructin NN graph ...')
 #####################################################
@@ -157,7 +144,7 @@ tf.reset_default_graph()
 learning_rate = 0.001
 batch_size = 50 #50
 display_step = 200
-tr_examples_num = tr_features.shape[0]
+tr_examples_num = len(tr_store)
 epoch_size = int(np.ceil(tr_examples_num / batch_size))
 epochs_num = 100
 training_iters = epoch_size
@@ -166,7 +153,6 @@ training_iters = epoch_size
 n_input = 20
 n_steps = 41
 n_hidden = 300
-n_classes = len(label_names)
 
 x = tf.placeholder(tf.float32, name="x", shape=[None, n_steps, n_input])
 y = tf.placeholder(tf.float32, name="y", shape=[None, n_classes])
@@ -228,15 +214,13 @@ with tf.Session() as session:
         training_accuracy_vec = []
         training_loss_vec = []
 
-        tr_features, tr_labels = unison_shuffle(tr_features, tr_labels)
-        # print('Data shapes after shuffling: train/test  data/lbl', tr_features.shape, tr_labels.shape,
-        #       ts_features.shape, ts_labels.shape)
-        # print('Labels: ', tr_labels)
+        # Shuffling indices only: the store itself stays on disk
+        tr_order = np.random.permutation(tr_examples_num)
 
         for itr in tqdm(range(training_iters), desc='Epoch %d' % int(epoch)):
-            offset = (itr * batch_size) % (tr_labels.shape[0] - batch_size)
-            batch_x = tr_features[offset:(offset + batch_size), :, :]
-            batch_y = tr_labels[offset:(offset + batch_size), :]
+            offset = (itr * batch_size) % (tr_examples_num - batch_size)
+            batch_x, batch_lbl, _ = tr_store.batch(tr_order[offset:(offset + batch_size)])
+            batch_y = one_hot_encode(batch_lbl, n_classes)
             _, train_loss_val, train_acc_val = session.run([optimizer, loss_f, accuracy], feed_dict={x: batch_x, y: batch_y})
             training_accuracy_vec.append(train_acc_val)
             training_loss_vec.append(train_loss_val)
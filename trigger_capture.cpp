@@ -0,0 +1,281 @@
+#include "trigger_capture.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+
+const char* trigger_reason_name(TriggerReason reason)
+{
+    switch(reason) {
+    case TRIGGER_API: return "api";
+    case TRIGGER_LABEL: return "label";
+    case TRIGGER_ENERGY: return "energy";
+    default: return "none";
+    }
+}
+
+static void write_le(std::ostream& os, uint32_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++, value >>= 8) os.put((char)(value & 0xFF));
+}
+
+static void write_wav_header(std::ostream& f, unsigned int rate, int channels)
+{
+    f << "RIFF----WAVEfmt ";
+    write_le(f, 16, 4);
+    write_le(f, 1, 2); //PCM
+    write_le(f, channels, 2);
+    write_le(f, rate, 4);
+    write_le(f, rate * channels * 2, 4);
+    write_le(f, channels * 2, 2);
+    write_le(f, 16, 2);
+    f << "data----";
+}
+
+// Fills in the chunk sizes left open by write_wav_header()
+static void finish_wav(std::ofstream& f)
+{
+    size_t file_length = f.tellp();
+    f.seekp(40);
+    write_le(f, file_length - 44, 4);
+    f.seekp(4);
+    write_le(f, file_length - 8, 4);
+    f.close();
+}
+
+// Number of the first segment of this run: after the segments listed by earlier runs in the csv
+// and after any left over segment file (e.g. a run killed before it listed its last segment)
+static long first_free_segment(const std::string& filename_base)
+{
+    long segment = 0;
+    std::ifstream segments_csv(filename_base + "_segments.csv");
+    std::string line;
+    std::getline(segments_csv, line); //header
+    while(std::getline(segments_csv, line)) {
+        char* end;
+        long listed = strtol(line.c_str(), &end, 10);
+        if(end != line.c_str() && listed >= segment) segment = listed + 1;
+    }
+    while(std::ifstream(filename_base + "_" + std::to_string(segment) + ".wav").good()) segment++;
+    return segment;
+}
+
+TriggerCapture::TriggerCapture(unsigned int rate,
+                               std::string filename_base,
+                               double pre_roll_s,
+                               double post_roll_s,
+                               int chunk_frames,
+                               int channels):
+    rate_(rate),
+    channels_(channels),
+    filename_base_(filename_base),
+    name_("TriggerCapture"),
+    ring_pos_(0),
+    ring_filled_(0),
+    pending_trigger_(TRIGGER_NONE),
+    last_label_(-1),
+    energy_trigger_(false),
+    energy_threshold_db_(0.),
+    energy_above_(false),
+    post_left_(0),
+    segment_(-1),
+    segment_reason_(TRIGGER_NONE),
+    first_segment_(first_free_segment(filename_base)),
+    queue_head_(0),
+    queue_count_(0),
+    run_fl_(false),
+    chunks_seen_(0),
+    chunks_written_(0),
+    chunks_dropped_(0),
+    segments_(0),
+    bytes_written_(0)
+{
+    pre_chunks_ = (size_t)ceil(pre_roll_s * rate_ / chunk_frames);
+    post_chunks_ = (size_t)ceil(post_roll_s * rate_ / chunk_frames);
+
+    // All chunk storage is allocated here: the reading thread only copies into reserved slots
+    ring_.resize(pre_chunks_);
+    for(size_t i = 0; i < ring_.size(); i++) ring_[i].frames.reserve(chunk_frames * channels_);
+    queue_.resize(pre_chunks_ + 2 * post_chunks_ + 16);
+    for(size_t i = 0; i < queue_.size(); i++) queue_[i].chunk.frames.reserve(chunk_frames * channels_);
+}
+
+TriggerCapture::~TriggerCapture()
+{
+    finish();
+}
+
+void TriggerCapture::start()
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(run_fl_) return;
+    run_fl_ = true;
+    th_ = std::thread(&TriggerCapture::writer_thread, this);
+}
+
+void TriggerCapture::finish()
+{
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if(!run_fl_) return;
+        run_fl_ = false;
+        cv_.notify_all();
+    }
+    th_.join();
+}
+
+void TriggerCapture::trigger(TriggerReason reason)
+{
+    pending_trigger_ = reason;
+}
+
+void TriggerCapture::onLabel(int label)
+{
+    int prev = last_label_.exchange(label);
+    if(prev >= 0 && prev != label) {
+        trigger(TRIGGER_LABEL);
+    }
+}
+
+void TriggerCapture::process(const micDataStamped& chunk)
+{
+    chunks_seen_++;
+    TriggerReason reason = (TriggerReason)pending_trigger_.exchange(TRIGGER_NONE);
+
+    if(energy_trigger_ && !chunk.frames.empty()) {
+        double sum = 0.;
+        for(size_t i = 0; i < chunk.frames.size(); i++) sum += (double)chunk.frames[i] * chunk.frames[i];
+        double db = 10. * log10(sum / chunk.frames.size() / (32768. * 32768.) + 1e-20);
+        bool above = db > energy_threshold_db_;
+        if(above && !energy_above_ && reason == TRIGGER_NONE) reason = TRIGGER_ENERGY; //rising edge only
+        energy_above_ = above;
+    }
+
+    if(reason != TRIGGER_NONE) {
+        if(post_left_ == 0) {
+            // New segment: the pre-roll goes first
+            segment_ = first_segment_ + segments_++;
+            segment_reason_ = reason;
+            if(!ring_.empty()) {
+                size_t start = (ring_pos_ + ring_.size() - ring_filled_) % ring_.size();
+                for(size_t i = 0; i < ring_filled_; i++) {
+                    enqueue(ring_[(start + i) % ring_.size()], false);
+                }
+            }
+            ring_filled_ = 0;
+        }
+        post_left_ = post_chunks_ + 1; //the current chunk + the post-roll (a retrigger extends it)
+    }
+
+    if(post_left_ > 0) {
+        post_left_--;
+        enqueue(chunk, post_left_ == 0);
+        return;
+    }
+
+    if(!ring_.empty()) {
+        micDataStamped& slot = ring_[ring_pos_];
+        slot.id = chunk.id;
+        slot.timestamp = chunk.timestamp;
+        slot.sample_index = chunk.sample_index;
+        slot.rate = chunk.rate;
+        slot.flags = chunk.flags;
+        slot.frames.assign(chunk.frames.begin(), chunk.frames.end());
+        ring_pos_ = (ring_pos_ + 1) % ring_.size();
+        ring_filled_ = std::min(ring_filled_ + 1, ring_.size());
+    }
+}
+
+void TriggerCapture::enqueue(const micDataStamped& chunk, bool last)
+{
+    std::unique_lock<std::mutex> lck(mtx_);
+    if(queue_count_ == queue_.size()) {
+        chunks_dropped_++;
+        return;
+    }
+    // The slot after the queued ones is not touched by the writer
+    pendingChunk& item = queue_[(queue_head_ + queue_count_) % queue_.size()];
+    item.chunk.id = chunk.id;
+    item.chunk.timestamp = chunk.timestamp;
+    item.chunk.sample_index = chunk.sample_index;
+    item.chunk.rate = chunk.rate;
+    item.chunk.flags = chunk.flags;
+    item.chunk.frames.assign(chunk.frames.begin(), chunk.frames.end());
+    item.segment = segment_;
+    item.reason = segment_reason_;
+    item.last = last;
+    queue_count_++;
+    cv_.notify_all();
+}
+
+void TriggerCapture::writer_thread()
+{
+    bool csv_exists = std::ifstream(filename_base_ + "_segments.csv").good();
+    std::ofstream segments_csv(filename_base_ + "_segments.csv", std::ios::app);
+    if(!csv_exists) {
+        segments_csv << "segment,file,first_timestamp,last_timestamp,chunks,reason" << std::endl;
+    }
+
+    std::ofstream wav;
+    std::string wav_name;
+    long open_segment = -1;
+    TriggerReason open_reason = TRIGGER_NONE;
+    int64_t first_timestamp = 0, last_timestamp = 0;
+    long segment_chunks = 0;
+
+    auto close_segment = [&]() {
+        if(open_segment < 0) return;
+        finish_wav(wav);
+        segments_csv << open_segment << "," << wav_name << "," << first_timestamp << "," << last_timestamp << ","
+                     << segment_chunks << "," << trigger_reason_name(open_reason) << std::endl;
+        fprintf(stdout, "%s: Segment %ld written: %s (%ld chunks, %s)\n", name_.c_str(), open_segment,
+                wav_name.c_str(), segment_chunks, trigger_reason_name(open_reason));
+        open_segment = -1;
+    };
+
+    printf("%s: Writer Thread ready ...\n", name_.c_str());
+    while(true)
+    {
+        size_t idx;
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            while(run_fl_ && queue_count_ == 0) cv_.wait(lck);
+            if(queue_count_ == 0) break; //finished and drained
+            idx = queue_head_;
+        }
+
+        // Writing outside the lock: the reading thread does not reuse the slot until it is released
+        const pendingChunk& item = queue_[idx];
+        if(item.segment != open_segment) {
+            close_segment();
+            wav_name = filename_base_ + "_" + std::to_string(item.segment) + ".wav";
+            wav.open(wav_name, std::ios::binary);
+            if(!wav) {
+                fprintf(stderr, "%s: ERROR: Cannot open %s\n", name_.c_str(), wav_name.c_str());
+            }
+            write_wav_header(wav, rate_, channels_);
+            open_segment = item.segment;
+            open_reason = item.reason;
+            first_timestamp = item.chunk.timestamp;
+            segment_chunks = 0;
+        }
+        size_t bytes = item.chunk.frames.size() * sizeof(int16_t);
+        wav.write((const char*)item.chunk.frames.data(), bytes);
+        last_timestamp = item.chunk.timestamp;
+        segment_chunks++;
+        chunks_written_++;
+        bytes_written_ += bytes;
+        if(item.last) close_segment();
+
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            queue_head_ = (queue_head_ + 1) % queue_.size();
+            queue_count_--;
+        }
+    }
+    close_segment();
+    printf("%s: Writer Thread finished. Segments %ld, chunks written %ld of %ld seen ...\n",
+           name_.c_str(), getSegments(), getChunksWritten(), getChunksSeen());
+}
@@ -0,0 +1,130 @@
+/*
+Pre-trigger capture: audio is only written to disk around events.
+TriggerCapture is a processing stage keeping the last pre_roll_s seconds of chunks in a preallocated ring.
+On a trigger the ring (pre-roll) and the next post_roll_s seconds are written into a segment file
+<filename_base>_<segment>.wav by a writer thread (the reading thread never touches the disk).
+A trigger during the post-roll extends the segment. Every segment is listed in <filename_base>_segments.csv
+(segment, file, first / last sample time stamps, chunks, trigger reason).
+A new run continues the numbering of the segments already on disk (earlier runs are never overwritten).
+Triggers:
+ - trigger()              : API call, e.g. a button or an external sensor
+ - onLabel(label)         : classifier output, triggers when the label changes (e.g. dry -> wet)
+ - setEnergyThreshold(db) : the chunk RMS rises above the threshold (dB full scale)
+trigger() and onLabel() are thread safe, the trigger takes effect at the next chunk.
+
+A minimal example:
+    TriggerCapture capture(mic_reader.getRate(), "events", 5.0, 5.0);
+    capture.setEnergyThreshold(-20.);
+    mic_reader.addStage(&capture);
+    scheduler.setCallback([&capture](const inferenceResult& res){ capture.onLabel(res.label); });
+    capture.start();
+ */
+
+#ifndef MIC_READ_THREAD_TRIGGER_CAPTURE_HPP
+#define MIC_READ_THREAD_TRIGGER_CAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "micread_thread.hpp"
+
+#define TRIGGER_DEF_PRE_ROLL_S 5.0
+#define TRIGGER_DEF_POST_ROLL_S 5.0
+#define TRIGGER_DEF_CHUNK_FRAMES MICREAD_DEF_BUF_SIZE //expected chunk size (slot preallocation)
+
+enum TriggerReason
+{
+    TRIGGER_NONE = 0,
+    TRIGGER_API,
+    TRIGGER_LABEL,
+    TRIGGER_ENERGY
+};
+
+const char* trigger_reason_name(TriggerReason reason);
+
+class TriggerCapture : public MicReadStage
+{
+public:
+    TriggerCapture(unsigned int rate,
+                   std::string filename_base,
+                   double pre_roll_s=TRIGGER_DEF_PRE_ROLL_S,
+                   double post_roll_s=TRIGGER_DEF_POST_ROLL_S,
+                   int chunk_frames=TRIGGER_DEF_CHUNK_FRAMES,
+                   int channels=1);
+    ~TriggerCapture();
+
+    void start(); //starts the writer thread
+    void finish(); //closes the current segment and stops the writer thread
+
+    // Triggers
+    void trigger(TriggerReason reason=TRIGGER_API);
+    void onLabel(int label);
+    void setEnergyThreshold(double db) {energy_threshold_db_ = db; energy_trigger_ = true;}
+
+    // MicReadStage: called by the reading thread
+    void process(const micDataStamped& chunk);
+    const char* name() const {return "trigger capture";}
+
+    bool isCapturing() const {return post_left_ > 0;}
+    long getChunksSeen() const {return chunks_seen_;}
+    long getChunksWritten() const {return chunks_written_;}
+    long getChunksDropped() const {return chunks_dropped_;} //writer queue full
+    long getSegments() const {return segments_;} //segments of this run
+    long getBytesWritten() const {return bytes_written_;}
+
+protected:
+    struct pendingChunk
+    {
+        micDataStamped chunk;
+        long segment;
+        TriggerReason reason;
+        bool last; //closes the segment
+    };
+
+    unsigned int rate_;
+    int channels_;
+    std::string filename_base_;
+    size_t pre_chunks_;
+    size_t post_chunks_;
+    std::string name_;
+
+    // Pre-roll ring (reading thread only)
+    std::vector<micDataStamped> ring_;
+    size_t ring_pos_;
+    size_t ring_filled_;
+
+    // Trigger state
+    std::atomic<int> pending_trigger_;
+    std::atomic<int> last_label_;
+    bool energy_trigger_;
+    double energy_threshold_db_;
+    bool energy_above_;
+    size_t post_left_; //chunks still to be written in the current segment
+    long segment_;
+    TriggerReason segment_reason_;
+    long first_segment_; //segments of earlier runs are kept (see first_free_segment())
+
+    // Writer queue (preallocated slots)
+    std::vector<pendingChunk> queue_;
+    size_t queue_head_;
+    size_t queue_count_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread th_;
+    bool run_fl_;
+
+    std::atomic<long> chunks_seen_;
+    std::atomic<long> chunks_written_;
+    std::atomic<long> chunks_dropped_;
+    std::atomic<long> segments_;
+    std::atomic<long> bytes_written_;
+
+    void enqueue(const micDataStamped& chunk, bool last);
+    void writer_thread();
+};
+
+#endif //MIC_READ_THREAD_TRIGGER_CAPTURE_HPP